@@ -0,0 +1,261 @@
+/*
+	BitMask class
+
+	The type for bool[] returns such as pos_mask.mask and spike_mask.mask.  It is
+	one bit per sample (64 samples per uint64_t word), so 8x smaller than bool[],
+	and combining masks (e.g. the several optional slices in pos_mask) is done a
+	word at a time with and_with/or_with/andnot_with.
+
+	It is chunked in the same way as ChunkedArray, i.e. chunk c covers samples
+	[c*chunk_len, (c+1)*chunk_len) and starts on a fresh word, so a mask lines up
+	chunk-for-chunk with the array it masks, even when chunk_len isn't a multiple
+	of 64 (the xml uses 10000).  Bits beyond the end of a chunk are always zero.
+
+	For each chunk we keep the number of set bits, which is updated by every
+	write, so chunk_summary(c) and summary() (all/none/mixture) are O(1) and
+	O(chunks) rather than a scan over the samples.  Consumers can use the chunk
+	summaries to skip whole chunks, e.g. kernels::hist_masked uses the unmasked
+	kernel for "all" chunks and skips "none" chunks entirely.
+
+	As with ChunkedArray, copies share the data (it is held by shared_ptr), the
+	compute writes it and then it is read-only once published.  Different chunks
+	can be written from different threads at the same time, but not the same one.
+*/
+
+#ifndef _BITMASK_H_
+#define _BITMASK_H_
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cassert>
+#include <algorithm>
+#include <ostream>
+
+
+enum class LogicalSummary : uint8_t {
+	all,
+	none,
+	mixture
+};
+
+inline std::ostream& operator<<(std::ostream& os, LogicalSummary s){
+	return os << (s == LogicalSummary::all ? "all" : s == LogicalSummary::none ? "none" : "mixture");
+}
+
+
+template<size_t chunk_len_>
+class BitMask{
+public:
+	static const size_t chunk_len = chunk_len_;
+	static const size_t words_per_chunk = (chunk_len + 63) / 64;
+	using self_t = BitMask<chunk_len>;
+
+private:
+	struct Data{
+		std::vector<uint64_t> words; // chunk c starts at words[c*words_per_chunk]
+		std::vector<uint32_t> counts; // set bits per chunk
+	};
+	std::shared_ptr<Data> data;
+	size_t len = 0;
+
+	static int popcount(uint64_t w){
+		return __builtin_popcountll(w);
+	}
+
+	uint64_t last_word_mask(size_t c) const{
+		/* the valid bits in the last word of chunk c */
+		const size_t r = chunk_size(c) % 64;
+		return r == 0 ? ~uint64_t(0) : (uint64_t(1) << r) - 1;
+	}
+
+	template<typename Op>
+	self_t& combine(self_t const& other, Op op){
+		assert(other.len == len);
+		for(size_t c=0; c<n_chunks(); c++){
+			uint64_t* w = chunk_words(c);
+			uint64_t const* o = other.cchunk_words(c);
+			const size_t n = chunk_n_words(c);
+			uint32_t count = 0;
+			for(size_t k=0; k<n; k++){
+				w[k] = op(w[k], o[k]);
+				count += popcount(w[k]);
+			}
+			data->counts[c] = count;
+		}
+		return *this;
+	}
+
+public:
+	BitMask() = default;
+
+	explicit BitMask(size_t n, bool fill=false){
+		allocate(n, fill);
+	}
+
+	void allocate(size_t n, bool fill=false){
+		// note that this doesn't affect other copies, they keep the old data.
+		len = n;
+		data = std::make_shared<Data>();
+		const size_t n_c = (n + chunk_len - 1) / chunk_len;
+		data->words.assign(n_c * words_per_chunk, fill ? ~uint64_t(0) : 0);
+		data->counts.assign(n_c, 0);
+		if(fill)
+			for(size_t c=0; c<n_c; c++){
+				// keep the bits past the end of each chunk clear
+				uint64_t* w = chunk_words(c);
+				const size_t n_w = chunk_n_words(c);
+				std::fill(w + n_w, w + words_per_chunk, 0);
+				w[n_w - 1] &= last_word_mask(c);
+				data->counts[c] = uint32_t(chunk_size(c));
+			}
+	}
+
+	size_t length() const{
+		return len;
+	}
+
+	size_t n_chunks() const{
+		return data == nullptr ? 0 : data->counts.size();
+	}
+
+	size_t bytes() const{
+		return data == nullptr ? 0 : data->words.size() * sizeof(uint64_t);
+	}
+
+	size_t chunk_size(size_t c) const{
+		assert(c < n_chunks());
+		return std::min(size_t(chunk_len), len - c*chunk_len);
+	}
+
+	size_t chunk_n_words(size_t c) const{
+		return (chunk_size(c) + 63) / 64;
+	}
+
+	uint64_t* chunk_words(size_t c){
+		/* If you write through this, call recount(c) afterwards. */
+		assert(c < n_chunks());
+		return &data->words[c * words_per_chunk];
+	}
+
+	uint64_t const* cchunk_words(size_t c) const{
+		assert(c < n_chunks());
+		return &data->words[c * words_per_chunk];
+	}
+
+	void recount(size_t c){
+		uint64_t const* w = cchunk_words(c);
+		const size_t n = chunk_n_words(c);
+		assert((w[n - 1] & ~last_word_mask(c)) == 0);
+		uint32_t count = 0;
+		for(size_t k=0; k<n; k++)
+			count += popcount(w[k]);
+		data->counts[c] = count;
+	}
+
+	bool operator[](size_t i) const{
+		assert(i < len);
+		const size_t j = i % chunk_len;
+		return (cchunk_words(i / chunk_len)[j / 64] >> (j % 64)) & 1;
+	}
+
+	void set(size_t i, bool v){
+		assert(i < len);
+		const size_t c = i / chunk_len, j = i % chunk_len;
+		uint64_t& w = chunk_words(c)[j / 64];
+		const uint64_t bit = uint64_t(1) << (j % 64);
+		if(bool(w & bit) != v){
+			w ^= bit;
+			data->counts[c] += v ? 1 : -1;
+		}
+	}
+
+	void set_range(size_t begin, size_t end, bool v){
+		/* sets [begin, end), a word at a time, e.g. for trial_time_slice */
+		assert(begin <= end && end <= len);
+		while(begin < end){
+			const size_t c = begin / chunk_len, j = begin % chunk_len;
+			const size_t j_end = std::min(size_t(chunk_len), j + (end - begin));
+			uint64_t* w = chunk_words(c);
+			int32_t delta = 0;
+			for(size_t k=j; k<j_end; ){
+				const size_t b = k % 64, n_b = std::min<size_t>(64 - b, j_end - k);
+				const uint64_t m = (n_b == 64 ? ~uint64_t(0) : ((uint64_t(1) << n_b) - 1)) << b;
+				uint64_t& word = w[k / 64];
+				const int before = popcount(word);
+				word = v ? (word | m) : (word & ~m);
+				delta += popcount(word) - before;
+				k += n_b;
+			}
+			data->counts[c] += delta;
+			begin += j_end - j;
+		}
+	}
+
+	self_t& and_with(self_t const& other){
+		return combine(other, [](uint64_t a, uint64_t b){ return a & b; });
+	}
+
+	self_t& or_with(self_t const& other){
+		return combine(other, [](uint64_t a, uint64_t b){ return a | b; });
+	}
+
+	self_t& andnot_with(self_t const& other){
+		/* this = this & ~other */
+		return combine(other, [](uint64_t a, uint64_t b){ return a & ~b; });
+	}
+
+	size_t chunk_count(size_t c) const{
+		assert(c < n_chunks());
+		return data->counts[c];
+	}
+
+	LogicalSummary chunk_summary(size_t c) const{
+		const size_t count = chunk_count(c);
+		return count == 0 ? LogicalSummary::none
+			 : count == chunk_size(c) ? LogicalSummary::all : LogicalSummary::mixture;
+	}
+
+	LogicalSummary summary() const{
+		/* O(chunks). An empty mask is "all", as nothing is masked out. */
+		bool any_set = false, any_clear = false;
+		for(size_t c=0; c<n_chunks(); c++){
+			const size_t count = chunk_count(c);
+			any_set |= count > 0;
+			any_clear |= count < chunk_size(c);
+		}
+		return !any_clear ? LogicalSummary::all : !any_set ? LogicalSummary::none : LogicalSummary::mixture;
+	}
+
+	size_t count() const{
+		size_t ret = 0;
+		for(size_t c=0; c<n_chunks(); c++)
+			ret += chunk_count(c);
+		return ret;
+	}
+
+	template<typename Foo>
+	void for_each_set(Foo foo) const{
+		/* calls foo(i) for each set bit, in order, skipping "none" chunks */
+		for(size_t c=0; c<n_chunks(); c++){
+			if(chunk_count(c) == 0)
+				continue;
+			uint64_t const* w = cchunk_words(c);
+			for(size_t k=0; k<chunk_n_words(c); k++)
+				for(uint64_t word = w[k]; word != 0; word &= word - 1)
+					foo(c*chunk_len + k*64 + __builtin_ctzll(word));
+		}
+	}
+
+	friend std::ostream& operator<<(std::ostream& os, self_t const& m){
+		size_t head_size = 64;
+		os << "BitMask<len=" << m.len << ", count=" << m.count() << ", " << m.summary() << ">[";
+		for(size_t i=0; i<m.len && i<head_size; i++)
+			os << (m[i] ? '1' : '0');
+		os << (m.len > head_size ? "...]" : "]");
+		return os;
+	}
+};
+
+
+#endif // _BITMASK_H_
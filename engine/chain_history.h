@@ -0,0 +1,234 @@
+/*
+	ChainHistory class
+
+	Holds the shape of a single chain/loop (e.g. cut_changes_loop in sample.xml),
+	i.e. for each chain id it records the parent id and the depth (number of
+	deltas applied since the first iteration).  It does not hold any of the
+	actual states, those live in the main store as normal KVPs, it just records
+	which ids currently have a computed state in the store, so that it can
+	tell the engine where to start replaying from.
+
+	Without any help, to get the state at id X the engine would have to walk
+	back down the chain until it finds a computed ancestor and then replay
+	every delta from there.  After eviction that can be thousands of deltas.
+	Instead we use two tricks:
+
+	  1. Jump pointers.  Each node stores a "jump" to some ancestor, chosen
+		 such that the jumps form a skew-binary skip-list (see Myers, 1983,
+		 "An applicative random-access stack").  This means ancestor_at_depth
+		 is O(log n) and needs only one extra id per node.  It works for
+		 branched histories as the jumps only ever point down the node's own
+		 path.
+
+	  2. Checkpoint levels. The checkpoint level of a node is the number of
+		 trailing zeros in its depth, so level-k checkpoints are spaced 2^k
+		 apart along every path (the first iteration is the top level).  Nodes
+		 with level >= pinned_level() are "pinned": the engine should only
+		 evict them as a last resort, and if it does have to recompute them
+		 during a replay it should keep them (see should_retain).  pinned_level
+		 is chosen so that the spacing of pinned nodes is at most log2(n), so
+		 replaying to any point needs at most O(log n) deltas.  Lower levels
+		 should be evicted first, see eviction_rank.
+
+	When pinned nodes have been evicted anyway, replay_plan falls back to
+	progressively coarser checkpoint levels, so the cost grows geometrically
+	rather than linearly with the number of evicted checkpoints.
+
+	Undo is just asking for the state of an ancestor, and branching is just
+	appending a new node onto an ancestor, so neither needs special handling.
+
+	This is not in any way thread-safe, it is intended to be owned by the main
+	thread, which is the only thread that inserts/deletes from the store anyway.
+*/
+
+#ifndef _CHAIN_HISTORY_H_
+#define _CHAIN_HISTORY_H_
+
+#include <vector>
+#include <ostream>
+#include <cstdint>
+#include <cassert>
+#include <algorithm>
+
+
+template<typename id_t, id_t invalid_id>
+class ChainHistory{
+public:
+	using depth_t = uint32_t;
+	using level_t = uint8_t;
+	static const level_t top_level = 32;
+
+private:
+	struct Node{
+		id_t parent = invalid_id;
+		id_t jump = invalid_id;
+		depth_t depth = 0;
+		bool exists = false;
+		bool computed = false;
+	};
+	std::vector<Node> nodes; // indexed by chain id, ids are allocated by the engine
+	depth_t max_depth = 0;
+
+	Node const& node(id_t id) const{
+		assert(has(id));
+		return nodes[id];
+	}
+
+	static level_t count_trailing_zeros(depth_t v){
+		// __builtin_ctz is undefined for zero, but depth zero is top level anyway.
+		return v == 0 ? top_level : __builtin_ctz(v);
+	}
+
+	static level_t floor_log2(depth_t v){
+		return v <= 1 ? 0 : 31 - __builtin_clz(v);
+	}
+
+public:
+
+	bool has(id_t id) const{
+		return id < nodes.size() && nodes[id].exists;
+	}
+
+	void append(id_t id, id_t parent){
+		/* Records a new node, parent is invalid_id for the first iteration.
+		   The parent must already have been appended. */
+		assert(!has(id));
+		assert(parent == invalid_id || has(parent));
+
+		if(id >= nodes.size())
+			nodes.resize(id+1);
+		Node& n = nodes[id];
+		n.exists = true;
+		n.computed = false;
+		n.parent = parent;
+
+		if(parent == invalid_id){
+			n.depth = 0;
+			n.jump = id;
+		}else{
+			Node const& p = nodes[parent];
+			Node const& pj = nodes[p.jump];
+			Node const& pjj = nodes[pj.jump];
+			n.depth = p.depth + 1;
+			n.jump = (p.depth - pj.depth == pj.depth - pjj.depth) ? pj.jump : parent;
+		}
+		max_depth = std::max(max_depth, n.depth);
+	}
+
+	id_t parent(id_t id) const{
+		return node(id).parent;
+	}
+
+	depth_t depth(id_t id) const{
+		return node(id).depth;
+	}
+
+	id_t ancestor_at_depth(id_t id, depth_t d) const{
+		/* O(log n) thanks to the jump pointers. */
+		assert(d <= depth(id));
+		while(nodes[id].depth > d){
+			id_t j = nodes[id].jump;
+			id = nodes[j].depth >= d ? j : nodes[id].parent;
+		}
+		return id;
+	}
+
+	void set_computed(id_t id, bool value){
+		/* The engine should call this whenever a state for id is inserted
+		   into or deleted from the store. */
+		assert(has(id));
+		nodes[id].computed = value;
+	}
+
+	bool is_computed(id_t id) const{
+		return node(id).computed;
+	}
+
+	level_t checkpoint_level(id_t id) const{
+		return count_trailing_zeros(depth(id));
+	}
+
+	level_t pinned_level() const{
+		/* spacing of pinned nodes is 2^pinned_level <= log2(max_depth). */
+		return floor_log2(std::max<depth_t>(1, floor_log2(max_depth)));
+	}
+
+	bool is_pinned(id_t id) const{
+		return checkpoint_level(id) >= pinned_level();
+	}
+
+	bool should_retain(id_t id) const{
+		// if we recompute a pinned node during a replay, we should keep it.
+		return is_pinned(id);
+	}
+
+	level_t eviction_rank(id_t id) const{
+		/* Lower values should be evicted first.  Pinned nodes all get the
+		   same (top) rank, as there is no point preferring one over another. */
+		return is_pinned(id) ? top_level : checkpoint_level(id);
+	}
+
+	id_t replay_plan(id_t id, std::vector<id_t>& deltas_out) const{
+		/* Returns the id of the computed state to start from, or invalid_id if
+		   we have to start again from the first iteration.  deltas_out is filled
+		   with the ids whose deltas need to be applied, oldest first, it ends with
+		   id itself (unless id is already computed, in which case it is empty). */
+
+		deltas_out.clear();
+		if(is_computed(id))
+			return id;
+
+		const depth_t d = depth(id);
+		id_t base = invalid_id;
+
+		// recent history (e.g. the previous head) is often still in the store,
+		// and looking for it costs no more than replaying up to the nearest pin.
+		const depth_t stride = depth_t(1) << pinned_level();
+		id_t x = id;
+		for(depth_t i=0; i<stride && nodes[x].parent != invalid_id; i++){
+			x = nodes[x].parent;
+			if(nodes[x].computed){
+				base = x;
+				break;
+			}
+		}
+
+		// otherwise look at progressively coarser checkpoint levels.
+		for(level_t level=pinned_level(); base == invalid_id && (d >> level) != 0; level++){
+			depth_t dd = (d >> level) << level;
+			if(dd == d)
+				continue;
+			id_t candidate = ancestor_at_depth(id, dd);
+			if(nodes[candidate].computed)
+				base = candidate;
+		}
+
+		// the loop stops short of depth 0, but the root is pinned too
+		if(base == invalid_id && d > 0 && nodes[ancestor_at_depth(id, 0)].computed)
+			base = ancestor_at_depth(id, 0);
+
+		for(x = id; x != base; x = nodes[x].parent){
+			deltas_out.push_back(x);
+			if(nodes[x].parent == invalid_id)
+				break;
+		}
+		std::reverse(deltas_out.begin(), deltas_out.end());
+		return base;
+	}
+
+	friend std::ostream& operator<<(std::ostream& os, ChainHistory const& h){
+		size_t n_nodes = 0, n_computed = 0, n_pinned = 0;
+		for(id_t id=0; id<h.nodes.size(); id++) if(h.nodes[id].exists){
+			n_nodes++;
+			n_computed += h.nodes[id].computed;
+			n_pinned += h.is_pinned(id);
+		}
+		os << "ChainHistory with " << n_nodes << " nodes (max depth " << h.max_depth
+		   << "), computed: " << n_computed << ", pinned: " << n_pinned
+		   << ", pinned_level: " << int(h.pinned_level()) << "\n";
+		return os;
+	}
+};
+
+
+#endif // _CHAIN_HISTORY_H_
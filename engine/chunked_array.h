@@ -0,0 +1,506 @@
+/*
+	ChunkedArray class
+
+	This is the type for returns with chunking="N" in the xml, e.g. xy, speed,
+	dist_to_boundary.  The data is split into chunks of chunk_len elements, each
+	allocated separately, with page_alloc::arena_policy() (e.g. on huge pages, or
+	interleaved over NUMA nodes, see page_alloc.h).  Copies share the chunks (the chunk table is held by
+	shared_ptr), so "xy = both_xy.xy1" doesn't copy anything.  That means it is
+	small and copyable and can live directly in a KVP.
+
+	Arrays are write-once: the compute allocates, writes every element (either in
+	order with write, or chunk-by-chunk with chunk_data) and then it is published
+	and read-only from then on.  Different threads may write different chunks at the
+	same time, which is what parallel_map and parallel_for_chunks do.
+
+	Node code iterates with "for(auto p : xy)", or for speed, chunk by chunk with
+	cchunk(c)/chunk_size(c).
+
+	parallel_map(pool, max_tasks, in, out, foo) is the element-wise loop
+	    for(size_t i=0; i<in.length(); i++) out[i] = foo(in[i], i)
+	split into one task per chunk on the worker pool (or at most max_tasks at once).
+	out is allocated to match in (and so must have the same chunk_len).  This is
+	how the CPU=N hint is honoured, see Engine::parallel_map.  foo is also given i,
+	so that it can look at neighbouring elements, e.g. in[i-1] for speed.
+
+	Nodes that are nothing but a parallel_map over the same array (map=X hint)
+	get fused by the generator into one parallel_for_chunks loop that reads each
+	chunk of X once and writes a chunk of every output, see FusedMap in
+	generate_cpp.py.  That only works because all the outputs have the same
+	chunk_len as X, so chunk c of each lines up.
+
+	progressive_for_chunks is parallel_for_chunks for nodes that want to give a
+	quick approximate answer before the exact one (progressive=N hint), e.g. tac on
+	a huge file: it does every N'th chunk first, lets the node publish what it has
+	as a provisional result, and then does the rest.
+
+	Storage is array-of-structs by default.  A return with layout="soa" in the xml,
+	e.g. xy, is ChunkedArray<point, N, SoA> instead, where each chunk holds all the
+	x's then all the y's (more generally, the struct is split into its int16
+	"lanes", see soa_lanes).  Node code doesn't change: "for(auto p : xy)", xy[i],
+	write, cchunk(c)[j] and chunk_data(c)[j] = p all work the same, except that they
+	give points by value rather than by reference.  What it buys is that kernels
+	can use clane(c, 0) and clane(c, 1) as two contiguous int16 arrays, so
+	vectorised loops over x and y need plain loads rather than shuffles, see
+	kernels::PointLanes.
+
+	Arrays of numbers can keep a min/max/mean pyramid (see ChunkPyramid in
+	pyramid.h), for plots of long arrays like speed and dir: call enable_pyramid()
+	before allocating, and each chunk is summarised once it's written (write does
+	that itself, chunk_data writers call finish_chunk(c), as parallel_map and the
+	fused loops do).  Then summarise(begin, end, n_out) gives n_out summaries of
+	equal parts of [begin, end), e.g. one per pixel column, reading the pyramid
+	rather than the samples.  The pyramid is shared by copies like the chunks are,
+	so it's cached in the store along with the array.
+*/
+
+#ifndef _CHUNKED_ARRAY_H_
+#define _CHUNKED_ARRAY_H_
+
+#include <vector>
+#include <memory>
+#include <cassert>
+#include <algorithm>
+#include <iterator>
+#include <cstring>
+#include <cstdint>
+#include <type_traits>
+
+#include "worker_pool.h"
+#include "pyramid.h"
+#include "page_alloc.h"
+
+
+// storage policies for ChunkedArray, see above
+struct AoS{};
+struct SoA{};
+
+template<typename T>
+struct soa_lanes{
+	/* how a struct is split up for SoA storage: as consecutive lanes of lane_t,
+	   i.e. point{int16 x; int16 y;} is two lanes, x then y. */
+	using lane_t = int16_t;
+	static const size_t n = sizeof(T) / sizeof(lane_t);
+	static_assert(sizeof(T) == n * sizeof(lane_t), "SoA needs a struct made of int16s");
+	static_assert(std::is_trivially_copyable<T>::value, "SoA needs a trivially copyable struct");
+};
+
+
+template<typename T, size_t chunk_len_, typename Storage=AoS>
+class ChunkedArray;
+
+template<typename T, size_t chunk_len_>
+class ChunkedArray<T, chunk_len_, AoS>{
+public:
+	static const size_t chunk_len = chunk_len_;
+	using self_t = ChunkedArray<T, chunk_len, AoS>;
+	using value_type = T;
+	using storage = AoS;
+
+private:
+	using chunk_table_t = std::vector<page_alloc::unique_array<T>>;
+	using pyramid_t = ChunkPyramid<T, chunk_len>;
+	std::shared_ptr<chunk_table_t> chunks;
+	std::shared_ptr<pyramid_t> pyramid;
+	bool want_pyramid = false;
+	size_t len = 0;
+	size_t write_cursor = 0;
+
+	void make_pyramid(std::true_type /* numbers */){
+		pyramid = std::make_shared<pyramid_t>(n_chunks());
+	}
+	void make_pyramid(std::false_type /* other */){}
+
+	void build_pyramid_chunk(std::true_type /* numbers */, size_t c){
+		pyramid->build_chunk(c, cchunk(c), chunk_size(c));
+	}
+	void build_pyramid_chunk(std::false_type /* other */, size_t){}
+
+	template<typename Summary>
+	void summarise_impl(size_t begin, size_t end, Summary& ret) const{
+		for(size_t c = begin / chunk_len; begin < end && c*chunk_len < end; c++){
+			const size_t j0 = begin > c*chunk_len ? begin - c*chunk_len : 0;
+			const size_t j1 = std::min(chunk_size(c), end - c*chunk_len);
+			if(!pyramid){
+				for(size_t j=j0; j<j1; j++)
+					ret.add(cchunk(c)[j]);
+			}else if(j0 == 0 && j1 == chunk_size(c)){
+				ret.add(pyramid->chunk_summary(c));
+			}else{
+				ret.add(pyramid->summarise(c, cchunk(c), j0, j1));
+			}
+		}
+	}
+
+public:
+	using summary_t = RangeSummary<T>;
+
+	ChunkedArray() = default;
+
+	explicit ChunkedArray(size_t n){
+		allocate(n);
+	}
+
+	void allocate(size_t n){
+		// note that this doesn't affect other copies, they keep the old chunks.
+		len = n;
+		write_cursor = 0;
+		chunks = std::make_shared<chunk_table_t>((n + chunk_len - 1) / chunk_len);
+		for(auto& c : *chunks)
+			c = page_alloc::make_array<T>(chunk_len);
+		pyramid.reset();
+		if(want_pyramid)
+			make_pyramid(std::is_arithmetic<T>());
+	}
+
+	void enable_pyramid(){
+		/* call before allocate, see above */
+		static_assert(std::is_arithmetic<T>::value, "pyramids are for arrays of numbers");
+		assert(chunks == nullptr);
+		want_pyramid = true;
+	}
+
+	bool has_pyramid() const{
+		return pyramid != nullptr;
+	}
+
+	void finish_chunk(size_t c){
+		/* chunk c has been written (via chunk_data), so summarise it if need be */
+		if(pyramid)
+			build_pyramid_chunk(std::is_arithmetic<T>(), c);
+	}
+
+	summary_t summarise(size_t begin, size_t end) const{
+		/* min/max/mean of [begin, end), using the pyramid if there is one. */
+		assert(begin <= end && end <= len);
+		summary_t ret;
+		summarise_impl(begin, end, ret);
+		return ret;
+	}
+
+	std::vector<summary_t> summarise(size_t begin, size_t end, size_t n_out) const{
+		/* summaries of n_out (near) equal parts of [begin, end), e.g. one per pixel */
+		assert(begin <= end && end <= len);
+		std::vector<summary_t> ret(n_out);
+		for(size_t k=0; k<n_out; k++)
+			summarise_impl(begin + (end - begin)*k/n_out, begin + (end - begin)*(k + 1)/n_out, ret[k]);
+		return ret;
+	}
+
+	size_t length() const{
+		return len;
+	}
+
+	size_t n_chunks() const{
+		return chunks == nullptr ? 0 : chunks->size();
+	}
+
+	size_t bytes() const{
+		/* the memory held by the chunks (not counting the pyramid), see utils::bytes_of */
+		return n_chunks() * chunk_len * sizeof(T);
+	}
+
+	size_t chunk_size(size_t c) const{
+		assert(c < n_chunks());
+		return std::min(size_t(chunk_len), len - c*chunk_len);
+	}
+
+	T* chunk_data(size_t c){
+		assert(c < n_chunks());
+		return (*chunks)[c].get();
+	}
+
+	T const* cchunk(size_t c) const{
+		assert(c < n_chunks());
+		return (*chunks)[c].get();
+	}
+
+	void write(T const& val){
+		/* sequential writes, as in the xml, "speed.write(...)". */
+		assert(write_cursor < len);
+		(*chunks)[write_cursor / chunk_len][write_cursor % chunk_len] = val;
+		write_cursor++;
+		if(pyramid && (write_cursor % chunk_len == 0 || write_cursor == len))
+			finish_chunk((write_cursor - 1) / chunk_len);
+	}
+
+	T const& operator[](size_t i) const{
+		assert(i < len);
+		return (*chunks)[i / chunk_len][i % chunk_len];
+	}
+
+	T& operator[](size_t i){
+		assert(i < len);
+		return (*chunks)[i / chunk_len][i % chunk_len];
+	}
+
+	class const_iterator{
+		self_t const* arr;
+		size_t i;
+		T const* p;
+		T const* chunk_end;
+	public:
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = T;
+		using difference_type = std::ptrdiff_t;
+		using pointer = T const*;
+		using reference = T const&;
+
+		const_iterator(self_t const* arr_in, size_t i_in) : arr(arr_in), i(i_in) {
+			p = chunk_end = nullptr;
+			if(i < arr->len){
+				p = arr->cchunk(i / chunk_len) + i % chunk_len;
+				chunk_end = arr->cchunk(i / chunk_len) + arr->chunk_size(i / chunk_len);
+			}
+		}
+		T const& operator*() const { return *p; }
+		const_iterator& operator++(){
+			// only touch the chunk table when we cross a chunk boundary
+			i++;
+			if(++p == chunk_end)
+				*this = const_iterator(arr, i);
+			return *this;
+		}
+		bool operator==(const_iterator const& other) const { return i == other.i; }
+		bool operator!=(const_iterator const& other) const { return i != other.i; }
+	};
+
+	const_iterator begin() const{
+		return const_iterator(this, 0);
+	}
+	const_iterator end() const{
+		return const_iterator(this, len);
+	}
+
+	friend std::ostream& operator<<(std::ostream& os, self_t const& a){
+		size_t head_size = 16;
+		os << "ChunkedArray<len=" << a.len << ", chunks=" << a.n_chunks() << ">[";
+		for(size_t i=0; i<a.len && i<head_size; i++)
+			os << (i ? ", " : "") << a[i];
+		os << (a.len > head_size ? ", ...]" : "]");
+		return os;
+	}
+};
+
+
+template<typename T, size_t chunk_len_>
+class ChunkedArray<T, chunk_len_, SoA>{
+public:
+	static const size_t chunk_len = chunk_len_;
+	using self_t = ChunkedArray<T, chunk_len, SoA>;
+	using value_type = T;
+	using storage = SoA;
+	using lane_t = typename soa_lanes<T>::lane_t;
+	static const size_t n_lanes = soa_lanes<T>::n;
+
+private:
+	// chunk c is n_lanes runs of chunk_len lane_t's, lane k starting at k*chunk_len
+	using chunk_table_t = std::vector<page_alloc::unique_array<lane_t>>;
+	std::shared_ptr<chunk_table_t> chunks;
+	size_t len = 0;
+	size_t write_cursor = 0;
+
+	static T load(lane_t const* chunk, size_t j){
+		lane_t v[n_lanes];
+		for(size_t k=0; k<n_lanes; k++)
+			v[k] = chunk[k*chunk_len + j];
+		T ret;
+		std::memcpy(&ret, v, sizeof(T));
+		return ret;
+	}
+
+	static void store(lane_t* chunk, size_t j, T const& val){
+		lane_t v[n_lanes];
+		std::memcpy(v, &val, sizeof(T));
+		for(size_t k=0; k<n_lanes; k++)
+			chunk[k*chunk_len + j] = v[k];
+	}
+
+public:
+	/* what cchunk and chunk_data give in place of T const* and T*, so that
+	   chunk-at-a-time code, e.g. parallel_map, doesn't need to know the layout. */
+	class const_chunk_ref{
+		lane_t const* p = nullptr;
+	public:
+		const_chunk_ref() = default;
+		explicit const_chunk_ref(lane_t const* p_in) : p(p_in) {}
+		T operator[](size_t j) const { return load(p, j); }
+	};
+
+	class chunk_ref{
+		lane_t* p = nullptr;
+	public:
+		class element_ref{
+			lane_t* p;
+			size_t j;
+		public:
+			element_ref(lane_t* p_in, size_t j_in) : p(p_in), j(j_in) {}
+			element_ref& operator=(T const& val){ store(p, j, val); return *this; }
+			operator T() const { return load(p, j); }
+		};
+		chunk_ref() = default;
+		explicit chunk_ref(lane_t* p_in) : p(p_in) {}
+		element_ref operator[](size_t j) const { return element_ref(p, j); }
+		T get(size_t j) const { return load(p, j); }
+	};
+
+	ChunkedArray() = default;
+
+	explicit ChunkedArray(size_t n){
+		allocate(n);
+	}
+
+	void allocate(size_t n){
+		len = n;
+		write_cursor = 0;
+		chunks = std::make_shared<chunk_table_t>((n + chunk_len - 1) / chunk_len);
+		for(auto& c : *chunks)
+			c = page_alloc::make_array<lane_t>(n_lanes * chunk_len);
+	}
+
+	size_t length() const{
+		return len;
+	}
+
+	size_t n_chunks() const{
+		return chunks == nullptr ? 0 : chunks->size();
+	}
+
+	size_t bytes() const{
+		return n_chunks() * n_lanes * chunk_len * sizeof(lane_t);
+	}
+
+	size_t chunk_size(size_t c) const{
+		assert(c < n_chunks());
+		return std::min(size_t(chunk_len), len - c*chunk_len);
+	}
+
+	void finish_chunk(size_t){
+		// no pyramids for SoA, they're not numbers
+	}
+
+	lane_t* lane(size_t c, size_t k){
+		/* the k'th lane of chunk c, e.g. for points lane(c, 0) is the x's */
+		assert(c < n_chunks() && k < n_lanes);
+		return (*chunks)[c].get() + k*chunk_len;
+	}
+
+	lane_t const* clane(size_t c, size_t k) const{
+		assert(c < n_chunks() && k < n_lanes);
+		return (*chunks)[c].get() + k*chunk_len;
+	}
+
+	chunk_ref chunk_data(size_t c){
+		assert(c < n_chunks());
+		return chunk_ref((*chunks)[c].get());
+	}
+
+	const_chunk_ref cchunk(size_t c) const{
+		assert(c < n_chunks());
+		return const_chunk_ref((*chunks)[c].get());
+	}
+
+	void write(T const& val){
+		assert(write_cursor < len);
+		store((*chunks)[write_cursor / chunk_len].get(), write_cursor % chunk_len, val);
+		write_cursor++;
+	}
+
+	T operator[](size_t i) const{
+		assert(i < len);
+		return load((*chunks)[i / chunk_len].get(), i % chunk_len);
+	}
+
+	void set(size_t i, T const& val){
+		assert(i < len);
+		store((*chunks)[i / chunk_len].get(), i % chunk_len, val);
+	}
+
+	class const_iterator{
+		self_t const* arr;
+		size_t i;
+	public:
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = T;
+		using difference_type = std::ptrdiff_t;
+		using pointer = void;
+		using reference = T;
+
+		const_iterator(self_t const* arr_in, size_t i_in) : arr(arr_in), i(i_in) {}
+		T operator*() const { return (*arr)[i]; }
+		const_iterator& operator++(){
+			i++;
+			return *this;
+		}
+		bool operator==(const_iterator const& other) const { return i == other.i; }
+		bool operator!=(const_iterator const& other) const { return i != other.i; }
+	};
+
+	const_iterator begin() const{
+		return const_iterator(this, 0);
+	}
+	const_iterator end() const{
+		return const_iterator(this, len);
+	}
+
+	friend std::ostream& operator<<(std::ostream& os, self_t const& a){
+		size_t head_size = 16;
+		os << "ChunkedArray<len=" << a.len << ", chunks=" << a.n_chunks() << ", SoA>[";
+		for(size_t i=0; i<a.len && i<head_size; i++)
+			os << (i ? ", " : "") << a[i];
+		os << (a.len > head_size ? ", ...]" : "]");
+		return os;
+	}
+};
+
+
+template<typename Array, typename Foo>
+void parallel_for_chunks(WorkerPool& pool, size_t max_tasks, Array const& arr, Foo foo){
+	/* calls foo(c) for each chunk index of arr, spread over the pool */
+	pool.parallel_for(arr.n_chunks(), max_tasks, foo);
+}
+
+template<typename Array, typename Foo, typename Publish>
+void progressive_for_chunks(WorkerPool& pool, size_t max_tasks, size_t stride,
+							Array const& arr, Foo foo, Publish publish){
+	/* calls foo(c) for each chunk index of arr, like parallel_for_chunks, but in two
+	   passes: first chunks 0, stride, 2*stride..., then publish(fraction_done, true),
+	   then all the other chunks and publish(1, false).  fraction_done is the fraction
+	   of the elements seen so far, e.g. for scaling up counts.  With stride <= 1, or
+	   if the first pass would cover everything anyway, it's one pass and one publish. */
+	const size_t n = arr.n_chunks();
+	if(stride <= 1 || n <= 1){
+		pool.parallel_for(n, max_tasks, foo);
+		publish(1.f, false);
+		return;
+	}
+	const size_t n_first = (n + stride - 1) / stride;
+	pool.parallel_for(n_first, max_tasks, [&](size_t k){ foo(k * stride); });
+	size_t n_done = 0;
+	for(size_t k=0; k<n_first; k++)
+		n_done += arr.chunk_size(k * stride);
+	publish(float(n_done) / float(arr.length()), true);
+	pool.parallel_for(n - n_first, max_tasks, [&](size_t k){
+		// the k'th chunk that isn't a multiple of stride
+		foo(k / (stride - 1) * stride + k % (stride - 1) + 1);
+	});
+	publish(1.f, false);
+}
+
+template<typename In, typename Out, size_t chunk_len, typename InStorage, typename OutStorage, typename Foo>
+void parallel_map(WorkerPool& pool, size_t max_tasks, ChunkedArray<In, chunk_len, InStorage> const& in,
+				  ChunkedArray<Out, chunk_len, OutStorage>& out, Foo foo){
+	out.allocate(in.length());
+	pool.parallel_for(in.n_chunks(), max_tasks, [&](size_t c){
+		auto const src = in.cchunk(c);
+		auto const dest = out.chunk_data(c);
+		const size_t n = in.chunk_size(c);
+		const size_t first_idx = c*chunk_len;
+		for(size_t j=0; j<n; j++)
+			dest[j] = foo(src[j], first_idx + j);
+		out.finish_chunk(c);
+	});
+}
+
+
+#endif // _CHUNKED_ARRAY_H_
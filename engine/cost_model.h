@@ -0,0 +1,184 @@
+/*
+	CostModel class
+
+	A running estimate, for each Q, of how long its body takes and how many bytes
+	its value holds, learnt from what the engine actually sees, so that decisions
+	which used to come from static hints can follow the data instead:
+
+		keeping	- when the last user ref to a compute's value goes, the engine
+				  either deletes it straight away, or keeps it in the store as
+				  a cached value (see Engine::user_ref_counter_delta), and
+				  under memory pressure the cached values that are cheapest to
+				  recompute per byte go first (see Engine::trim_cache).  The
+				  CACHE=1 hint (utils::cache_hint) is only the default, used
+				  until we have min_observations of the Q, after which we keep
+				  values whose recompute cost is at least keep_ms_per_mb.
+		ordering - the worker queue runs the task with the longest expected
+				  path to the end of the graph first (its "bottom level"), so
+				  the critical path starts as early as possible, see
+				  critical_path_ms and Engine::schedule.
+		splitting - nodes with a CPU=N hint only split into chunk tasks if
+				  their runs take at least min_split_ms, as below that the
+				  tasks cost more than they save, see Engine::parallelism_for.
+
+	Fusing (the map=X hint) is decided by the generator, so isn't covered here.
+
+	The estimates are exponentially weighted moving averages (the most recent
+	run has weight alpha), kept separately for each power of 2 of input bytes
+	(the sum of utils::bytes_of over the upstream values), as e.g. speed takes
+	10x longer on a 10x longer trial.  Predicting for a size we haven't seen
+	uses the nearest size we have, scaled linearly.  Decisions that don't know
+	the input size use the type's estimates pooled over all sizes.
+
+	Observations can come from any thread, each estimate is updated under a
+	per-type spin lock, as it's a handful of doubles.  Reads are racy but only
+	ever see a value that was written, as each double is a relaxed atomic.
+*/
+
+#ifndef _COST_MODEL_H_
+#define _COST_MODEL_H_
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+
+template<size_t n_types>
+class CostModel{
+public:
+	static const size_t n_size_buckets = 40; // up to 2^40 bytes of input
+
+	double alpha = 0.2;
+	size_t min_observations = 4;
+	double keep_ms_per_mb = 1;
+	double min_split_ms = 0.5;
+
+private:
+	struct Estimate{
+		std::atomic<double> ms{0};
+		std::atomic<double> bytes{0};
+		std::atomic<uint32_t> n_runs{0};
+		std::atomic<uint32_t> n_outputs{0};
+	};
+
+	struct TypeModel{
+		std::atomic_flag lock = ATOMIC_FLAG_INIT;
+		bool cache_hint = false;
+		Estimate pooled;
+		std::array<Estimate, n_size_buckets> by_size;
+	};
+
+	std::array<TypeModel, n_types> types;
+
+	static size_t bucket_for(size_t input_bytes){
+		return input_bytes == 0 ? 0 : std::min<size_t>(n_size_buckets - 1, 64 - __builtin_clzll(input_bytes));
+	}
+
+	void update(std::atomic<double>& est, std::atomic<uint32_t>& n, double v){
+		const double old = est.load(std::memory_order_relaxed);
+		est.store(n.load(std::memory_order_relaxed) == 0 ? v : old + alpha * (v - old), std::memory_order_relaxed);
+		n.store(n.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	}
+
+	template<typename Foo>
+	void locked(size_t type, Foo foo){
+		while(types[type].lock.test_and_set(std::memory_order_acquire))
+			;
+		foo(types[type]);
+		types[type].lock.clear(std::memory_order_release);
+	}
+
+	double predict(size_t type, size_t input_bytes, std::atomic<double> Estimate::* field,
+				   std::atomic<uint32_t> Estimate::* count) const{
+		// the nearest bucket with any observations, scaled by the difference in size
+		auto const& by_size = types[type].by_size;
+		const size_t b = bucket_for(input_bytes);
+		for(size_t d=0; d<n_size_buckets; d++){
+			for(int sign : {-1, +1}){
+				const size_t b2 = b + sign * int(d);
+				if(b2 >= n_size_buckets || (d == 0 && sign > 0))
+					continue;
+				if((by_size[b2].*count).load(std::memory_order_relaxed) > 0)
+					return (by_size[b2].*field).load(std::memory_order_relaxed) * std::ldexp(1.0, int(b) - int(b2));
+			}
+		}
+		return 0;
+	}
+
+public:
+	void set_cache_hint(size_t type, bool keep){
+		types[type].cache_hint = keep;
+	}
+
+	void observe_run(size_t type, size_t input_bytes, double ms){
+		locked(type, [&](TypeModel& t){
+			update(t.pooled.ms, t.pooled.n_runs, ms);
+			auto& e = t.by_size[bucket_for(input_bytes)];
+			update(e.ms, e.n_runs, ms);
+		});
+	}
+
+	void observe_output(size_t type, size_t input_bytes, size_t bytes){
+		locked(type, [&](TypeModel& t){
+			update(t.pooled.bytes, t.pooled.n_outputs, double(bytes));
+			auto& e = t.by_size[bucket_for(input_bytes)];
+			update(e.bytes, e.n_outputs, double(bytes));
+		});
+	}
+
+	size_t n_runs(size_t type) const{
+		return types[type].pooled.n_runs.load(std::memory_order_relaxed);
+	}
+
+	double predict_ms(size_t type, size_t input_bytes) const{
+		return predict(type, input_bytes, &Estimate::ms, &Estimate::n_runs);
+	}
+
+	double predict_bytes(size_t type, size_t input_bytes) const{
+		return predict(type, input_bytes, &Estimate::bytes, &Estimate::n_outputs);
+	}
+
+	double mean_ms(size_t type) const{
+		return types[type].pooled.ms.load(std::memory_order_relaxed);
+	}
+
+	double keep_score(size_t type) const{
+		/* ms to recompute per MB held, higher is more worth keeping */
+		const double bytes = std::max(1.0, types[type].pooled.bytes.load(std::memory_order_relaxed));
+		return mean_ms(type) / bytes * (1 << 20);
+	}
+
+	bool worth_keeping(size_t type) const{
+		/* the CACHE hint until we know better, see above */
+		TypeModel const& t = types[type];
+		if(t.pooled.n_runs.load(std::memory_order_relaxed) < min_observations ||
+		   t.pooled.n_outputs.load(std::memory_order_relaxed) < min_observations)
+			return t.cache_hint;
+		return keep_score(type) >= keep_ms_per_mb;
+	}
+
+	bool worth_splitting(size_t type) const{
+		return n_runs(type) < min_observations || mean_ms(type) >= min_split_ms;
+	}
+
+	template<typename Adjacency>
+	double critical_path_ms(Adjacency const& adj, size_t type) const{
+		/* The expected time from starting type to finishing everything downstream
+		   of it, i.e. its own mean_ms plus the most expensive chain of downstream
+		   types.  adj is StaticGraph::adjacency(), so downstream types come later. */
+		std::array<double, n_types> bottom{};
+		for(size_t i=n_types; i-- > type; ){
+			double longest = 0;
+			for(size_t j=i+1; j<n_types; j++)
+				if(adj[j][i])
+					longest = std::max(longest, bottom[j]);
+			bottom[i] = mean_ms(i) + longest;
+		}
+		return bottom[type];
+	}
+};
+
+
+#endif // _COST_MODEL_H_
@@ -1,7 +1,27 @@
 
+#include <string>
+#include <unordered_map>
+#include <tuple>
+#include <algorithm>
+#include <fstream>
+#include <future>
+
 #include "key_value_pair.h"
-#include "unordered_map.h"
+#include "slot_class_store.h"
 #include "variable_width_contiguous_store.h"
+#include "chain_history.h"
+#include "persistent_vector.h"
+#include "mapped_file.h"
+#include "io_executor.h"
+#include "worker_pool.h"
+#include "chunked_array.h"
+#include "static_graph.h"
+#include "bitmask.h"
+#include "kernels.h"
+#include "trace.h"
+#include "profile.h"
+#include "cost_model.h"
+#include "wakeup.h"
 
 /* engien_refs.h is really a part of this file, we just split it up to 
    keep individual files a bit easier to navigate for the reader. */
@@ -32,14 +52,20 @@ template<size_t store_capacity, typename id_t, typename ...Qs>
 class Engine{
 
 public:
-	using kvp_t = KeyValuePair<KeyValueHeader, id_t, Qs...>;
-	static_assert(sizeof(kvp_t) <= 2* kvp_t::minimum_alignment, 
-					"KVP is larger than 2 (cache line) units.");
-
-	using store_t = unordered_map<kvp_t, store_capacity>;
+#ifdef VENOMOUS_TYPED_STORE
+	using store_t = TypedStore<KeyValueHeader, id_t, store_capacity, Qs...>;
+#else
+	using store_t = SlotClassStore<KeyValueHeader, id_t, store_capacity, Qs...>;
+#endif
 	using self_t = Engine<store_capacity, id_t, Qs...>;
 	using key_element_t = id_t;
-	using key_prefix_t = typename kvp_t::key_prefix_t;
+	using key_prefix_t = typename store_t::key_prefix_t;
+	using graph_t = StaticGraph<Qs...>;
+	static_assert(graph_t::is_topological(),
+				  "Qs must be listed after all of their upstream Qs.");
+
+	template<typename Q>
+	using q_key_t = std::array<key_element_t, utils::key_length<Q>::value>;
 
 	static const id_t invalid_id = -1;
 	std::array<id_t, sizeof...(Qs)> next_id_for_type;
@@ -49,62 +75,276 @@ public:
 
 	using callback_p_t = CallbackRefBaseA<self_t>*;
 
+	struct CallbackEntry{
+		/* the extra data for each callback's full-befores in callbacks */
+		callback_p_t cb_p;
+		key_prefix_t prefix; // of the Q it's for, as Qs can share full-befores
+	};
+
 private:
 	/*
 		There are a whole bunch of different containers storing stuff.
 
 		store - a hash-map of sorts, uses full-befores as keys, and actual
 			    data as values. Keys and data are packed together into a
-			    KVP which is aligned on cache-lines.  Provides some level
-			    of thread-safe usage, but most interesting stuff has to
-			    be done on main thread.
+			    KVP, in one of several sub-tables by size, so that small
+			    KVPs share cache lines, or with VENOMOUS_TYPED_STORE in a
+			    sub-table per Q, see slot_class_store.h.  Provides some
+			    level of thread-safe usage, but most interesting stuff has
+			    to be done on main thread.
 
-		user_ref_count - indices match up to store, counts number of
+		user_ref_count - indices match up to store.find_index, counts number of
 				 references on the user-side of the planet.  TODO: make
 				 threading guarnaees.
 
 		callbacks - holds the full-befores for callbacks. The user holds
 				an RAII-ref to individual callbacks in here, i.e. whne 
 				the user no longer cares about a given callback it will
-				be removed from this container.  It is very fast to iterate
+				be removed from this container.  Each entry also records the
+				prefix of the Q it is for.  It is very fast to iterate
 				over this container, and fairly fast to insert/delete.
 				There are no special threading guarantees.
+
+		intern_tables - for input Qs that are interned (see make_input), this
+				maps from the Q's intern_key to its id.  Indexed by the
+				prefix of the Q's intern domain.  Main thread only.
+
+		produced_on - indices match up to store.find_index, 1 + the worker
+				that ran the node which produced the value, or 0 if unknown, so
+				that its consumers can be run on the same core, see
+				preferred_worker.  Only a hint, it isn't cleared when a slot is
+				reused.  Any thread.
+
+		last_computed_keys - for incremental Qs (ones with a delta path), the
+				key each was last computed for, which is the base for the next
+				delta, see bind_delta.  Main thread only.
+
+		chain_histories - for chain Qs, i.e. the states of loops, the shape of
+				each chain and which of its states are in the store, indexed
+				by prefix, see append_chain and chain_history.h.  Main thread
+				only.
+
+		node_stats - run times, cache hits etc. for each Q, indexed by
+				prefix, see profile.h and write_profile_json.  Any thread.
+
+		cost_model - learnt run times and value sizes for each Q, which
+				decide whether unreferenced values are kept (see trim_cache),
+				the order of the worker queue, and whether CPU=N nodes split
+				into chunk tasks, see cost_model.h.  Any thread.
+
+		cache_budget - the most bytes of unreferenced values that trim_cache
+				leaves in the store.
+
+		cache_grew - set whenever the unreferenced values may have grown
+				(a user ref dropped to zero, a value was computed or
+				published) or the budget shrank, so that poll only scans
+				the store to trim it when it could be over budget.  Any
+				thread.
+
+		wakeup, posted - the main thread sleeps on wakeup until there's
+				something to do, and other threads hand it jobs through posted,
+				see start and poll.  Any thread.
+
+		pending_reads - the continuation for each read submitted with
+				read_async, keyed by the tag we gave it, until poll collects
+				its completion.  Main thread only.
+
+		io_executor - runs the compute nodes with the disk=True hint, and
+				the batched async reads of read_async, so that CPU work never
+				waits on disk.  Completions signal wakeup, see poll.
+
+		workers - runs all the other compute nodes, and the chunk tasks
+				of nodes with a CPU=N hint.
+
+		These two are declared last, so that they're destroyed, i.e. their
+		threads are joined, before any of the members their tasks use.
 	*/
 	store_t store;
-	std::array<std::atomic<size_t>, store_capacity> user_ref_count; 
-	VariableWidthContiguousStore<id_t, invalid_id, callback_p_t, 4> callbacks;
+	std::array<std::atomic<size_t>, store_t::capacity_> user_ref_count; 
+	std::array<std::atomic<uint16_t>, store_t::capacity_> produced_on{};
+	VariableWidthContiguousStore<id_t, invalid_id, CallbackEntry, 4> callbacks;
+
+	struct InternEntry{
+		id_t id;
+		size_t n_holders; // number of Qs in the domain with a KVP in the store for this id
+	};
+	std::array<std::unordered_map<std::string, InternEntry>, sizeof...(Qs)> intern_tables;
+
+	using intern_release_t = void(*)(self_t&, key_element_t const*, key_element_t const*);
+	static const std::array<intern_release_t, sizeof...(Qs)> intern_release_vtable;
+	static const std::array<char const*, sizeof...(Qs)> q_names; // indexed by prefix, see utils::q_name
+
+	std::tuple<q_key_t<Qs>...> last_computed_keys;
+	std::array<bool, sizeof...(Qs)> has_last_computed{};
+
+	using chain_history_t = ChainHistory<id_t, invalid_id>;
+	std::array<chain_history_t, sizeof...(Qs)> chain_histories; // only used for chain Qs
+	static const size_t no_chain = size_t(-1);
+	static const std::array<size_t, sizeof...(Qs)> chain_key_indices; // indexed by prefix, see chain_key_index
+
+	std::array<NodeStats, sizeof...(Qs)> node_stats;
+
+	CostModel<sizeof...(Qs)> cost_model;
+	size_t cache_budget = size_t(1) << 30;
+	std::atomic<bool> cache_grew{false};
+
+	Wakeup wakeup;
+	std::vector<std::function<void()>> posted;
+	std::mutex posted_mutex;
+	std::atomic<std::thread::id> main_thread{std::thread::id()}; // unset until start or poll
+	std::thread engine_thread;
+	std::atomic<bool> stopping{false};
+
+	using read_callback_t = std::function<void(ReadCompletion const&)>;
+	struct PendingRead{
+		uint64_t tag; // the caller's
+		std::shared_ptr<read_callback_t> on_done; // shared by the batch
+	};
+	std::unordered_map<uint64_t, PendingRead> pending_reads;
+	uint64_t next_read_tag = 0;
+
+	IoExecutor io_executor;
+	WorkerPool workers;
+
+	template<typename KVP>
+	using value_bytes_t = size_t(*)(KVP const&);
+	template<typename KVP>
+	static const std::array<value_bytes_t<KVP>, sizeof...(Qs)> value_bytes_vtable; // one per slot class
+
 public:
+	explicit Engine(page_alloc::Policy const& alloc_policy=page_alloc::Policy())
+		: store(alloc_policy) {
+		/* alloc_policy is for the store's tables, and the value arenas (see
+		   page_alloc.h), e.g. Pages::transparent_huge and Numa::interleave for
+		   a big cache on a multi-socket server. */
+		page_alloc::set_arena_policy(alloc_policy);
+		io_executor.notify_on_completion(wakeup.fd());
+
+		// only computes can be kept unreferenced, as inputs can't be remade
+		int dummy[] = {0, (cost_model.set_cache_hint(prefix_for<Qs>(),
+							utils::cache_hint<Qs>::value && utils::upstream_of<Qs>::type::size > 0), 0)...};
+		(void)dummy;
+	}
+
+	~Engine(){
+		stop();
+	}
+
 	using callback_ref_t = typename decltype(callbacks)::BucketRef;
 	static const size_t max_len_callbacks = decltype(callbacks)::max_len;
 
 	template<typename Q, self_t* engine_p, typename ...Args>
 	static auto make_input(Args&& ...args){
-		auto prefix = prefix_for<Q>();
-		auto id = engine_p->next_id_for_type[prefix]++;
+		/* If Q is interned, i.e. it has "static const bool interned = true", then
+		   inputs are content-addressed: Q must provide a "std::string intern_key() const"
+		   method, and if an input with the same intern_key already exists we return
+		   a ref to its id rather than allocating a new one.  This means that all the
+		   downstream results get shared too.
+		   Q can also specify "using intern_domain = OtherQ;", in which case ids are
+		   allocated from OtherQ's id space and deduplicated against OtherQ and any other
+		   Qs in the same domain, this is for aliases, e.g. pos_file_name and set_file_name
+		   pointing at the same path should get the same id as the axona_file_name.
+		   Any thread, after start it's done on the main thread, see on_main_thread. */
+		return engine_p->on_main_thread([&]{
+			return engine_p->template make_input_impl<Q, engine_p>(
+							utils::is_interned<Q>(), std::forward<Args>(args)...);
+		});
+	}
+
+private:
+
+	template<typename Q>
+	constexpr static auto id_prefix_for(){
+		// Qs in the same intern domain share an id space.
+		return prefix_for<typename utils::intern_domain<Q>::type>();
+	}
+
+	template<typename Q, self_t* engine_p, typename ...Args>
+	auto make_input_impl(std::false_type /* not interned */, Args&& ...args){
+		assert(is_main_thread()); // next_id_for_type and store inserts, see make_input
+		auto id = next_id_for_type[id_prefix_for<Q>()]++;
 		std::array<id_t, 1> key{id};
-		auto p = engine_p->store.insert(prefix, key.cbegin(), key.cend());
+		auto p = store.template insert<Q>(key.cbegin(), key.cend());
 		assert(p != nullptr);
 		p->template placement_new_value<Q>(std::forward<Args...>(args)...);
+		wakeup.notify(); // a new input, see poll
 		return KeyRef<self_t, engine_p, Q>(key);
 	}
 
-private:
+	template<typename Q, self_t* engine_p, typename ...Args>
+	auto make_input_impl(std::true_type /* interned */, Args&& ...args){
+		assert(is_main_thread()); // and intern_tables
+		// we have to construct the value before we know whether we need it
+		Q value(std::forward<Args>(args)...);
+		auto& table = intern_tables[id_prefix_for<Q>()];
+		auto it = table.find(value.intern_key());
+		std::array<id_t, 1> key;
+
+		if(it != table.end()){
+			key[0] = it->second.id;
+			if(store.template find<Q>(key.cbegin(), key.cend()) != nullptr){
+				node_stats[prefix_for<Q>()].record_lookup(true);
+				VENOMOUS_TRACE_INSTANT("cache_hit", utils::q_name<Q>());
+				return KeyRef<self_t, engine_p, Q>(key); // already exists, just take another ref
+			}
+			it->second.n_holders++; // exists, but only for other Qs in the domain
+		}else{
+			key[0] = next_id_for_type[id_prefix_for<Q>()]++;
+			table.emplace(value.intern_key(), InternEntry{key[0], 1});
+		}
+
+		node_stats[prefix_for<Q>()].record_lookup(false);
+		VENOMOUS_TRACE_INSTANT("cache_miss", utils::q_name<Q>());
+		auto p = store.template insert<Q>(key.cbegin(), key.cend());
+		assert(p != nullptr);
+		p->template placement_new_value<Q>(std::move(value));
+		wakeup.notify();
+		return KeyRef<self_t, engine_p, Q>(key);
+	}
+
+	template<typename Q>
+	static void release_interned(self_t& self, key_element_t const* begin, key_element_t const* end){
+		/* this goes in intern_release_vtable, it's called just before deleting
+		   the KVP of an input. */
+		self.release_interned_impl<Q>(utils::is_interned<Q>(), begin, end);
+	}
+
+	template<typename Q>
+	void release_interned_impl(std::false_type /* not interned */,
+							   key_element_t const* /* begin */, key_element_t const* /* end */){}
+
+	template<typename Q>
+	void release_interned_impl(std::true_type /* interned */,
+							   key_element_t const* begin, key_element_t const* end){
+		auto p = store.template find<Q>(begin, end);
+		assert(p != nullptr);
+		auto& table = intern_tables[id_prefix_for<Q>()];
+		auto it = table.find(p->template cget<Q>().intern_key());
+		assert(it != table.end() && it->second.n_holders > 0);
+		if(--it->second.n_holders == 0)
+			table.erase(it);
+	}
 
-	void callback_now_at(callback_ref_t const& ref, callback_p_t cb_p){
-		callbacks.set_extra(ref, cb_p);
+	void callback_now_at(callback_ref_t const& ref, callback_p_t cb_p, key_prefix_t prefix){
+		callbacks.set_extra(ref, CallbackEntry{cb_p, prefix});
 	}
 
 	template<typename Q, self_t* engine_p, typename State, void (*func_p)(KeyRef<self_t, engine_p, Q>, State), typename ...Args>
 	static auto make_callback(State state, Args ...args){
-		static_assert(sizeof...(Args) == Q::accompanying_key_n -1, 
+		static_assert(sizeof...(Args) == utils::key_length<Q>::value -1, 
 					  "full-befores list is not the correct length");
 
+		/* Main thread only, i.e. before start, or in a posted job after it, as
+		   the CallbackRef updates callbacks whenever it's moved or destroyed,
+		   and publish iterates it on the main thread. */
+		assert(engine_p->is_main_thread());
+
 		// TODO: accept refs rather than raw id_t's, and check they match the proper type for Q
 
 		// add callback's full-befores to callbacks store...
 		std::array<id_t, sizeof...(Args)> full_befores{args...};
-		auto ref = engine_p->callbacks.insert(full_befores.cbegin(), full_befores.cend(), nullptr /*,
-												, prefix_for<Q>() */);
+		auto ref = engine_p->callbacks.insert(full_befores.cbegin(), full_befores.cend(),
+											  CallbackEntry{nullptr, prefix_for<Q>()});
 
 
 		/* callbackRef will register a pointer to itself in engine_p->callbacks, and if it
@@ -119,63 +359,747 @@ private:
 		/* This can be called both from main-thread and from user-thread(s) */
 		static_assert(delta == -1 || delta == +1, "delta should be +-1");
 
-		auto idx = store.template find<size_t>(prefix, begin, end /* TODO: ,
-												 user_thread_id or main_thread_id */);
+		auto idx = store.find_index(prefix, begin, end /* TODO: ,
+									user_thread_id or main_thread_id */);
 		assert(idx != store_t::invalid_index);
 
 		if(delta == +1){
 			user_ref_count[idx]++;
 		}else{
 			size_t v = --user_ref_count[idx]; // aqr_rel vs seq_const ?
-			if(v == 0){
-				//TODO: make this thread-safe, i.e. if not on main, post request to main
-				store.delete_(prefix, begin, end); // TODO: strictly we could reuse idx here
+			if(v == 0)
+				cache_grew.store(true, std::memory_order_relaxed);
+			if(v == 0 && !cost_model.worth_keeping(prefix)){
+				if(is_main_thread()){
+					if(!chain_retains(prefix, begin))
+						evict(prefix, begin, end); // TODO: strictly we could reuse idx here
+				}else{
+					// it may have been taken again by the time main gets to it
+					std::vector<key_element_t> key(begin, end);
+					post([this, prefix, key]{
+						const size_t idx = store.find_index(prefix, key.data(), key.data() + key.size());
+						if(idx != store_t::invalid_index && user_ref_count[idx] == 0 &&
+						   !chain_retains(prefix, key.data()))
+							evict(prefix, key.data(), key.data() + key.size());
+					});
+				}
 			}
+			// otherwise it stays in the store as a cached value, see trim_cache
 		}
 	}
 
+	void evict(key_prefix_t prefix, key_element_t const* begin, key_element_t const* end){
+		node_stats[prefix].record_eviction();
+		VENOMOUS_TRACE_INSTANT("evict", q_names[prefix]);
+		intern_release_vtable[prefix](*this, begin, end);
+		chain_set_computed(prefix, begin, false);
+		store.delete_(prefix, begin, end);
+	}
+
+	template<typename Q>
+	constexpr static size_t chain_key_index_impl(std::true_type /* chain */){
+		return 1 + graph_t::template chain_position<Q>();
+	}
+
+	template<typename Q>
+	constexpr static size_t chain_key_index_impl(std::false_type /* not chain */){
+		return no_chain;
+	}
+
+	template<typename Q>
+	constexpr static size_t chain_key_index(){
+		// where Q's chain id is within its key, or no_chain
+		return chain_key_index_impl<Q>(utils::is_chain<Q>());
+	}
+
+	void chain_set_computed(key_prefix_t prefix, key_element_t const* key, bool value){
+		const size_t k = chain_key_indices[prefix];
+		if(k != no_chain && chain_histories[prefix].has(key[k]))
+			chain_histories[prefix].set_computed(key[k], value);
+	}
+
+	bool chain_retains(key_prefix_t prefix, key_element_t const* key) const{
+		/* true for the pinned states of chains, which we keep even when nothing
+		   refers to them, see ChainHistory::should_retain */
+		const size_t k = chain_key_indices[prefix];
+		return k != no_chain && chain_histories[prefix].has(key[k]) &&
+			   chain_histories[prefix].should_retain(key[k]);
+	}
+
+	size_t chain_eviction_rank(key_prefix_t prefix, key_element_t const* key) const{
+		/* see ChainHistory::eviction_rank, everything that isn't a chain state
+		   ranks alongside the pinned ones */
+		const size_t k = chain_key_indices[prefix];
+		if(k == no_chain || !chain_histories[prefix].has(key[k]))
+			return chain_history_t::top_level;
+		return chain_histories[prefix].eviction_rank(key[k]);
+	}
+
+	template<typename Q, typename KVP>
+	static size_t value_bytes(KVP const& kvp){
+		/* this goes in value_bytes_vtable */
+		return utils::bytes_of(kvp.template cget<Q>());
+	}
+
+	template<typename U>
+	size_t value_bytes_at(q_key_t<U> const& key){
+		auto p = store.template find<U>(key.cbegin(), key.cend());
+		return p == nullptr || !p->is_constructed() ? 0 : value_bytes<U>(*p);
+	}
+
+	template<typename Q, typename ...Us>
+	size_t input_bytes_impl(q_key_t<Q> const& key, utils::type_list<Us...>){
+		size_t ret = 0;
+		int dummy[] = {0, (ret += value_bytes_at<Us>(upstream_key<Q, Us>(key)), 0)...};
+		(void)dummy;
+		return ret;
+	}
+
 	template<typename Q>
-	Q const& cget_value(std::array<key_element_t, Q::accompanying_key_n> key){
-		auto p = store.find(prefix_for<Q>(), key.cbegin(), key.cend());
+	size_t input_bytes(q_key_t<Q> const& key){
+		/* the size of Q's upstream values for key, which is what CostModel buckets by */
+		return input_bytes_impl<Q>(key, typename utils::upstream_of<Q>::type());
+	}
+
+public:
+	template<typename Q, typename Task>
+	void schedule(q_key_t<Q> const& key, Task&& task){
+		/* Runs the body of compute Q for key. Nodes with the disk=True hint go to
+		   the io_executor so they never block the CPU workers, the rest go in the
+		   worker queue ordered by their expected critical path, see CostModel.
+		   Each run is timed for Q's node_stats and the cost_model, and with
+		   VENOMOUS_TRACE it's also recorded as a "node" span, see trace.h.
+		   CPU nodes go on the deque of the worker that produced their biggest
+		   input, see preferred_worker, and record which worker they ran on.
+		   The task holds an epoch guard from now until its body returns, so the
+		   upstream values it was bound to aren't destroyed under it if they're
+		   deleted meanwhile, see epoch.h.  So bind, then schedule, with no
+		   deletes in between. */
+		schedule_sized<Q>(input_bytes<Q>(key), recording_producer<Q>(key, std::forward<Task>(task)),
+						  preferred_worker<Q>(key));
+	}
+
+	template<typename Q, typename Task>
+	void schedule(Task&& task){
+		/* as above, for when the key isn't known, so the cost_model can't tell
+		   the size of the inputs */
+		schedule_sized<Q>(0, std::forward<Task>(task));
+	}
+
+private:
+	template<typename Q, typename Task>
+	void schedule_sized(size_t in_bytes, Task&& task, size_t worker=WorkerPool::any_worker){
+		schedule_impl(utils::is_disk_bound<Q>(),
+					  guarded(trace::wrap("node", utils::q_name<Q>(), timed<Q>(in_bytes, std::forward<Task>(task)))),
+					  cost_model.critical_path_ms(graph_t::adjacency(), prefix_for<Q>()), worker);
+	}
+
+	template<typename Q, typename Task>
+	auto recording_producer(q_key_t<Q> const& key, Task&& task){
+		return [this, key, task = std::forward<Task>(task)]() mutable {
+			task();
+			const size_t worker = workers.current_worker();
+			const size_t idx = store.find_index(prefix_for<Q>(), key.cbegin(), key.cend());
+			if(worker != WorkerPool::any_worker && idx != store_t::invalid_index)
+				produced_on[idx].store(uint16_t(worker + 1), std::memory_order_relaxed);
+		};
+	}
+
+	template<typename U>
+	void consider_producer(q_key_t<U> const& key, size_t& best_bytes, size_t& best_worker){
+		const size_t idx = store.find_index(prefix_for<U>(), key.cbegin(), key.cend());
+		if(idx == store_t::invalid_index)
+			return;
+		const size_t worker = produced_on[idx].load(std::memory_order_relaxed);
+		const size_t bytes = value_bytes_at<U>(key);
+		if(worker != 0 && (best_worker == WorkerPool::any_worker || bytes > best_bytes)){
+			best_bytes = bytes;
+			best_worker = worker - 1;
+		}
+	}
+
+	template<typename Q, typename ...Us>
+	size_t preferred_worker_impl(q_key_t<Q> const& key, utils::type_list<Us...>){
+		size_t best_bytes = 0, best_worker = WorkerPool::any_worker;
+		int dummy[] = {0, (consider_producer<Us>(upstream_key<Q, Us>(key), best_bytes, best_worker), 0)...};
+		(void)dummy;
+		return best_worker;
+	}
+
+	template<typename Q>
+	size_t preferred_worker(q_key_t<Q> const& key){
+		/* the worker that produced Q's biggest upstream value for key, as that's
+		   where it's most likely still in cache, or any_worker */
+		return preferred_worker_impl<Q>(key, typename utils::upstream_of<Q>::type());
+	}
+
+	template<typename Q, typename Task>
+	auto timed(size_t in_bytes, Task&& task){
+		return [this, in_bytes, task = std::forward<Task>(task)]() mutable {
+			const uint64_t t0 = NodeStats::now_ns();
+			task();
+			const uint64_t ns = NodeStats::now_ns() - t0;
+			node_stats[prefix_for<Q>()].record_run(ns);
+			cost_model.observe_run(prefix_for<Q>(), in_bytes, ns / 1e6);
+		};
+	}
+
+	template<typename Task>
+	auto guarded(Task&& task){
+		/* pins the epoch here, on the main thread, rather than when the task
+		   starts, and wakes the main thread when it's done, so it can reclaim
+		   and schedule whatever was waiting on it */
+		return [this, guard = Epochs::get().pin(), task = std::forward<Task>(task)]() mutable {
+			task();
+			guard.release();
+			wakeup.notify();
+		};
+	}
+
+	template<typename Task>
+	void schedule_impl(std::true_type /* disk bound */, Task&& task, double /* priority */, size_t /* worker */){
+		io_executor.run(std::forward<Task>(task));
+	}
+
+	template<typename Task>
+	void schedule_impl(std::false_type /* cpu bound */, Task&& task, double priority, size_t worker){
+		workers.run(std::forward<Task>(task), priority, worker);
+	}
+
+	template<typename Q>
+	bool is_provisional_value(q_key_t<Q> const& key){
+		auto p = store.template find<Q>(key.cbegin(), key.cend());
+		assert(p != nullptr);
+		return p->is_provisional();
+	}
+
+	template<typename Q>
+	Q const& cget_value(q_key_t<Q> key){
+		auto p = store.template find<Q>(key.cbegin(), key.cend());
 		assert(p != nullptr);
 		return p->template cget<Q>();
 	}
 
+	template<typename Q, typename ...Us, size_t ...Idx>
+	void bind_upstream_impl(Q& q, q_key_t<Q> const& key, utils::type_list<Us...>,
+							std::index_sequence<Idx...>){
+		int dummy[] = {0, (q.upstream_values[Idx] = &cget_value<Us>(upstream_key<Q, Us>(key)), 0)...};
+		(void)dummy;
+	}
+
+	template<typename Q>
+	Q const* find_value(q_key_t<Q> const& key){
+		// like cget_value, but it's ok if it's not there (e.g. it was evicted)
+		auto p = store.template find<Q>(key.cbegin(), key.cend());
+		node_stats[prefix_for<Q>()].record_lookup(p != nullptr);
+		VENOMOUS_TRACE_INSTANT(p == nullptr ? "cache_miss" : "cache_hit", utils::q_name<Q>());
+		return p == nullptr ? nullptr : &p->template cget<Q>();
+	}
+
+	template<typename Q, typename ...Us, size_t ...Idx>
+	bool bind_prev_upstream_impl(Q& q, q_key_t<Q> const& base, utils::type_list<Us...>,
+								 std::index_sequence<Idx...>){
+		bool ok = true;
+		int dummy[] = {0, (ok &= (q.prev_upstream_values[Idx] = find_value<Us>(upstream_key<Q, Us>(base))) != nullptr, 0)...};
+		(void)dummy;
+		return ok;
+	}
+
+	template<typename Q, typename ...Ds, size_t ...Idx>
+	bool bind_delta_values_impl(Q& q, q_key_t<Q> const& base, q_key_t<Q> const& key,
+								utils::type_list<Ds...>, std::index_sequence<Idx...>){
+		// the old and new values of each delta_over input, interleaved; the old
+		// ones may have been evicted since, then it's a full recompute
+		const auto positions = graph_t::template delta_positions<Q>();
+		bool ok = true;
+		int dummy[] = {0, (ok &= (q.delta_values[2*Idx] = find_value<Ds>(q_key_t<Ds>{{ base[1 + positions[Idx]] }})) != nullptr,
+						   ok &= (q.delta_values[2*Idx + 1] = find_value<Ds>(q_key_t<Ds>{{ key[1 + positions[Idx]] }})) != nullptr, 0)...};
+		(void)dummy;
+		return ok;
+	}
+
+	template<typename Q>
+	bool bind_delta_impl(std::false_type /* not incremental */, Q&, q_key_t<Q> const&){
+		return false;
+	}
+
+	template<typename Q>
+	bool bind_delta_impl(std::true_type /* incremental */, Q& q, q_key_t<Q> const& key){
+		const size_t i = graph_t::template index<Q>();
+		if(!has_last_computed[i])
+			return false;
+		q_key_t<Q> const& base = std::get<graph_t::template index<Q>()>(last_computed_keys);
+		if(base == key)
+			return false;
+
+		// the keys may only differ in the delta_over inputs
+		const auto positions = graph_t::template delta_positions<Q>();
+		for(size_t k=0; k<key.size(); k++)
+			if(base[k] != key[k] &&
+			   std::find(positions.begin(), positions.end(), k - 1) == positions.end())
+				return false;
+
+		q.prev_value = find_value<Q>(base);
+		if(q.prev_value == nullptr)
+			return false;
+		using upstream_t = typename utils::upstream_of<Q>::type;
+		if(!bind_prev_upstream_impl(q, base, upstream_t(), std::make_index_sequence<upstream_t::size>()))
+			return false;
+		using delta_over_t = typename utils::delta_over<Q>::type;
+		return bind_delta_values_impl(q, base, key, delta_over_t(), std::make_index_sequence<delta_over_t::size>());
+	}
+
+	template<typename U, size_t n_Q, size_t n_map>
+	static q_key_t<U> upstream_key_impl(std::true_type /* U is an input */,
+							std::array<key_element_t, n_Q> const& key, std::array<size_t, n_map> const& map){
+		return q_key_t<U>{{ key[1 + map[0]] }};
+	}
+
+	template<typename U, size_t n_Q, size_t n_map>
+	static q_key_t<U> upstream_key_impl(std::false_type /* U is a compute */,
+							std::array<key_element_t, n_Q> const& key, std::array<size_t, n_map> const& map){
+		q_key_t<U> ret;
+		ret[0] = prefix_for<U>(); // slot 0 of a compute's key is its own prefix
+		for(size_t k=0; k<n_map; k++)
+			ret[1 + k] = key[1 + map[k]];
+		return ret;
+	}
+
 public:
 	template<typename Q>
 	constexpr static auto prefix_for(){ //convenience
-		return kvp_t::template prefix_for<Q>();
+		return store_t::template prefix_for<Q>();
+	}
+
+	template<typename Q>
+	size_t parallelism_for() const{
+		/* The number of chunk tasks Q may run at once, from its CPU=N hint.
+		   CPU=auto (i.e. 0) means all the workers plus the calling thread.
+		   Nodes that the cost_model has seen are quick aren't split at all. */
+		if(!cost_model.worth_splitting(prefix_for<Q>()))
+			return 1;
+		const int hint = utils::cpu_hint<Q>::value;
+		return hint > 0 ? size_t(hint) : workers.size() + 1;
+	}
+
+	template<typename Q, typename U>
+	static q_key_t<U> upstream_key(q_key_t<Q> const& key){
+		/* The key of U, for U one of Q's upstream, made from Q's key by copying
+		   ids according to the static key_map, see StaticGraph. */
+		return upstream_key_impl<U>(
+				std::integral_constant<bool, utils::upstream_of<U>::type::size == 0>(),
+				key, graph_t::template key_map<Q, U>());
+	}
+
+	template<typename Q>
+	void bind_upstream(Q& q, q_key_t<Q> const& key){
+		/* Fills q.upstream_values with pointers to the values of each of Q's
+		   upstream Qs, in the order they are declared, which is what the generated
+		   arg accessors read from.  They all have to be in the store already, which
+		   they will be if Qs are run in topological order. */
+		using upstream_t = typename utils::upstream_of<Q>::type;
+		bind_upstream_impl(q, key, upstream_t(), std::make_index_sequence<upstream_t::size>());
 	}
 
-	void run(){
-		// eventually this will be called once, and start up the main
-		// engine thread loop, but for now the user has to repeatedly
-		// call it manually.
-		std::cout << "------ RUN -----------------------------"  << std::endl;
-		int padding = -1;
+	template<typename Q>
+	bool bind_delta(Q& q, q_key_t<Q> const& key){
+		/* Nodes can have a delta path as well as their full body, declared in the
+		   xml with <delta over="some_input">, for when only those inputs have
+		   changed since it was last computed and the old value can be patched in
+		   proportion to how much changed, e.g. speed_dwell when trial_time_slice is
+		   dragged.  If Q has one, and the key Q was last computed for (see
+		   note_computed) differs from key only in the delta_over inputs, and the old
+		   value, the old upstream values and the old and new values of the
+		   delta_over inputs are all still in the store, this binds them
+		   (q.prev_value, q.prev_upstream_values, and the old and new values of the
+		   delta_over inputs in q.delta_values) and returns true.  Then
+		   q.delta(sink) can be run instead of q(sink), after bind_upstream as usual.
+		   q.delta may still return false, meaning it can't do this one, in which
+		   case run q(sink). Main thread only. */
+		return bind_delta_impl(utils::is_incremental<Q>(), q, key);
+	}
+
+	template<typename Q, typename ...Args>
+	Q& emplace(q_key_t<Q> const& key, Args&& ...args){
+		/* Makes the store entry for compute Q's value for key, for whoever runs
+		   Q's node, which then binds and runs it, and publishes the value.
+		   It's pending until the exact value is published or note_computed,
+		   so trim_cache leaves it alone while the node is running.
+		   Main thread only. */
+		auto p = store.template insert<Q>(key.cbegin(), key.cend());
+		assert(p != nullptr);
+		p->template placement_new_value<Q>(std::forward<Args>(args)...);
+		p->set_pending(true);
+		return p->template get<Q>();
+	}
+
+	template<typename Q>
+	void note_computed(q_key_t<Q> const& key){
+		/* Call when Q's value for key is in the store, however it was computed, so
+		   that the next bind_delta can patch it, and for chain Qs so the chain's
+		   history knows it can replay from there. Main thread only. */
+		cache_grew.store(true, std::memory_order_relaxed);
+		auto p = store.template find<Q>(key.cbegin(), key.cend());
+		if(p != nullptr)
+			p->set_pending(false);
+		chain_set_computed(prefix_for<Q>(), key.data(), true);
+		if(!utils::is_incremental<Q>::value)
+			return;
+		std::get<graph_t::template index<Q>()>(last_computed_keys) = key;
+		has_last_computed[graph_t::template index<Q>()] = true;
+	}
+
+	template<typename Q>
+	void append_chain(id_t id, id_t parent){
+		/* For chain Qs, i.e. the state of a loop, which have "using chain_over = X;"
+		   for X the input that defines each iteration (e.g. cut_state, over
+		   cut_delta, in sample.xml's cut_changes_loop): records that X's id is
+		   applied to the state at parent, or to the first state if parent is
+		   invalid_id.  An undo is just asking for an ancestor's state, and a
+		   branch is appending a new id onto an ancestor. Main thread only. */
+		static_assert(utils::is_chain<Q>::value, "Q has no chain_over");
+		chain_histories[prefix_for<Q>()].append(id, parent);
+	}
+
+	template<typename Q>
+	id_t chain_replay(q_key_t<Q> const& key, std::vector<id_t>& ids_out){
+		/* How to get the state of chain Q for key, i.e. at the iteration given by
+		   key's chain_over id: returns the iteration whose state (for the rest of
+		   key) is in the store, to start from, or invalid_id to start from the
+		   first iteration, and fills ids_out with the iterations to compute after
+		   it, oldest first.  Each one is computed from the one before as usual
+		   (the delta path, see bind_delta), and note_computed.  Once nothing
+		   refers to them, the intermediate states are kept only if they are
+		   checkpoints, and are the first to go from the cache otherwise, see
+		   chain_history.h for why that keeps replays short. Main thread only. */
+		static_assert(utils::is_chain<Q>::value, "Q has no chain_over");
+		auto& history = chain_histories[prefix_for<Q>()];
+		const size_t k = chain_key_index<Q>();
+		q_key_t<Q> base_key = key;
+		while(true){
+			const id_t base = history.replay_plan(key[k], ids_out);
+			if(base == invalid_id)
+				return base;
+			base_key[k] = base;
+			if(store.template find<Q>(base_key.cbegin(), base_key.cend()) != nullptr)
+				return base;
+			history.set_computed(base, false); // it was computed for other befores
+		}
+	}
+
+	template<typename Q>
+	chain_history_t const& chain_history() const{
+		return chain_histories[prefix_for<Q>()];
+	}
+
+	template<typename Q, typename In, typename Out, size_t chunk_len, typename InStorage,
+			 typename OutStorage, typename Foo>
+	void parallel_map(ChunkedArray<In, chunk_len, InStorage> const& in,
+					  ChunkedArray<Out, chunk_len, OutStorage>& out, Foo foo){
+		/* For use in the body of Q, see ::parallel_map in chunked_array.h. With
+		   the default CPU=1 this is just a plain loop on the calling thread. */
+		::parallel_map(workers, parallelism_for<Q>(), in, out, foo);
+	}
+
+	template<typename Q, typename Array, typename Foo>
+	void parallel_for_chunks(Array const& arr, Foo foo){
+		/* For use in the body of Q, see ::parallel_for_chunks in chunked_array.h.
+		   This is what the generated fused funcs use: for nodes with the map=X
+		   hint, utils::fused_into<Q>::type is a func that computes Q together with
+		   the other element-wise nodes over X in one pass, writing each of their
+		   returns separately.  Whoever schedules Q should prefer that func when
+		   more than one of its members is requested (or cheap to keep). */
+		::parallel_for_chunks(workers, parallelism_for<Q>(), arr, foo);
+	}
+
+	template<typename Q, typename Array, typename Foo, typename Publish>
+	void progressive_for_chunks(Array const& arr, Foo foo, Publish publish){
+		/* For use in the body of Q, see ::progressive_for_chunks in chunked_array.h.
+		   The stride is Q's progressive=N hint, without it there's just the one,
+		   final, publish.  In the publish lambda the node writes its returns and
+		   yields them as provisional (or not), which ends up in publish<Q> below.
+		   publish is called on the thread running the node, after the chunks of
+		   each pass are done, so it can read what foo wrote without locking. */
+		::progressive_for_chunks(workers, parallelism_for<Q>(), size_t(utils::progressive_stride<Q>::value),
+								 arr, foo, publish);
+	}
+
+	template<typename Q>
+	void publish(q_key_t<Q> const& key, bool provisional){
+		/* Q's value for key is in the store (either an approximation, from a
+		   node with a progressive=N hint, or the exact value), so mark it as such and
+		   exec the callbacks registered for it.  They can check
+		   KeyRef::is_provisional(), and will be exec'd again when the exact value
+		   is published.  Only Q's callbacks are exec'd, not those of other Qs that
+		   happen to have the same full-befores.  Any thread: the node's publish
+		   lambda in progressive_for_chunks runs wherever the node does, so off the
+		   main thread this is posted there (in order, so the exact value's publish
+		   still comes after the provisional one).  If the value has been evicted
+		   meanwhile, i.e. all its refs were dropped, this does nothing. */
+		if(!is_main_thread()){
+			post([this, key, provisional]{ publish<Q>(key, provisional); });
+			return;
+		}
+		auto p = store.template find<Q>(key.cbegin(), key.cend());
+		if(p == nullptr)
+			return; // evicted meanwhile, i.e. nobody wants it any more
+		p->set_provisional(provisional);
+		p->set_pending(provisional);
+		cache_grew.store(true, std::memory_order_relaxed);
+		if(!provisional){
+			const size_t bytes = value_bytes<Q>(*p);
+			node_stats[prefix_for<Q>()].record_bytes(bytes);
+			cost_model.observe_output(prefix_for<Q>(), input_bytes<Q>(key), bytes);
+		}
+		const size_t n_befores = key.size() - 1;
 		callbacks.for_each(
-		[=](id_t const* begin, id_t const* end){
-			std::array<int, max_len_callbacks> v;
-			std::fill(std::copy(begin, end, v.begin()), v.end(), padding);
-			std::cout << "found callback registered for full-befores: " << v << std::endl;
-			return true;
+		[&](id_t const* begin, id_t const* end){
+			return size_t(end - begin) >= n_befores &&
+				   std::equal(key.cbegin() + 1, key.cend(), begin) &&
+				   std::all_of(begin + n_befores, end, [](id_t v){ return v == id_t(invalid_id); });
 		},
-		[](callback_p_t cb_p, auto begin, auto end){
-
-			/*		
-			// --- create dummy value in store and dummily-return it to callback --- //
-			std::array<key_element_t, Q::accompanying_key_n> dummy_key;
-			auto p = store.insert(prefix_for<Q>(), dmmyu_key.begin(), dummy_key.end());
-			assert(p != nullptr);
-			Q::exec(*p);
-			KeyRef<self_t, engine_p, Q> dummy_ref(dummy_key);
-			func_p(dummy_ref);
-			*/
-			std::cout << "I'd love to call the callback pointed to: " << cb_p << "\n";
+		[&](CallbackEntry const& entry, id_t const*, id_t const*){
+			if(entry.cb_p != nullptr && entry.prefix == prefix_for<Q>()){
+				VENOMOUS_TRACE_SCOPE("callback", utils::q_name<Q>(), provisional);
+				entry.cb_p->exec(key.data(), key.data() + key.size());
+			}
+		});
+	}
+
+	template<typename Q>
+	NodeStats const& stats() const{
+		return node_stats[prefix_for<Q>()];
+	}
+
+	struct Stats{
+		typename store_t::Stats store; // per_prefix is indexed by prefix_for<Q>()
+		std::array<size_t, decltype(callbacks)::n_buckets> callbacks_per_bucket;
+
+		friend std::ostream& operator<<(std::ostream& os, Stats const& s){
+			os << "store " << s.store << "\ncallbacks per bucket: ";
+			for(auto n : s.callbacks_per_bucket)
+				os << n << " ";
+			return os;
+		}
+	};
+
+	Stats stats() const{
+		/* A snapshot of the store and callbacks, for monitoring long running sessions,
+		   see unordered_map::stats.  Main thread only, as the callbacks aren't thread safe. */
+		return Stats{store.stats(), callbacks.bucket_sizes()};
+	}
+
+	void write_profile_json(std::ostream& os) const{
+		/* {"nodes": {"<prefix>": {"name": "<q_name>", "runs": ..., }, ...}}, see
+		   NodeStats::write_json.  Keyed by prefix as Qs without a q_name are all
+		   "?".  This is what the explorer's load_profile reads. Any thread. */
+		os << "{\"nodes\": {";
+		for(size_t i=0; i<sizeof...(Qs); i++){
+			os << (i == 0 ? "\n" : ",\n") << "\"" << i << "\": ";
+			node_stats[i].write_json(os, q_names[i]);
+		}
+		os << "\n}}\n";
+	}
+
+	bool write_profile_json(char const* path) const{
+		std::ofstream f(path);
+		if(!f)
+			return false;
+		write_profile_json(f);
+		return bool(f);
+	}
+
+	void set_cache_budget(size_t bytes){
+		cache_budget = bytes;
+		cache_grew.store(true, std::memory_order_relaxed);
+	}
+
+	void pin_workers(bool pin){
+		/* pin each worker to its own core, see WorkerPool::set_pinning.  Call
+		   before scheduling anything. */
+		workers.set_pinning(pin);
+	}
+
+	size_t trim_cache(size_t max_bytes){
+		/* Deletes cached values, i.e. ones with no user refs that the cost_model
+		   said were worth keeping, until they add up to at most max_bytes.  The
+		   ones that are cheapest to recompute per byte go first, except that
+		   the states of chains that aren't checkpoints go before anything
+		   else, see ChainHistory::eviction_rank. Returns the bytes freed.
+		   Main thread only.
+		   It scans the whole store, so poll only calls it when cache_grew.
+		   Values that running computes may be reading are only retired, and
+		   freed later by store.reclaim(), see unordered_map::delete_, and the
+		   ones they're still writing (pending, see emplace) aren't touched. */
+		struct Cached{
+			size_t rank;
+			double score;
+			size_t bytes;
+			key_prefix_t prefix;
+			std::vector<key_element_t> key;
+		};
+		std::vector<Cached> cached;
+		size_t total = 0;
+		store.for_each_valid([&](size_t idx, auto const& kvp){
+			if(user_ref_count[idx] != 0 || !kvp.is_constructed() || kvp.is_pending())
+				return; // in use, or its node is still running
+			const auto prefix = kvp.key_prefix();
+			const size_t bytes = value_bytes_vtable<std::decay_t<decltype(kvp)>>[prefix](kvp);
+			total += bytes;
+			cached.push_back(Cached{chain_eviction_rank(prefix, kvp.cbegin_key()),
+									cost_model.keep_score(prefix), bytes, prefix,
+									std::vector<key_element_t>(kvp.cbegin_key(), kvp.cend_key())});
+		});
+		std::sort(cached.begin(), cached.end(), [](Cached const& a, Cached const& b){
+			return a.rank != b.rank ? a.rank < b.rank : a.score < b.score;
+		});
+		size_t freed = 0;
+		for(auto const& c : cached){
+			if(total - freed <= max_bytes)
+				break;
+			evict(c.prefix, c.key.data(), c.key.data() + c.key.size());
+			freed += c.bytes;
+		}
+		return freed;
+	}
+
+	bool is_main_thread() const{
+		/* before start or poll, whoever is calling is the main thread */
+		const std::thread::id id = main_thread;
+		return id == std::thread::id() || id == std::this_thread::get_id();
+	}
+
+	void post(std::function<void()> job){
+		/* runs job on the main thread, in its next poll. Any thread.  While
+		   there's no main thread (before the first poll, or after stop) every
+		   thread counts as it, so the job runs right here. */
+		{
+			std::lock_guard<std::mutex> lock(posted_mutex);
+			if(main_thread != std::thread::id()){
+				posted.push_back(std::move(job));
+				job = nullptr;
+			}
+		}
+		if(job)
+			job();
+		else
+			wakeup.notify();
+	}
+
+	template<typename Job>
+	auto on_main_thread(Job job){
+		/* runs job on the main thread and returns its result, i.e. right here
+		   if this is the main thread, otherwise posted, and this waits for the
+		   next poll to get to it.  Any thread but a posted job's own. */
+		if(is_main_thread())
+			return job();
+		std::promise<decltype(job())> result;
+		post([&]{ result.set_value(job()); });
+		return result.get_future().get();
+	}
+
+	void read_async(std::vector<ReadRequest> batch, read_callback_t on_done){
+		/* Submits the batch in one go (one syscall with io_uring, see
+		   io_executor.h), e.g. the first blocks of each of a trial's files when
+		   it's opened, and calls on_done on the main thread, in poll, for each
+		   completion, with the tag from its ReadRequest.  The dest buffers must
+		   stay alive until then.  Any thread, it's posted to the main thread if
+		   need be. */
+		if(!is_main_thread()){
+			post([this, batch, on_done]{ read_async(batch, on_done); });
+			return;
+		}
+		auto shared = std::make_shared<read_callback_t>(std::move(on_done));
+		for(auto& r : batch){
+			pending_reads.emplace(next_read_tag, PendingRead{r.tag, shared});
+			r.tag = next_read_tag++;
+		}
+		io_executor.submit_reads(batch.data(), batch.data() + batch.size());
+	}
+
+	void notify(){
+		/* wakes the main thread, e.g. after changing inputs. Any thread. */
+		wakeup.notify();
+	}
+
+	int fd(){
+		/* For a host application that drives the engine from its own event
+		   loop instead of calling start: call poll, on the thread that made
+		   the engine's inputs, whenever this is readable.  -1 if the platform
+		   has no eventfd, in which case call poll at least once per frame. */
+		return wakeup.fd();
+	}
+
+	void start(){
+		/* Starts the engine thread, which sleeps until woken (by finished
+		   nodes, I/O completions, posted jobs, or notify) and then polls.
+		   From then on that thread is the main thread, so everything that
+		   is main thread only has to go through post.  It is the main thread
+		   by the time this returns, so the caller isn't any more. */
+		if(engine_thread.joinable())
+			return;
+		stopping = false;
+		std::promise<void> is_main;
+		engine_thread = std::thread([this, &is_main]{
+			main_thread = std::this_thread::get_id();
+			is_main.set_value();
+			while(!stopping){
+				wakeup.wait();
+				poll();
+			}
 		});
+		is_main.get_future().wait();
+	}
 
-		std::cout << "----------------------------------------"  << std::endl;
+	void stop(){
+		/* stops the engine thread, if it was started, after its current poll */
+		if(!engine_thread.joinable())
+			return;
+		stopping = true;
+		wakeup.notify();
+		engine_thread.join();
 
+		// and runs whatever was posted after its last poll, as someone may be
+		// waiting for it, see on_main_thread.  Anything posted later runs inline.
+		std::vector<std::function<void()>> jobs;
+		{
+			std::lock_guard<std::mutex> lock(posted_mutex);
+			main_thread = std::thread::id();
+			jobs.swap(posted);
+		}
+		for(auto& job : jobs)
+			job();
+	}
+
+	void poll(){
+		/* Does everything that's pending on the main thread, i.e. posted
+		   jobs (e.g. evictions from user threads dropping refs), finished
+		   reads from read_async, trimming the cache, and reclaiming retired
+		   values.  Callbacks are exec'd by publish, as values are computed. */
+		if(main_thread == std::thread::id())
+			main_thread = std::this_thread::get_id();
+		assert(is_main_thread());
+		wakeup.consume();
+
+		std::vector<std::function<void()>> jobs;
+		{
+			std::lock_guard<std::mutex> lock(posted_mutex);
+			jobs.swap(posted);
+		}
+		for(auto& job : jobs)
+			job();
+
+		io_executor.poll_completions([this](ReadCompletion const& c){
+			auto it = pending_reads.find(c.tag);
+			assert(it != pending_reads.end());
+			PendingRead pending = std::move(it->second);
+			pending_reads.erase(it);
+			(*pending.on_done)(ReadCompletion{pending.tag, c.result});
+		});
+
+		if(cache_grew.exchange(false, std::memory_order_relaxed))
+			trim_cache(cache_budget); // otherwise it's still within budget since the last one
+		store.reclaim();
 	}
 
 
@@ -191,4 +1115,26 @@ public:
 
 };
 
+// construct intern_release_vtable
+template<size_t store_capacity, typename id_t, typename ...Qs>
+const std::array<typename Engine<store_capacity, id_t, Qs...>::intern_release_t, sizeof...(Qs)>
+Engine<store_capacity, id_t, Qs...>::intern_release_vtable = {
+&Engine<store_capacity, id_t, Qs...>::template release_interned<Qs>...};
+
+// construct chain_key_indices
+template<size_t store_capacity, typename id_t, typename ...Qs>
+const std::array<size_t, sizeof...(Qs)>
+Engine<store_capacity, id_t, Qs...>::chain_key_indices = {
+Engine<store_capacity, id_t, Qs...>::template chain_key_index<Qs>()...};
 
+// construct value_bytes_vtable
+template<size_t store_capacity, typename id_t, typename ...Qs>
+template<typename KVP>
+const std::array<typename Engine<store_capacity, id_t, Qs...>::template value_bytes_t<KVP>, sizeof...(Qs)>
+Engine<store_capacity, id_t, Qs...>::value_bytes_vtable = {
+&Engine<store_capacity, id_t, Qs...>::template value_bytes<Qs, KVP>...};
+
+// construct q_names
+template<size_t store_capacity, typename id_t, typename ...Qs>
+const std::array<char const*, sizeof...(Qs)>
+Engine<store_capacity, id_t, Qs...>::q_names = {utils::q_name<Qs>()...};
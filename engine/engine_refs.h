@@ -15,7 +15,7 @@ class KeyRef{
 
 	using key_element_t = typename E::key_element_t;
 	using self_t = KeyRef<E, engine_p, Q>;
-	using key_t = std::array<key_element_t, Q::accompanying_key_n>;
+	using key_t = std::array<key_element_t, utils::key_length<Q>::value>;
 	key_t key;
 	static const auto q_prefix = E::template prefix_for<Q>();
 public:
@@ -44,6 +44,15 @@ public:
 	Q const& cget(){
 		return engine_p->template cget_value<Q>(key);
 	}
+	key_t const& cget_key() const{
+		/* for inputs it's just {id}, which is what make_callback takes */
+		return key;
+	}
+	bool is_provisional(){
+		/* true if this is an early approximation, computed from part of the
+		   input, the callback will be exec'd again with the exact value. */
+		return engine_p->template is_provisional_value<Q>(key);
+	}
 };
 
 
@@ -94,15 +103,15 @@ public:
 	CallbackRef(typename base_t::ref_t&& ref_in, State state_in) 
 				: base_t(std::move(ref_in)),
 				  state(state_in) {
-				  	engine_p->callback_now_at(base_t::get_ref(), this);
+				  	engine_p->callback_now_at(base_t::get_ref(), this, q_prefix);
 				  };
 	CallbackRef(self_t&& other) 
 				: base_t(std::move(other)),
 				  state(std::move(other.state)) {
-					engine_p->callback_now_at(base_t::get_ref(), this);
+					engine_p->callback_now_at(base_t::get_ref(), this, q_prefix);
 				};
 	~CallbackRef() override{
-		engine_p->callback_now_at(base_t::get_ref(), nullptr);
+		engine_p->callback_now_at(base_t::get_ref(), nullptr, q_prefix);
 	};
 	void exec(typename E::key_element_t const* begin,
 				 typename E::key_element_t const* end) override{
@@ -0,0 +1,139 @@
+/*
+	Epochs class
+
+	Epoch-based reclamation, so that the main thread can delete KVPs from the
+	store while workers are reading their values, without the workers taking
+	any locks.  The main thread retires a KVP instead of destroying it: it
+	can no longer be found, or its slot reused, but the value stays where it
+	is until no reader can still have a pointer to it, see
+	unordered_map::delete_ and unordered_map::reclaim.
+
+	Readers pin an epoch by holding a Guard, from before they get a pointer to
+	a value until after they finish with it.  Engine::schedule takes a guard
+	on the main thread, when the task is scheduled (i.e. just after its
+	upstream values were bound), and the task releases it when its body
+	returns.  Chunk tasks spawned by a node don't need their own, as the
+	node waits for them while holding its guard.
+
+	There is a global epoch, and a count of the guards pinned in each of the
+	last 3 epochs (the counts are indexed by epoch % 3).  The main thread can
+	advance the global epoch from e to e+1 once there are no guards left from
+	e-1, so by the time it reaches r+2, every guard that was pinned at or
+	before r, i.e. every reader that could have found something retired at r,
+	has been released.  Guards pinned later can't find it, as it was unfindable
+	from the moment it was retired.  Retired things are destroyed in the order
+	they were retired, so checking them is O(1) per reclaim.
+
+	Pinning re-checks the global epoch after counting itself in, so a pin
+	racing with an advance either sees the new epoch or holds up the advance.
+	The counters are shared by all the threads, as guards are per task, not
+	per thread (they are taken on the main thread and released on a worker),
+	and tasks are long enough for that not to matter.
+
+	There is one Epochs for the whole process, Epochs::get(), as with the
+	Tracer.  Only the main thread advances or retires.
+*/
+
+#ifndef _EPOCH_H_
+#define _EPOCH_H_
+
+#include <atomic>
+#include <array>
+#include <cstdint>
+
+
+class Epochs{
+	struct alignas(64) Counter{
+		std::atomic<uint64_t> n{0};
+	};
+
+	std::atomic<uint64_t> global{0};
+	std::array<Counter, 3> n_guards;
+
+	Epochs() = default;
+
+	void unpin(uint64_t epoch){
+		n_guards[epoch % 3].n.fetch_sub(1, std::memory_order_release);
+	}
+
+public:
+	Epochs(Epochs const&) = delete;
+	Epochs& operator=(Epochs const&) = delete;
+
+	static Epochs& get(){
+		static Epochs epochs;
+		return epochs;
+	}
+
+	class Guard{
+		/* Copies pin the same epoch, each copy must be released (or destroyed). */
+		uint64_t epoch = 0;
+		bool active = false;
+
+		friend class Epochs;
+		explicit Guard(uint64_t epoch_in) : epoch(epoch_in), active(true) {}
+
+	public:
+		Guard() = default;
+		Guard(Guard const& other) : epoch(other.epoch), active(other.active) {
+			if(active)
+				Epochs::get().n_guards[epoch % 3].n.fetch_add(1, std::memory_order_relaxed);
+		}
+		Guard(Guard&& other) : epoch(other.epoch), active(other.active) {
+			other.active = false;
+		}
+		Guard& operator=(Guard other){
+			release();
+			epoch = other.epoch;
+			active = other.active;
+			other.active = false;
+			return *this;
+		}
+		~Guard(){
+			release();
+		}
+
+		void release(){
+			if(active)
+				Epochs::get().unpin(epoch);
+			active = false;
+		}
+	};
+
+	Guard pin(){
+		while(true){
+			const uint64_t e = global.load(std::memory_order_seq_cst);
+			n_guards[e % 3].n.fetch_add(1, std::memory_order_seq_cst);
+			if(global.load(std::memory_order_seq_cst) == e)
+				return Guard(e);
+			unpin(e); // raced with an advance, try again in the new epoch
+		}
+	}
+
+	uint64_t current() const{
+		return global.load(std::memory_order_seq_cst);
+	}
+
+	size_t n_pinned() const{
+		size_t ret = 0;
+		for(auto const& c : n_guards)
+			ret += c.n.load(std::memory_order_seq_cst);
+		return ret;
+	}
+
+	bool try_advance(){
+		/* main thread only, see above */
+		const uint64_t e = global.load(std::memory_order_relaxed);
+		if(n_guards[(e + 2) % 3].n.load(std::memory_order_acquire) != 0) // i.e. epoch e-1
+			return false;
+		global.store(e + 1, std::memory_order_seq_cst);
+		return true;
+	}
+
+	bool is_safe(uint64_t retired_at) const{
+		return current() >= retired_at + 2;
+	}
+};
+
+
+#endif // _EPOCH_H_
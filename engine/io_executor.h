@@ -0,0 +1,479 @@
+/*
+	IoExecutor class
+
+	A separate executor for disk-bound work, so that CPU workers are never blocked
+	waiting on disk.  It has two parts:
+
+	  1. A small pool of I/O threads, which runs the bodies of compute nodes
+		 marked with the disk=True hint (see Engine::schedule), as well as any
+		 reads that can't go through io_uring.
+
+	  2. Batched asynchronous reads. The main thread submits a batch of
+		 ReadRequests (e.g. the first blocks of the pos, set, tet, eeg and cut files
+		 when a new trial is opened) with submit_reads, and later collects
+		 ReadCompletions with poll_completions.  Where available we use io_uring, so
+		 the whole batch is one syscall and no threads are tied up; otherwise each
+		 read becomes a pread task on the I/O thread pool, so the files are still
+		 read concurrently.  Engine::read_async is the way in through the engine,
+		 its poll collects the completions.
+
+	We talk to io_uring with raw syscalls rather than liburing, as we only need
+	plain reads.  If io_uring_setup fails at runtime (old kernel, seccomp, etc.)
+	we silently use the thread pool instead.  Define VENOMOUS_NO_IO_URING to never
+	try it.
+
+	Short reads are resubmitted internally, so a completion's result is either the
+	full requested length, the number of bytes before EOF, or -errno.
+
+	The I/O threads are started lazily on first use, so that a global engine
+	doesn't spawn threads during static initialization.
+
+	notify_on_completion(fd) makes every completed read also signal an eventfd
+	(with io_uring the kernel does it, via IORING_REGISTER_EVENTFD), so that a
+	main thread sleeping on it wakes up to collect them, see wakeup.h.
+
+	submit_reads, poll_completions, wait_completions and notify_on_completion
+	are main-thread only, run can be called from anywhere.
+*/
+
+#ifndef _IO_EXECUTOR_H_
+#define _IO_EXECUTOR_H_
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <cassert>
+
+#include <unistd.h>
+
+#include "trace.h"
+
+#if defined(__linux__) && defined(__has_include) && !defined(VENOMOUS_NO_IO_URING)
+#if __has_include(<linux/io_uring.h>)
+#define VENOMOUS_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#endif
+#endif
+
+
+struct ReadRequest{
+	int fd;
+	uint8_t* dest;
+	size_t offset;
+	size_t len;
+	uint64_t tag; // passed back in the completion
+};
+
+struct ReadCompletion{
+	uint64_t tag;
+	ssize_t result; // bytes read, or -errno
+};
+
+
+#ifdef VENOMOUS_IO_URING
+namespace io_executor_impl{
+
+class IoUring{
+	/* Just enough of io_uring to submit IORING_OP_READs and reap their
+	   completions.  Single producer, single consumer (the main thread). */
+	int ring_fd = -1;
+	unsigned sq_entries = 0;
+	unsigned cq_entries = 0;
+
+	void* sq_ring = nullptr;
+	void* cq_ring = nullptr;
+	size_t sq_ring_len = 0;
+	size_t cq_ring_len = 0;
+	io_uring_sqe* sqes = nullptr;
+
+	unsigned* sq_head; unsigned* sq_tail; unsigned* sq_mask; unsigned* sq_array;
+	unsigned* cq_head; unsigned* cq_tail; unsigned* cq_mask; io_uring_cqe* cqes;
+
+	unsigned n_unsubmitted = 0;
+
+	template<typename T>
+	static T* at(void* base, unsigned offset){
+		return reinterpret_cast<T*>(static_cast<uint8_t*>(base) + offset);
+	}
+
+public:
+	bool setup(unsigned entries){
+		io_uring_params p;
+		std::memset(&p, 0, sizeof(p));
+		ring_fd = syscall(__NR_io_uring_setup, entries, &p);
+		if(ring_fd < 0)
+			return false;
+		sq_entries = p.sq_entries;
+		cq_entries = p.cq_entries;
+
+		sq_ring_len = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+		cq_ring_len = p.cq_off.cqes + p.cq_entries*sizeof(io_uring_cqe);
+		bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+		if(single_mmap)
+			sq_ring_len = cq_ring_len = std::max(sq_ring_len, cq_ring_len);
+
+		sq_ring = mmap(nullptr, sq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+					   ring_fd, IORING_OFF_SQ_RING);
+		if(sq_ring == MAP_FAILED){
+			sq_ring = nullptr;
+			return false;
+		}
+		if(single_mmap){
+			cq_ring = sq_ring;
+		}else{
+			cq_ring = mmap(nullptr, cq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+						   ring_fd, IORING_OFF_CQ_RING);
+			if(cq_ring == MAP_FAILED){
+				cq_ring = nullptr;
+				return false;
+			}
+		}
+		void* s = mmap(nullptr, p.sq_entries*sizeof(io_uring_sqe), PROT_READ | PROT_WRITE,
+					   MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+		if(s == MAP_FAILED)
+			return false;
+		sqes = static_cast<io_uring_sqe*>(s);
+
+		sq_head = at<unsigned>(sq_ring, p.sq_off.head);
+		sq_tail = at<unsigned>(sq_ring, p.sq_off.tail);
+		sq_mask = at<unsigned>(sq_ring, p.sq_off.ring_mask);
+		sq_array = at<unsigned>(sq_ring, p.sq_off.array);
+		cq_head = at<unsigned>(cq_ring, p.cq_off.head);
+		cq_tail = at<unsigned>(cq_ring, p.cq_off.tail);
+		cq_mask = at<unsigned>(cq_ring, p.cq_off.ring_mask);
+		cqes = at<io_uring_cqe>(cq_ring, p.cq_off.cqes);
+		return true;
+	}
+
+	~IoUring(){
+		if(sqes != nullptr)
+			munmap(sqes, sq_entries*sizeof(io_uring_sqe));
+		if(cq_ring != nullptr && cq_ring != sq_ring)
+			munmap(cq_ring, cq_ring_len);
+		if(sq_ring != nullptr)
+			munmap(sq_ring, sq_ring_len);
+		if(ring_fd >= 0)
+			close(ring_fd);
+	}
+
+	int fd() const{
+		return ring_fd;
+	}
+
+	bool register_eventfd(int event_fd){
+		return syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_EVENTFD, &event_fd, 1) == 0;
+	}
+
+	bool push_read(int fd, uint8_t* dest, size_t offset, size_t len, uint64_t user_data){
+		// returns false if the submission queue is full, call flush and try again
+		unsigned tail = *sq_tail;
+		unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+		if(tail - head >= sq_entries)
+			return false;
+		unsigned idx = tail & *sq_mask;
+		io_uring_sqe& sqe = sqes[idx];
+		std::memset(&sqe, 0, sizeof(sqe));
+		sqe.opcode = IORING_OP_READ;
+		sqe.fd = fd;
+		sqe.addr = reinterpret_cast<uint64_t>(dest);
+		sqe.len = len;
+		sqe.off = offset;
+		sqe.user_data = user_data;
+		sq_array[idx] = idx;
+		__atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+		n_unsubmitted++;
+		return true;
+	}
+
+	void flush(unsigned min_complete=0){
+		// one syscall for the whole batch
+		unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+		int ret;
+		do{
+			ret = syscall(__NR_io_uring_enter, ring_fd, n_unsubmitted, min_complete, flags, nullptr, 0);
+		}while(ret < 0 && errno == EINTR);
+		if(ret > 0)
+			n_unsubmitted -= std::min<unsigned>(ret, n_unsubmitted);
+	}
+
+	template<typename Foo>
+	size_t reap(Foo foo){
+		/* calls foo(user_data, res) for each completion */
+		unsigned head = *cq_head;
+		unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+		size_t n = 0;
+		for(; head != tail; head++, n++){
+			io_uring_cqe const& cqe = cqes[head & *cq_mask];
+			foo(cqe.user_data, cqe.res);
+		}
+		__atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+		return n;
+	}
+};
+
+} // io_executor_impl
+#endif // VENOMOUS_IO_URING
+
+
+class IoExecutor{
+public:
+	using task_t = std::function<void()>;
+
+private:
+	const size_t n_threads;
+	std::vector<std::thread> threads;
+	std::deque<task_t> tasks;
+	std::mutex tasks_mutex;
+	std::condition_variable tasks_cv;
+	bool stopping = false;
+
+	// completions from the thread-pool reads, protected by completions_mutex
+	std::vector<ReadCompletion> pool_completions;
+	std::mutex completions_mutex;
+	std::condition_variable completions_cv;
+	std::atomic<size_t> n_in_flight{0};
+	std::atomic<int> notify_fd{-1}; // see notify_on_completion
+
+#ifdef VENOMOUS_IO_URING
+	io_executor_impl::IoUring ring;
+	bool ring_ok = false;
+	bool ring_tried = false;
+	std::vector<ReadRequest> ring_in_flight; // indexed by user_data
+	std::vector<size_t> ring_free_slots;
+	std::vector<size_t> ring_done_bytes;
+	const unsigned ring_entries;
+#endif
+
+	void start_threads(){
+		if(!threads.empty())
+			return;
+		for(size_t i=0; i<n_threads; i++)
+			threads.emplace_back([this]{ thread_loop(); });
+	}
+
+	void thread_loop(){
+		while(true){
+			task_t task;
+			{
+				std::unique_lock<std::mutex> lock(tasks_mutex);
+				tasks_cv.wait(lock, [this]{ return stopping || !tasks.empty(); });
+				if(tasks.empty())
+					return; // only when stopping
+				task = std::move(tasks.front());
+				tasks.pop_front();
+			}
+			task();
+		}
+	}
+
+	static ssize_t pread_fully(ReadRequest const& r){
+		size_t done = 0;
+		while(done < r.len){
+			ssize_t n = pread(r.fd, r.dest + done, r.len - done, r.offset + done);
+			if(n < 0 && errno == EINTR)
+				continue;
+			if(n < 0)
+				return -errno;
+			if(n == 0)
+				break; // EOF
+			done += n;
+		}
+		return done;
+	}
+
+	void complete_from_pool(ReadCompletion c){
+		{
+			std::lock_guard<std::mutex> lock(completions_mutex);
+			pool_completions.push_back(c);
+		}
+		completions_cv.notify_one();
+		if(notify_fd >= 0){
+			const uint64_t one = 1;
+			ssize_t ret = write(notify_fd, &one, sizeof(one));
+			(void)ret;
+		}
+	}
+
+#ifdef VENOMOUS_IO_URING
+	bool using_ring(){
+		if(!ring_tried){
+			ring_tried = true;
+			ring_ok = ring.setup(ring_entries);
+			if(ring_ok && notify_fd >= 0)
+				ring.register_eventfd(notify_fd);
+		}
+		return ring_ok;
+	}
+
+	void ring_push(size_t slot, size_t done){
+		ReadRequest const& r = ring_in_flight[slot];
+		while(!ring.push_read(r.fd, r.dest + done, r.offset + done, r.len - done, slot)){
+			// submission queue is full: submit what we have, wait for something to finish
+			ring.flush(1);
+			ring_reap();
+		}
+	}
+
+	size_t ring_reap(){
+		/* moves io_uring completions into pool_completions, resubmitting short reads */
+		std::vector<ReadCompletion> done;
+		std::vector<size_t> resubmit;
+		ring.reap([&](uint64_t slot, int res){
+			ReadRequest const& r = ring_in_flight[slot];
+			if(res > 0 && ring_done_bytes[slot] + res < r.len){
+				ring_done_bytes[slot] += res;
+				resubmit.push_back(slot);
+				return;
+			}
+			ssize_t result = res < 0 ? ssize_t(res) : ssize_t(ring_done_bytes[slot] + res);
+			done.push_back({r.tag, result});
+			ring_free_slots.push_back(slot);
+		});
+		// we can't push while reaping, as pushing may need to reap
+		for(size_t slot : resubmit)
+			ring_push(slot, ring_done_bytes[slot]);
+		if(!resubmit.empty())
+			ring.flush();
+		if(!done.empty()){
+			std::lock_guard<std::mutex> lock(completions_mutex);
+			pool_completions.insert(pool_completions.end(), done.begin(), done.end());
+		}
+		return done.size();
+	}
+#endif
+
+public:
+	IoExecutor(size_t n_threads_in=4, unsigned ring_entries_in=64)
+			: n_threads(n_threads_in)
+#ifdef VENOMOUS_IO_URING
+			, ring_entries(ring_entries_in)
+#endif
+			{}
+
+	~IoExecutor(){
+		{
+			std::lock_guard<std::mutex> lock(tasks_mutex);
+			stopping = true;
+		}
+		tasks_cv.notify_all();
+		for(auto& t : threads)
+			t.join();
+	}
+
+	void run(task_t task){
+		/* Runs task on one of the I/O threads, e.g. the body of a disk=True compute. */
+		{
+			std::lock_guard<std::mutex> lock(tasks_mutex);
+			start_threads();
+			tasks.push_back(std::move(task));
+			VENOMOUS_TRACE_COUNTER("io_queue", tasks.size());
+		}
+		tasks_cv.notify_one();
+	}
+
+	void submit_reads(ReadRequest const* begin, ReadRequest const* end){
+		/* Main thread only. */
+		n_in_flight += end - begin;
+#ifdef VENOMOUS_IO_URING
+		if(using_ring()){
+			for(; begin != end; ++begin){
+				size_t slot;
+				if(ring_free_slots.empty()){
+					slot = ring_in_flight.size();
+					ring_in_flight.push_back(*begin);
+					ring_done_bytes.push_back(0);
+				}else{
+					slot = ring_free_slots.back();
+					ring_free_slots.pop_back();
+					ring_in_flight[slot] = *begin;
+					ring_done_bytes[slot] = 0;
+				}
+				ring_push(slot, 0);
+			}
+			ring.flush();
+			return;
+		}
+#endif
+		for(; begin != end; ++begin){
+			ReadRequest r = *begin;
+			run([this, r]{
+				VENOMOUS_TRACE_SCOPE("io", "pread", int64_t(r.len));
+				complete_from_pool({r.tag, pread_fully(r)});
+			});
+		}
+	}
+
+	template<typename Foo>
+	size_t poll_completions(Foo foo){
+		/* Main thread only. Non-blocking, calls foo(ReadCompletion const&) for each
+		   read that has finished since the last call, and returns the count. */
+#ifdef VENOMOUS_IO_URING
+		if(ring_ok)
+			ring_reap();
+#endif
+		std::vector<ReadCompletion> done;
+		{
+			std::lock_guard<std::mutex> lock(completions_mutex);
+			done.swap(pool_completions);
+		}
+		for(auto const& c : done)
+			foo(c);
+		n_in_flight -= done.size();
+		return done.size();
+	}
+
+	template<typename Foo>
+	size_t wait_completions(Foo foo){
+		/* Main thread only. As poll_completions, but blocks until at least one
+		   read has finished (or returns 0 straight away if nothing is in flight). */
+		VENOMOUS_TRACE_SCOPE("io", "wait_completions", int64_t(n_in_flight));
+		while(n_in_flight > 0){
+#ifdef VENOMOUS_IO_URING
+			if(ring_ok){
+				ring.flush(1);
+			}else
+#endif
+			{
+				std::unique_lock<std::mutex> lock(completions_mutex);
+				completions_cv.wait(lock, [this]{ return !pool_completions.empty(); });
+			}
+			size_t n = poll_completions(foo);
+			if(n > 0)
+				return n;
+		}
+		return 0;
+	}
+
+	void notify_on_completion(int event_fd){
+		/* Main thread only, before submitting any reads. See the comment at the top. */
+		notify_fd = event_fd;
+#ifdef VENOMOUS_IO_URING
+		if(ring_ok && event_fd >= 0)
+			ring.register_eventfd(event_fd);
+#endif
+	}
+
+	size_t in_flight() const{
+		return n_in_flight;
+	}
+
+	bool uses_io_uring() const{
+#ifdef VENOMOUS_IO_URING
+		return ring_ok;
+#else
+		return false;
+#endif
+	}
+};
+
+
+#endif // _IO_EXECUTOR_H_
@@ -0,0 +1,777 @@
+/*
+	kernels namespace
+
+	The vectorised primitives that node code spends most of its time in:
+
+		hist / hist_masked - binned histograms, e.g. speed_dwell. Values are binned
+			as int(v / bin_size), anything outside [0, n_bins) is dropped, and counts
+			are *added* to h, so you can call it once per chunk.  The mask can be
+			bool[] or a BitMask, with a BitMask whole chunks that are all/none
+			masked skip the mask/the chunk.
+		hist_masked_delta - patches a hist_masked result for a change of mask within
+			a range of samples, e.g. speed_dwell's delta path when trial_time_slice moves.
+		in_range - lo < v < hi as a BitMask, e.g. the slices in pos_mask.
+		gather_sorted - out[i] = src[inds[i]] where inds is ascending, e.g.
+			speed.iter_sorted(group_pos_inds), also for a BitMask src as in spike_mask.
+		hypot_diff / atan2_diff - distance and direction between corresponding
+			points of two arrays, e.g. hypot_diff(xy+1, xy, n-1) for speed, and
+			atan2_diff(xy, xy+1, n-1) for dir_disp (same order as angle_ab).
+		hypot_from - distance from a fixed point, e.g. circular dist_to_boundary.
+		boundary_dist_rect - min of the four distances to the sides of a rect.
+
+	Points are the xml's point type, i.e. two int16s x then y, the kernels are
+	templated on it so that they don't need to know its name.  The point kernels
+	also take PointLanes, i.e. separate x and y arrays as in a chunk of a
+	layout="soa" array (see lanes(arr, c)), which is the faster form for SIMD as
+	x and y are loaded directly, rather than unpacked from interleaved pairs.
+
+	Each kernel has a scalar implementation and, on x86 with GCC/clang, an AVX2 one.
+	The AVX2 versions are compiled with __attribute__((target("avx2"))), so the rest
+	of the program doesn't need -mavx2, and which one runs is decided at run time
+	with __builtin_cpu_supports, once.  Define VENOMOUS_NO_SIMD to only ever use
+	scalar, or call kernels::use_simd(false), e.g. to compare the two.
+
+	Histograms use private sub-histograms, one per SIMD lane (or per unrolled
+	element in the scalar version), so that consecutive values falling in the
+	same bin (which is the usual case, speed changes slowly) don't serialise on
+	one counter.  They are summed into h at the end.  This costs lanes*n_bins of
+	scratch, which is on the stack when n_bins is small.
+
+	atan2 uses the same polynomial approximation in both paths (max error ~1e-5
+	rad), evaluated in the same order with the same roundings (no FMA, which is
+	why the AVX2 target doesn't include it), and likewise hypot, so results don't
+	depend on which machine computed them, which matters as they get cached.
+	That holds as long as the scalar path isn't contracted into FMAs either,
+	i.e. add -ffp-contract=off if building with -mfma or -march=native.  Like
+	angle_ab in sample.xml, atan2 is nan unless both |dx| and |dy| are over
+	0.001, which includes when either is nan.
+
+	TODO: AVX-512, NEON.
+*/
+
+#ifndef _KERNELS_H_
+#define _KERNELS_H_
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+
+#include "chunked_array.h"
+#include "bitmask.h"
+
+#if !defined(VENOMOUS_NO_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VENOMOUS_KERNELS_AVX2
+#include <immintrin.h>
+#endif
+
+
+namespace kernels{
+
+struct PointLanes{
+	/* the x's and y's of some points, e.g. a chunk of a ChunkedArray<point, N, SoA> */
+	int16_t const* x;
+	int16_t const* y;
+	PointLanes operator+(size_t i) const { return PointLanes{x + i, y + i}; }
+};
+
+template<typename P, size_t chunk_len>
+PointLanes lanes(ChunkedArray<P, chunk_len, SoA> const& arr, size_t c){
+	static_assert(ChunkedArray<P, chunk_len, SoA>::n_lanes == 2, "PointLanes are for {x, y} points");
+	return PointLanes{arr.clane(c, 0), arr.clane(c, 1)};
+}
+
+namespace impl{
+
+inline bool& simd_enabled(){
+#ifdef VENOMOUS_KERNELS_AVX2
+	static bool enabled = __builtin_cpu_supports("avx2");
+#else
+	static bool enabled = false;
+#endif
+	return enabled;
+}
+
+template<typename P>
+struct point_layout{
+	/* P must be {int16 x; int16 y;}, we read it as pairs of int16s */
+	static_assert(sizeof(P) == 2*sizeof(int16_t), "point must be two int16s");
+	static int16_t const* data(P const* p){
+		return reinterpret_cast<int16_t const*>(p);
+	}
+};
+
+// the lanes of the sub-histograms, and the most bins we keep them on the stack for
+const size_t hist_lanes = 8;
+const size_t hist_stack_bins = 512;
+
+template<typename Foo>
+void with_sub_hists(size_t n_bins, uint32_t* h, Foo foo){
+	/* calls foo(sub) with hist_lanes zeroed sub-histograms laid out one after
+	   the other, then adds them all into h. */
+	uint32_t stack_sub[hist_lanes*hist_stack_bins];
+	std::vector<uint32_t> heap_sub;
+	uint32_t* sub = stack_sub;
+	if(n_bins > hist_stack_bins){
+		heap_sub.resize(hist_lanes*n_bins);
+		sub = heap_sub.data();
+	}
+	std::fill(sub, sub + hist_lanes*n_bins, 0);
+	foo(sub);
+	for(size_t k=0; k<hist_lanes; k++)
+		for(size_t b=0; b<n_bins; b++)
+			h[b] += sub[k*n_bins + b];
+}
+
+/* The masks for the histograms: test(i) says whether sample i is included,
+   and in the AVX2 code load8_mask(mask, i) gives it for 8 lanes at once. */
+struct NoMask{
+	bool test(size_t) const { return true; }
+};
+
+struct BoolMask{
+	bool const* m;
+	bool test(size_t i) const { return m[i]; }
+};
+
+struct BitsMask{
+	uint64_t const* w; // a chunk of a BitMask
+	bool test(size_t i) const { return (w[i / 64] >> (i % 64)) & 1; }
+};
+
+template<typename T>
+inline bool bin_of(T v, float inv_bin_size, size_t n_bins, size_t& bin){
+	const float f = float(v) * inv_bin_size;
+	if(!(f >= 0.f && f < float(n_bins))) // also catches nan
+		return false;
+	bin = size_t(f);
+	return true;
+}
+
+template<typename T, typename Mask>
+void hist_scalar(T const* vals, Mask mask, size_t n, float inv_bin_size,
+				 size_t n_bins, uint32_t* h){
+	with_sub_hists(n_bins, h, [&](uint32_t* sub){
+		size_t bin, i = 0;
+		// branch free, as out of range/masked values are rare-ish and unpredictable
+		for(; i + hist_lanes <= n; i += hist_lanes)
+			for(size_t k=0; k<hist_lanes; k++){
+				const float f = float(vals[i + k]) * inv_bin_size;
+				const bool ok = mask.test(i + k) && f >= 0.f && f < float(n_bins);
+				sub[k*n_bins + (ok ? size_t(f) : 0)] += ok;
+			}
+		for(; i<n; i++)
+			if(mask.test(i) && bin_of(vals[i], inv_bin_size, n_bins, bin))
+				sub[bin]++;
+	});
+}
+
+inline float atan_poly(float x){
+	/* atan on [0, 1], Abramowitz & Stegun 4.4.49, |error| < 1e-5 */
+	const float x2 = x*x;
+	return x*(0.9998660f + x2*(-0.3302995f + x2*(0.1801410f + x2*(-0.0851330f + x2*0.0208351f))));
+}
+
+inline float atan2_approx(float y, float x){
+	const float ax = std::fabs(x), ay = std::fabs(y);
+	if(!(ax > 0.001f && ay > 0.001f)) // as angle_ab, also catches nan
+		return std::numeric_limits<float>::quiet_NaN();
+	const float pi = 3.14159265358979f;
+	float r = atan_poly(std::min(ax, ay) / std::max(ax, ay));
+	if(ay > ax) r = pi/2 - r;
+	if(x < 0.f) r = pi - r;
+	return y < 0.f ? -r : r;
+}
+
+template<typename T>
+void gather_sorted_scalar(T const* src, size_t base, uint32_t const* inds, size_t n, T* out){
+	for(size_t i=0; i<n; i++)
+		out[i] = src[inds[i] - base];
+}
+
+template<typename P, typename Foo>
+void for_each_point_pair(P const* a, P const* b, size_t n, float* out, Foo foo){
+	int16_t const* pa = point_layout<P>::data(a);
+	int16_t const* pb = point_layout<P>::data(b);
+	for(size_t i=0; i<n; i++)
+		out[i] = foo(float(pa[2*i]) - float(pb[2*i]), float(pa[2*i+1]) - float(pb[2*i+1]));
+}
+
+template<typename Foo>
+void for_each_point_pair(PointLanes a, PointLanes b, size_t n, float* out, Foo foo){
+	for(size_t i=0; i<n; i++)
+		out[i] = foo(float(a.x[i]) - float(b.x[i]), float(a.y[i]) - float(b.y[i]));
+}
+
+inline void boundary_dist_rect_scalar(PointLanes p, size_t n, float left, float top,
+									  float W, float H, float* out){
+	for(size_t i=0; i<n; i++){
+		const float x = p.x[i], y = p.y[i];
+		out[i] = std::min(std::min(x - left, left + W - x), std::min(y - top, top + H - y));
+	}
+}
+
+template<typename P>
+void boundary_dist_rect_scalar(P const* p, size_t n, float left, float top,
+							   float W, float H, float* out){
+	int16_t const* pp = point_layout<P>::data(p);
+	for(size_t i=0; i<n; i++){
+		const float x = pp[2*i], y = pp[2*i+1];
+		out[i] = std::min(std::min(x - left, left + W - x), std::min(y - top, top + H - y));
+	}
+}
+
+template<typename T>
+void in_range_scalar(T const* vals, size_t n, float lo, float hi, uint64_t* words){
+	/* one chunk of a BitMask, words must start zeroed past n */
+	for(size_t i=0; i<n; i += 64){
+		uint64_t w = 0;
+		for(size_t k=0; k<64 && i + k < n; k++){
+			const float v = float(vals[i + k]);
+			w |= uint64_t(v > lo && v < hi) << k;
+		}
+		words[i / 64] = w;
+	}
+}
+
+
+#ifdef VENOMOUS_KERNELS_AVX2
+#define VENOMOUS_AVX2 __attribute__((target("avx2"))) // not fma, see the top
+
+// ---- loading 8 values as floats
+
+VENOMOUS_AVX2 inline __m256 load8_ps(float const* v){
+	return _mm256_loadu_ps(v);
+}
+VENOMOUS_AVX2 inline __m256 load8_ps(int16_t const* v){
+	return _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(
+				_mm_loadu_si128(reinterpret_cast<__m128i const*>(v))));
+}
+VENOMOUS_AVX2 inline __m256 load8_ps(int32_t const* v){
+	return _mm256_cvtepi32_ps(_mm256_loadu_si256(reinterpret_cast<__m256i const*>(v)));
+}
+
+template<typename T>
+struct has_load8 : std::integral_constant<bool,
+	std::is_same<T, float>::value || std::is_same<T, int16_t>::value ||
+	std::is_same<T, int32_t>::value> {};
+
+// all-ones lanes where samples i to i+7 are included, i is a multiple of 8
+VENOMOUS_AVX2 inline __m256 load8_mask(NoMask, size_t){
+	return _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+}
+
+VENOMOUS_AVX2 inline __m256 load8_mask(BoolMask mask, size_t i){
+	int64_t bytes;
+	std::memcpy(&bytes, mask.m + i, 8);
+	__m256i m = _mm256_cvtepu8_epi32(_mm_cvtsi64_si128(bytes));
+	return _mm256_castsi256_ps(_mm256_cmpgt_epi32(m, _mm256_setzero_si256()));
+}
+
+VENOMOUS_AVX2 inline __m256 load8_mask(BitsMask mask, size_t i){
+	const int byte = int((mask.w[i / 64] >> (i % 64)) & 0xff);
+	const __m256i lane_bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+	__m256i m = _mm256_and_si256(_mm256_set1_epi32(byte), lane_bits);
+	return _mm256_castsi256_ps(_mm256_cmpeq_epi32(m, lane_bits));
+}
+
+VENOMOUS_AVX2 inline void load8_points(int16_t const* p, __m256& x, __m256& y){
+	/* 8 points are 16 int16s, i.e. each 32-bit lane is one point with x in the low half */
+	__m256i v = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(p));
+	x = _mm256_cvtepi32_ps(_mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16));
+	y = _mm256_cvtepi32_ps(_mm256_srai_epi32(v, 16));
+}
+
+template<typename T, typename Mask>
+VENOMOUS_AVX2 void hist_avx2(T const* vals, Mask mask, size_t n, float inv_bin_size,
+							 size_t n_bins, uint32_t* h){
+	with_sub_hists(n_bins, h, [&](uint32_t* sub) VENOMOUS_AVX2 {
+		const __m256 inv = _mm256_set1_ps(inv_bin_size);
+		const __m256 lo = _mm256_setzero_ps();
+		const __m256 hi = _mm256_set1_ps(float(n_bins));
+		// lane k adds to sub-histogram k, so lanes never conflict
+		const __m256i lane_offset = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+													   _mm256_set1_epi32(int(n_bins)));
+		alignas(32) int32_t idx[hist_lanes];
+		size_t i = 0;
+		for(; i + hist_lanes <= n; i += hist_lanes){
+			__m256 f = _mm256_mul_ps(load8_ps(vals + i), inv);
+			__m256 ok = _mm256_and_ps(_mm256_cmp_ps(f, lo, _CMP_GE_OQ), _mm256_cmp_ps(f, hi, _CMP_LT_OQ));
+			ok = _mm256_and_ps(ok, load8_mask(mask, i));
+			int ok_bits = _mm256_movemask_ps(ok);
+			if(ok_bits == 0)
+				continue;
+			_mm256_store_si256(reinterpret_cast<__m256i*>(idx),
+							   _mm256_add_epi32(_mm256_cvttps_epi32(f), lane_offset));
+			if(ok_bits == 0xff){
+				for(size_t k=0; k<hist_lanes; k++)
+					sub[idx[k]]++;
+			}else{
+				for(size_t k=0; k<hist_lanes; k++)
+					if(ok_bits & (1 << k))
+						sub[idx[k]]++;
+			}
+		}
+		size_t bin;
+		for(; i<n; i++)
+			if(mask.test(i) && bin_of(vals[i], inv_bin_size, n_bins, bin))
+				sub[bin]++;
+	});
+}
+
+template<typename T>
+VENOMOUS_AVX2 void gather_sorted_avx2(T const* src, size_t base, uint32_t const* inds,
+									  size_t n, T* out){
+	/* 4 byte types only. inds are ascending, so the source addresses are too,
+	   and the hardware prefetcher mostly keeps up, we just help it a bit further on. */
+	static_assert(sizeof(T) == 4, "gather_sorted_avx2 is for 4 byte types");
+	const __m256i b = _mm256_set1_epi32(int32_t(base));
+	int const* s = reinterpret_cast<int const*>(src);
+	const size_t prefetch_dist = 64;
+	size_t i = 0;
+	for(; i + 8 <= n; i += 8){
+		if(i + prefetch_dist < n)
+			_mm_prefetch(reinterpret_cast<char const*>(src + (inds[i + prefetch_dist] - base)), _MM_HINT_T0);
+		__m256i ix = _mm256_sub_epi32(_mm256_loadu_si256(reinterpret_cast<__m256i const*>(inds + i)), b);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_i32gather_epi32(s, ix, 4));
+	}
+	for(; i<n; i++)
+		out[i] = src[inds[i] - base];
+}
+
+VENOMOUS_AVX2 inline __m256 hypot8(__m256 dx, __m256 dy){
+	return _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)));
+}
+
+VENOMOUS_AVX2 inline __m256 atan2_8(__m256 y, __m256 x){
+	/* same steps as atan2_approx, but branch free */
+	const __m256 sign = _mm256_set1_ps(-0.f);
+	const __m256 ax = _mm256_andnot_ps(sign, x), ay = _mm256_andnot_ps(sign, y);
+	const __m256 mx = _mm256_max_ps(ax, ay), mn = _mm256_min_ps(ax, ay);
+	const __m256 t = _mm256_div_ps(mn, mx);
+	const __m256 t2 = _mm256_mul_ps(t, t);
+	__m256 r = _mm256_add_ps(_mm256_mul_ps(t2, _mm256_set1_ps(0.0208351f)), _mm256_set1_ps(-0.0851330f));
+	r = _mm256_add_ps(_mm256_mul_ps(t2, r), _mm256_set1_ps(0.1801410f));
+	r = _mm256_add_ps(_mm256_mul_ps(t2, r), _mm256_set1_ps(-0.3302995f));
+	r = _mm256_add_ps(_mm256_mul_ps(t2, r), _mm256_set1_ps(0.9998660f));
+	r = _mm256_mul_ps(t, r);
+	const __m256 pi = _mm256_set1_ps(3.14159265358979f);
+	r = _mm256_blendv_ps(r, _mm256_sub_ps(_mm256_mul_ps(pi, _mm256_set1_ps(0.5f)), r),
+						 _mm256_cmp_ps(ay, ax, _CMP_GT_OQ));
+	r = _mm256_blendv_ps(r, _mm256_sub_ps(pi, r), _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_LT_OQ));
+	r = _mm256_blendv_ps(r, _mm256_sub_ps(_mm256_setzero_ps(), r), _mm256_cmp_ps(y, _mm256_setzero_ps(), _CMP_LT_OQ));
+	// as angle_ab, nan unless both are over 0.001 (the compares are false for nan)
+	const __m256 eps = _mm256_set1_ps(0.001f);
+	const __m256 ok = _mm256_and_ps(_mm256_cmp_ps(ax, eps, _CMP_GT_OQ), _mm256_cmp_ps(ay, eps, _CMP_GT_OQ));
+	return _mm256_blendv_ps(_mm256_set1_ps(std::numeric_limits<float>::quiet_NaN()), r, ok);
+}
+
+struct Hypot8{
+	VENOMOUS_AVX2 __m256 operator()(__m256 dx, __m256 dy) const { return hypot8(dx, dy); }
+};
+
+struct Atan2Neg8{
+	// the pairs give a - b, and we want the direction from a to b
+	VENOMOUS_AVX2 __m256 operator()(__m256 dx, __m256 dy) const {
+		const __m256 sign = _mm256_set1_ps(-0.f);
+		return atan2_8(_mm256_xor_ps(dy, sign), _mm256_xor_ps(dx, sign));
+	}
+};
+
+template<typename Foo, typename Fallback>
+VENOMOUS_AVX2 void for_each_point_pair_avx2(int16_t const* pa, int16_t const* pb, size_t n,
+											float* out, Foo foo, Fallback fallback){
+	size_t i = 0;
+	for(; i + 8 <= n; i += 8){
+		__m256 ax, ay, bx, by;
+		load8_points(pa + 2*i, ax, ay);
+		load8_points(pb + 2*i, bx, by);
+		_mm256_storeu_ps(out + i, foo(_mm256_sub_ps(ax, bx), _mm256_sub_ps(ay, by)));
+	}
+	for(; i<n; i++)
+		out[i] = fallback(float(pa[2*i]) - float(pb[2*i]), float(pa[2*i+1]) - float(pb[2*i+1]));
+}
+
+template<typename Foo, typename Fallback>
+VENOMOUS_AVX2 void for_each_point_pair_avx2(PointLanes a, PointLanes b, size_t n,
+											float* out, Foo foo, Fallback fallback){
+	/* as above, but no unpacking */
+	size_t i = 0;
+	for(; i + 8 <= n; i += 8)
+		_mm256_storeu_ps(out + i, foo(_mm256_sub_ps(load8_ps(a.x + i), load8_ps(b.x + i)),
+									  _mm256_sub_ps(load8_ps(a.y + i), load8_ps(b.y + i))));
+	for(; i<n; i++)
+		out[i] = fallback(float(a.x[i]) - float(b.x[i]), float(a.y[i]) - float(b.y[i]));
+}
+
+VENOMOUS_AVX2 inline void boundary_dist_rect_avx2(PointLanes p, size_t n, float left, float top,
+												  float W, float H, float* out){
+	const __m256 l = _mm256_set1_ps(left), r = _mm256_set1_ps(left + W);
+	const __m256 t = _mm256_set1_ps(top), b = _mm256_set1_ps(top + H);
+	size_t i = 0;
+	for(; i + 8 <= n; i += 8){
+		const __m256 x = load8_ps(p.x + i), y = load8_ps(p.y + i);
+		__m256 d = _mm256_min_ps(_mm256_min_ps(_mm256_sub_ps(x, l), _mm256_sub_ps(r, x)),
+								 _mm256_min_ps(_mm256_sub_ps(y, t), _mm256_sub_ps(b, y)));
+		_mm256_storeu_ps(out + i, d);
+	}
+	boundary_dist_rect_scalar(p + i, n - i, left, top, W, H, out + i);
+}
+
+template<typename P>
+VENOMOUS_AVX2 void boundary_dist_rect_avx2(P const* p, size_t n, float left, float top,
+										   float W, float H, float* out){
+	int16_t const* pp = point_layout<P>::data(p);
+	const __m256 l = _mm256_set1_ps(left), r = _mm256_set1_ps(left + W);
+	const __m256 t = _mm256_set1_ps(top), b = _mm256_set1_ps(top + H);
+	size_t i = 0;
+	for(; i + 8 <= n; i += 8){
+		__m256 x, y;
+		load8_points(pp + 2*i, x, y);
+		__m256 d = _mm256_min_ps(_mm256_min_ps(_mm256_sub_ps(x, l), _mm256_sub_ps(r, x)),
+								 _mm256_min_ps(_mm256_sub_ps(y, t), _mm256_sub_ps(b, y)));
+		_mm256_storeu_ps(out + i, d);
+	}
+	boundary_dist_rect_scalar(p + i, n - i, left, top, W, H, out + i);
+}
+
+template<typename T>
+VENOMOUS_AVX2 void in_range_avx2(T const* vals, size_t n, float lo, float hi, uint64_t* words){
+	const __m256 l = _mm256_set1_ps(lo), h = _mm256_set1_ps(hi);
+	size_t i = 0;
+	for(; i + 64 <= n; i += 64){
+		uint64_t w = 0;
+		for(size_t k=0; k<64; k += 8){
+			__m256 v = load8_ps(vals + i + k);
+			__m256 ok = _mm256_and_ps(_mm256_cmp_ps(v, l, _CMP_GT_OQ), _mm256_cmp_ps(v, h, _CMP_LT_OQ));
+			w |= uint64_t(_mm256_movemask_ps(ok)) << k;
+		}
+		words[i / 64] = w;
+	}
+	in_range_scalar(vals + i, n - i, lo, hi, words + i / 64);
+}
+
+#undef VENOMOUS_AVX2
+#endif // VENOMOUS_KERNELS_AVX2
+
+
+template<typename T, typename Mask>
+void hist_dispatch(std::true_type /* has avx2 version */, T const* vals, Mask mask,
+				   size_t n, float inv_bin_size, size_t n_bins, uint32_t* h){
+#ifdef VENOMOUS_KERNELS_AVX2
+	if(simd_enabled())
+		return hist_avx2(vals, mask, n, inv_bin_size, n_bins, h);
+#endif
+	hist_scalar(vals, mask, n, inv_bin_size, n_bins, h);
+}
+
+template<typename T, typename Mask>
+void hist_dispatch(std::false_type /* scalar only */, T const* vals, Mask mask,
+				   size_t n, float inv_bin_size, size_t n_bins, uint32_t* h){
+	hist_scalar(vals, mask, n, inv_bin_size, n_bins, h);
+}
+
+template<typename T>
+void in_range_dispatch(std::true_type /* has avx2 version */, T const* vals, size_t n,
+					   float lo, float hi, uint64_t* words){
+#ifdef VENOMOUS_KERNELS_AVX2
+	if(simd_enabled())
+		return in_range_avx2(vals, n, lo, hi, words);
+#endif
+	in_range_scalar(vals, n, lo, hi, words);
+}
+
+template<typename T>
+void in_range_dispatch(std::false_type /* scalar only */, T const* vals, size_t n,
+					   float lo, float hi, uint64_t* words){
+	in_range_scalar(vals, n, lo, hi, words);
+}
+
+#ifdef VENOMOUS_KERNELS_AVX2
+template<typename T>
+using has_hist_avx2 = has_load8<T>;
+#else
+template<typename T>
+using has_hist_avx2 = std::false_type;
+#endif
+
+template<typename T>
+void gather_dispatch(std::true_type /* 4 byte T */, T const* src, size_t base,
+					 uint32_t const* inds, size_t n, T* out){
+#ifdef VENOMOUS_KERNELS_AVX2
+	if(simd_enabled())
+		return gather_sorted_avx2(src, base, inds, n, out);
+#endif
+	gather_sorted_scalar(src, base, inds, n, out);
+}
+
+template<typename T>
+void gather_dispatch(std::false_type /* other T */, T const* src, size_t base,
+					 uint32_t const* inds, size_t n, T* out){
+	gather_sorted_scalar(src, base, inds, n, out);
+}
+
+} // namespace impl
+
+
+inline bool use_simd(bool enable){
+	/* returns whether SIMD is now in use, i.e. false if it isn't available */
+#ifdef VENOMOUS_KERNELS_AVX2
+	impl::simd_enabled() = enable && __builtin_cpu_supports("avx2");
+#endif
+	return impl::simd_enabled();
+}
+
+inline char const* isa(){
+	return impl::simd_enabled() ? "avx2" : "scalar";
+}
+
+// ---- histograms
+
+template<typename T>
+void hist(T const* vals, size_t n, float bin_size, size_t n_bins, uint32_t* h){
+	impl::hist_dispatch(impl::has_hist_avx2<T>(), vals, impl::NoMask(), n, 1.f/bin_size, n_bins, h);
+}
+
+template<typename T>
+void hist_masked(T const* vals, bool const* mask, size_t n, float bin_size,
+				 size_t n_bins, uint32_t* h){
+	impl::hist_dispatch(impl::has_hist_avx2<T>(), vals, impl::BoolMask{mask}, n, 1.f/bin_size, n_bins, h);
+}
+
+template<typename T, size_t chunk_len>
+std::vector<uint32_t> hist(ChunkedArray<T, chunk_len> const& vals, float bin_size, size_t n_bins){
+	std::vector<uint32_t> h(n_bins, 0);
+	for(size_t c=0; c<vals.n_chunks(); c++)
+		hist(vals.cchunk(c), vals.chunk_size(c), bin_size, n_bins, h.data());
+	return h;
+}
+
+template<typename T, size_t chunk_len>
+std::vector<uint32_t> hist_masked(ChunkedArray<T, chunk_len> const& vals,
+								  ChunkedArray<bool, chunk_len> const& mask,
+								  float bin_size, size_t n_bins){
+	assert(mask.length() == vals.length());
+	std::vector<uint32_t> h(n_bins, 0);
+	for(size_t c=0; c<vals.n_chunks(); c++)
+		hist_masked(vals.cchunk(c), mask.cchunk(c), vals.chunk_size(c), bin_size, n_bins, h.data());
+	return h;
+}
+
+template<typename T, size_t chunk_len>
+std::vector<uint32_t> hist_masked(ChunkedArray<T, chunk_len> const& vals,
+								  BitMask<chunk_len> const& mask,
+								  float bin_size, size_t n_bins){
+	assert(mask.length() == vals.length());
+	std::vector<uint32_t> h(n_bins, 0);
+	for(size_t c=0; c<vals.n_chunks(); c++){
+		switch(mask.chunk_summary(c)){
+		case LogicalSummary::none:
+			break;
+		case LogicalSummary::all:
+			hist(vals.cchunk(c), vals.chunk_size(c), bin_size, n_bins, h.data());
+			break;
+		case LogicalSummary::mixture:
+			impl::hist_dispatch(impl::has_hist_avx2<T>(), vals.cchunk(c), impl::BitsMask{mask.cchunk_words(c)},
+								vals.chunk_size(c), 1.f/bin_size, n_bins, h.data());
+			break;
+		}
+	}
+	return h;
+}
+
+template<typename T, size_t chunk_len>
+void hist_masked_delta(ChunkedArray<T, chunk_len> const& vals, BitMask<chunk_len> const& old_mask,
+					   BitMask<chunk_len> const& new_mask, size_t begin, size_t end,
+					   float bin_size, std::vector<uint32_t>& h){
+	/* Turns h = hist_masked(vals, old_mask, ...) into hist_masked(vals, new_mask, ...),
+	   given that the masks only differ within [begin, end).  It only reads the mask
+	   words in that range, and the values where the masks differ, so it costs
+	   (end - begin)/64 plus the number of changed samples. */
+	assert(old_mask.length() == vals.length() && new_mask.length() == vals.length());
+	end = std::min(end, vals.length());
+	const float inv_bin_size = 1.f/bin_size;
+	size_t bin;
+	for(size_t c = begin / chunk_len; begin < end && c*chunk_len < end; c++){
+		const size_t j0 = begin > c*chunk_len ? begin - c*chunk_len : 0;
+		const size_t j1 = std::min(vals.chunk_size(c), end - c*chunk_len);
+		uint64_t const* o = old_mask.cchunk_words(c);
+		uint64_t const* w = new_mask.cchunk_words(c);
+		T const* v = vals.cchunk(c);
+		for(size_t k = j0 / 64; k*64 < j1; k++){
+			uint64_t in_range = ~uint64_t(0);
+			if(k*64 < j0)
+				in_range &= ~uint64_t(0) << (j0 % 64);
+			if((k + 1)*64 > j1)
+				in_range &= (uint64_t(1) << (j1 % 64)) - 1;
+			for(uint64_t added = w[k] & ~o[k] & in_range; added != 0; added &= added - 1)
+				if(impl::bin_of(v[k*64 + __builtin_ctzll(added)], inv_bin_size, h.size(), bin))
+					h[bin]++;
+			for(uint64_t removed = o[k] & ~w[k] & in_range; removed != 0; removed &= removed - 1)
+				if(impl::bin_of(v[k*64 + __builtin_ctzll(removed)], inv_bin_size, h.size(), bin))
+					h[bin]--;
+		}
+	}
+}
+
+template<typename T, size_t chunk_len>
+void in_range(ChunkedArray<T, chunk_len> const& vals, T lo, T hi, BitMask<chunk_len>& out){
+	/* out[i] = lo < vals[i] < hi, strictly, as in pos_mask. */
+	out.allocate(vals.length());
+	for(size_t c=0; c<vals.n_chunks(); c++){
+		impl::in_range_dispatch(impl::has_hist_avx2<T>(), vals.cchunk(c), vals.chunk_size(c),
+								float(lo), float(hi), out.chunk_words(c));
+		out.recount(c);
+	}
+}
+
+// ---- gathers
+
+template<typename T>
+void gather_sorted(T const* src, uint32_t const* inds, size_t n, T* out){
+	impl::gather_dispatch(std::integral_constant<bool, sizeof(T) == 4>(), src, 0, inds, n, out);
+}
+
+template<typename T, size_t chunk_len>
+void gather_sorted(ChunkedArray<T, chunk_len> const& src, uint32_t const* inds, size_t n, T* out){
+	/* As inds is sorted, it splits into runs that fall in the same chunk, and
+	   each run is a plain gather from that chunk's data. */
+	assert(std::is_sorted(inds, inds + n));
+	size_t i = 0;
+	while(i < n){
+		const size_t c = inds[i] / chunk_len;
+		const size_t chunk_end = (c + 1) * chunk_len;
+		const size_t run_end = std::lower_bound(inds + i, inds + n, chunk_end) - inds;
+		impl::gather_dispatch(std::integral_constant<bool, sizeof(T) == 4>(),
+							  src.cchunk(c), c*chunk_len, inds + i, run_end - i, out + i);
+		i = run_end;
+	}
+}
+
+template<typename T, size_t chunk_len, size_t inds_chunk_len>
+void gather_sorted(ChunkedArray<T, chunk_len> const& src,
+				   ChunkedArray<uint32_t, inds_chunk_len> const& inds,
+				   ChunkedArray<T, inds_chunk_len>& out){
+	/* the form node code uses, out is allocated to match inds */
+	out.allocate(inds.length());
+	for(size_t c=0; c<inds.n_chunks(); c++)
+		gather_sorted(src, inds.cchunk(c), inds.chunk_size(c), out.chunk_data(c));
+}
+
+template<size_t chunk_len, size_t inds_chunk_len>
+void gather_sorted(BitMask<chunk_len> const& src,
+				   ChunkedArray<uint32_t, inds_chunk_len> const& inds,
+				   BitMask<inds_chunk_len>& out){
+	/* out[i] = src[inds[i]], e.g. spike_mask from pos_mask. If src is all/none
+	   we don't need to look at inds at all, otherwise we only look up bits in
+	   the "mixture" chunks of src. */
+	const LogicalSummary s = src.summary();
+	out.allocate(inds.length(), s == LogicalSummary::all);
+	if(s != LogicalSummary::mixture)
+		return;
+	for(size_t c=0; c<inds.n_chunks(); c++){
+		uint32_t const* ind = inds.cchunk(c);
+		uint64_t* w = out.chunk_words(c);
+		for(size_t j=0; j<inds.chunk_size(c); j++){
+			const size_t src_c = ind[j] / chunk_len;
+			const LogicalSummary cs = src.chunk_summary(src_c);
+			const bool bit = cs == LogicalSummary::all ||
+							(cs == LogicalSummary::mixture && src[ind[j]]);
+			w[j / 64] |= uint64_t(bit) << (j % 64);
+		}
+		out.recount(c);
+	}
+}
+
+// ---- points
+
+template<typename P>
+void hypot_diff(P const* a, P const* b, size_t n, float* out){
+	auto scalar = [](float dx, float dy){ return std::sqrt(dx*dx + dy*dy); };
+#ifdef VENOMOUS_KERNELS_AVX2
+	if(impl::simd_enabled())
+		return impl::for_each_point_pair_avx2(impl::point_layout<P>::data(a), impl::point_layout<P>::data(b),
+						n, out, impl::Hypot8(), scalar);
+#endif
+	impl::for_each_point_pair(a, b, n, out, scalar);
+}
+
+template<typename P>
+void atan2_diff(P const* a, P const* b, size_t n, float* out){
+	/* out[i] is the direction from a[i] to b[i], like angle_ab(a[i], b[i]) */
+	auto scalar = [](float dx, float dy){ return impl::atan2_approx(-dy, -dx); };
+#ifdef VENOMOUS_KERNELS_AVX2
+	if(impl::simd_enabled())
+		return impl::for_each_point_pair_avx2(impl::point_layout<P>::data(a), impl::point_layout<P>::data(b),
+						n, out, impl::Atan2Neg8(), scalar);
+#endif
+	impl::for_each_point_pair(a, b, n, out, scalar);
+}
+
+inline void hypot_diff(PointLanes a, PointLanes b, size_t n, float* out){
+	auto scalar = [](float dx, float dy){ return std::sqrt(dx*dx + dy*dy); };
+#ifdef VENOMOUS_KERNELS_AVX2
+	if(impl::simd_enabled())
+		return impl::for_each_point_pair_avx2(a, b, n, out, impl::Hypot8(), scalar);
+#endif
+	impl::for_each_point_pair(a, b, n, out, scalar);
+}
+
+inline void atan2_diff(PointLanes a, PointLanes b, size_t n, float* out){
+	auto scalar = [](float dx, float dy){ return impl::atan2_approx(-dy, -dx); };
+#ifdef VENOMOUS_KERNELS_AVX2
+	if(impl::simd_enabled())
+		return impl::for_each_point_pair_avx2(a, b, n, out, impl::Atan2Neg8(), scalar);
+#endif
+	impl::for_each_point_pair(a, b, n, out, scalar);
+}
+
+template<typename P>
+void hypot_from(P const* p, size_t n, P centre, float* out){
+	/* this is hypot_diff against a repeated point, so we just reuse that in blocks */
+	const size_t block = 256;
+	P centres[block];
+	std::fill(centres, centres + block, centre);
+	for(size_t i=0; i<n; i += block)
+		hypot_diff(p + i, centres, std::min(block, n - i), out + i);
+}
+
+template<typename P>
+void boundary_dist_rect(P const* p, size_t n, P topleft, float W, float H, float* out){
+	int16_t const* tl = impl::point_layout<P>::data(&topleft);
+#ifdef VENOMOUS_KERNELS_AVX2
+	if(impl::simd_enabled())
+		return impl::boundary_dist_rect_avx2(p, n, tl[0], tl[1], W, H, out);
+#endif
+	impl::boundary_dist_rect_scalar(p, n, tl[0], tl[1], W, H, out);
+}
+
+template<typename P>
+void hypot_from(PointLanes p, size_t n, P centre, float* out){
+	const size_t block = 256;
+	int16_t const* c = impl::point_layout<P>::data(&centre);
+	int16_t cx[block], cy[block];
+	std::fill(cx, cx + block, c[0]);
+	std::fill(cy, cy + block, c[1]);
+	for(size_t i=0; i<n; i += block)
+		hypot_diff(p + i, PointLanes{cx, cy}, std::min(block, n - i), out + i);
+}
+
+template<typename P>
+void boundary_dist_rect(PointLanes p, size_t n, P topleft, float W, float H, float* out){
+	int16_t const* tl = impl::point_layout<P>::data(&topleft);
+#ifdef VENOMOUS_KERNELS_AVX2
+	if(impl::simd_enabled())
+		return impl::boundary_dist_rect_avx2(p, n, tl[0], tl[1], W, H, out);
+#endif
+	impl::boundary_dist_rect_scalar(p, n, tl[0], tl[1], W, H, out);
+}
+
+
+} // namespace kernels
+
+
+#endif // _KERNELS_H_
@@ -4,21 +4,30 @@
 	stores:  [header] [key] [padding] [value]
 	        | fixed  |     fixed total       |
 
-	It is cache-line aligned, hard-coded at 64bytes, this means its length is also
-	a multiple of cache line in length.  The padding is calculated so as to align
-	the value to its required alignment (which must be compatible with the KVP 
-	overal alignment, i.e. if KVP is 64B-cache-line aligned, value can be
-	1,2,4,8,16,32, or 64 aligned, but nothing larger.) 
+	Its total length is exactly slot_len bytes, which is either a power of 2
+	below the cache line (16 or 32), in which case it is also aligned to
+	slot_len, so several KVPs share a line without any straddling it, or a
+	multiple of the cache line, in which case it is cache-line aligned.  This
+	is what lets the store keep small KVPs in small slots, see SlotClassStore.
+	The padding is calculated so as to align the value to its required
+	alignment (which must be compatible with the KVP overal alignment, i.e. if
+	KVP is 16B aligned, value can be 1,2,4,8, or 16 aligned, but nothing
+	larger.)  Use fits<Q>() to check that a given Q fits in slot_len.
+
+	The key starts right after the header (as_u8_array is aligned to the header,
+	so the compiler can't tuck it into the header's tail padding), which is what
+	offset_for_value assumes.
 
 	header is of fixed size, and key is an array of
-	key_element_t, with length given by value::accompanying_key_n.
+	key_element_t, with length given by utils::key_length<value> (i.e. value::accompanying_key_n,
+	or derived from value::upstream, see tmp_utils.h).
 
 	The header has a type_id() method which is aliased to key_prefix(). This
 	is considered to be part of the key, the other header data is bitflags that
 	record state of the value and thread-wise locks.
 
-	The class is templated on the list of value types (and the 
-	header implementation).
+	The class is templated on the slot length and the list of value types (and
+	the header implementation).
 
 	You can move/copy construct KeyValuePairs, but generally
 	you will default construct, which puts the header into a "null"
@@ -60,8 +69,13 @@
 		safe_to_read - checks whether a lock bit is set for current thread
 						or no-op on main thread
 		main_thread_only_ref - checks whether no threads (apart from main) 
-						are currently safe to read, i.e. is main safe to
-						destruct/move/copy etc.?
+						can currently be reading, i.e. is main safe to
+						destruct/move/copy etc.? i.e. it's not retired and no
+						epoch is pinned, see epoch.h.
+		is_retired - deleted, but the value may still be being read, so it
+					can't be found or moved, see unordered_map::delete_.
+		is_provisional/is_pending - an approximate value, or one whose node
+					hasn't finished yet, see Engine::publish and Engine::emplace.
 	The header is probably a 64bit atomic thing, as most of its state is
 	used in an atomic-neccessary way (including aquire/release semantics)
 	but the total amount of state should fit in 64 bits really.
@@ -86,6 +100,7 @@
 #include <type_traits>
 
 #include "tmp_utils.h"
+#include "epoch.h"
 
 
 namespace key_value_pair_impl{
@@ -116,7 +131,7 @@ constexpr size_t offset_for_value(){
 			      "key_element_t alignment requires padding after header_t"); // can relax this if we are careful below
 
 	return	utils::round_length_to_alignment(
-				sizeof(typename KVP::key_element_t_) * Q::accompanying_key_n,
+				sizeof(typename KVP::key_element_t_) * utils::key_length<Q>::value,
 				alignof(Q),
 				sizeof(typename KVP::header_t_),
 				KVP::minimum_alignment);
@@ -135,7 +150,12 @@ struct alignas(8) KeyValueHeader{
 	static const type_id_t tombstone = -2;
 
 	type_id_t _type_id = null; 
-	uint8_t _is_constructed = 0; // todo this is really supposed to be a bit field
+	uint8_t _is_constructed : 1;
+	uint8_t _is_provisional : 1; // see Engine::publish
+	uint8_t _is_retired : 1; // see unordered_map::delete_
+	uint8_t _is_pending : 1; // see Engine::emplace
+
+	KeyValueHeader() : _is_constructed(0), _is_provisional(0), _is_retired(0), _is_pending(0) {}
 		
 	bool is_constructed() const{
 		return _is_constructed; // probably need an atomic aquire here
@@ -145,8 +165,32 @@ struct alignas(8) KeyValueHeader{
 		_is_constructed = value;
 		// TODO: probably need an atomic_release here
 	}
+	bool is_provisional() const{
+		return _is_provisional;
+	}
+	void set_provisional(bool value){
+		assert(is_valid_type());
+		_is_provisional = value;
+	}
+	bool is_pending() const{
+		return _is_pending;
+	}
+	void set_pending(bool value){
+		assert(is_valid_type());
+		_is_pending = value;
+	}
+	bool is_retired() const{
+		return _is_retired;
+	}
+	void retire(){
+		assert(is_valid_type());
+		_is_retired = 1;
+	}
 	void destruct_to_tombstone() {
 		_is_constructed = 0;
+		_is_provisional = 0;
+		_is_retired = 0;
+		_is_pending = 0;
 		_type_id = tombstone;
 	}
 	void tombstone_to_null(){
@@ -171,7 +215,8 @@ struct alignas(8) KeyValueHeader{
 		return true; // TODO: implement thread-wise bit fields indicating read lock reference.
 	}
 	bool main_thread_only_ref() const{
-		return true; // TODO: when we have thread-wise bit fields, check all are zero apart from main thread
+		// readers don't say what they are reading, only that they might be
+		return !_is_retired && Epochs::get().n_pinned() == 0;
 	}
 	auto type_id() const{
 		return _type_id; 
@@ -180,20 +225,28 @@ struct alignas(8) KeyValueHeader{
 
 const size_t CACHE_LINE_LEN = 64;
 
+constexpr size_t alignment_for_slot_len(size_t slot_len){
+	return slot_len < CACHE_LINE_LEN ? slot_len : CACHE_LINE_LEN;
+}
+
 // header_t basically has to be KeyValueHeader class above, or similar
-template<typename header_t, typename key_element_t, typename ...Qs>
+template<typename header_t, typename key_element_t, size_t slot_len, typename ...Qs>
 class 
-alignas(CACHE_LINE_LEN /*see minimum_alignment below*/) 
+alignas(alignment_for_slot_len(slot_len) /*see minimum_alignment below*/) 
 KeyValuePair : public header_t {
 	public:
-	static const size_t minimum_alignment = CACHE_LINE_LEN;
+	static const size_t minimum_alignment = alignment_for_slot_len(slot_len);
+	static const size_t slot_len_ = slot_len;
 
+	static_assert(utils::is_pow_2(slot_len) ? slot_len > sizeof(header_t) : slot_len % CACHE_LINE_LEN == 0,
+				  "slot_len should be a power of 2, or a multiple of the cache line.");
 	static_assert(std::is_pod<key_element_t>::value, 
 				  "key_element_t should be POD."); // could maybe relax this
-	using self_t = KeyValuePair<header_t, key_element_t, Qs...>; //convenience
+	using self_t = KeyValuePair<header_t, key_element_t, slot_len, Qs...>; //convenience
 	using header_t_ = header_t;
 	using key_prefix_t = typename header_t::type_id_t;
 	using key_element_t_ = key_element_t; //note that this is the type within the array, not the array itself
+	static const size_t n_types = sizeof...(Qs); // key prefixes are [0, n_types)
 	using dtor_t = void(*)(self_t&);
 	using mvctor_t = void(*)(self_t&, self_t&&);
 	using cpctor_t = void(*)(self_t&, self_t const&);
@@ -202,12 +255,20 @@ KeyValuePair : public header_t {
 	const static std::array<mvctor_t, sizeof...(Qs)> mvctor_vtable; 
 	const static std::array<cpctor_t, sizeof...(Qs)> cpctor_vtable; 
 	const static std::array<size_t, sizeof...(Qs)> key_length_table; // note this doesn't dictate offset for value due to alignment issues
+	const static std::array<bool, sizeof...(Qs)> fits_table;
 	
-	const static size_t max_len_key_and_value = utils::max_element<key_value_pair_impl::
-										length_for_key_and_value<Qs, self_t>()...>();
-	std::array<uint8_t, max_len_key_and_value> as_u8_array; 
+	const static size_t max_len_key_and_value = slot_len - sizeof(header_t);
+	alignas(alignof(header_t)) std::array<uint8_t, max_len_key_and_value> as_u8_array; 
+
+	template<typename Q>
+	constexpr static bool fits(){
+		// the alignment check comes first, as offset_for_value requires it
+		return alignof(Q) <= minimum_alignment &&
+			   key_value_pair_impl::length_for_key_and_value<Q, self_t>() <= max_len_key_and_value;
+	}
 
 	KeyValuePair() {
+		static_assert(sizeof(self_t) == slot_len, "header_t should fit before as_u8_array without padding.");
 		assert(header_t::is_null() && !header_t::is_constructed());
 	}
 
@@ -248,7 +309,8 @@ KeyValuePair : public header_t {
 
 	void destruct_to_tombstone(){
 		// TODO: assert(is_on_main_thread);
-		assert(header_t::main_thread_only_ref());
+		// retired KVPs are only destroyed once their epoch is safe, see unordered_map::reclaim
+		assert(header_t::is_retired() || header_t::main_thread_only_ref());
 
 		if(header_t::is_valid_type() && header_t::is_constructed())
 			dtor_vtable[header_t::type_id()](*this);
@@ -257,7 +319,7 @@ KeyValuePair : public header_t {
 
 	void tombstone_to_null(){
 		// TODO: assert(is_on_main_thread)
-		assert(header_t::main_thread_only_ref());
+		// no need for main_thread_only_ref, a tombstone has no value to be read
 		assert(header_t::is_tombstone());
 		header_t::tombstone_to_null();
 	}
@@ -268,6 +330,7 @@ KeyValuePair : public header_t {
 		this should only be called if the KeyValuePair is in null/tombstone state.*/
 		assert(!header_t::is_valid_type()); // otherwise we should destruct first
 		assert(end - begin == key_length_table[type_id_in]);		
+		assert(fits_table[type_id_in]);
 
 		header_t::set_to_type_id(type_id_in);
 		std::copy(begin, end, begin_key());
@@ -304,15 +367,15 @@ KeyValuePair : public header_t {
 	}
 
 	template<typename Q>
-	std::array<key_element_t, Q::accompanying_key_n>& get_key_before(){
+	std::array<key_element_t, utils::key_length<Q>::value>& get_key_before(){
 		assert(is_type<Q>());
-		return *reinterpret_cast<std::array<key_element_t, Q::accompanying_key_n>*>(&as_u8_array[0]);	
+		return *reinterpret_cast<std::array<key_element_t, utils::key_length<Q>::value>*>(&as_u8_array[0]);	
 	}
 
 	template<typename Q>
-	std::array<key_element_t, Q::accompanying_key_n> const& cget_key_before() const{
+	std::array<key_element_t, utils::key_length<Q>::value> const& cget_key_before() const{
 		assert(is_type<Q>());
-		return *reinterpret_cast<std::array<key_element_t, Q::accompanying_key_n> const*>(&as_u8_array[0]);	
+		return *reinterpret_cast<std::array<key_element_t, utils::key_length<Q>::value> const*>(&as_u8_array[0]);	
 	}
 
 	key_element_t* end_key(){
@@ -347,26 +410,31 @@ private:
 };
 
 // construct dtor_vtable
-template<typename header_t, typename key_element_t, typename ...Qs>
-const std::array<typename KeyValuePair<header_t, key_element_t, Qs...>::dtor_t, sizeof...(Qs)> 
-KeyValuePair<header_t, key_element_t, Qs...>::dtor_vtable = {
-&key_value_pair_impl::destroy_value<Qs, KeyValuePair<header_t, key_element_t, Qs...>> ...};
+template<typename header_t, typename key_element_t, size_t slot_len, typename ...Qs>
+const std::array<typename KeyValuePair<header_t, key_element_t, slot_len, Qs...>::dtor_t, sizeof...(Qs)> 
+KeyValuePair<header_t, key_element_t, slot_len, Qs...>::dtor_vtable = {
+&key_value_pair_impl::destroy_value<Qs, KeyValuePair<header_t, key_element_t, slot_len, Qs...>> ...};
 
 
 // construct cpctor_vtable
-template<typename header_t, typename key_element_t, typename ...Qs>
-const std::array<typename KeyValuePair<header_t, key_element_t, Qs...>::cpctor_t, sizeof...(Qs)> 
-KeyValuePair<header_t, key_element_t, Qs...>::cpctor_vtable = {
-&key_value_pair_impl::copy_value<Qs, KeyValuePair<header_t, key_element_t, Qs...>> ...};
+template<typename header_t, typename key_element_t, size_t slot_len, typename ...Qs>
+const std::array<typename KeyValuePair<header_t, key_element_t, slot_len, Qs...>::cpctor_t, sizeof...(Qs)> 
+KeyValuePair<header_t, key_element_t, slot_len, Qs...>::cpctor_vtable = {
+&key_value_pair_impl::copy_value<Qs, KeyValuePair<header_t, key_element_t, slot_len, Qs...>> ...};
 
 // construct mvctor_vtable
-template<typename header_t, typename key_element_t, typename ...Qs>
-const std::array<typename KeyValuePair<header_t, key_element_t, Qs...>::mvctor_t, sizeof...(Qs)> 
-KeyValuePair<header_t, key_element_t, Qs...>::mvctor_vtable = {
-&key_value_pair_impl::move_value<Qs, KeyValuePair<header_t, key_element_t, Qs...>> ...};
+template<typename header_t, typename key_element_t, size_t slot_len, typename ...Qs>
+const std::array<typename KeyValuePair<header_t, key_element_t, slot_len, Qs...>::mvctor_t, sizeof...(Qs)> 
+KeyValuePair<header_t, key_element_t, slot_len, Qs...>::mvctor_vtable = {
+&key_value_pair_impl::move_value<Qs, KeyValuePair<header_t, key_element_t, slot_len, Qs...>> ...};
 
-template<typename header_t, typename key_element_t, typename ...Qs>
+template<typename header_t, typename key_element_t, size_t slot_len, typename ...Qs>
 const std::array<size_t, sizeof...(Qs)>
-KeyValuePair<header_t, key_element_t, Qs...>::key_length_table = {Qs::accompanying_key_n...};
+KeyValuePair<header_t, key_element_t, slot_len, Qs...>::key_length_table = {utils::key_length<Qs>::value...};
+
+template<typename header_t, typename key_element_t, size_t slot_len, typename ...Qs>
+const std::array<bool, sizeof...(Qs)>
+KeyValuePair<header_t, key_element_t, slot_len, Qs...>::fits_table = {
+KeyValuePair<header_t, key_element_t, slot_len, Qs...>::template fits<Qs>()...};
 
 #endif // _KeyValuePair_H_
\ No newline at end of file
@@ -51,24 +51,35 @@ using std::vector;
 
 #include "engine.h"
 
+/* Key lengths follow from the upstream lists, see utils::key_length. In generated
+   code (see generate_cpp.py) these come from the xml. */
 struct input_a{
-	static const auto accompanying_key_n = 1;
+	static const bool interned = true;
 
 	const std::string value;
 	template<typename ...Args>
 	input_a(Args&& ...args) : value(std::forward<Args...>(args...)){};
+	std::string intern_key() const { return value; }
+};
+
+struct input_b{
+	int value;
+};
+
+struct input_c{
+	float value;
 };
 
 struct custom_a : public vector<int>{
-	static const auto accompanying_key_n = 3;
+	using upstream = utils::type_list<input_a, input_b>;
 };
 
 struct custom_b : public vector<float>{
-	static const auto accompanying_key_n = 3;
+	using upstream = utils::type_list<custom_a, input_b>;
 };
 
 struct custom_c : public vector<double>{
-	static const auto accompanying_key_n = 4;
+	using upstream = utils::type_list<custom_b, input_c>;
 
 	template<typename KVP>
 	static void exec(KVP& kvp){
@@ -90,7 +101,7 @@ struct custom_c : public vector<double>{
 
 
 
-using engine_t = Engine<64, id_t, input_a, custom_a, custom_b, custom_c>;
+using engine_t = Engine<64, id_t, input_a, input_b, input_c, custom_a, custom_b, custom_c>;
 engine_t engine;
 using dispatcher_t = Dispatcher<engine_t, &engine>;
 dispatcher_t dispatcher;
@@ -106,6 +117,7 @@ void got_c(typename dispatcher_t::callback_arg<custom_c>::type v, NoState ns){
 int main(int argc, char **argv){
 	if(true){
 		auto r1 = dispatcher.make_input<input_a>("hello world"s);
+		auto r2 = dispatcher.make_input<input_a>("hello world"s); // interned, so shares r1's id
 		auto c1a = dispatcher.make_callback<custom_c, NoState, got_c>(
 											NoState(), 13UL, 89UL, 10UL);
 		//std::cout << engine << std::endl;	
@@ -113,7 +125,7 @@ int main(int argc, char **argv){
 
 		//std::cout << "r1: " << r1.cget().value << std::endl;  
 
-		engine.run();
+		engine.poll();
 	}
 
 	//std::cout << engine << std::endl;	
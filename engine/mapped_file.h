@@ -0,0 +1,224 @@
+/*
+	MappedFile and MappedBuffer classes
+
+	MappedFile is an RAII wrapper around a read-only memory mapping of a whole
+	file.  You get one with MappedFile::open(path), which returns a shared_ptr
+	(or nullptr on failure, we don't use exceptions).
+
+	MappedBuffer is the value type that compute nodes like axona_file return
+	for their "buffer": it is just a (shared) reference to the MappedFile plus an
+	offset and length, i.e. a view.  So when it is cached in the store no bytes
+	are copied, and the OS page cache acts as our cache for the actual data. It is
+	small and copyable, so it can live directly in a KVP.  Copies (and subviews)
+	share the mapping, which is unmapped when the last one goes away.
+
+	The buffer is split into fixed-size blocks (e.g. 2MB), matching the requested
+	blocks of the compute.  will_need(block) gives the OS a MADV_WILLNEED hint for
+	that block (rounded out to page boundaries), and the whole mapping is marked
+	MADV_SEQUENTIAL when it is opened, as our parsers basically always stream through
+	from start to finish.  Downstream parsers (spike_times, both_xy) can iterate
+	fixed-length records directly from the mapping with for_each_record, which also
+	issues the will_need hint one block ahead of where it is reading.
+
+	On platforms without mmap we fall back to reading the whole file into a heap
+	buffer, so everything still works, it's just not zero-copy.
+
+	Note that if the file is modified/truncated by someone else while mapped we may
+	get SIGBUS, we don't try to deal with that.
+*/
+
+#ifndef _MAPPED_FILE_H_
+#define _MAPPED_FILE_H_
+
+#include <memory>
+#include <string>
+#include <ostream>
+#include <cstdint>
+#include <cassert>
+#include <algorithm>
+
+#if defined(_WIN32)
+#include <fstream>
+#include <vector>
+#define VENOMOUS_NO_MMAP
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+
+class MappedFile{
+	uint8_t const* base = nullptr;
+	size_t len = 0;
+#ifdef VENOMOUS_NO_MMAP
+	std::vector<uint8_t> heap_copy;
+#endif
+
+	MappedFile() = default;
+
+public:
+	MappedFile(MappedFile const&) = delete;
+	MappedFile& operator=(MappedFile const&) = delete;
+
+	static std::shared_ptr<MappedFile const> open(std::string const& path){
+		std::shared_ptr<MappedFile> f(new MappedFile());
+#ifdef VENOMOUS_NO_MMAP
+		std::ifstream in(path, std::ios::binary);
+		if(!in)
+			return nullptr;
+		f->heap_copy.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+		f->base = f->heap_copy.data();
+		f->len = f->heap_copy.size();
+#else
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if(fd < 0)
+			return nullptr;
+		struct stat st;
+		if(fstat(fd, &st) != 0){
+			::close(fd);
+			return nullptr;
+		}
+		f->len = st.st_size;
+		if(f->len > 0){
+			void* p = mmap(nullptr, f->len, PROT_READ, MAP_PRIVATE, fd, 0);
+			if(p == MAP_FAILED){
+				::close(fd);
+				return nullptr;
+			}
+			f->base = static_cast<uint8_t const*>(p);
+			madvise(p, f->len, MADV_SEQUENTIAL);
+		}
+		::close(fd); // the mapping keeps its own reference to the file
+#endif
+		return f;
+	}
+
+	~MappedFile(){
+#ifndef VENOMOUS_NO_MMAP
+		if(base != nullptr)
+			munmap(const_cast<uint8_t*>(base), len);
+#endif
+	}
+
+	uint8_t const* data() const{
+		return base;
+	}
+
+	size_t length() const{
+		return len;
+	}
+
+	void advise(size_t offset, size_t n, int advice) const{
+		// madvise needs a page-aligned start, so we round offset down
+#ifndef VENOMOUS_NO_MMAP
+		if(base == nullptr || offset >= len)
+			return;
+		static const size_t page_size = sysconf(_SC_PAGESIZE);
+		size_t start = offset - offset % page_size;
+		n = std::min(n + (offset - start), len - start);
+		madvise(const_cast<uint8_t*>(base) + start, n, advice);
+#endif
+	}
+
+	void will_need(size_t offset, size_t n) const{
+#ifndef VENOMOUS_NO_MMAP
+		advise(offset, n, MADV_WILLNEED);
+#endif
+	}
+};
+
+
+class MappedBuffer{
+	std::shared_ptr<MappedFile const> file;
+	size_t offset = 0;
+	size_t len = 0;
+	size_t block_len = 1;
+
+public:
+	MappedBuffer() = default;
+
+	MappedBuffer(std::shared_ptr<MappedFile const> file_in, size_t block_len_in,
+				 size_t offset_in=0, size_t len_in=size_t(-1))
+			: file(std::move(file_in)), block_len(block_len_in) {
+		assert(block_len > 0);
+		if(file == nullptr)
+			return;
+		offset = std::min(offset_in, file->length());
+		len = std::min(len_in, file->length() - offset);
+	}
+
+	static MappedBuffer open(std::string const& path, size_t block_len){
+		// check is_valid() on the result
+		return MappedBuffer(MappedFile::open(path), block_len);
+	}
+
+	bool is_valid() const{
+		return file != nullptr;
+	}
+
+	MappedBuffer subview(size_t sub_offset, size_t sub_len=size_t(-1)) const{
+		/* e.g. for skipping past the header to the data_start. Note the
+		   subview has its own block numbering, starting at sub_offset. */
+		sub_offset = std::min(sub_offset, len);
+		return MappedBuffer(file, block_len, offset + sub_offset,
+							std::min(sub_len, len - sub_offset));
+	}
+
+	size_t length() const{
+		return len;
+	}
+
+	uint8_t const* data() const{
+		return file == nullptr ? nullptr : file->data() + offset;
+	}
+
+	size_t n_blocks() const{
+		return (len + block_len - 1) / block_len;
+	}
+
+	size_t block_length(size_t block_ii) const{
+		assert(block_ii < n_blocks());
+		return std::min(block_len, len - block_ii*block_len);
+	}
+
+	uint8_t const* block(size_t block_ii) const{
+		assert(block_ii < n_blocks());
+		return data() + block_ii*block_len;
+	}
+
+	void will_need(size_t block_ii) const{
+		if(block_ii < n_blocks())
+			file->will_need(offset + block_ii*block_len, block_length(block_ii));
+	}
+
+	template<typename Foo>
+	void for_each_record(size_t record_len, Foo foo) const{
+		/* calls foo(uint8_t const* record) for each complete record_len-byte record,
+		   reading straight out of the mapping.  The block after the one currently
+		   being read is hinted with will_need. */
+		assert(record_len > 0);
+		size_t n_records = len / record_len;
+		size_t next_hint = 0;
+		for(size_t i=0; i<n_records; i++){
+			size_t pos = i*record_len;
+			if(pos >= next_hint){
+				if(pos == 0)
+					will_need(0);
+				will_need(pos/block_len + 1);
+				next_hint = (pos/block_len + 1)*block_len;
+			}
+			foo(data() + pos);
+		}
+	}
+
+	friend std::ostream& operator<<(std::ostream& os, MappedBuffer const& b){
+		os << "MappedBuffer[offset=" << b.offset << ", len=" << b.len
+		   << ", blocks=" << b.n_blocks() << (b.is_valid() ? "]" : ", invalid]");
+		return os;
+	}
+};
+
+
+#endif // _MAPPED_FILE_H_
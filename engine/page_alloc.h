@@ -0,0 +1,300 @@
+/*
+	Page allocation
+
+	Big arrays that are read at random, i.e. the store's hash tables and the
+	chunks of the ChunkedArrays that hold most values, come from here rather
+	than from new[], so that they can be put on huge pages, to cut TLB misses
+	when probing a multi-GB table, and placed on particular NUMA nodes.
+
+	A Policy says how:
+
+		pages	- normal: plain anonymous mmap.
+				  transparent_huge: the mapping is 2MB aligned and rounded up
+				  to 2MB, and marked MADV_HUGEPAGE, so the kernel can back it
+				  with huge pages (if THP is enabled, i.e. "madvise" or
+				  "always" in /sys/kernel/mm/transparent_hugepage/enabled).
+				  explicit_huge: MAP_HUGETLB, which needs pages reserved in
+				  /proc/sys/vm/nr_hugepages, if there aren't enough it falls
+				  back to transparent_huge.
+		numa	- default_policy: whatever the calling thread's policy is,
+				  normally each page goes on the node of whichever thread first
+				  touches it.
+				  interleave: pages round-robin over all the online nodes, for
+				  tables that every thread probes.
+				  bind: all on node.
+		min_bytes - smaller allocations aren't worth a mapping (or would waste
+				  most of a huge page), so they come from the heap, and the
+				  above doesn't apply.
+
+	NUMA placement is done with the mbind syscall, so we don't need libnuma,
+	and it is only a hint: if it fails (e.g. on a kernel without NUMA) the
+	memory is still allocated, just wherever the kernel likes.  Likewise a
+	failed huge page mapping falls back to normal pages.  Only running out of
+	memory entirely is an error, which aborts, as with new[] and -fno-exceptions.
+
+	make_array<T>(n, policy) gives a unique_array<T>, a unique_ptr<T[]> whose
+	deleter knows how the memory was allocated.  The elements are default
+	initialised, like new T[n], which for fresh mappings means zeros.
+
+	The engine sets the policy for its store in its constructor, and also
+	makes it the arena_policy(), which is what ChunkedArray::allocate uses.
+	That is process wide, so set it before starting any work.
+
+	On platforms without mmap everything comes from the heap.
+*/
+
+#ifndef _PAGE_ALLOC_H_
+#define _PAGE_ALLOC_H_
+
+#include <new>
+#include <memory>
+#include <cstdint>
+#include <cstdlib>
+#include <cassert>
+#include <algorithm>
+#include <type_traits>
+
+#if defined(_WIN32)
+#include <malloc.h>
+#ifndef VENOMOUS_NO_MMAP
+#define VENOMOUS_NO_MMAP
+#endif
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fstream>
+#include <string>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#endif
+
+
+namespace page_alloc{
+
+enum class Pages : uint8_t {
+	normal,
+	transparent_huge,
+	explicit_huge
+};
+
+enum class Numa : uint8_t {
+	default_policy,
+	interleave,
+	bind
+};
+
+struct Policy{
+	Pages pages = Pages::normal;
+	Numa numa = Numa::default_policy;
+	int node = 0; // for Numa::bind
+	size_t min_bytes = size_t(1) << 20;
+};
+
+const size_t huge_page_len = size_t(2) << 20;
+
+struct Block{
+	void* p = nullptr;
+	size_t len = 0; // of the mapping, or 0 if it came from the heap
+};
+
+inline Policy& arena_policy_ref(){
+	static Policy policy;
+	return policy;
+}
+
+inline Policy const& arena_policy(){
+	return arena_policy_ref();
+}
+
+inline void set_arena_policy(Policy const& policy){
+	arena_policy_ref() = policy;
+}
+
+inline void* heap_allocate(size_t bytes, size_t alignment){
+	void* p = nullptr;
+	alignment = std::max(alignment, sizeof(void*));
+#ifdef _WIN32
+	p = _aligned_malloc(std::max<size_t>(bytes, 1), alignment);
+#else
+	if(posix_memalign(&p, alignment, std::max<size_t>(bytes, 1)) != 0)
+		p = nullptr;
+#endif
+	if(p == nullptr)
+		abort();
+	return p;
+}
+
+inline void heap_free(void* p){
+#ifdef _WIN32
+	_aligned_free(p);
+#else
+	free(p);
+#endif
+}
+
+#ifndef VENOMOUS_NO_MMAP
+
+inline unsigned long online_nodes_mask(){
+	// parses e.g. "0-1,3" from sysfs, nodes beyond 63 are ignored
+	static const unsigned long mask = []{
+		unsigned long ret = 0;
+		std::ifstream f("/sys/devices/system/node/online");
+		std::string s;
+		if(f >> s){
+			char const* c = s.c_str();
+			while(*c != '\0'){
+				char* end;
+				const unsigned long lo = strtoul(c, &end, 10);
+				if(end == c)
+					break;
+				c = end;
+				unsigned long hi = lo;
+				if(*c == '-'){
+					hi = strtoul(c + 1, &end, 10);
+					c = end;
+				}
+				for(unsigned long n=lo; n<=hi && n<64; n++)
+					ret |= 1ul << n;
+				if(*c == ',')
+					c++;
+			}
+		}
+		return ret == 0 ? 1ul : ret;
+	}();
+	return mask;
+}
+
+inline bool place(void* p, size_t len, Policy const& policy){
+	/* mbind, before anything touches the pages, returns false if it failed */
+#if defined(__linux__) && defined(SYS_mbind)
+	const int mpol_bind = 2, mpol_interleave = 3; // from linux/mempolicy.h
+	unsigned long mask = 0;
+	int mode = 0;
+	switch(policy.numa){
+	case Numa::default_policy:
+		return true;
+	case Numa::interleave:
+		mask = online_nodes_mask();
+		mode = mpol_interleave;
+		break;
+	case Numa::bind:
+		if(policy.node < 0 || policy.node >= 64)
+			return false;
+		mask = 1ul << policy.node;
+		mode = mpol_bind;
+		break;
+	default:
+		return false; // not a Numa we know
+	}
+	return syscall(SYS_mbind, p, len, mode, &mask, sizeof(mask) * 8 + 1, 0) == 0;
+#else
+	return policy.numa == Numa::default_policy;
+#endif
+}
+
+inline void* map_aligned(size_t len, size_t alignment){
+	/* an anonymous mapping of len bytes, starting on a multiple of alignment,
+	   by mapping extra and trimming the ends */
+	const size_t padded = len + alignment;
+	void* p = mmap(nullptr, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(p == MAP_FAILED)
+		return nullptr;
+	const uintptr_t start = reinterpret_cast<uintptr_t>(p);
+	const uintptr_t aligned = (start + alignment - 1) / alignment * alignment;
+	if(aligned > start)
+		munmap(p, aligned - start);
+	if(start + padded > aligned + len)
+		munmap(reinterpret_cast<void*>(aligned + len), start + padded - (aligned + len));
+	return reinterpret_cast<void*>(aligned);
+}
+
+#endif // VENOMOUS_NO_MMAP
+
+inline Block allocate(size_t bytes, size_t alignment, Policy const& policy){
+	/* alignment must be at most the page size, it's only for the heap path */
+	Block ret;
+#ifndef VENOMOUS_NO_MMAP
+	if(bytes >= policy.min_bytes && bytes > 0){
+		static const size_t page_size = sysconf(_SC_PAGESIZE);
+		assert(alignment <= page_size);
+		Pages pages = policy.pages;
+#ifdef MAP_HUGETLB
+		if(pages == Pages::explicit_huge){
+			ret.len = (bytes + huge_page_len - 1) / huge_page_len * huge_page_len;
+			ret.p = mmap(nullptr, ret.len, PROT_READ | PROT_WRITE,
+						 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+			if(ret.p == MAP_FAILED)
+				pages = Pages::transparent_huge; // none reserved, or not enough
+		}
+#else
+		if(pages == Pages::explicit_huge)
+			pages = Pages::transparent_huge;
+#endif
+		if(pages == Pages::transparent_huge){
+			ret.len = (bytes + huge_page_len - 1) / huge_page_len * huge_page_len;
+			ret.p = map_aligned(ret.len, huge_page_len);
+#ifdef MADV_HUGEPAGE
+			if(ret.p != nullptr)
+				madvise(ret.p, ret.len, MADV_HUGEPAGE);
+#endif
+		}else if(pages == Pages::normal){
+			ret.len = (bytes + page_size - 1) / page_size * page_size;
+			ret.p = mmap(nullptr, ret.len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		}
+		if(ret.p == nullptr || ret.p == MAP_FAILED)
+			abort();
+		place(ret.p, ret.len, policy);
+		return ret;
+	}
+#endif
+	ret.p = heap_allocate(bytes, alignment);
+	return ret;
+}
+
+inline void deallocate(Block const& block){
+	if(block.p == nullptr)
+		return;
+#ifndef VENOMOUS_NO_MMAP
+	if(block.len > 0){
+		munmap(block.p, block.len);
+		return;
+	}
+#endif
+	heap_free(block.p);
+}
+
+template<typename T>
+class ArrayDeleter{
+	size_t n = 0;
+	Block block;
+public:
+	ArrayDeleter() = default;
+	ArrayDeleter(size_t n_in, Block const& block_in) : n(n_in), block(block_in) {}
+
+	void operator()(T* p) const{
+		for(size_t i=0; i<n; i++)
+			p[i].~T();
+		deallocate(block);
+	}
+
+	bool is_mapped() const{
+		return block.len > 0;
+	}
+};
+
+template<typename T>
+using unique_array = std::unique_ptr<T[], ArrayDeleter<T>>;
+
+template<typename T>
+unique_array<T> make_array(size_t n, Policy const& policy=arena_policy()){
+	const Block block = allocate(n * sizeof(T), alignof(T), policy);
+	T* p = static_cast<T*>(block.p);
+	for(size_t i=0; i<n; i++)
+		new (p + i) T;
+	return unique_array<T>(p, ArrayDeleter<T>(n, block));
+}
+
+} // namespace page_alloc
+
+#endif // _PAGE_ALLOC_H_
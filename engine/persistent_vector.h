@@ -0,0 +1,150 @@
+/*
+	PersistentVector class
+
+	A fixed-chunk-size vector, where each chunk is reference counted and copy-on-write.
+	Copying a PersistentVector only copies the table of chunk pointers, so the copy
+	shares all of its data with the original.  Writing to an element (via set, or
+	mutable_chunk) first checks whether the chunk is shared, and if so, clones just
+	that one chunk.
+
+	This is intended for the states of chains, e.g. cut_state in sample.xml, where each
+	iteration is the previous state plus one small delta.  A delta touching a few hundred
+	elements only allocates the handful of chunks it touches, and undo/redo/branching
+	share everything else.  Note that copying is O(n/chunk_len) rather than O(1), but
+	with the default 4096-element chunks a 1M-element vector has only 245 chunks.
+
+	The class is small and copy/move constructible, so it can be used directly as
+	a value type (or member of a value type) in the KVP store.
+
+	Thread-safety: the chunk refcounts are std::shared_ptr, so they are atomic, and it is
+	fine for multiple threads to hold copies of the same PersistentVector and read from
+	them.  But only one thread should be writing to a given PersistentVector instance, and
+	nobody should be copying from that instance while it's being written to.  Chunks
+	themselves are never written once shared, so readers of other copies are unaffected.
+
+	Iterating is fastest with for_each_chunk, which gives contiguous ranges.
+*/
+
+#ifndef _PERSISTENT_VECTOR_H_
+#define _PERSISTENT_VECTOR_H_
+
+#include <array>
+#include <vector>
+#include <memory>
+#include <ostream>
+#include <cassert>
+#include <algorithm>
+
+
+template<typename T, size_t chunk_len_log2=12>
+class PersistentVector{
+public:
+	static const size_t chunk_len = size_t(1) << chunk_len_log2;
+	using self_t = PersistentVector<T, chunk_len_log2>;
+	using value_type = T;
+	using chunk_t = std::array<T, chunk_len>;
+
+private:
+	std::vector<std::shared_ptr<chunk_t>> chunks;
+	size_t len = 0;
+
+	static size_t chunk_idx(size_t i){
+		return i >> chunk_len_log2;
+	}
+	static size_t idx_in_chunk(size_t i){
+		return i & (chunk_len-1);
+	}
+
+	chunk_t& own_chunk(size_t c){
+		// clone the chunk if anyone else has a reference to it
+		assert(c < chunks.size());
+		if(chunks[c].use_count() > 1)
+			chunks[c] = std::make_shared<chunk_t>(*chunks[c]);
+		return *chunks[c];
+	}
+
+public:
+	PersistentVector() = default;
+
+	PersistentVector(size_t n, T const& fill) : len(n) {
+		/* note that all chunks initially share a single filled chunk, so
+		   this is cheap even for very large n. */
+		if(n == 0)
+			return;
+		auto filled = std::make_shared<chunk_t>();
+		filled->fill(fill);
+		chunks.assign(chunk_idx(n-1)+1, filled);
+	}
+
+	size_t size() const{
+		return len;
+	}
+
+	size_t n_chunks() const{
+		return chunks.size();
+	}
+
+	T const& operator[](size_t i) const{
+		assert(i < len);
+		return (*chunks[chunk_idx(i)])[idx_in_chunk(i)];
+	}
+
+	void set(size_t i, T const& val){
+		assert(i < len);
+		own_chunk(chunk_idx(i))[idx_in_chunk(i)] = val;
+	}
+
+	void push_back(T const& val){
+		if(idx_in_chunk(len) == 0)
+			chunks.push_back(std::make_shared<chunk_t>());
+		own_chunk(chunk_idx(len))[idx_in_chunk(len)] = val;
+		len++;
+	}
+
+	T* mutable_chunk(size_t c){
+		/* For bulk writes within a single chunk. Returns a pointer to the start
+		   of chunk c, valid for chunk_size(c) elements. */
+		return own_chunk(c).data();
+	}
+
+	size_t chunk_size(size_t c) const{
+		assert(c < chunks.size());
+		return c+1 < chunks.size() ? chunk_len : len - c*chunk_len;
+	}
+
+	T const* cbegin_chunk(size_t c) const{
+		return chunks[c]->data();
+	}
+
+	template<typename Foo>
+	void for_each_chunk(Foo foo) const{
+		/* foo(T const* begin, T const* end, size_t first_idx) */
+		for(size_t c=0; c<chunks.size(); c++)
+			foo(chunks[c]->data(), chunks[c]->data() + chunk_size(c), c*chunk_len);
+	}
+
+	bool shares_chunk_with(self_t const& other, size_t c) const{
+		return c < chunks.size() && c < other.chunks.size() && chunks[c] == other.chunks[c];
+	}
+
+	size_t unshared_bytes() const{
+		/* Bytes that would be freed if this instance was destroyed. */
+		size_t n = 0;
+		for(auto const& p : chunks)
+			n += p.use_count() == 1 ? sizeof(chunk_t) : 0;
+		return n;
+	}
+
+	friend std::ostream& operator<<(std::ostream& os, self_t const& v){
+		size_t head_size = 16;
+		os << "PersistentVector<len=" << v.len << ", chunks=" << v.chunks.size()
+		   << ", unshared_bytes=" << v.unshared_bytes() << ">[";
+		for(size_t i=0; i<v.len && i<head_size; i++)
+			os << (i ? ", " : "") << v[i];
+		os << (v.len > head_size ? ", ...]" : "]");
+		return os;
+	}
+};
+
+
+#endif // _PERSISTENT_VECTOR_H_
@@ -0,0 +1,154 @@
+/*
+	NodeStats class
+
+	Aggregated statistics for one Q, the engine keeps one of these per Q (see
+	Engine::node_stats) and Engine::write_profile_json writes them all out, for
+	the explorer to show as a heat overlay (see load_profile in
+	explorer/venomous_explorer.html).  It's the place to start when deciding
+	which nodes to optimise, or re-chunk.
+
+		runs		- how many times the node's body was run (Engine::schedule)
+		total/mean	- wall time of those runs
+		p99			- approximate, from a histogram with 4 buckets per power of 2,
+					  so it's the upper edge of the bucket, i.e. up to ~19% high.
+		bytes		- the sum of utils::bytes_of(value) over each exact value
+					  published (Engine::publish)
+		hits/misses	- lookups of the Q's value that did/didn't find it in the
+					  store (Engine::find_value and interning)
+		evictions	- KVPs of the Q deleted from the store
+
+	Everything is a relaxed atomic, updated from whichever thread did the thing,
+	so recording costs about as much as the atomic increment, and reading while
+	things are running gives a slightly inconsistent, but never torn, snapshot.
+*/
+
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+#include <atomic>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <algorithm>
+
+
+class NodeStats{
+public:
+	static const size_t sub_buckets = 4; // per power of 2
+	static const size_t n_buckets = 64 * sub_buckets;
+
+private:
+	std::atomic<uint64_t> n_runs{0};
+	std::atomic<uint64_t> total_ns{0};
+	std::atomic<uint64_t> n_bytes{0};
+	std::atomic<uint64_t> n_hits{0};
+	std::atomic<uint64_t> n_misses{0};
+	std::atomic<uint64_t> n_evictions{0};
+	std::array<std::atomic<uint32_t>, n_buckets> run_hist{};
+
+	static size_t bucket_for(uint64_t ns){
+		if(ns < sub_buckets)
+			return ns;
+		const int msb = 63 - __builtin_clzll(ns);
+		// the 2 bits below the msb pick the sub bucket
+		return msb * sub_buckets + ((ns >> (msb - 2)) & (sub_buckets - 1));
+	}
+
+	static uint64_t bucket_upper_ns(size_t b){
+		if(b < 2*sub_buckets)
+			return std::min(b, sub_buckets - 1); // buckets [sub_buckets, 2*sub_buckets) are never used
+		const size_t msb = b / sub_buckets, sub = b % sub_buckets;
+		return ((sub_buckets + sub + 1) << (msb - 2)) - 1;
+	}
+
+	static void relaxed_inc(std::atomic<uint64_t>& x, uint64_t v=1){
+		x.fetch_add(v, std::memory_order_relaxed);
+	}
+
+public:
+	static uint64_t now_ns(){
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	void record_run(uint64_t ns){
+		relaxed_inc(n_runs);
+		relaxed_inc(total_ns, ns);
+		run_hist[bucket_for(ns)].fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void record_bytes(uint64_t n){
+		relaxed_inc(n_bytes, n);
+	}
+
+	void record_lookup(bool hit){
+		relaxed_inc(hit ? n_hits : n_misses);
+	}
+
+	void record_eviction(){
+		relaxed_inc(n_evictions);
+	}
+
+	uint64_t runs() const{
+		return n_runs.load(std::memory_order_relaxed);
+	}
+
+	double total_ms() const{
+		return total_ns.load(std::memory_order_relaxed) / 1e6;
+	}
+
+	double mean_ms() const{
+		const uint64_t n = runs();
+		return n == 0 ? 0 : total_ms() / n;
+	}
+
+	double p99_ms() const{
+		uint64_t n = 0;
+		for(auto const& b : run_hist)
+			n += b.load(std::memory_order_relaxed);
+		// the smallest bucket with at most 1% of runs above it
+		uint64_t seen = 0;
+		for(size_t b=0; b<n_buckets; b++){
+			seen += run_hist[b].load(std::memory_order_relaxed);
+			if(n > 0 && seen * 100 >= n * 99)
+				return bucket_upper_ns(b) / 1e6;
+		}
+		return 0;
+	}
+
+	uint64_t bytes() const{
+		return n_bytes.load(std::memory_order_relaxed);
+	}
+
+	uint64_t hits() const{
+		return n_hits.load(std::memory_order_relaxed);
+	}
+
+	uint64_t misses() const{
+		return n_misses.load(std::memory_order_relaxed);
+	}
+
+	uint64_t evictions() const{
+		return n_evictions.load(std::memory_order_relaxed);
+	}
+
+	void write_json(std::ostream& os, char const* name=nullptr) const{
+		/* one object, e.g. {"name": "speed", "runs": 3, ...}, with the name only if
+		   given, cache_hit_rate is null if there were no lookups */
+		const uint64_t n_lookups = hits() + misses();
+		os << "{";
+		if(name != nullptr)
+			os << "\"name\": \"" << name << "\", ";
+		os << "\"runs\": " << runs() << ", \"total_ms\": " << total_ms() << ", \"mean_ms\": " << mean_ms()
+		   << ", \"p99_ms\": " << p99_ms() << ", \"bytes\": " << bytes() << ", \"cache_hit_rate\": ";
+		if(n_lookups == 0)
+			os << "null";
+		else
+			os << double(hits()) / n_lookups;
+		os << ", \"evictions\": " << evictions() << "}";
+	}
+};
+
+
+#endif // _PROFILE_H_
@@ -0,0 +1,190 @@
+/*
+	ChunkPyramid class
+
+	A min/max/mean summary of a ChunkedArray at several resolutions, so that e.g. a
+	plot of speed over an hour-long recording, which only needs the min and max for
+	each pixel column, doesn't have to read the whole array.  See
+	ChunkedArray::enable_pyramid and ChunkedArray::summarise.
+
+	For each chunk there is one level per block size, 64 samples, then 4x bigger
+	each level up to the whole chunk, each level being the summaries of consecutive
+	blocks of that size (the last one in a chunk may be short).  That is about
+	1/48th as many summaries as samples, at 24 bytes each for floats (32 for
+	doubles), so ~0.5 bytes per sample, i.e. ~12.5% extra for float data.  Which
+	is still why it's opt-in.  A chunk's levels are built in one pass when the
+	chunk has been written, see ChunkedArray::finish_chunk.
+
+	summarise(c, data, j0, j1) gives the exact summary of samples [j0, j1) of chunk
+	c, using the biggest blocks that fit inside the range, and only reading the raw
+	data for the (< 64 sample) ragged ends.  So summarising a range costs roughly
+	its length in whole chunks plus a few dozen blocks, rather than its length.
+
+	As with ChunkedArray, different threads can build different chunks at the same
+	time, and it's read-only once the array is published.
+*/
+
+#ifndef _PYRAMID_H_
+#define _PYRAMID_H_
+
+#include <vector>
+#include <memory>
+#include <cassert>
+#include <algorithm>
+#include <limits>
+#include <ostream>
+#include <type_traits>
+
+
+template<typename T>
+struct RangeSummary{
+	T min = std::numeric_limits<T>::max();
+	T max = std::numeric_limits<T>::lowest();
+	double sum = 0;
+	size_t n = 0;
+
+	void add(T v){
+		// note that nans are counted, and make the sum/mean nan, but don't affect min/max
+		min = std::min(min, v);
+		max = std::max(max, v);
+		sum += v;
+		n++;
+	}
+
+	void add(RangeSummary const& other){
+		min = std::min(min, other.min);
+		max = std::max(max, other.max);
+		sum += other.sum;
+		n += other.n;
+	}
+
+	double mean() const{
+		return n == 0 ? std::numeric_limits<double>::quiet_NaN() : sum / n;
+	}
+
+	friend std::ostream& operator<<(std::ostream& os, RangeSummary const& s){
+		return os << "{min=" << s.min << ", max=" << s.max << ", mean=" << s.mean() << ", n=" << s.n << "}";
+	}
+};
+
+
+template<typename T, size_t chunk_len_>
+class ChunkPyramid{
+public:
+	static const size_t chunk_len = chunk_len_;
+	static const size_t base_block = 64;
+	static const size_t block_factor = 4;
+	using summary_t = RangeSummary<T>;
+
+private:
+	static constexpr size_t count_levels(size_t block){
+		return block >= chunk_len ? 1 : 1 + count_levels(block * block_factor);
+	}
+
+public:
+	static const size_t n_levels = count_levels(base_block);
+
+private:
+	static size_t block_size(size_t level){
+		size_t b = base_block;
+		for(size_t l=0; l<level; l++)
+			b *= block_factor;
+		return b;
+	}
+
+	static size_t level_offset(size_t level){
+		// where level starts within a chunk's summaries
+		size_t ret = 0;
+		for(size_t l=0; l<level; l++)
+			ret += (chunk_len + block_size(l) - 1) / block_size(l);
+		return ret;
+	}
+
+	std::vector<std::unique_ptr<summary_t[]>> chunks;
+
+	summary_t const* level_data(size_t c, size_t level) const{
+		return chunks[c].get() + level_offset(level);
+	}
+
+public:
+	explicit ChunkPyramid(size_t n_chunks) : chunks(n_chunks) {
+		static_assert(std::is_arithmetic<T>::value, "pyramids are for arrays of numbers");
+		for(auto& c : chunks)
+			c.reset(new summary_t[level_offset(n_levels)]);
+	}
+
+	size_t n_chunks() const{
+		return chunks.size();
+	}
+
+	size_t bytes() const{
+		return n_chunks() * level_offset(n_levels) * sizeof(summary_t);
+	}
+
+	void build_chunk(size_t c, T const* data, size_t n){
+		/* data is the n samples of chunk c */
+		assert(c < n_chunks() && n <= chunk_len);
+		summary_t* level0 = chunks[c].get();
+		for(size_t b=0; b*base_block < n; b++){
+			summary_t s;
+			for(size_t j=b*base_block; j<std::min(n, (b+1)*base_block); j++)
+				s.add(data[j]);
+			level0[b] = s;
+		}
+		for(size_t level=1; level<n_levels; level++){
+			summary_t const* below = chunks[c].get() + level_offset(level - 1);
+			summary_t* here = chunks[c].get() + level_offset(level);
+			const size_t n_below = (n + block_size(level - 1) - 1) / block_size(level - 1);
+			for(size_t b=0; b*block_factor < n_below; b++){
+				summary_t s;
+				for(size_t k=b*block_factor; k<std::min(n_below, (b+1)*block_factor); k++)
+					s.add(below[k]);
+				here[b] = s;
+			}
+		}
+	}
+
+	summary_t chunk_summary(size_t c) const{
+		// the top level is a single block covering the chunk
+		return level_data(c, n_levels - 1)[0];
+	}
+
+	summary_t summarise(size_t c, T const* data, size_t j0, size_t j1) const{
+		/* the summary of samples [j0, j1) of chunk c, data is the chunk's samples */
+		assert(c < n_chunks() && j0 <= j1 && j1 <= chunk_len);
+		summary_t ret;
+		summarise_impl(c, data, j0, j1, n_levels - 1, ret);
+		return ret;
+	}
+
+private:
+	void summarise_impl(size_t c, T const* data, size_t j0, size_t j1, size_t level, summary_t& ret) const{
+		// use the whole blocks at this level, and recurse for the bits either side
+		if(j0 >= j1)
+			return;
+		const size_t b = block_size(level);
+		const size_t first = (j0 + b - 1) / b, last = j1 / b; // whole blocks [first, last)
+		if(first >= last){
+			if(level == 0)
+				for(size_t j=j0; j<j1; j++)
+					ret.add(data[j]);
+			else
+				summarise_impl(c, data, j0, j1, level - 1, ret);
+			return;
+		}
+		summary_t const* blocks = level_data(c, level);
+		for(size_t k=first; k<last; k++)
+			ret.add(blocks[k]);
+		if(level == 0){
+			for(size_t j=j0; j<first*b; j++)
+				ret.add(data[j]);
+			for(size_t j=last*b; j<j1; j++)
+				ret.add(data[j]);
+		}else{
+			summarise_impl(c, data, j0, first*b, level - 1, ret);
+			summarise_impl(c, data, last*b, j1, level - 1, ret);
+		}
+	}
+};
+
+
+#endif // _PYRAMID_H_
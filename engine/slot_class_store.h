@@ -0,0 +1,339 @@
+/*
+	SlotClassStore and TypedStore classes
+
+	The engine's store of KVPs, split into several unordered_maps.  A single
+	unordered_map has one KVP type, so every slot is as long as the longest
+	key+value of any Q, which is often two cache lines, even though most inputs
+	are a 4-byte key and a small value.  And every find has to cope with keys of
+	any length, and probes past entries of every other Q.
+
+	Both are a PartitionedStore, the difference is how Qs are assigned to tables:
+
+	SlotClassStore - n_classes tables, with 16, 32, 64 and 128 byte slots, and
+		each Q is assigned, at compile time, to the smallest class whose
+		KeyValuePair it fits (see KeyValuePair::fits and SlotClasses::table_for).
+		The 16 and 32 byte KVPs are aligned to their length, so 4 or 2 of them
+		pack into each cache line, without any of them straddling lines.  Each
+		class that has at least one Q gets capacity slots, the others get a
+		single slot (they are never used).  So the footprint is capacity times
+		the sum of the used slot lengths, rather than capacity times the
+		longest, and for a given capacity this can be more memory than a single
+		table, but the small entries, which are most of them, are 2-8x denser.
+
+	TypedStore - a table per Q, with the same slot length Q would have in the
+		SlotClassStore, and with Q's key length fixed at compile time, so that
+		hashing and comparing keys is unrolled, and probing only ever meets
+		entries of Q.  Each table has utils::store_capacity<Q> slots, which
+		defaults to capacity, so big or rare Qs can have smaller tables.
+		The engine uses this if VENOMOUS_TYPED_STORE is defined.
+
+	All the tables' KVPs are templated on the full list of Qs, so a Q's
+	prefix is the same whichever table it is in, and the per-prefix stats can
+	just be added up.  A Q only ever goes in its own table though.
+
+	The interface mirrors unordered_map, except that insert and find are
+	templated on Q, and return a pointer to Q's table's KVP. find_index and
+	delete_ take the prefix at runtime, as the engine's refs do, and dispatch
+	through vtables indexed by prefix.  Indices from find_index and
+	for_each_valid run over all the tables, [0, capacity_), each table's
+	indices following on from the previous table's, so that the engine can
+	keep one array of ref counts for the whole store.
+
+	Everything about threading, and allocation, is as for unordered_map, each
+	table is allocated with the page_alloc::Policy given to the constructor.
+*/
+
+#ifndef _SLOT_CLASS_STORE_H_
+#define _SLOT_CLASS_STORE_H_
+
+#include <tuple>
+#include <array>
+#include <utility>
+#include <ostream>
+
+#include "key_value_pair.h"
+#include "unordered_map.h"
+#include "tmp_utils.h"
+
+
+namespace slot_class_store_impl{
+
+const size_t n_classes = 4;
+
+constexpr size_t slot_len(size_t c){
+	return size_t(16) << c; // 16, 32, 64, 128
+}
+
+/*
+	A partition says how many tables there are (n_tables), which one each Q
+	goes in (table_for<Q>), and for each table its KVP type (kvp_t<t>), its
+	capacity (capacity_for(t)) and its key length (key_len_for(t), 0 meaning
+	any, see unordered_map).
+*/
+
+template<typename header_t, typename key_element_t, size_t capacity, typename ...Qs>
+struct SlotClasses{
+	static const size_t n_tables = n_classes;
+
+	template<size_t c>
+	using kvp_t = KeyValuePair<header_t, key_element_t, slot_len(c), Qs...>;
+
+	template<typename Q, size_t ...Cs>
+	constexpr static size_t class_for_impl(std::index_sequence<Cs...>){
+		const std::array<bool, n_classes> fits{{kvp_t<Cs>::template fits<Q>()...}};
+		for(size_t c=0; c<n_classes; c++)
+			if(fits[c])
+				return c;
+		return n_classes; // doesn't fit in any
+	}
+
+	template<typename Q>
+	constexpr static size_t table_for(){
+		return class_for_impl<Q>(std::make_index_sequence<n_classes>());
+	}
+
+	constexpr static size_t capacity_for(size_t c){
+		const std::array<size_t, sizeof...(Qs)> classes{{table_for<Qs>()...}};
+		for(size_t i=0; i<sizeof...(Qs); i++)
+			if(classes[i] == c)
+				return capacity;
+		return 1; // unused class
+	}
+
+	constexpr static size_t key_len_for(size_t){
+		return 0;
+	}
+
+	static void describe(std::ostream& os, size_t c){
+		os << "slot class " << slot_len(c) << "B";
+	}
+};
+
+template<typename header_t, typename key_element_t, size_t capacity, typename ...Qs>
+struct PerQTables{
+	static const size_t n_tables = sizeof...(Qs);
+	using classes = SlotClasses<header_t, key_element_t, capacity, Qs...>;
+
+	template<size_t t>
+	using q_t = typename std::tuple_element<t, std::tuple<Qs...>>::type;
+
+	template<size_t t>
+	using kvp_t = typename classes::template kvp_t<classes::template table_for<q_t<t>>()>;
+
+	template<typename Q>
+	constexpr static size_t table_for(){
+		return utils::index_of_type<Q, Qs...>();
+	}
+
+	constexpr static size_t capacity_for(size_t t){
+		const std::array<size_t, sizeof...(Qs)> capacities{{utils::store_capacity<Qs, capacity>::value...}};
+		return capacities[t];
+	}
+
+	constexpr static size_t key_len_for(size_t t){
+		const std::array<size_t, sizeof...(Qs)> key_lens{{utils::key_length<Qs>::value...}};
+		return key_lens[t];
+	}
+
+	static void describe(std::ostream& os, size_t t){
+		static const std::array<char const*, sizeof...(Qs)> names{{utils::q_name<Qs>()...}};
+		os << names[t];
+	}
+};
+
+template<typename partition>
+constexpr size_t offset_for(size_t t){
+	// where table t's indices start, see PartitionedStore::find_index
+	size_t ret = 0;
+	for(size_t t2=0; t2<t; t2++)
+		ret += partition::capacity_for(t2);
+	return ret;
+}
+
+} // slot_class_store_impl
+
+
+template<template<typename, typename, size_t, typename...> class Partition,
+		 typename header_t, typename key_element_t, size_t capacity, typename ...Qs>
+class PartitionedStore{
+	using partition = Partition<header_t, key_element_t, capacity, Qs...>;
+
+	template<size_t ...Ts>
+	static auto tables_type(std::index_sequence<Ts...>)
+		-> std::tuple<unordered_map<typename partition::template kvp_t<Ts>, partition::capacity_for(Ts),
+									partition::key_len_for(Ts)>...>; // only for decltype
+	using tables_t = decltype(tables_type(std::make_index_sequence<partition::n_tables>()));
+
+	constexpr static size_t offset_for(size_t t){
+		return slot_class_store_impl::offset_for<partition>(t);
+	}
+
+public:
+	using self_t = PartitionedStore<Partition, header_t, key_element_t, capacity, Qs...>; //convenience
+	using key_prefix_t = typename header_t::type_id_t;
+
+	static const size_t n_tables = partition::n_tables;
+	static const size_t n_prefixes = sizeof...(Qs);
+	static const size_t capacity_ = slot_class_store_impl::offset_for<partition>(n_tables); // over all the tables
+	static const size_t invalid_index = -1;
+	static const size_t main_thread_id = 0;
+	using Stats = typename std::tuple_element<0, tables_t>::type::Stats;
+
+	template<typename Q>
+	constexpr static size_t table_for(){
+		return partition::template table_for<Q>();
+	}
+
+	template<typename Q>
+	using kvp_for = typename partition::template kvp_t<table_for<Q>()>;
+
+	template<typename Q>
+	constexpr static auto prefix_for(){
+		return utils::index_of_type<Q, Qs...>();
+	}
+
+	static size_t slot_len_for(key_prefix_t prefix){
+		static const std::array<size_t, n_prefixes> slot_lens{{kvp_for<Qs>::slot_len_...}};
+		return slot_lens[prefix];
+	}
+
+private:
+	tables_t tables;
+
+	using find_index_t = size_t(*)(self_t&, key_element_t const*, key_element_t const*);
+	using delete_t = void(*)(self_t&, key_element_t const*, key_element_t const*);
+	static const std::array<find_index_t, sizeof...(Qs)> find_index_vtable;
+	static const std::array<delete_t, sizeof...(Qs)> delete_vtable;
+
+	template<typename Q>
+	auto& table_of(){
+		return std::get<table_for<Q>()>(tables);
+	}
+
+	template<typename Q>
+	static size_t find_index_impl(self_t& self, key_element_t const* begin, key_element_t const* end){
+		/* this goes in find_index_vtable */
+		const size_t idx = self.table_of<Q>().template find<size_t>(prefix_for<Q>(), begin, end);
+		return idx == invalid_index ? invalid_index : offset_for(table_for<Q>()) + idx;
+	}
+
+	template<typename Q>
+	static void delete_impl(self_t& self, key_element_t const* begin, key_element_t const* end){
+		/* this goes in delete_vtable */
+		self.table_of<Q>().delete_(prefix_for<Q>(), begin, end);
+	}
+
+	template<typename Tables, typename Foo, size_t ...Ts>
+	static void for_each_table(Tables& tables, Foo foo, std::index_sequence<Ts...>){
+		// calls foo(t, table) for each table t, in order
+		int dummy[] = {0, (foo(Ts, std::get<Ts>(tables)), 0)...};
+		(void)dummy;
+	}
+
+	template<typename Tables, typename Foo>
+	static void for_each_table(Tables& tables, Foo foo){
+		for_each_table(tables, foo, std::make_index_sequence<n_tables>());
+	}
+
+	template<size_t ...Ts>
+	PartitionedStore(page_alloc::Policy const& policy, std::index_sequence<Ts...>)
+		: tables((void(Ts), policy)...) {}
+
+public:
+	explicit PartitionedStore(page_alloc::Policy const& policy=page_alloc::Policy())
+		: PartitionedStore(policy, std::make_index_sequence<n_tables>()) {
+		static_assert(utils::max_element<slot_class_store_impl::SlotClasses<
+							header_t, key_element_t, capacity, Qs...>::template table_for<Qs>()...>()
+						< slot_class_store_impl::n_classes,
+					  "KVP is larger than 2 (cache line) units.");
+	}
+
+	template<typename Q>
+	kvp_for<Q>* insert(key_element_t const* begin, key_element_t const* end){
+		return table_of<Q>().insert(prefix_for<Q>(), begin, end);
+	}
+
+	template<typename Q>
+	kvp_for<Q>* find(key_element_t const* begin, key_element_t const* end,
+					 size_t thread_id=main_thread_id){
+		return table_of<Q>().find(prefix_for<Q>(), begin, end, thread_id);
+	}
+
+	size_t find_index(key_prefix_t prefix, key_element_t const* begin, key_element_t const* end){
+		/* the index is unique over all the tables, or invalid_index if not found */
+		assert(size_t(prefix) < n_prefixes);
+		return find_index_vtable[prefix](*this, begin, end);
+	}
+
+	void delete_(key_prefix_t prefix, key_element_t const* begin, key_element_t const* end){
+		assert(size_t(prefix) < n_prefixes);
+		delete_vtable[prefix](*this, begin, end);
+	}
+
+	template<typename Foo>
+	void for_each_valid(Foo foo) const{
+		/* calls foo(idx, kvp) for each valid entry, where kvp's type depends on
+		   its table, so foo has to be a generic lambda. As for unordered_map. */
+		for_each_table(tables, [&](size_t t, auto const& table){
+			const size_t offset = offset_for(t);
+			table.for_each_valid([&](size_t idx, auto const& kvp){
+				foo(offset + idx, kvp);
+			});
+		});
+	}
+
+	Stats stats() const{
+		/* the sum over the tables, see unordered_map::stats */
+		Stats ret;
+		for_each_table(tables, [&](size_t, auto const& table){
+			ret += table.stats();
+		});
+		return ret;
+	}
+
+	size_t reclaim(){
+		/* see unordered_map::reclaim */
+		size_t n = 0;
+		for_each_table(tables, [&](size_t, auto& table){
+			n += table.reclaim();
+		});
+		return n;
+	}
+
+	void attempt_clear_tombstones(){
+		for_each_table(tables, [](size_t, auto& table){
+			table.attempt_clear_tombstones();
+		});
+	}
+
+	friend std::ostream& operator<<(std::ostream& os, self_t const& store){
+		for_each_table(store.tables, [&](size_t t, auto const& table){
+			partition::describe(os, t);
+			os << ": " << table;
+		});
+		return os;
+	}
+};
+
+// construct find_index_vtable
+template<template<typename, typename, size_t, typename...> class Partition,
+		 typename header_t, typename key_element_t, size_t capacity, typename ...Qs>
+const std::array<typename PartitionedStore<Partition, header_t, key_element_t, capacity, Qs...>::find_index_t, sizeof...(Qs)>
+PartitionedStore<Partition, header_t, key_element_t, capacity, Qs...>::find_index_vtable = {
+&PartitionedStore<Partition, header_t, key_element_t, capacity, Qs...>::template find_index_impl<Qs>...};
+
+// construct delete_vtable
+template<template<typename, typename, size_t, typename...> class Partition,
+		 typename header_t, typename key_element_t, size_t capacity, typename ...Qs>
+const std::array<typename PartitionedStore<Partition, header_t, key_element_t, capacity, Qs...>::delete_t, sizeof...(Qs)>
+PartitionedStore<Partition, header_t, key_element_t, capacity, Qs...>::delete_vtable = {
+&PartitionedStore<Partition, header_t, key_element_t, capacity, Qs...>::template delete_impl<Qs>...};
+
+
+template<typename header_t, typename key_element_t, size_t capacity, typename ...Qs>
+using SlotClassStore = PartitionedStore<slot_class_store_impl::SlotClasses, header_t, key_element_t, capacity, Qs...>;
+
+template<typename header_t, typename key_element_t, size_t capacity, typename ...Qs>
+using TypedStore = PartitionedStore<slot_class_store_impl::PerQTables, header_t, key_element_t, capacity, Qs...>;
+
+#endif // _SLOT_CLASS_STORE_H_
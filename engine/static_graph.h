@@ -0,0 +1,105 @@
+/*
+	StaticGraph class
+
+	The dependency graph of the Qs, worked out entirely at compile time from each
+	Q's "using upstream = utils::type_list<...>" member (which the generator emits
+	for every input/compute/alias, see generate_cpp.py).  The engine's Qs must be
+	listed in topological order, i.e. every Q comes after all of its upstream Qs,
+	the generator emits them that way and Engine static_asserts it.
+
+	Everything is constexpr, so resolving a Q's dependencies at run time is just
+	indexing into static arrays rather than discovering anything:
+
+		index<Q>() - position of Q in Qs, which is also its key prefix.
+		upstream_indices<Q>() - std::array of the indices of Q's direct upstream Qs,
+			in the order Q declares them (which is the order of its arg accessors).
+		adjacency() - n x n table of bools, adjacency()[i][j] is true if Qs[j] is a
+			direct upstream of Qs[i].
+		is_topological() - true if no Q depends on itself or a later Q.
+		key_map<Q, U>() - for U upstream of Q, the position of each of U's
+			full-befores within Q's full-befores, so that U's key can be built
+			from Q's key with no lookups, see Engine::upstream_key.
+		delta_positions<Q>() - the positions within Q's full-befores of the inputs
+			that Q's delta path handles changes to, see Engine::bind_delta.
+		chain_position<Q>() - the position within Q's full-befores of the input
+			whose ids are Q's chain ids, for chain Qs only, see Engine::append_chain.
+
+	See utils::upstream_of, utils::input_closure and utils::key_length in tmp_utils.h
+	for what full-befores and key lengths are.
+*/
+
+#ifndef _STATIC_GRAPH_H_
+#define _STATIC_GRAPH_H_
+
+#include <array>
+
+
+template<typename ...Qs>
+class StaticGraph{
+public:
+	static const size_t n = sizeof...(Qs);
+	using qs_t = utils::type_list<Qs...>;
+	using adjacency_t = std::array<std::array<bool, n>, n>;
+
+	template<typename Q>
+	constexpr static size_t index(){
+		return utils::index_in<qs_t, Q>::value;
+	}
+
+	template<typename Q>
+	constexpr static auto upstream_indices(){
+		return indices_of(typename utils::upstream_of<Q>::type());
+	}
+
+	constexpr static adjacency_t adjacency(){
+		return adjacency_t{{ adjacency_row<Qs>()... }};
+	}
+
+	constexpr static bool is_topological(){
+		const adjacency_t adj = adjacency();
+		for(size_t i=0; i<n; i++)
+			for(size_t j=i; j<n; j++)
+				if(adj[i][j])
+					return false;
+		return true;
+	}
+
+	template<typename Q, typename U>
+	constexpr static auto key_map(){
+		static_assert(utils::contains<typename utils::upstream_of<Q>::type, U>::value,
+					  "U is not upstream of Q");
+		return positions_in<typename utils::input_closure<Q>::type>(
+										typename utils::input_closure<U>::type());
+	}
+
+	template<typename Q>
+	constexpr static auto delta_positions(){
+		return positions_in<typename utils::input_closure<Q>::type>(
+										typename utils::delta_over<Q>::type());
+	}
+
+	template<typename Q>
+	constexpr static size_t chain_position(){
+		return utils::index_in<typename utils::input_closure<Q>::type,
+							   typename utils::chain_over<Q>::type>::value;
+	}
+
+private:
+	template<typename ...Us>
+	constexpr static std::array<size_t, sizeof...(Us)> indices_of(utils::type_list<Us...>){
+		return {{ index<Us>()... }};
+	}
+
+	template<typename Q>
+	constexpr static std::array<bool, n> adjacency_row(){
+		return {{ utils::contains<typename utils::upstream_of<Q>::type, Qs>::value... }};
+	}
+
+	template<typename L, typename ...Us>
+	constexpr static std::array<size_t, sizeof...(Us)> positions_in(utils::type_list<Us...>){
+		return {{ utils::index_in<L, Us>::value... }};
+	}
+};
+
+
+#endif // _STATIC_GRAPH_H_
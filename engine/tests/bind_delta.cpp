@@ -0,0 +1,113 @@
+/*
+	Engine::bind_delta binds the old value, the old upstream values and the old
+	and new values of the delta_over inputs when they're all still in the store,
+	and otherwise returns false, meaning run the full body, rather than reading
+	an evicted value.
+*/
+
+#include "common.h"
+
+using id_t = uint32_t;
+
+struct speed_t{
+	std::vector<int> _0;
+};
+
+struct slice_t{
+	size_t _0, _1;
+};
+
+struct mask_func{
+	using upstream = utils::type_list<slice_t>;
+	size_t first, last;
+};
+
+// as speed_dwell in sample.xml, the delta_over input is only upstream of an upstream
+struct dwell_func{
+	using upstream = utils::type_list<speed_t, mask_func>;
+	std::array<void const*, 2> upstream_values;
+	using delta_over = utils::type_list<slice_t>;
+	void const* prev_value = nullptr;
+	std::array<void const*, 2> prev_upstream_values;
+	std::array<void const*, 2> delta_values; // old then new, for each of delta_over
+	long sum = 0;
+
+	speed_t const& speed() const { return *static_cast<speed_t const*>(upstream_values[0]); }
+	mask_func const& mask() const { return *static_cast<mask_func const*>(upstream_values[1]); }
+	dwell_func const& prev_dwell() const { return *static_cast<dwell_func const*>(prev_value); }
+	slice_t const& prev_slice() const { return *static_cast<slice_t const*>(delta_values[0]); }
+	slice_t const& new_slice() const { return *static_cast<slice_t const*>(delta_values[1]); }
+
+	void full(){
+		for(size_t i=mask().first; i<mask().last; i++)
+			sum += speed()._0[i];
+	}
+	void delta(){
+		// the slices only grow at the end here
+		sum = prev_dwell().sum;
+		for(size_t i=prev_slice()._1; i<new_slice()._1; i++)
+			sum += speed()._0[i];
+	}
+};
+
+using engine_t = Engine<64, id_t, speed_t, slice_t, mask_func, dwell_func>;
+engine_t engine;
+using dwell_key_t = engine_t::q_key_t<dwell_func>;
+
+dwell_key_t dwell_key(id_t speed, id_t slice){
+	return dwell_key_t{{ id_t(engine_t::prefix_for<dwell_func>()), speed, slice }};
+}
+
+KeyRef<engine_t, &engine, mask_func> compute_mask(id_t slice){
+	const engine_t::q_key_t<mask_func> key{{ id_t(engine_t::prefix_for<mask_func>()), slice }};
+	KeyRef<engine_t, &engine, slice_t> slice_ref(engine_t::q_key_t<slice_t>{{ slice }});
+	engine.emplace<mask_func>(key, mask_func{slice_ref.cget()._0, slice_ref.cget()._1});
+	engine.note_computed<mask_func>(key);
+	return KeyRef<engine_t, &engine, mask_func>(key);
+}
+
+KeyRef<engine_t, &engine, dwell_func> compute(dwell_key_t const& key, bool expect_delta){
+	auto& q = engine.emplace<dwell_func>(key, dwell_func{});
+	engine.bind_upstream(q, key);
+	const bool delta = engine.bind_delta(q, key);
+	assert(delta == expect_delta);
+	if(delta)
+		q.delta();
+	else
+		q.full();
+	engine.note_computed<dwell_func>(key);
+	return KeyRef<engine_t, &engine, dwell_func>(key);
+}
+
+int main(){
+	std::vector<int> speeds(100);
+	for(int i=0; i<100; i++)
+		speeds[i] = i;
+	auto speed = engine_t::make_input<speed_t, &engine>(speed_t{speeds});
+	auto slice_a = engine_t::make_input<slice_t, &engine>(slice_t{0, 10});
+	auto slice_b = engine_t::make_input<slice_t, &engine>(slice_t{0, 20});
+	auto slice_c = engine_t::make_input<slice_t, &engine>(slice_t{0, 30});
+	const id_t speed_id = speed.cget_key()[0];
+
+	auto mask_a = compute_mask(slice_a.cget_key()[0]);
+	auto mask_b = compute_mask(slice_b.cget_key()[0]);
+	auto mask_c = compute_mask(slice_c.cget_key()[0]);
+	auto a = compute(dwell_key(speed_id, slice_a.cget_key()[0]), false);
+	assert(a.cget().sum == 45);
+
+	// everything's there, so b is patched from a
+	auto b = compute(dwell_key(speed_id, slice_b.cget_key()[0]), true);
+	assert(b.cget().sum == 190);
+
+	// b's slice is evicted, while b and its mask are kept, so c can't be a delta
+	const id_t c_slice_id = slice_c.cget_key()[0];
+	{
+		auto dropped = std::move(slice_b);
+	}
+	engine.trim_cache(0);
+	auto c = compute(dwell_key(speed_id, c_slice_id), false);
+	assert(c.cget().sum == 435);
+
+	std::cout << "bind_delta: ok" << std::endl;
+	return 0;
+}
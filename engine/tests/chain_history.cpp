@@ -0,0 +1,104 @@
+/*
+	ChainHistory on its own, and wired into the engine, see Engine::append_chain.
+*/
+
+#include "common.h"
+
+using id_t = uint32_t;
+
+struct step_t{
+	static const auto accompanying_key_n = 1;
+	int delta;
+};
+
+struct state_t{
+	using upstream = utils::type_list<step_t>;
+	using chain_over = step_t;
+	int value;
+};
+
+using engine_t = Engine<64, id_t, step_t, state_t>;
+engine_t engine;
+using state_key_t = engine_t::q_key_t<state_t>;
+
+state_key_t state_key(id_t step){
+	return state_key_t{{ id_t(engine_t::prefix_for<state_t>()), step }};
+}
+
+void test_history(){
+	const id_t invalid = id_t(-1);
+	ChainHistory<id_t, invalid> h;
+	for(id_t id=0; id<100; id++)
+		h.append(id, id == 0 ? invalid : id - 1);
+	h.append(100, 50); // a branch off depth 50
+	assert(h.depth(99) == 99 && h.depth(100) == 51);
+	assert(h.ancestor_at_depth(99, 37) == 37);
+	assert(h.ancestor_at_depth(100, 50) == 50);
+	assert(h.ancestor_at_depth(100, 3) == 3);
+
+	// pinned every 2^pinned_level deltas, never more than log2(max_depth) apart
+	assert((1u << h.pinned_level()) <= 6);
+	assert(h.is_pinned(0) && h.is_pinned(64) && !h.is_pinned(63));
+	assert(h.eviction_rank(1) < h.eviction_rank(2) && h.eviction_rank(2) < h.eviction_rank(64));
+
+	std::vector<id_t> deltas;
+	assert(h.replay_plan(99, deltas) == invalid && deltas.size() == 100);
+
+	h.set_computed(96, true);
+	assert(h.replay_plan(99, deltas) == 96);
+	assert((deltas == std::vector<id_t>{97, 98, 99}));
+
+	// only ancestors count, i.e. not 64 for the branch
+	h.set_computed(64, true);
+	h.set_computed(32, true);
+	assert(h.replay_plan(100, deltas) == 32);
+	assert(deltas.size() == 19 && deltas.front() == 33 && deltas[17] == 50 && deltas.back() == 100);
+	assert(h.replay_plan(96, deltas) == 96 && deltas.empty());
+
+	// with every checkpoint above it evicted, from the root rather than scratch
+	for(id_t id : {96, 64, 32})
+		h.set_computed(id, false);
+	h.set_computed(0, true);
+	assert(h.replay_plan(99, deltas) == 0);
+	assert(deltas.size() == 99 && deltas.front() == 1 && deltas.back() == 99);
+	assert(h.replay_plan(100, deltas) == 0 && deltas.size() == 51);
+}
+
+void test_engine(){
+	const size_t n = 10;
+	std::vector<KeyRef<engine_t, &engine, step_t>> steps;
+	for(id_t i=0; i<n; i++){
+		steps.push_back(engine_t::make_input<step_t, &engine>(step_t{1}));
+		engine.append_chain<state_t>(i, i == 0 ? engine_t::invalid_id : i - 1);
+		engine.emplace<state_t>(state_key(i), state_t{int(i)});
+		engine.note_computed<state_t>(state_key(i));
+	}
+	auto const& h = engine.chain_history<state_t>();
+	assert(h.is_computed(9) && h.pinned_level() == 1);
+
+	// dropping the last ref keeps checkpoints, and evicts the rest
+	{ KeyRef<engine_t, &engine, state_t> ref(state_key(4)); }
+	{ KeyRef<engine_t, &engine, state_t> ref(state_key(3)); }
+	assert(h.is_computed(4) && !h.is_computed(3));
+
+	// the non-checkpoints go from the cache first
+	engine.trim_cache(5 * sizeof(state_t));
+	for(id_t i=0; i<n; i++)
+		assert(h.is_computed(i) == (i % 2 == 0));
+
+	std::vector<id_t> ids;
+	assert(engine.chain_replay<state_t>(state_key(9), ids) == 8);
+	assert((ids == std::vector<id_t>{9}));
+	assert(engine.chain_replay<state_t>(state_key(6), ids) == 6 && ids.empty());
+
+	engine.trim_cache(0);
+	assert(engine.chain_replay<state_t>(state_key(9), ids) == engine_t::invalid_id);
+	assert(ids.size() == n && ids.front() == 0);
+}
+
+int main(){
+	test_history();
+	test_engine();
+	std::cout << "chain_history: ok" << std::endl;
+	return 0;
+}
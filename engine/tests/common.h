@@ -0,0 +1,28 @@
+/*
+	Included first by each of the tests, which are plain programs that assert
+	what they check and return 0, see "make test" in the makefile.  Unlike
+	main.cpp they leave NDEBUG undefined, so the engine's own asserts are on too.
+
+	Like main.cpp, the engine's headers expect these to be included already.
+*/
+
+#ifndef _TESTS_COMMON_H_
+#define _TESTS_COMMON_H_
+
+#include <iostream>
+#include <string>
+#include <memory>
+#include <cassert>
+#include <vector>
+#include <unordered_map>
+#include <tuple>
+#include <iterator>
+#include <type_traits>
+#include <algorithm>
+#include <chrono>
+#include <atomic>
+
+#include "tmp_utils.h"
+#include "engine.h"
+
+#endif // _TESTS_COMMON_H_
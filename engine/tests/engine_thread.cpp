@@ -0,0 +1,125 @@
+/*
+	The engine thread: it's the main thread as soon as start returns, after
+	that inputs made on other threads are made on the main thread (interned
+	ones still share an id), and an engine destroyed while its workers are
+	still running nodes joins them before the members their tasks use
+	(wakeup, node_stats etc.) go away.  Jobs posted as it stops still run.
+*/
+
+#include "common.h"
+#include <thread>
+#include <memory>
+
+using id_t = uint32_t;
+
+struct name_t{
+	static const bool interned = true;
+	std::string _0;
+	std::string intern_key() const { return _0; }
+};
+
+struct pos_t{
+	int _0;
+};
+
+struct speed_func{
+	using upstream = utils::type_list<pos_t>;
+	std::array<void const*, 1> upstream_values;
+	int speed = 0;
+};
+
+using engine_t = Engine<64, id_t, name_t, pos_t, speed_func>;
+engine_t engine;
+using dispatcher_t = Dispatcher<engine_t, &engine>;
+dispatcher_t dispatcher;
+
+void test_inputs_after_start(){
+	auto before = dispatcher.make_input<pos_t>(pos_t{1}); // this is the main thread, until start
+	assert(engine.is_main_thread());
+	engine.start();
+	assert(!engine.is_main_thread()); // straight away, not once the engine thread gets going
+	std::vector<KeyRef<engine_t, &engine, pos_t>> refs;
+	std::vector<KeyRef<engine_t, &engine, name_t>> names;
+	std::mutex refs_mutex;
+	std::vector<std::thread> users;
+	for(int t=0; t<3; t++)
+		users.emplace_back([&, t]{
+			for(int i=0; i<5; i++){
+				auto pos = dispatcher.make_input<pos_t>(pos_t{t * 10 + i});
+				auto name = dispatcher.make_input<name_t>(name_t{"same"});
+				std::lock_guard<std::mutex> lock(refs_mutex);
+				refs.push_back(std::move(pos));
+				names.push_back(std::move(name));
+			}
+		});
+	for(auto& u : users)
+		u.join();
+	auto here = dispatcher.make_input<pos_t>(pos_t{99}); // not the main thread any more either
+
+	assert(refs.size() == 15 && names.size() == 15);
+	std::vector<id_t> ids{before.cget_key()[0], here.cget_key()[0]};
+	for(auto& r : refs)
+		ids.push_back(r.cget_key()[0]);
+	std::sort(ids.begin(), ids.end());
+	assert(std::unique(ids.begin(), ids.end()) == ids.end());
+	for(auto const& n : names)
+		assert(n.cget_key()[0] == names[0].cget_key()[0]);
+	assert(here.cget()._0 == 99);
+
+	// dropped here and evicted by the engine thread, before stop
+	while(!names.empty())
+		names.pop_back();
+	while(!refs.empty())
+		refs.pop_back();
+	engine.stop();
+}
+
+void test_destroy_while_running(){
+	std::atomic<int> n_run{0};
+	{
+		auto local = std::unique_ptr<engine_t>(new engine_t());
+		local->start();
+		for(int i=0; i<50; i++)
+			local->schedule<speed_func>([&]{
+				std::this_thread::sleep_for(std::chrono::microseconds(200));
+				n_run++;
+			});
+	} // stops the engine thread, then drains and joins the workers
+	assert(n_run == 50);
+}
+
+void test_start_stop(){
+	for(int i=0; i<50; i++){
+		engine.start();
+		assert(!engine.is_main_thread());
+		engine.stop();
+		assert(engine.is_main_thread());
+	}
+
+	// a job posted after the engine thread's last poll still runs, so inputs
+	// made while it stops don't wait forever
+	for(int i=0; i<50; i++){
+		engine.start();
+		std::atomic<bool> done{false};
+		std::atomic<int> n_made{0};
+		std::thread user([&]{
+			while(!done){
+				auto pos = dispatcher.make_input<pos_t>(pos_t{n_made});
+				n_made++;
+			}
+		});
+		while(n_made == 0)
+			std::this_thread::yield();
+		engine.stop(); // the user thread is the main thread from here on
+		done = true;
+		user.join();
+	}
+}
+
+int main(){
+	test_inputs_after_start();
+	test_start_stop();
+	test_destroy_while_running();
+	std::cout << "engine_thread: ok" << std::endl;
+	return 0;
+}
@@ -0,0 +1,96 @@
+/*
+	Epoch-based reclamation: a deleted KVP is only retired while any epoch it
+	could have been read in is still pinned, and destroyed by a later reclaim.
+	Through the engine, a scheduled node's guard keeps the upstream values it
+	was bound to alive while the main thread evicts them.
+*/
+
+#include "common.h"
+#include <thread>
+
+using id_t = uint32_t;
+
+std::atomic<int> n_destroyed{0};
+
+struct pos_t{
+	int _0;
+	int magic = 42;
+	pos_t(int v) : _0(v) {}
+	pos_t(pos_t const& other) = default;
+	~pos_t(){
+		magic = 0;
+		n_destroyed++;
+	}
+};
+
+struct speed_func{
+	using upstream = utils::type_list<pos_t>;
+	std::array<void const*, 1> upstream_values;
+	pos_t const& pos() const { return *static_cast<pos_t const*>(upstream_values[0]); }
+	int speed = 0;
+};
+
+using engine_t = Engine<64, id_t, pos_t, speed_func>;
+engine_t engine;
+using dispatcher_t = Dispatcher<engine_t, &engine>;
+dispatcher_t dispatcher;
+
+void test_epochs(){
+	Epochs& epochs = Epochs::get();
+	while(!epochs.try_advance()) ; // nothing's pinned
+	const uint64_t e = epochs.current();
+	auto guard = epochs.pin();
+	assert(epochs.n_pinned() == 1);
+	assert(epochs.try_advance()); // to e+1, as nothing's pinned in e-1
+	assert(!epochs.try_advance()); // not to e+2, the guard in e may still read something retired in e
+	assert(!epochs.is_safe(e));
+	auto copy = guard;
+	guard.release();
+	assert(!epochs.try_advance() && epochs.n_pinned() == 1);
+	copy.release();
+	assert(epochs.try_advance() && epochs.is_safe(e) && epochs.n_pinned() == 0);
+}
+
+void test_engine(){
+	auto pos = dispatcher.make_input<pos_t>(pos_t(7));
+	const engine_t::q_key_t<speed_func> key{{ id_t(engine_t::prefix_for<speed_func>()), pos.cget_key()[0] }};
+	auto& q = engine.emplace<speed_func>(key, speed_func{});
+	KeyRef<engine_t, &engine, speed_func> speed_ref(key);
+	engine.bind_upstream(q, key);
+	const int destroyed_before = n_destroyed;
+
+	// the node reads pos only after the main thread has evicted it
+	std::atomic<bool> evicted{false}, done{false};
+	engine.schedule<speed_func>(key, [&]{
+		while(!evicted)
+			std::this_thread::yield();
+		q.speed = q.pos()._0 * q.pos().magic;
+		done = true;
+	});
+	{
+		auto dropped = std::move(pos); // the last ref, so it's deleted right away
+	}
+	auto const s = engine.stats().store;
+	assert(s.n_retired == 1 && s.per_prefix[engine_t::prefix_for<pos_t>()].deletes == 1);
+	engine.poll(); // reclaims what it can, which isn't pos
+	assert(n_destroyed == destroyed_before);
+	evicted = true;
+	while(!done)
+		std::this_thread::yield();
+	assert(q.speed == 7 * 42);
+
+	// the guard is released just after the body returns
+	const auto t0 = std::chrono::steady_clock::now();
+	while(engine.stats().store.n_retired != 0 && std::chrono::steady_clock::now() - t0 < std::chrono::seconds(5)){
+		std::this_thread::yield();
+		engine.poll();
+	}
+	assert(engine.stats().store.n_retired == 0 && n_destroyed == destroyed_before + 1);
+}
+
+int main(){
+	test_epochs();
+	test_engine();
+	std::cout << "epoch: ok" << std::endl;
+	return 0;
+}
@@ -0,0 +1,105 @@
+/*
+	The shape of the fused loops the generator emits for nodes with a map=X hint
+	(see FusedMap in generate_cpp.py): one pass over each chunk of xy, running
+	every member's kernel and writing each of their returns, gives the same
+	arrays as running the members on their own.
+*/
+
+#include "common.h"
+#include <cmath>
+
+using id_t = uint32_t;
+
+struct point{
+	int16_t x, y;
+};
+
+using xy_array_t = ChunkedArray<point, 1000>;
+
+struct xy_t{
+	xy_array_t _0;
+};
+
+struct xy_map_fused_func;
+
+struct speed_func{
+	static const int cpu = 0;
+	using upstream = utils::type_list<xy_t>;
+	using fused_into = xy_map_fused_func;
+	ChunkedArray<float, 1000> speed;
+};
+
+struct dist_to_boundary_func{
+	static const int cpu = 0;
+	using upstream = utils::type_list<xy_t>;
+	using fused_into = xy_map_fused_func;
+	ChunkedArray<float, 1000> dist_to_boundary;
+};
+
+struct xy_map_fused_func{
+	static const int cpu = 0;
+	using upstream = utils::type_list<xy_t>;
+	ChunkedArray<float, 1000> speed;
+	ChunkedArray<float, 1000> dist_to_boundary;
+};
+
+using engine_t = Engine<64, id_t, xy_t, speed_func, dist_to_boundary_func, xy_map_fused_func>;
+engine_t engine;
+
+static_assert(std::is_same<utils::fused_into<speed_func>::type, xy_map_fused_func>::value, "");
+static_assert(std::is_same<utils::fused_into<xy_t>::type, xy_t>::value, "");
+
+// the members' kernels, as the generator pulls them out of their parallel_maps
+auto speed_kernel(xy_array_t const& xy){
+	return [&xy](point p, size_t i){
+		const point p_old = i > 0 ? xy[i-1] : p;
+		return std::hypot(float(p_old.x - p.x), float(p_old.y - p.y)) * 50;
+	};
+}
+
+auto dist_kernel(bool is_circle){
+	return [=](point p, size_t){
+		if(is_circle)
+			return std::hypot(float(p.x - 100), float(p.y - 100));
+		else
+			return float(std::min(std::min(p.x, p.y), int16_t(200 - std::max(p.x, p.y))));
+	};
+}
+
+int main(){
+	const size_t n = 12345;
+	xy_array_t xy(n);
+	for(size_t i=0; i<n; i++)
+		xy.write(point{int16_t(i % 200), int16_t((i * 7) % 200)});
+
+	for(bool is_circle : {true, false}){
+		speed_func speed;
+		dist_to_boundary_func dist;
+		engine.parallel_map<speed_func>(xy, speed.speed, speed_kernel(xy));
+		engine.parallel_map<dist_to_boundary_func>(xy, dist.dist_to_boundary, dist_kernel(is_circle));
+
+		xy_map_fused_func fused;
+		auto const speed_k = speed_kernel(xy);
+		auto const dist_k = dist_kernel(is_circle);
+		fused.speed.allocate(n);
+		fused.dist_to_boundary.allocate(n);
+		engine.parallel_for_chunks<xy_map_fused_func>(xy, [&](size_t c){
+			auto const src_c = xy.cchunk(c);
+			auto const speed_c = fused.speed.chunk_data(c);
+			auto const dist_c = fused.dist_to_boundary.chunk_data(c);
+			for(size_t j=0, m=xy.chunk_size(c), i=c*xy.chunk_len; j<m; j++, i++){
+				speed_c[j] = speed_k(src_c[j], i);
+				dist_c[j] = dist_k(src_c[j], i);
+			}
+			fused.speed.finish_chunk(c);
+			fused.dist_to_boundary.finish_chunk(c);
+		});
+
+		for(size_t i=0; i<n; i++){
+			assert(fused.speed[i] == speed.speed[i]);
+			assert(fused.dist_to_boundary[i] == dist.dist_to_boundary[i]);
+		}
+	}
+	std::cout << "fused_map: ok" << std::endl;
+	return 0;
+}
@@ -0,0 +1,41 @@
+/*
+	kernels::in_range compiles for every element type, not only the ones with an
+	avx2 version (so a double or uint16_t ChunkedArray used to fail to build),
+	and gives the same mask with and without SIMD.
+*/
+
+#include "common.h"
+#include <random>
+
+template<typename T>
+void check(T lo, T hi){
+	const size_t n = 2500; // a ragged last chunk, and a ragged last word in each
+	ChunkedArray<T, 1000> vals(n);
+	std::mt19937 rng(7);
+	for(size_t i=0; i<n; i++)
+		vals[i] = T(rng() % 200);
+
+	BitMask<1000> masks[2];
+	for(bool simd : {false, true}){
+		kernels::use_simd(simd);
+		kernels::in_range(vals, lo, hi, masks[simd]);
+	}
+	size_t count = 0;
+	for(size_t i=0; i<n; i++){
+		const bool expected = vals[i] > lo && vals[i] < hi;
+		assert(masks[0][i] == expected && masks[1][i] == expected);
+		count += expected;
+	}
+	assert(masks[0].count() == count && masks[1].count() == count);
+}
+
+int main(){
+	check<float>(10, 150);
+	check<int16_t>(10, 150);
+	check<int32_t>(10, 150);
+	check<double>(10, 150);   // scalar only
+	check<uint16_t>(10, 150); // scalar only
+	check<uint8_t>(0, 100);   // scalar only
+	std::cout << "in_range: ok" << std::endl;
+	return 0;
+}
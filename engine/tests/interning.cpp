@@ -0,0 +1,62 @@
+/*
+	Interned inputs, and aliases in the same intern domain, see Engine::make_input.
+*/
+
+#include "common.h"
+
+using id_t = uint32_t;
+
+struct file_name_t{
+	static const bool interned = true;
+	std::string _0;
+	std::string intern_key() const { return _0; }
+};
+
+struct pos_file_name_t{
+	// an alias, so shares file_name_t's ids
+	using intern_domain = file_name_t;
+	static const bool interned = true;
+	std::string _0;
+	std::string intern_key() const { return _0; }
+};
+
+struct trial_t{
+	int _0;
+};
+
+using engine_t = Engine<64, id_t, file_name_t, pos_file_name_t, trial_t>;
+engine_t engine;
+
+template<typename Q>
+id_t id_of(KeyRef<engine_t, &engine, Q> const& ref){
+	return ref.cget_key()[0];
+}
+
+int main(){
+	auto a = engine_t::make_input<file_name_t, &engine>(file_name_t{"r1.set"});
+	auto b = engine_t::make_input<file_name_t, &engine>(file_name_t{"r1.set"});
+	auto c = engine_t::make_input<file_name_t, &engine>(file_name_t{"r2.set"});
+	assert(id_of(a) == id_of(b) && id_of(a) != id_of(c));
+	assert(engine.stats<file_name_t>().hits() == 1 && engine.stats<file_name_t>().misses() == 2);
+
+	// same string, same id, but its own KVP
+	auto p = engine_t::make_input<pos_file_name_t, &engine>(pos_file_name_t{"r2.set"});
+	assert(id_of(p) == id_of(c) && p.cget()._0 == "r2.set");
+
+	// not interned, so always a new id
+	auto t1 = engine_t::make_input<trial_t, &engine>(trial_t{1});
+	auto t2 = engine_t::make_input<trial_t, &engine>(trial_t{1});
+	assert(id_of(t1) != id_of(t2));
+
+	// once nothing in the domain holds it, the string is forgotten
+	const id_t old_id = id_of(c);
+	{ auto moved = std::move(c); }
+	auto c2 = engine_t::make_input<file_name_t, &engine>(file_name_t{"r2.set"});
+	assert(id_of(c2) == old_id); // p still holds it
+	{ auto moved_p = std::move(p); auto moved_c = std::move(c2); }
+	auto c3 = engine_t::make_input<file_name_t, &engine>(file_name_t{"r2.set"});
+	assert(id_of(c3) != old_id);
+
+	std::cout << "interning: ok" << std::endl;
+	return 0;
+}
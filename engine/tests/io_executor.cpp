@@ -0,0 +1,128 @@
+/*
+	disk=True nodes run on the io_executor, so they aren't held up by busy CPU
+	workers, and batched reads (io_uring, or preads on the I/O threads).
+*/
+
+#include "common.h"
+#include <cstdio>
+#include <fcntl.h>
+
+using id_t = uint32_t;
+
+struct file_name_t{
+	std::string _0;
+};
+
+struct axona_file_func{
+	static const bool disk = true;
+	using upstream = utils::type_list<file_name_t>;
+	int header;
+};
+
+struct speed_func{
+	using upstream = utils::type_list<axona_file_func>;
+	int speed;
+};
+
+using engine_t = Engine<64, id_t, file_name_t, axona_file_func, speed_func>;
+engine_t engine;
+
+void test_disk_nodes(){
+	// fill every CPU worker with nodes that wait for the disk node
+	std::atomic<bool> disk_done{false};
+	std::atomic<size_t> n_cpu_done{0};
+	const size_t n_blockers = 2 * std::max(1u, std::thread::hardware_concurrency());
+	for(size_t i=0; i<n_blockers; i++)
+		engine.schedule<speed_func>([&]{
+			while(!disk_done)
+				std::this_thread::yield();
+			n_cpu_done++;
+		});
+	const auto main_id = std::this_thread::get_id();
+	engine.schedule<axona_file_func>([&]{
+		assert(std::this_thread::get_id() != main_id);
+		disk_done = true;
+	});
+	// the runs are recorded just after the bodies return
+	while(engine.stats<speed_func>().runs() < n_blockers || engine.stats<axona_file_func>().runs() < 1)
+		std::this_thread::yield();
+	assert(n_cpu_done == n_blockers);
+}
+
+const char* path = "build/tests/io_executor.bin";
+const size_t len = 1 << 20;
+
+std::vector<uint8_t> write_file(){
+	std::vector<uint8_t> data(len);
+	for(size_t i=0; i<len; i++)
+		data[i] = uint8_t(i * 7);
+	FILE* f = fopen(path, "wb");
+	assert(f != nullptr);
+	fwrite(data.data(), 1, len, f);
+	fclose(f);
+	return data;
+}
+
+void test_reads(){
+	const std::vector<uint8_t> data = write_file();
+	const int fd = open(path, O_RDONLY);
+	assert(fd >= 0);
+	IoExecutor io(2);
+	const size_t n = 5, block = 64 << 10;
+	std::vector<uint8_t> dest(n * block);
+	std::vector<ReadRequest> requests;
+	for(size_t i=0; i<n; i++) // the last one runs off the end of the file
+		requests.push_back(ReadRequest{fd, &dest[i*block], i == n-1 ? len - 100 : i*3*block, block, i});
+	io.submit_reads(requests.data(), requests.data() + n);
+
+	std::vector<ssize_t> results(n, -1);
+	size_t n_done = 0;
+	while(n_done < n)
+		n_done += io.wait_completions([&](ReadCompletion const& c){ results[c.tag] = c.result; });
+	assert(io.in_flight() == 0);
+	for(size_t i=0; i<n; i++){
+		assert(results[i] == ssize_t(i == n-1 ? 100 : block));
+		assert(std::equal(&dest[i*block], &dest[i*block] + results[i], &data[requests[i].offset]));
+	}
+	close(fd);
+	std::remove(path);
+}
+
+void test_engine_reads(){
+	/* through the engine, with its thread collecting the completions */
+	const std::vector<uint8_t> data = write_file();
+	const int fd = open(path, O_RDONLY);
+	assert(fd >= 0);
+	engine.start();
+	const size_t n = 4, block = 4096;
+	std::vector<uint8_t> dest(n * block);
+	std::vector<ReadRequest> requests;
+	for(size_t i=0; i<n; i++)
+		requests.push_back(ReadRequest{fd, &dest[i*block], i*5*block + 1, block, 100 + i});
+	std::vector<std::atomic<ssize_t>> results(n);
+	for(auto& r : results)
+		r = -1;
+	std::atomic<size_t> n_done{0};
+	engine.read_async(requests, [&](ReadCompletion const& c){
+		assert(engine.is_main_thread());
+		results[c.tag - 100] = c.result;
+		n_done++;
+	});
+	while(n_done < n)
+		std::this_thread::yield();
+	engine.stop();
+	for(size_t i=0; i<n; i++){
+		assert(results[i] == ssize_t(block));
+		assert(std::equal(&dest[i*block], &dest[i*block] + block, &data[requests[i].offset]));
+	}
+	close(fd);
+	std::remove(path);
+}
+
+int main(){
+	test_disk_nodes();
+	test_reads();
+	test_engine_reads();
+	std::cout << "io_executor: ok" << std::endl;
+	return 0;
+}
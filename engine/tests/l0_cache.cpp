@@ -0,0 +1,109 @@
+/*
+	The per-thread L0 cache in front of unordered_map::find never returns a KVP
+	that has been deleted, retired or moved by attempt_clear_tombstones, even
+	with another thread finding the same keys while the main thread changes the
+	table.
+*/
+
+#include "common.h"
+#include <thread>
+
+using id_t = uint32_t;
+
+struct pos_t{
+	id_t _0; // the same as its key, so readers can check they got the right one
+};
+
+using store_t = SlotClassStore<KeyValueHeader, id_t, 256, pos_t>;
+
+void insert(store_t& store, id_t id){
+	auto p = store.insert<pos_t>(&id, &id + 1);
+	assert(p != nullptr);
+	p->template placement_new_value<pos_t>(pos_t{id});
+}
+
+pos_t const* find(store_t& store, id_t id){
+	auto p = store.find<pos_t>(&id, &id + 1);
+	return p == nullptr ? nullptr : &p->template cget<pos_t>();
+}
+
+void del(store_t& store, id_t id){
+	store.delete_(store_t::prefix_for<pos_t>(), &id, &id + 1);
+}
+
+void test_single_thread(){
+	store_t store;
+	for(id_t i=0; i<40; i++)
+		insert(store, i);
+	for(id_t i=0; i<40; i++)
+		assert(find(store, i)->_0 == i); // and now cached
+
+	// deleted, with and without a reader pinned
+	del(store, 3);
+	assert(find(store, 3) == nullptr);
+	{
+		auto guard = Epochs::get().pin();
+		del(store, 4);
+		assert(store.stats().n_retired == 1);
+		assert(find(store, 4) == nullptr);
+	}
+	store.reclaim();
+	assert(find(store, 4) == nullptr);
+
+	// moved closer to their hash
+	for(id_t i=0; i<40; i += 3)
+		del(store, i);
+	store.attempt_clear_tombstones();
+	for(id_t i=0; i<40; i++){
+		pos_t const* p = find(store, i);
+		assert(i % 3 == 0 || i == 4 ? p == nullptr : p != nullptr && p->_0 == i);
+	}
+
+	// and reinserted, maybe somewhere else
+	for(id_t i=0; i<40; i += 3)
+		insert(store, i);
+	for(id_t i=0; i<40; i++)
+		assert(i == 4 ? find(store, i) == nullptr : find(store, i)->_0 == i);
+}
+
+void test_threads(){
+	store_t store;
+	const id_t n = 48;
+	for(id_t i=0; i<n; i++)
+		insert(store, i);
+
+	std::atomic<bool> stop{false};
+	std::atomic<size_t> n_found{0};
+	std::thread reader([&]{
+		while(!stop){
+			auto guard = Epochs::get().pin();
+			for(id_t i=0; i<n; i++){
+				pos_t const* p = find(store, i);
+				if(p != nullptr){
+					assert(p->_0 == i);
+					n_found++;
+				}
+			}
+		}
+	});
+	while(n_found == 0)
+		std::this_thread::yield(); // the reader has started, and cached some
+	for(int round=0; round<300; round++){
+		for(id_t i=round % 5; i<n; i += 5)
+			del(store, i);
+		store.attempt_clear_tombstones();
+		for(id_t i=round % 5; i<n; i += 5)
+			insert(store, i);
+		store.reclaim();
+		std::this_thread::yield(); // let the reader in, even on one core
+	}
+	stop = true;
+	reader.join();
+}
+
+int main(){
+	test_single_thread();
+	test_threads();
+	std::cout << "l0_cache: ok" << std::endl;
+	return 0;
+}
@@ -0,0 +1,64 @@
+/*
+	MappedBuffer, read straight from the mapping as spike_times and both_xy do,
+	and kept in the store as part of a node's value.
+*/
+
+#include "common.h"
+#include <cstdio>
+#include <cstring>
+
+using id_t = uint32_t;
+
+struct file_name_t{
+	std::string _0;
+};
+
+struct axona_file_func{
+	using upstream = utils::type_list<file_name_t>;
+	MappedBuffer buffer;
+};
+
+using engine_t = Engine<64, id_t, file_name_t, axona_file_func>;
+engine_t engine;
+
+int main(){
+	const std::string path = "build/tests/mapped_file.bin";
+	const size_t record_len = 16, n_records = 1000, header_len = 10;
+	{
+		FILE* f = fopen(path.c_str(), "wb");
+		assert(f != nullptr);
+		fwrite("data_start", 1, header_len, f);
+		for(uint32_t i=0; i<n_records; i++){
+			uint8_t record[record_len] = {};
+			std::memcpy(record, &i, sizeof(i));
+			fwrite(record, 1, record_len, f);
+		}
+		fclose(f);
+	}
+
+	assert(!MappedBuffer::open("build/tests/no_such_file", 64).is_valid());
+	MappedBuffer f = MappedBuffer::open(path, 4096);
+	assert(f.is_valid() && f.length() == header_len + record_len*n_records);
+	assert(std::memcmp(f.data(), "data_start", header_len) == 0);
+
+	auto name = engine_t::make_input<file_name_t, &engine>(file_name_t{path});
+	const engine_t::q_key_t<axona_file_func> key{{ id_t(engine_t::prefix_for<axona_file_func>()), name.cget_key()[0] }};
+	engine.emplace<axona_file_func>(key, axona_file_func{f.subview(header_len)});
+	KeyRef<engine_t, &engine, axona_file_func> ref(key);
+	f = MappedBuffer(); // the stored view keeps the mapping alive
+
+	MappedBuffer const& buffer = ref.cget().buffer;
+	assert(buffer.length() == record_len*n_records && buffer.n_blocks() == 4);
+	assert(buffer.block_length(3) == record_len*n_records - 3*4096);
+	uint32_t expected = 0;
+	buffer.for_each_record(record_len, [&](uint8_t const* c){
+		uint32_t v;
+		std::memcpy(&v, c, sizeof(v));
+		assert(v == expected++);
+	});
+	assert(expected == n_records);
+
+	std::remove(path.c_str());
+	std::cout << "mapped_file: ok" << std::endl;
+	return 0;
+}
@@ -0,0 +1,44 @@
+/*
+	page_alloc: every combination of Pages and Numa policy gives usable, zeroed
+	memory (placement and huge pages are only hints), small arrays come from the
+	heap, and place() reports what it couldn't do rather than reading an unset
+	mode.
+*/
+
+#include "common.h"
+
+using namespace page_alloc;
+
+void check_array(Policy const& policy, size_t n){
+	auto a = make_array<uint32_t>(n, policy);
+	assert(a.get_deleter().is_mapped() == (n * sizeof(uint32_t) >= policy.min_bytes));
+	for(size_t i=0; i<n; i++)
+		assert(a[i] == 0 || !a.get_deleter().is_mapped());
+	for(size_t i=0; i<n; i++)
+		a[i] = uint32_t(i);
+	for(size_t i=0; i<n; i += 4093)
+		assert(a[i] == i);
+}
+
+int main(){
+	for(Pages pages : {Pages::normal, Pages::transparent_huge, Pages::explicit_huge})
+		for(Numa numa : {Numa::default_policy, Numa::interleave, Numa::bind}){
+			Policy policy;
+			policy.pages = pages;
+			policy.numa = numa;
+			check_array(policy, 3 << 20);
+			check_array(policy, 100); // under min_bytes
+		}
+
+	std::vector<char> buf(8192);
+	Policy policy;
+	assert(place(buf.data(), buf.size(), policy)); // default_policy is a no-op
+	policy.numa = Numa::bind;
+	policy.node = 64; // out of the mask's range
+	assert(!place(buf.data(), buf.size(), policy));
+	policy.numa = Numa(7); // not a Numa, e.g. from a bad config value
+	assert(!place(buf.data(), buf.size(), policy));
+
+	std::cout << "page_alloc: ok" << std::endl;
+	return 0;
+}
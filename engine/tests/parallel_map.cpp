@@ -0,0 +1,77 @@
+/*
+	CPU=N nodes split their element-wise loops into chunk tasks on the workers,
+	see Engine::parallel_map and parallel_for_chunks.
+*/
+
+#include "common.h"
+#include <set>
+#include <mutex>
+
+using id_t = uint32_t;
+
+struct xy_t{
+	int _0;
+};
+
+struct speed_func{
+	static const int cpu = 4;
+	using upstream = utils::type_list<xy_t>;
+};
+
+struct dist_func{
+	static const int cpu = 0; // CPU=auto
+	using upstream = utils::type_list<xy_t>;
+};
+
+struct dwell_func{
+	using upstream = utils::type_list<speed_func>; // CPU=1
+};
+
+using engine_t = Engine<64, id_t, xy_t, speed_func, dist_func, dwell_func>;
+engine_t engine;
+
+template<typename Q>
+void check_map(size_t expected_parallelism){
+	assert(engine.parallelism_for<Q>() == expected_parallelism);
+	const size_t n = 100003;
+	ChunkedArray<int, 1024> in(n);
+	for(size_t i=0; i<n; i++)
+		in[i] = int(i);
+
+	// the first chunk waits for a second thread to join in (or gives up)
+	std::mutex mutex;
+	std::set<std::thread::id> threads;
+	auto saw_threads = [&]{
+		std::lock_guard<std::mutex> lock(mutex);
+		threads.insert(std::this_thread::get_id());
+		return threads.size();
+	};
+	ChunkedArray<int, 1024> out;
+	engine.parallel_map<Q>(in, out, [&](int v, size_t i){
+		const auto t0 = std::chrono::steady_clock::now();
+		if(i == 0 && expected_parallelism > 1)
+			while(saw_threads() < 2 && std::chrono::steady_clock::now() - t0 < std::chrono::seconds(5))
+				std::this_thread::yield();
+		else if(i % 1024 == 0)
+			saw_threads();
+		return v * 2 + 1;
+	});
+	assert(out.length() == n);
+	for(size_t i=0; i<n; i++)
+		assert(out[i] == int(i) * 2 + 1);
+	assert((threads.size() > 1) == (expected_parallelism > 1));
+
+	// parallel_for_chunks visits every chunk once
+	std::vector<std::atomic<int>> visits(in.n_chunks());
+	engine.parallel_for_chunks<Q>(in, [&](size_t c){ visits[c]++; });
+	for(auto const& v : visits)
+		assert(v == 1);
+}
+
+int main(){
+	check_map<speed_func>(4);
+	check_map<dist_func>(std::max(1u, std::thread::hardware_concurrency()) + 1);
+	check_map<dwell_func>(1);
+	std::cout << "parallel_map: ok" << std::endl;
+	return 0;
+}
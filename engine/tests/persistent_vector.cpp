@@ -0,0 +1,88 @@
+/*
+	PersistentVector as the value of a chain's state in the engine, as the
+	generator emits for returns with storage="persistent".
+*/
+
+#include "common.h"
+
+using id_t = uint32_t;
+
+struct cut_delta_t{
+	static const auto accompanying_key_n = 1;
+	size_t first, n;
+	uint8_t group;
+};
+
+struct cut_state_func{
+	using upstream = utils::type_list<cut_delta_t>;
+	using chain_over = cut_delta_t;
+	PersistentVector<uint8_t> group_nums;
+};
+
+using engine_t = Engine<64, id_t, cut_delta_t, cut_state_func>;
+engine_t engine;
+using state_key_t = engine_t::q_key_t<cut_state_func>;
+
+state_key_t state_key(id_t delta){
+	return state_key_t{{ id_t(engine_t::prefix_for<cut_state_func>()), delta }};
+}
+
+void test_vector(){
+	using vec_t = PersistentVector<int, 2>; // 4 element chunks
+	vec_t a(40, 7);
+	assert(a.size() == 40 && a.n_chunks() == 10 && a.unshared_bytes() == 0);
+	vec_t b = a;
+	b.set(5, 1);
+	assert(a[5] == 7 && b[5] == 1 && b[4] == 7);
+	assert(!b.shares_chunk_with(a, 1) && b.shares_chunk_with(a, 0) && b.shares_chunk_with(a, 2));
+	b.push_back(3);
+	assert(b.size() == 41 && b[40] == 3 && a.size() == 40);
+	size_t n = 0;
+	b.for_each_chunk([&](int const* begin, int const* end, size_t first){
+		assert(first == n);
+		n += end - begin;
+	});
+	assert(n == 41);
+}
+
+void test_engine(){
+	// each iteration copies the previous state and paints a few elements
+	const size_t n_spikes = 1 << 20;
+	std::vector<KeyRef<engine_t, &engine, cut_delta_t>> deltas;
+	std::vector<KeyRef<engine_t, &engine, cut_state_func>> states;
+	for(id_t i=0; i<4; i++){
+		deltas.push_back(engine_t::make_input<cut_delta_t, &engine>(cut_delta_t{1000 + 300*i, 300, uint8_t(i+1)}));
+		engine.append_chain<cut_state_func>(i, i == 0 ? engine_t::invalid_id : i - 1);
+		auto& state = engine.emplace<cut_state_func>(state_key(i),
+				i == 0 ? cut_state_func{PersistentVector<uint8_t>(n_spikes, 0)} : states.back().cget());
+		auto const& d = deltas.back().cget();
+		for(size_t k=d.first; k<d.first+d.n; k++)
+			state.group_nums.set(k, d.group);
+		engine.note_computed<cut_state_func>(state_key(i));
+		states.emplace_back(state_key(i));
+	}
+
+	auto const& s0 = states[0].cget().group_nums;
+	auto const& s3 = states[3].cget().group_nums;
+	assert(s0[1000] == 1 && s3[1000] == 1 && s3[1300] == 2 && s3[1900] == 4 && s0[1900] == 0);
+	size_t shared = 0;
+	for(size_t c=0; c<s3.n_chunks(); c++)
+		shared += s3.shares_chunk_with(s0, c);
+	assert(shared == s3.n_chunks() - 1); // the paints all land in chunk 0
+
+	// evicting earlier states leaves the later ones intact
+	KeyRef<engine_t, &engine, cut_state_func> keep = std::move(states[3]);
+	states.clear();
+	engine.trim_cache(0);
+	assert(!engine.chain_history<cut_state_func>().is_computed(0));
+	auto const& kept = keep.cget().group_nums;
+	assert(kept.size() == n_spikes && kept[1000] == 1 && kept[1950] == 4 && kept[5000] == 0);
+	assert(kept.unshared_bytes() == sizeof(PersistentVector<uint8_t>::chunk_t));
+}
+
+int main(){
+	test_vector();
+	test_engine();
+	std::cout << "persistent_vector: ok" << std::endl;
+	return 0;
+}
@@ -0,0 +1,64 @@
+/*
+	The point kernels give bit-identical results with and without SIMD (so it
+	doesn't matter which machine computed a cached value), and atan2_diff has
+	the same nans as angle_ab in sample.xml.
+*/
+
+#include "common.h"
+#include <cmath>
+#include <random>
+
+struct point{
+	int16_t x, y;
+};
+
+float angle_ab(point a, point b){
+	// as in sample.xml
+	float dx = float(b.x) - float(a.x);
+	float dy = float(b.y) - float(a.y);
+	return std::fabs(dx) > 0.001 && std::fabs(dy) > 0.001 ? std::atan2(dy, dx) : NAN;
+}
+
+bool same_bits(std::vector<float> const& a, std::vector<float> const& b){
+	return a.size() == b.size() && std::memcmp(a.data(), b.data(), a.size()*sizeof(float)) == 0;
+}
+
+int main(){
+	const size_t n = 10007;
+	std::mt19937 rng(1);
+	std::uniform_int_distribution<int> coord(-30000, 30000), small(-2, 2);
+	std::vector<point> a(n), b(n);
+	std::vector<int16_t> ax(n), ay(n), bx(n), by(n);
+	for(size_t i=0; i<n; i++){
+		a[i] = point{int16_t(coord(rng)), int16_t(coord(rng))};
+		// plenty of zero differences in x, y or both
+		b[i] = i % 3 ? point{int16_t(coord(rng)), int16_t(coord(rng))}
+					 : point{int16_t(a[i].x + small(rng)), int16_t(a[i].y + small(rng))};
+		ax[i] = a[i].x; ay[i] = a[i].y; bx[i] = b[i].x; by[i] = b[i].y;
+	}
+	const kernels::PointLanes la{ax.data(), ay.data()}, lb{bx.data(), by.data()};
+
+	std::vector<std::vector<float>> hypots, atans;
+	for(bool simd : {false, true}){
+		kernels::use_simd(simd);
+		std::vector<float> h(n), t(n), h_lanes(n), t_lanes(n);
+		kernels::hypot_diff(a.data(), b.data(), n, h.data());
+		kernels::atan2_diff(a.data(), b.data(), n, t.data());
+		kernels::hypot_diff(la, lb, n, h_lanes.data());
+		kernels::atan2_diff(la, lb, n, t_lanes.data());
+		assert(same_bits(h, h_lanes) && same_bits(t, t_lanes));
+		hypots.push_back(h);
+		atans.push_back(t);
+	}
+	assert(same_bits(hypots[0], hypots[1]));
+	assert(same_bits(atans[0], atans[1]));
+
+	for(size_t i=0; i<n; i++){
+		const float expected = angle_ab(a[i], b[i]);
+		assert(std::isnan(atans[0][i]) == std::isnan(expected));
+		assert(std::isnan(expected) || std::fabs(atans[0][i] - expected) < 1e-4);
+		assert(std::fabs(hypots[0][i] - std::hypot(float(a[i].x - b[i].x), float(a[i].y - b[i].y))) <= 1e-3f * hypots[0][i] + 1e-6f);
+	}
+	std::cout << "point_kernels: ok (" << kernels::isa() << ")" << std::endl;
+	return 0;
+}
@@ -0,0 +1,57 @@
+/*
+	Engine::write_profile_json keys each Q's stats by its prefix, with its
+	q_name as a field, so Qs without a q_name (which are all "?") don't give
+	duplicate keys.
+*/
+
+#include "common.h"
+#include <sstream>
+#include <set>
+
+using id_t = uint32_t;
+
+struct pos_t{
+	int _0;
+};
+
+struct speed_func{
+	using upstream = utils::type_list<pos_t>;
+	static char const* q_name(){ return "speed"; }
+};
+
+struct dir_func{
+	using upstream = utils::type_list<pos_t>; // no q_name, so "?" like pos_t
+};
+
+using engine_t = Engine<64, id_t, pos_t, speed_func, dir_func>;
+engine_t engine;
+
+int main(){
+	engine.schedule<speed_func>([]{});
+	while(engine.stats<speed_func>().runs() == 0)
+		std::this_thread::yield();
+
+	std::ostringstream os;
+	engine.write_profile_json(os);
+	const std::string json = os.str();
+
+	// one entry per Q, with distinct keys
+	std::set<std::string> keys;
+	size_t n_entries = 0;
+	for(size_t p = json.find("\n\""); p != std::string::npos; p = json.find("\n\"", p + 1)){
+		const size_t end = json.find('"', p + 2);
+		keys.insert(json.substr(p + 2, end - p - 2));
+		n_entries++;
+	}
+	assert(n_entries == 3 && keys.size() == 3);
+
+	std::ostringstream speed_key;
+	speed_key << "\"" << engine_t::prefix_for<speed_func>() << "\": {\"name\": \"speed\", \"runs\": 1,";
+	assert(json.find(speed_key.str()) != std::string::npos);
+	std::ostringstream dir_key;
+	dir_key << "\"" << engine_t::prefix_for<dir_func>() << "\": {\"name\": \"?\", \"runs\": 0,";
+	assert(json.find(dir_key.str()) != std::string::npos);
+
+	std::cout << "profile_json: ok" << std::endl;
+	return 0;
+}
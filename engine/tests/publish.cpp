@@ -0,0 +1,106 @@
+/*
+	Engine::publish execs only the callbacks registered for that Q (not those of
+	other Qs with the same full-befores), and can be called from the thread
+	running the node, as progressive_for_chunks' publish lambda is, in which case
+	the callbacks run in the main thread's next poll, provisional one first.
+	The node here is the shape of tac in sample.xml, with a histogram per chunk.
+*/
+
+#include "common.h"
+#include <thread>
+
+using id_t = uint32_t;
+
+struct times_t{
+	ChunkedArray<uint32_t, 256> _0;
+};
+
+struct tac_func{
+	static const int cpu = 0;
+	static const int progressive = 4;
+	using upstream = utils::type_list<times_t>;
+	std::vector<uint32_t> hist;
+};
+
+struct count_func{
+	using upstream = utils::type_list<times_t>; // the same full-befores as tac
+	size_t n;
+};
+
+using engine_t = Engine<64, id_t, times_t, tac_func, count_func>;
+engine_t engine;
+using dispatcher_t = Dispatcher<engine_t, &engine>;
+dispatcher_t dispatcher;
+
+struct Seen{
+	std::vector<std::pair<char, bool>> calls; // which Q, and whether provisional
+	std::thread::id thread;
+};
+
+void got_tac(dispatcher_t::callback_arg<tac_func>::type v, Seen* seen){
+	seen->calls.push_back({'t', v.is_provisional()});
+	seen->thread = std::this_thread::get_id();
+}
+
+void got_count(dispatcher_t::callback_arg<count_func>::type v, Seen* seen){
+	seen->calls.push_back({'c', v.is_provisional()});
+}
+
+const size_t n_bins = 16;
+
+void run_tac(tac_func& q, ChunkedArray<uint32_t, 256> const& times, engine_t::q_key_t<tac_func> const& key){
+	// a histogram per chunk, summed in the publish lambda
+	std::vector<std::vector<uint32_t>> chunk_hists(times.n_chunks(), std::vector<uint32_t>(n_bins));
+	engine.progressive_for_chunks<tac_func>(times, [&](size_t c){
+		auto& hist = chunk_hists[c];
+		for(size_t j=0; j<times.chunk_size(c); j++)
+			hist[times.cchunk(c)[j] % n_bins]++;
+	}, [&](float, bool is_provisional){
+		q.hist.assign(n_bins, 0);
+		for(auto const& hist_c : chunk_hists)
+			for(size_t i=0; i<n_bins; i++)
+				q.hist[i] += hist_c[i];
+		engine.publish<tac_func>(key, is_provisional);
+	});
+}
+
+int main(){
+	const size_t n = 256 * 20 + 3;
+	ChunkedArray<uint32_t, 256> times(n);
+	for(size_t i=0; i<n; i++)
+		times[i] = uint32_t(i * 7);
+	auto times_ref = dispatcher.make_input<times_t>(times_t{times});
+	const id_t times_id = times_ref.cget_key()[0];
+	const engine_t::q_key_t<tac_func> tac_key{{ id_t(engine_t::prefix_for<tac_func>()), times_id }};
+	const engine_t::q_key_t<count_func> count_key{{ id_t(engine_t::prefix_for<count_func>()), times_id }};
+
+	Seen seen;
+	auto tac_cb = dispatcher.make_callback<tac_func, Seen*, got_tac>(&seen, times_id);
+	auto count_cb = dispatcher.make_callback<count_func, Seen*, got_count>(&seen, times_id);
+	engine.emplace<count_func>(count_key, count_func{n});
+	auto& tac = engine.emplace<tac_func>(tac_key, tac_func{});
+	KeyRef<engine_t, &engine, tac_func> tac_ref(tac_key); // so the last poll doesn't trim it before we check it
+
+	// on the main thread, each publish execs just its own Q's callback, straight away
+	engine.publish<count_func>(count_key, false);
+	assert(seen.calls.size() == 1 && seen.calls[0].first == 'c');
+	seen.calls.clear();
+
+	// the node runs elsewhere, once the main thread has started polling
+	engine.poll();
+	std::thread node([&]{ run_tac(tac, times, tac_key); });
+	node.join();
+	assert(seen.calls.empty());
+	engine.poll();
+	assert(seen.calls.size() == 2);
+	assert(seen.calls[0] == std::make_pair('t', true) && seen.calls[1] == std::make_pair('t', false));
+	assert(seen.thread == std::this_thread::get_id());
+
+	std::vector<uint32_t> expected(n_bins);
+	for(size_t i=0; i<n; i++)
+		expected[times[i] % n_bins]++;
+	assert(tac.hist == expected);
+
+	std::cout << "publish: ok" << std::endl;
+	return 0;
+}
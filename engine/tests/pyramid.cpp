@@ -0,0 +1,46 @@
+/*
+	ChunkPyramid gives the same summaries as reading the samples, for ranges
+	within and across chunks, and costs about 1/8th extra memory for floats.
+*/
+
+#include "common.h"
+#include <cmath>
+#include <random>
+
+int main(){
+	const size_t chunk_len = 1 << 14;
+	using array_t = ChunkedArray<float, chunk_len>;
+	const size_t n = 5 * chunk_len + 1234;
+	array_t speed;
+	speed.enable_pyramid();
+	speed.allocate(n);
+	std::mt19937 rng(3);
+	std::uniform_real_distribution<float> dist(0, 100);
+	for(size_t i=0; i<n; i++)
+		speed.write(dist(rng));
+
+	// summaries of whole chunks, ragged ends and single samples
+	std::uniform_int_distribution<size_t> pos(0, n);
+	for(int t=0; t<200; t++){
+		size_t begin = pos(rng), end = pos(rng);
+		if(begin > end)
+			std::swap(begin, end);
+		if(t % 10 == 0)
+			end = std::min(n, begin + 1);
+		RangeSummary<float> expected;
+		for(size_t i=begin; i<end; i++)
+			expected.add(speed[i]);
+		auto got = speed.summarise(begin, end);
+		assert(got.n == expected.n && got.min == expected.min && got.max == expected.max);
+		assert(got.n == 0 || std::fabs(got.mean() - expected.mean()) < 1e-6 * std::fabs(expected.mean()));
+	}
+
+	// the memory claim in pyramid.h
+	static_assert(sizeof(RangeSummary<float>) == 24, "");
+	ChunkPyramid<float, chunk_len> pyramid(10);
+	const double extra = double(pyramid.bytes()) / double(10 * chunk_len * sizeof(float));
+	assert(extra > 0.11 && extra < 0.14);
+
+	std::cout << "pyramid: ok" << std::endl;
+	return 0;
+}
@@ -0,0 +1,100 @@
+/*
+	SlotClassStore puts each Q in the smallest of the 16/32/64/128 byte slot
+	classes it fits, so small KVPs pack several to a cache line, and it behaves
+	as one store: indices are unique over all the tables, and finds, deletes,
+	for_each_valid and stats cover all of them.
+*/
+
+#include "common.h"
+#include <set>
+
+using id_t = uint32_t;
+
+struct tiny_t{
+	int _0; // with a 4 byte key, 8 bytes after the header
+};
+
+struct medium_t{
+	double _0, _1;
+};
+
+struct large_t{
+	double _0[5];
+};
+
+struct huge_t{
+	double _0[12];
+};
+
+using store_t = SlotClassStore<KeyValueHeader, id_t, 64, tiny_t, medium_t, large_t, huge_t>;
+
+static_assert(store_t::table_for<tiny_t>() == 0 && store_t::table_for<medium_t>() == 1 &&
+			  store_t::table_for<large_t>() == 2 && store_t::table_for<huge_t>() == 3, "");
+static_assert(sizeof(store_t::kvp_for<tiny_t>) == 16 && alignof(store_t::kvp_for<tiny_t>) == 16, "4 per line");
+static_assert(sizeof(store_t::kvp_for<medium_t>) == 32 && alignof(store_t::kvp_for<medium_t>) == 32, "2 per line");
+static_assert(sizeof(store_t::kvp_for<huge_t>) == 128, "");
+static_assert(store_t::capacity_ == 4 * 64, "");
+
+template<typename Q>
+void insert(store_t& store, id_t id, Q const& q){
+	const id_t key[1] = {id};
+	auto p = store.insert<Q>(key, key + 1);
+	assert(p != nullptr);
+	p->template placement_new_value<Q>(q);
+}
+
+template<typename Q>
+Q const* find(store_t& store, id_t id){
+	const id_t key[1] = {id};
+	auto p = store.find<Q>(key, key + 1);
+	return p == nullptr ? nullptr : &p->template cget<Q>();
+}
+
+int main(){
+	store_t store;
+	const id_t n = 40;
+	std::set<size_t> indices;
+	for(id_t i=0; i<n; i++){
+		insert(store, i, tiny_t{int(i)});
+		insert(store, i, medium_t{double(i), 1});
+		insert(store, i, large_t{{double(i)}});
+		insert(store, i, huge_t{{double(i)}});
+		for(size_t prefix=0; prefix<4; prefix++){
+			const size_t idx = store.find_index(prefix, &i, &i + 1);
+			assert(idx < store_t::capacity_);
+			indices.insert(idx);
+		}
+	}
+	assert(indices.size() == 4 * n);
+	assert(store.stats().n_valid == 4 * n && store.stats().capacity == store_t::capacity_);
+
+	// the same key in each Q is a different entry
+	for(id_t i=0; i<n; i++){
+		assert(find<tiny_t>(store, i)->_0 == int(i));
+		assert(find<medium_t>(store, i)->_0 == i);
+		assert(find<large_t>(store, i)->_0[0] == i);
+		assert(find<huge_t>(store, i)->_0[0] == i);
+	}
+
+	// delete the odd ones of tiny and huge
+	for(id_t i=1; i<n; i += 2){
+		store.delete_(store_t::prefix_for<tiny_t>(), &i, &i + 1);
+		store.delete_(store_t::prefix_for<huge_t>(), &i, &i + 1);
+	}
+	store.reclaim();
+	for(id_t i=0; i<n; i++){
+		assert((find<tiny_t>(store, i) == nullptr) == (i % 2 == 1));
+		assert((find<huge_t>(store, i) == nullptr) == (i % 2 == 1));
+		assert(find<medium_t>(store, i) != nullptr);
+	}
+	std::array<size_t, 4> per_prefix{};
+	store.for_each_valid([&](size_t idx, auto const& kvp){
+		assert(indices.count(idx) == 1);
+		per_prefix[kvp.key_prefix()]++;
+	});
+	assert(per_prefix[0] == n / 2 && per_prefix[1] == n && per_prefix[2] == n && per_prefix[3] == n / 2);
+	assert(store.stats().n_valid == 3 * n);
+
+	std::cout << "slot_classes: ok" << std::endl;
+	return 0;
+}
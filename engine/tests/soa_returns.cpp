@@ -0,0 +1,97 @@
+/*
+	Returns with layout="soa" in the xml are ChunkedArray<T, N, SoA> (see
+	return_type in generate_cpp.py): node code reads and writes them like the
+	default layout, both directly and as a value in the engine's store, and the
+	kernels' PointLanes forms agree with the interleaved ones.
+*/
+
+#include "common.h"
+#include <cmath>
+
+using id_t = uint32_t;
+
+struct point{
+	int16_t x, y;
+};
+
+struct pos_t{
+	std::vector<point> _0;
+};
+
+// <return name="xy" type="point[]" chunking="1000" layout="soa">
+struct xy_func{
+	static const int cpu = 0;
+	using upstream = utils::type_list<pos_t>;
+	ChunkedArray<point, 1000, SoA> xy;
+};
+
+// the same without layout="soa"
+struct xy_aos_func{
+	using upstream = utils::type_list<pos_t>;
+	ChunkedArray<point, 1000> xy;
+};
+
+using engine_t = Engine<64, id_t, pos_t, xy_func, xy_aos_func>;
+engine_t engine;
+
+template<typename Q>
+engine_t::q_key_t<Q> key_for(id_t pos){
+	return engine_t::q_key_t<Q>{{ id_t(engine_t::prefix_for<Q>()), pos }};
+}
+
+template<typename Q>
+void compute(id_t pos_id, pos_t const& pos){
+	auto& q = engine.emplace<Q>(key_for<Q>(pos_id), Q{});
+	q.xy.allocate(pos._0.size());
+	for(point p : pos._0)
+		q.xy.write(p);
+	engine.note_computed<Q>(key_for<Q>(pos_id));
+}
+
+int main(){
+	const size_t n = 2345;
+	pos_t pos;
+	for(size_t i=0; i<n; i++)
+		pos._0.push_back(point{int16_t(i % 300), int16_t(-int(i * 7 % 500))});
+	auto pos_ref = engine_t::make_input<pos_t, &engine>(pos_t(pos));
+	const id_t pos_id = pos_ref.cget_key()[0];
+
+	compute<xy_func>(pos_id, pos);
+	compute<xy_aos_func>(pos_id, pos);
+	KeyRef<engine_t, &engine, xy_func> soa_ref(key_for<xy_func>(pos_id));
+	KeyRef<engine_t, &engine, xy_aos_func> aos_ref(key_for<xy_aos_func>(pos_id));
+	auto const& soa = soa_ref.cget().xy;
+	auto const& aos = aos_ref.cget().xy;
+
+	// the node-code interface
+	assert(soa.length() == n && soa.n_chunks() == 3);
+	size_t i = 0;
+	for(point p : soa){
+		assert(p.x == aos[i].x && p.y == aos[i].y && soa[i].x == p.x);
+		i++;
+	}
+	assert(i == n);
+	for(size_t c=0; c<soa.n_chunks(); c++){
+		int16_t const* xs = soa.clane(c, 0);
+		int16_t const* ys = soa.clane(c, 1);
+		for(size_t j=0; j<soa.chunk_size(c); j++)
+			assert(xs[j] == aos.cchunk(c)[j].x && ys[j] == aos.cchunk(c)[j].y && soa.cchunk(c)[j].y == ys[j]);
+	}
+
+	// element-wise maps and the kernels
+	ChunkedArray<float, 1000> speed;
+	engine.parallel_map<xy_func>(soa, speed, [&](point p, size_t i){
+		const point p_old = i > 0 ? soa[i-1] : p;
+		return std::hypot(float(p_old.x - p.x), float(p_old.y - p.y));
+	});
+	for(size_t c=0; c<soa.n_chunks(); c++){
+		const size_t m = soa.chunk_size(c);
+		std::vector<float> from_lanes(m), from_points(m);
+		kernels::hypot_diff(kernels::lanes(soa, c), kernels::lanes(soa, c) + 1, m - 1, from_lanes.data());
+		kernels::hypot_diff(aos.cchunk(c), aos.cchunk(c) + 1, m - 1, from_points.data());
+		for(size_t j=0; j+1<m; j++)
+			assert(from_lanes[j] == from_points[j] && std::fabs(from_lanes[j] - speed[c*1000 + j + 1]) < 1e-3f);
+	}
+	std::cout << "soa_returns: ok" << std::endl;
+	return 0;
+}
@@ -0,0 +1,66 @@
+/*
+	The graph the Qs declare (see StaticGraph), and the upstream keys the engine
+	makes from it to bind a node to its args, see Engine::bind_upstream.
+*/
+
+#include "common.h"
+
+using id_t = uint32_t;
+
+struct pos_file_name_t{ int _0; };
+struct set_file_name_t{ int _0; };
+struct trial_t{ int _0; };
+
+struct both_xy_func{
+	using upstream = utils::type_list<pos_file_name_t, set_file_name_t>;
+	int value;
+};
+
+struct speed_func{
+	// full-befores: pos_file_name, set_file_name, trial
+	using upstream = utils::type_list<trial_t, both_xy_func>;
+	int value;
+	std::array<void const*, 2> upstream_values;
+	trial_t const& trial() const { return *static_cast<trial_t const*>(upstream_values[0]); }
+	both_xy_func const& both_xy() const { return *static_cast<both_xy_func const*>(upstream_values[1]); }
+};
+
+using engine_t = Engine<64, id_t, pos_file_name_t, set_file_name_t, trial_t, both_xy_func, speed_func>;
+using graph_t = engine_t::graph_t;
+engine_t engine;
+
+static_assert(graph_t::is_topological(), "");
+static_assert(!StaticGraph<speed_func, trial_t, both_xy_func, pos_file_name_t, set_file_name_t>::is_topological(), "");
+static_assert(utils::key_length<speed_func>::value == 4 && utils::key_length<trial_t>::value == 1, "");
+static_assert(std::is_same<utils::input_closure<speed_func>::type,
+						   utils::type_list<trial_t, pos_file_name_t, set_file_name_t>>::value, "");
+
+int main(){
+	assert(graph_t::index<speed_func>() == 4);
+	assert((graph_t::upstream_indices<speed_func>() == std::array<size_t, 2>{{2, 3}}));
+	const auto adj = graph_t::adjacency();
+	assert(adj[4][3] && adj[4][2] && !adj[4][0] && adj[3][0] && adj[3][1] && !adj[3][2]);
+	assert((graph_t::key_map<speed_func, both_xy_func>() == std::array<size_t, 2>{{1, 2}}));
+
+	// speed's key is {its prefix, trial, pos, set}
+	auto pos = engine_t::make_input<pos_file_name_t, &engine>(pos_file_name_t{1});
+	auto set = engine_t::make_input<set_file_name_t, &engine>(set_file_name_t{2});
+	auto trial = engine_t::make_input<trial_t, &engine>(trial_t{3});
+	const engine_t::q_key_t<speed_func> key{{ id_t(engine_t::prefix_for<speed_func>()),
+				trial.cget_key()[0], pos.cget_key()[0], set.cget_key()[0] }};
+
+	const auto both_key = engine_t::upstream_key<speed_func, both_xy_func>(key);
+	assert(both_key[0] == engine_t::prefix_for<both_xy_func>());
+	assert(both_key[1] == pos.cget_key()[0] && both_key[2] == set.cget_key()[0]);
+	assert((engine_t::upstream_key<speed_func, trial_t>(key) == trial.cget_key()));
+
+	// so a node can be bound to values that were stored under their own keys
+	engine.emplace<both_xy_func>(both_key, both_xy_func{42});
+	KeyRef<engine_t, &engine, both_xy_func> both_ref(both_key);
+	speed_func speed;
+	engine.bind_upstream(speed, key);
+	assert(speed.trial()._0 == 3 && speed.both_xy().value == 42);
+
+	std::cout << "static_graph: ok" << std::endl;
+	return 0;
+}
@@ -0,0 +1,90 @@
+/*
+	Engine::stats: per-Q inserts, deletes and hits (counted per thread and summed
+	on read, with each thread's counters only allocated when it uses a table),
+	the probe histograms, load factor, tombstones, and the number of callbacks
+	in each length bucket.
+*/
+
+#include "common.h"
+#include <thread>
+
+using id_t = uint32_t;
+
+struct pos_t{
+	int _0;
+};
+
+struct speed_func{
+	using upstream = utils::type_list<pos_t>;
+	int speed;
+};
+
+using engine_t = Engine<64, id_t, pos_t, speed_func>;
+engine_t engine;
+using dispatcher_t = Dispatcher<engine_t, &engine>;
+dispatcher_t dispatcher;
+
+void got_speed(dispatcher_t::callback_arg<speed_func>::type, int){}
+
+template<typename Stats>
+uint64_t sum(Stats const& a){
+	uint64_t ret = 0;
+	for(auto n : a)
+		ret += n;
+	return ret;
+}
+
+int main(){
+	const size_t pos_prefix = engine_t::prefix_for<pos_t>();
+	const size_t speed_prefix = engine_t::prefix_for<speed_func>();
+	const auto s0 = engine.stats();
+	assert(s0.store.n_valid == 0 && s0.store.load_factor() == 0);
+	assert(s0.store.counter_bytes == 0); // no thread has used a table yet
+
+	std::vector<KeyRef<engine_t, &engine, pos_t>> pos;
+	for(int i=0; i<20; i++)
+		pos.push_back(dispatcher.make_input<pos_t>(pos_t{i}));
+	const auto s1 = engine.stats();
+	assert(s1.store.per_prefix[pos_prefix].inserts == 20);
+	assert(s1.store.per_prefix[speed_prefix].inserts == 0);
+	assert(s1.store.n_valid == 20 && s1.store.load_factor() == 20.0 / s1.store.capacity);
+	assert(sum(s1.store.entry_probes) == 20);
+	assert(s1.store.counter_bytes > 0 && s1.store.counter_bytes < 4096); // just this thread's, in pos' table
+
+	// lookups from two threads are all counted
+	const uint64_t hits_before = s1.store.per_prefix[pos_prefix].hits;
+	auto read_all = [&]{
+		for(auto& p : pos)
+			assert(p.cget()._0 >= 0);
+	};
+	read_all();
+	std::thread t(read_all);
+	t.join();
+	const auto s2 = engine.stats();
+	assert(s2.store.per_prefix[pos_prefix].hits == hits_before + 40);
+	assert(s2.store.counter_bytes == 2 * s1.store.counter_bytes);
+	uint64_t n_finds = 0;
+	for(auto const& c : s2.store.per_prefix)
+		n_finds += c.hits + c.misses;
+	assert(sum(s2.store.find_probes) == n_finds);
+
+	// deletes, by dropping the refs
+	while(pos.size() > 5)
+		pos.pop_back();
+	engine.trim_cache(0);
+	engine.poll();
+	const auto s3 = engine.stats();
+	assert(s3.store.per_prefix[pos_prefix].deletes == 15);
+	assert(s3.store.n_valid == 5 && sum(s3.store.entry_probes) == 5);
+	assert(s3.store.n_tombstones + s3.store.n_retired <= 15);
+	assert(s3.store.tombstone_ratio() == double(s3.store.n_tombstones) / s3.store.capacity);
+
+	// callbacks, all in the bucket for full-befores of length 1
+	auto cb_a = dispatcher.make_callback<speed_func, int, got_speed>(0, pos[0].cget_key()[0]);
+	auto cb_b = dispatcher.make_callback<speed_func, int, got_speed>(0, pos[1].cget_key()[0]);
+	const auto s4 = engine.stats();
+	assert(s4.callbacks_per_bucket[0] == 2 && sum(s4.callbacks_per_bucket) == 2);
+
+	std::cout << "store_stats: ok" << std::endl;
+	return 0;
+}
@@ -0,0 +1,95 @@
+/*
+	With VENOMOUS_TRACE, the engine records node runs, evictions and callbacks
+	into per-thread buffers once trace::enable is on, and write_chrome_json
+	drains them as Chrome trace events.  Full buffers drop new events and count
+	them rather than overwrite ones the reader may be looking at.
+*/
+
+#define VENOMOUS_TRACE
+#include "common.h"
+#include <sstream>
+
+using id_t = uint32_t;
+
+struct pos_t{
+	int _0;
+};
+
+struct speed_func{
+	using upstream = utils::type_list<pos_t>;
+	int speed;
+	static char const* q_name(){ return "speed"; }
+};
+
+using engine_t = Engine<64, id_t, pos_t, speed_func>;
+engine_t engine;
+using dispatcher_t = Dispatcher<engine_t, &engine>;
+dispatcher_t dispatcher;
+
+void got_speed(dispatcher_t::callback_arg<speed_func>::type, int){}
+
+std::string flush(){
+	std::ostringstream os;
+	trace::write_chrome_json(os);
+	return os.str();
+}
+
+size_t count(std::string const& json, std::string const& what){
+	size_t n = 0;
+	for(size_t p = json.find(what); p != std::string::npos; p = json.find(what, p + 1))
+		n++;
+	return n;
+}
+
+int main(){
+	auto pos = dispatcher.make_input<pos_t>(pos_t{3});
+	const id_t pos_id = pos.cget_key()[0];
+	const engine_t::q_key_t<speed_func> key{{ id_t(engine_t::prefix_for<speed_func>()), pos_id }};
+
+	// off at runtime, nothing is recorded
+	engine.emplace<speed_func>(key, speed_func{1});
+	engine.note_computed<speed_func>(key); // or it's pending, so not trimmed
+	engine.trim_cache(0);
+	assert(count(flush(), "\"name\"") == 0);
+
+	trace::enable(true);
+	{
+		auto cb = dispatcher.make_callback<speed_func, int, got_speed>(0, pos_id);
+		engine.emplace<speed_func>(key, speed_func{2});
+		KeyRef<engine_t, &engine, speed_func> ref(key);
+		engine.publish<speed_func>(key, false);
+		std::atomic<bool> ran{false};
+		engine.schedule<speed_func>(key, [&]{ ran = true; });
+		while(engine.stats<speed_func>().runs() == 0)
+			std::this_thread::yield();
+		assert(ran);
+	}
+	engine.trim_cache(0);
+	// the node span ends just after its run is counted, so it may still be on its way
+	std::string json = flush();
+	assert(json.find("{\"traceEvents\":[") == 0);
+	const auto t0 = std::chrono::steady_clock::now();
+	while(count(json, "\"cat\":\"node\"") == 0 && std::chrono::steady_clock::now() - t0 < std::chrono::seconds(5))
+		json += flush();
+	assert(count(json, "\"cat\":\"node\",\"name\":\"speed\"") == 1);
+	assert(count(json, "\"cat\":\"callback\",\"name\":\"speed\"") == 1);
+	assert(count(json, "\"cat\":\"evict\",\"name\":\"speed\"") == 1);
+	assert(count(json, "\"ph\":\"X\"") >= 2 && count(json, "\"dropped_events\":0") >= 1);
+
+	// it was all drained
+	assert(count(flush(), "\"name\"") == 0);
+
+	// a full buffer drops and counts
+	std::thread t([]{
+		for(size_t i=0; i<trace::ThreadBuffer::capacity + 5; i++)
+			trace::instant("test", "fill", int64_t(i));
+	});
+	t.join();
+	const std::string full = flush();
+	assert(count(full, "\"name\":\"fill\"") == trace::ThreadBuffer::capacity);
+	assert(count(full, "\"dropped_events\":5") == 1);
+	trace::enable(false);
+
+	std::cout << "trace: ok" << std::endl;
+	return 0;
+}
@@ -0,0 +1,92 @@
+/*
+	Values without user refs that are worth keeping (here by the CACHE hint) stay
+	in the store as a cache, which poll trims back to the cache budget, but only
+	when it could have gone over, i.e. something was dropped, computed or
+	published, or the budget shrank, since trim_cache scans the whole store.
+	Values whose node hasn't published the exact value yet are never trimmed.
+*/
+
+#include "common.h"
+#include <thread>
+
+using id_t = uint32_t;
+
+struct pos_t{
+	int _0;
+};
+
+struct speed_func{
+	static const bool cache = true;
+	using upstream = utils::type_list<pos_t>;
+	int speed;
+	size_t bytes() const { return 1000; }
+};
+
+using engine_t = Engine<64, id_t, pos_t, speed_func>;
+engine_t engine;
+using dispatcher_t = Dispatcher<engine_t, &engine>;
+dispatcher_t dispatcher;
+using speed_ref_t = KeyRef<engine_t, &engine, speed_func>;
+
+size_t n_speeds(){
+	return engine.stats().store.per_prefix[engine_t::prefix_for<speed_func>()].inserts -
+		   engine.stats().store.per_prefix[engine_t::prefix_for<speed_func>()].deletes;
+}
+
+int main(){
+	engine.set_cache_budget(5500);
+	std::vector<KeyRef<engine_t, &engine, pos_t>> pos;
+	std::vector<speed_ref_t> speeds;
+	for(int i=0; i<11; i++){
+		pos.push_back(dispatcher.make_input<pos_t>(pos_t{i}));
+		const engine_t::q_key_t<speed_func> key{{ id_t(engine_t::prefix_for<speed_func>()), pos.back().cget_key()[0] }};
+		engine.emplace<speed_func>(key, speed_func{i});
+		engine.note_computed<speed_func>(key);
+		speeds.push_back(speed_ref_t(key));
+	}
+	engine.poll();
+	assert(n_speeds() == 11); // all referenced
+
+	// dropped, so cached, and trimmed to the budget
+	while(speeds.size() > 1)
+		speeds.pop_back();
+	assert(n_speeds() == 11);
+	engine.poll();
+	assert(n_speeds() == 5 + 1);
+
+	// nothing's changed, so nothing to do
+	engine.poll();
+	assert(n_speeds() == 5 + 1);
+
+	// a smaller budget is applied by the next poll
+	engine.set_cache_budget(2500);
+	engine.poll();
+	assert(n_speeds() == 2 + 1);
+
+	// and so is the last ref being dropped
+	speeds.clear();
+	engine.poll();
+	assert(n_speeds() == 2);
+
+	// but not while its node is still running, even between its publishes
+	engine.set_cache_budget(0);
+	engine.poll();
+	assert(n_speeds() == 0);
+	const engine_t::q_key_t<speed_func> key{{ id_t(engine_t::prefix_for<speed_func>()), pos[0].cget_key()[0] }};
+	auto& running = engine.emplace<speed_func>(key, speed_func{0});
+	engine.poll();
+	assert(n_speeds() == 1);
+	std::thread([&]{ running.speed = 1; engine.publish<speed_func>(key, true); }).join();
+	engine.poll();
+	assert(n_speeds() == 1);
+	std::thread([&]{ running.speed = 2; engine.publish<speed_func>(key, false); }).join();
+	engine.poll(); // published, then trimmed
+	assert(n_speeds() == 0);
+
+	// and a publish for one that's gone does nothing
+	engine.publish<speed_func>(key, false);
+	assert(n_speeds() == 0);
+
+	std::cout << "trim_cache: ok" << std::endl;
+	return 0;
+}
@@ -0,0 +1,73 @@
+/*
+	With VENOMOUS_TYPED_STORE the engine's store is a TypedStore: a table per Q,
+	with Q's key length fixed at compile time and Q::store_capacity slots (or the
+	engine's capacity), so a Q's entries never share a probe chain with another
+	Q's.  The engine works the same on top of it.
+*/
+
+#define VENOMOUS_TYPED_STORE
+#include "common.h"
+
+using id_t = uint32_t;
+
+struct pos_t{
+	int _0;
+};
+
+struct speed_func{
+	using upstream = utils::type_list<pos_t>;
+	int speed;
+};
+
+struct dwell_func{
+	static const size_t store_capacity = 16; // rare, so a smaller table
+	using upstream = utils::type_list<speed_func, pos_t>;
+	int dwell;
+};
+
+using engine_t = Engine<64, id_t, pos_t, speed_func, dwell_func>;
+engine_t engine;
+using dispatcher_t = Dispatcher<engine_t, &engine>;
+dispatcher_t dispatcher;
+using store_t = engine_t::store_t;
+
+static_assert(std::is_same<store_t, TypedStore<KeyValueHeader, id_t, 64, pos_t, speed_func, dwell_func>>::value, "");
+static_assert(store_t::n_tables == 3 && store_t::capacity_ == 64 + 64 + 16, "");
+static_assert(store_t::table_for<pos_t>() == 0 && store_t::table_for<dwell_func>() == 2, "");
+
+int main(){
+	// speed and dwell have the same key for each pos, each in its own table
+	const auto speed_prefix = id_t(engine_t::prefix_for<speed_func>());
+	const auto dwell_prefix = id_t(engine_t::prefix_for<dwell_func>());
+	std::vector<KeyRef<engine_t, &engine, pos_t>> pos;
+	std::vector<KeyRef<engine_t, &engine, speed_func>> speeds;
+	std::vector<KeyRef<engine_t, &engine, dwell_func>> dwells;
+	for(int i=0; i<10; i++){
+		pos.push_back(dispatcher.make_input<pos_t>(pos_t{i}));
+		const id_t pos_id = pos.back().cget_key()[0];
+		const engine_t::q_key_t<speed_func> speed_key{{ speed_prefix, pos_id }};
+		const engine_t::q_key_t<dwell_func> dwell_key{{ dwell_prefix, pos_id }};
+		engine.emplace<speed_func>(speed_key, speed_func{i * 10});
+		engine.emplace<dwell_func>(dwell_key, dwell_func{i * 100});
+		speeds.emplace_back(speed_key);
+		dwells.emplace_back(dwell_key);
+	}
+	for(int i=0; i<10; i++)
+		assert(pos[i].cget()._0 == i && speeds[i].cget().speed == i * 10 && dwells[i].cget().dwell == i * 100);
+
+	auto const stats = engine.stats().store;
+	assert(stats.n_valid == 30 && stats.capacity == store_t::capacity_);
+	assert(stats.per_prefix[engine_t::prefix_for<dwell_func>()].inserts == 10);
+
+	// evicting one Q leaves the others
+	while(!dwells.empty())
+		dwells.pop_back();
+	engine.trim_cache(0);
+	engine.poll();
+	assert(engine.stats().store.n_valid == 20);
+	for(int i=0; i<10; i++)
+		assert(speeds[i].cget().speed == i * 10);
+
+	std::cout << "typed_store: ok" << std::endl;
+	return 0;
+}
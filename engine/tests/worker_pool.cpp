@@ -0,0 +1,68 @@
+/*
+	WorkerPool: every task runs exactly once, whether it's queued while the
+	workers are busy, asleep, or being stopped (the destructor drains what's
+	left before the threads exit), and nested parallel_fors finish.
+*/
+
+#include "common.h"
+#include <thread>
+
+void test_drain_on_stop(){
+	std::atomic<int> n_run{0};
+	{
+		WorkerPool pool(2);
+		std::atomic<bool> go{false};
+		for(int w=0; w<2; w++)
+			pool.run([&]{ while(!go) std::this_thread::yield(); });
+		for(int i=0; i<100; i++)
+			pool.run([&]{ n_run++; }, 0, size_t(i % 2));
+		go = true;
+	} // stopping, with tasks still queued
+	assert(n_run == 100);
+}
+
+void test_sleep_and_wake(){
+	WorkerPool pool(3);
+	std::atomic<int> n_run{0};
+	std::vector<std::atomic<int>> counts(300);
+	for(int batch=0; batch<3; batch++){
+		// let the workers go back to sleep between batches
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		std::vector<std::thread> producers;
+		for(int p=0; p<3; p++)
+			producers.emplace_back([&, batch, p]{
+				for(int i=0; i<100/3 + 1; i++){
+					const int k = batch * 100 + (p * 34 + i);
+					if(k < (batch + 1) * 100)
+						pool.run([&, k]{
+							assert(pool.current_worker() < pool.size());
+							counts[k]++;
+							n_run++;
+						}, double(i % 3));
+				}
+			});
+		for(auto& t : producers)
+			t.join();
+		while(n_run < (batch + 1) * 100)
+			std::this_thread::yield();
+	}
+	for(auto const& c : counts)
+		assert(c == 1);
+}
+
+void test_nested_parallel_for(){
+	WorkerPool pool(2);
+	std::atomic<size_t> total{0};
+	pool.parallel_for(8, 3, [&](size_t){
+		pool.parallel_for(100, 3, [&](size_t j){ total += j; });
+	});
+	assert(total == 8 * 4950);
+}
+
+int main(){
+	test_drain_on_stop();
+	test_sleep_and_wake();
+	test_nested_parallel_for();
+	std::cout << "worker_pool: ok" << std::endl;
+	return 0;
+}
@@ -124,6 +124,252 @@ template<bool...values> struct all_of
     : std::is_same<bool_pack<values..., true>, bool_pack<true, values...>>{};
 
 
+// ======================
+
+/*
+	is_disk_bound<Q>::value is true if Q has a "static const bool disk = true" member.
+	cpu_hint<Q>::value is Q::cpu if it exists, otherwise 1. 0 means "auto".
+	is_interned<Q>::value is true if Q has a "static const bool interned = true" member.
+	intern_domain<Q>::type is Q::intern_domain if it exists, otherwise Q.
+	fused_into<Q>::type is Q::fused_into if it exists, otherwise Q.
+	progressive_stride<Q>::value is Q::progressive if it exists, otherwise 0 (off).
+	cache_hint<Q>::value is Q::cache if it exists, otherwise false, it's only the
+	default for CostModel::worth_keeping.
+	store_capacity<Q, default>::value is Q::store_capacity if it exists, otherwise
+	default, it's only used by the TypedStore (see slot_class_store.h), where
+	it is the number of slots in Q's table, so must be a power of 2.
+	q_name<Q>() is Q::q_name() if it exists, otherwise "?", it's only used for
+	tracing and the like (see trace.h), so needn't be unique.
+	bytes_of(x) is x.bytes() if it exists, otherwise sizeof(x), it's the "bytes
+	produced" in the node profile, see Engine::publish and profile.h.
+	See Engine::make_input, Engine::schedule, Engine::parallel_map,
+	Engine::parallel_for_chunks and Engine::progressive_for_chunks for what these mean.
+*/
+template<typename...> struct make_void{ using type = void; };
+
+template<typename Q, typename=void>
+struct is_interned : std::false_type {};
+
+template<typename Q>
+struct is_interned<Q, typename make_void<decltype(Q::interned)>::type>
+	: std::integral_constant<bool, Q::interned> {};
+
+template<typename Q, typename=void>
+struct is_disk_bound : std::false_type {};
+
+template<typename Q>
+struct is_disk_bound<Q, typename make_void<decltype(Q::disk)>::type>
+	: std::integral_constant<bool, Q::disk> {};
+
+template<typename Q, typename=void>
+struct cpu_hint : std::integral_constant<int, 1> {};
+
+template<typename Q>
+struct cpu_hint<Q, typename make_void<decltype(Q::cpu)>::type>
+	: std::integral_constant<int, Q::cpu> {};
+
+template<typename Q, typename=void>
+struct intern_domain { using type = Q; };
+
+template<typename Q>
+struct intern_domain<Q, typename make_void<typename Q::intern_domain>::type> {
+	using type = typename Q::intern_domain;
+};
+
+template<typename Q, typename=void>
+struct fused_into { using type = Q; };
+
+template<typename Q>
+struct fused_into<Q, typename make_void<typename Q::fused_into>::type> {
+	using type = typename Q::fused_into;
+};
+
+template<typename Q, typename=void>
+struct progressive_stride : std::integral_constant<int, 0> {};
+
+template<typename Q>
+struct progressive_stride<Q, typename make_void<decltype(Q::progressive)>::type>
+	: std::integral_constant<int, Q::progressive> {};
+
+template<typename Q, typename=void>
+struct cache_hint : std::false_type {};
+
+template<typename Q>
+struct cache_hint<Q, typename make_void<decltype(Q::cache)>::type>
+	: std::integral_constant<bool, Q::cache> {};
+
+template<typename Q, size_t default_capacity, typename=void>
+struct store_capacity : std::integral_constant<size_t, default_capacity> {};
+
+template<typename Q, size_t default_capacity>
+struct store_capacity<Q, default_capacity, typename make_void<decltype(Q::store_capacity)>::type>
+	: std::integral_constant<size_t, Q::store_capacity> {};
+
+template<typename Q>
+auto q_name_impl(int) -> decltype(Q::q_name()) {
+	return Q::q_name();
+}
+
+template<typename Q>
+char const* q_name_impl(...){
+	return "?";
+}
+
+template<typename Q>
+char const* q_name(){
+	return q_name_impl<Q>(0);
+}
+
+template<typename T>
+auto bytes_of_impl(T const& x, int) -> decltype(size_t(x.bytes())) {
+	return x.bytes();
+}
+
+template<typename T>
+size_t bytes_of_impl(T const&, ...){
+	return sizeof(T);
+}
+
+template<typename T>
+size_t bytes_of(T const& x){
+	return bytes_of_impl(x, 0);
+}
+
+// ======================
+
+/*
+	type_list<Ts...> is just a list of types, contains<L, T>::value says whether T is
+	in L, and concat_unique<L1, L2>::type is L1 followed by the things in L2 that
+	aren't already in L1.
+*/
+template<typename ...Ts>
+struct type_list{
+	static const size_t size = sizeof...(Ts);
+};
+
+template<typename L, typename T>
+struct contains;
+
+template<typename T, typename ...Ts>
+struct contains<type_list<Ts...>, T>
+	: std::integral_constant<bool, !all_of<!std::is_same<T, Ts>::value...>::value> {};
+
+template<typename L1, typename L2>
+struct concat_unique;
+
+template<typename L1>
+struct concat_unique<L1, type_list<>> { using type = L1; };
+
+template<typename ...As, typename B, typename ...Bs>
+struct concat_unique<type_list<As...>, type_list<B, Bs...>> {
+	using type = typename concat_unique<
+		typename std::conditional<contains<type_list<As...>, B>::value,
+								  type_list<As...>, type_list<As..., B>>::type,
+		type_list<Bs...>>::type;
+};
+
+template<typename L, typename T>
+struct index_in;
+
+template<typename T, typename ...Ts>
+struct index_in<type_list<Ts...>, T> {
+	static_assert(contains<type_list<Ts...>, T>::value, "T is not in the list");
+	static const size_t value = index_of_type<T, Ts...>();
+};
+
+/*
+	The dependency graph, as declared by the Qs themselves (the generator emits these):
+
+	upstream_of<Q>::type is Q::upstream if it exists, i.e. the type_list of Qs
+		that are Q's args, otherwise type_list<> (as for inputs).
+	input_closure<Q>::type is the distinct inputs upstream of Q, in order of first
+		appearance, or type_list<Q> if Q is itself an input. These are the
+		full-befores of Q.
+	key_length<Q>::value is Q::accompanying_key_n if it exists, otherwise 1 for
+		inputs (their id), or 1 + the number of full-befores for computes (slot 0 is
+		the compute's prefix, the rest are the ids of the inputs in input_closure
+		order).  If Q declares both, they must agree.
+
+	See StaticGraph in static_graph.h.
+*/
+template<typename Q, typename=void>
+struct upstream_of { using type = type_list<>; };
+
+template<typename Q>
+struct upstream_of<Q, typename make_void<typename Q::upstream>::type> {
+	using type = typename Q::upstream;
+};
+
+template<typename Q, typename L=typename upstream_of<Q>::type>
+struct input_closure;
+
+template<typename L>
+struct closure_of_list;
+
+template<>
+struct closure_of_list<type_list<>> { using type = type_list<>; };
+
+template<typename U, typename ...Us>
+struct closure_of_list<type_list<U, Us...>> {
+	using type = typename concat_unique<
+		typename input_closure<U>::type,
+		typename closure_of_list<type_list<Us...>>::type>::type;
+};
+
+template<typename Q, typename L>
+struct input_closure { using type = typename closure_of_list<L>::type; };
+
+template<typename Q>
+struct input_closure<Q, type_list<>> { using type = type_list<Q>; };
+
+template<typename Q>
+struct derived_key_length : std::integral_constant<size_t,
+	upstream_of<Q>::type::size == 0 ? 1 : 1 + input_closure<Q>::type::size> {};
+
+template<typename Q, typename=void>
+struct key_length : derived_key_length<Q> {};
+
+template<typename Q>
+struct key_length<Q, typename make_void<decltype(Q::accompanying_key_n)>::type>
+	: std::integral_constant<size_t, Q::accompanying_key_n> {
+	static_assert(upstream_of<Q>::type::size == 0 ||
+				  size_t(Q::accompanying_key_n) == derived_key_length<Q>::value,
+				  "accompanying_key_n doesn't match the declared upstream");
+};
+
+/*
+	delta_over<Q>::type is Q::delta_over if it exists, otherwise type_list<>. These are
+		the inputs (from Q's input_closure) that Q's delta path can cope with changing,
+		and is_incremental<Q>::value is true if there are any. See Engine::bind_delta.
+*/
+template<typename Q, typename=void>
+struct delta_over { using type = type_list<>; };
+
+template<typename Q>
+struct delta_over<Q, typename make_void<typename Q::delta_over>::type> {
+	using type = typename Q::delta_over;
+};
+
+template<typename Q>
+struct is_incremental : std::integral_constant<bool, (delta_over<Q>::type::size > 0)> {};
+
+/*
+	chain_over<Q>::type is Q::chain_over if it exists, otherwise void.  It's for the
+		state of a loop (e.g. cut_state in sample.xml's cut_changes_loop), and is the
+		input whose ids identify the loop's iterations, and is_chain<Q>::value is true
+		if there is one. See Engine::append_chain.
+*/
+template<typename Q, typename=void>
+struct chain_over { using type = void; };
+
+template<typename Q>
+struct chain_over<Q, typename make_void<typename Q::chain_over>::type> {
+	using type = typename Q::chain_over;
+};
+
+template<typename Q>
+struct is_chain : std::integral_constant<bool, !std::is_void<typename chain_over<Q>::type>::value> {};
+
 // ======================
 
 template<size_t ...X>
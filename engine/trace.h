@@ -0,0 +1,273 @@
+/*
+	Tracing
+
+	An opt-in timeline of what the engine is doing, written out in the Chrome
+	trace event format, so it can be opened in chrome://tracing or Perfetto.
+	It's compiled out entirely unless VENOMOUS_TRACE is defined: without it the
+	VENOMOUS_TRACE_... macros expand to nothing and trace::wrap just returns the
+	task it was given.  When it is compiled in, it is also off at
+	runtime until trace::enable(true), so an idle build costs one relaxed
+	atomic load per event site.
+
+	What gets recorded (see the call sites for the exact names):
+
+		node		- a span for each run of a compute node's body, named by
+					  the Q (see Engine::schedule)
+		cache_hit,
+		cache_miss	- an instant each time the engine looks up a value that
+					  may or may not be in the store (find_value, interning)
+		evict		- an instant when a KVP is deleted from the store
+		callback	- a span for each callback exec'd by Engine::publish
+		io			- spans for waiting on reads, and for preads on the
+					  I/O threads
+		counters	- the length of the worker and I/O task queues, each time
+					  something is pushed
+
+	Each thread appends fixed-size Events to its own ring buffer, which it
+	registers with the Tracer the first time it records something.  A buffer
+	has a single writer (its thread) and a single reader (whoever calls
+	write_chrome_json), so it's lock free, with just an acquire/release pair on
+	the head and tail indices.  If the reader doesn't keep up, i.e. a buffer
+	fills between flushes, new events are dropped (and counted) rather than
+	overwriting old ones, which would race with the reader.
+
+	Names and categories are stored as pointers, so they must be string
+	literals, or otherwise live forever, e.g. utils::q_name<Q>().
+
+	write_chrome_json drains all the buffers, so it can be called repeatedly
+	(each file gets the events since the last call), and from any thread.
+*/
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <ostream>
+#include <utility>
+
+#ifdef VENOMOUS_TRACE
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <cstdint>
+
+
+namespace trace {
+
+enum class Kind : uint8_t {
+	span,
+	instant,
+	counter
+};
+
+struct Event{
+	uint64_t t0_ns;
+	uint64_t dur_ns; // spans only
+	char const* cat;
+	char const* name;
+	int64_t value; // the counter's value, or an arg for spans/instants
+	Kind kind;
+};
+
+inline uint64_t now_ns(){
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class ThreadBuffer{
+public:
+	static const size_t capacity = size_t(1) << 15; // must be a power of 2
+
+private:
+	std::unique_ptr<Event[]> events{new Event[capacity]};
+	std::atomic<size_t> head{0}; // written by the owning thread only
+	std::atomic<size_t> tail{0}; // written by the reader only
+
+public:
+	const uint32_t tid;
+	std::atomic<size_t> n_dropped{0};
+
+	explicit ThreadBuffer(uint32_t tid_in) : tid(tid_in) {}
+
+	void push(Event const& e){
+		const size_t h = head.load(std::memory_order_relaxed);
+		if(h - tail.load(std::memory_order_acquire) == capacity){
+			n_dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		events[h & (capacity - 1)] = e;
+		head.store(h + 1, std::memory_order_release);
+	}
+
+	template<typename Foo>
+	void drain(Foo foo){
+		/* calls foo(Event const&) for everything pushed since the last drain */
+		size_t t = tail.load(std::memory_order_relaxed);
+		const size_t h = head.load(std::memory_order_acquire);
+		for(; t != h; t++)
+			foo(events[t & (capacity - 1)]);
+		tail.store(h, std::memory_order_release);
+	}
+};
+
+class Tracer{
+	std::mutex buffers_mutex;
+	std::vector<std::unique_ptr<ThreadBuffer>> buffers; // never shrinks, threads may have exited
+	const uint64_t t_start_ns = now_ns();
+
+	Tracer() = default;
+
+public:
+	std::atomic<bool> enabled{false};
+
+	static Tracer& get(){
+		static Tracer tracer;
+		return tracer;
+	}
+
+	ThreadBuffer& local(){
+		thread_local ThreadBuffer* buffer = nullptr;
+		if(buffer == nullptr){
+			std::lock_guard<std::mutex> lock(buffers_mutex);
+			buffers.emplace_back(new ThreadBuffer(uint32_t(buffers.size())));
+			buffer = buffers.back().get();
+		}
+		return *buffer;
+	}
+
+	void write_chrome_json(std::ostream& os){
+		std::lock_guard<std::mutex> lock(buffers_mutex);
+		size_t n_dropped = 0;
+		bool first = true;
+		os << "{\"traceEvents\":[";
+		for(auto& b : buffers){
+			const uint32_t tid = b->tid;
+			b->drain([&](Event const& e){
+				os << (first ? "\n" : ",\n");
+				first = false;
+				// ts and dur are in microseconds
+				os << "{\"cat\":\"" << e.cat << "\",\"name\":\"" << e.name << "\",\"pid\":1,\"tid\":" << tid
+				   << ",\"ts\":" << (e.t0_ns - t_start_ns) / 1000.0;
+				switch(e.kind){
+				case Kind::span:
+					os << ",\"ph\":\"X\",\"dur\":" << e.dur_ns / 1000.0 << ",\"args\":{\"value\":" << e.value << "}}";
+					break;
+				case Kind::instant:
+					os << ",\"ph\":\"i\",\"s\":\"t\",\"args\":{\"value\":" << e.value << "}}";
+					break;
+				case Kind::counter:
+					os << ",\"ph\":\"C\",\"args\":{\"" << e.name << "\":" << e.value << "}}";
+					break;
+				}
+			});
+			n_dropped += b->n_dropped.exchange(0);
+		}
+		os << "\n],\"displayTimeUnit\":\"ns\",\"otherData\":{\"dropped_events\":" << n_dropped << "}}\n";
+	}
+};
+
+inline void enable(bool on=true){
+	Tracer::get().enabled.store(on, std::memory_order_relaxed);
+}
+
+inline bool enabled(){
+	return Tracer::get().enabled.load(std::memory_order_relaxed);
+}
+
+inline void record(Kind kind, char const* cat, char const* name, int64_t value,
+				   uint64_t t0_ns, uint64_t dur_ns=0){
+	Tracer::get().local().push(Event{t0_ns, dur_ns, cat, name, value, kind});
+}
+
+inline void instant(char const* cat, char const* name, int64_t value=0){
+	if(enabled())
+		record(Kind::instant, cat, name, value, now_ns());
+}
+
+inline void counter(char const* name, int64_t value){
+	if(enabled())
+		record(Kind::counter, "counters", name, value, now_ns());
+}
+
+class Scope{
+	/* Records a span from construction to destruction, if tracing was enabled
+	   at construction. */
+	char const* cat;
+	char const* name;
+	int64_t value;
+	uint64_t t0_ns;
+public:
+	Scope(char const* cat_in, char const* name_in, int64_t value_in=0)
+		: cat(cat_in), name(name_in), value(value_in), t0_ns(enabled() ? now_ns() : 0) {}
+	Scope(Scope const&) = delete;
+	Scope& operator=(Scope const&) = delete;
+	~Scope(){
+		if(t0_ns != 0)
+			record(Kind::span, cat, name, value, t0_ns, now_ns() - t0_ns);
+	}
+};
+
+template<typename Task>
+auto wrap(char const* cat, char const* name, Task&& task){
+	/* task, but recording a span each time it's called */
+	return [cat, name, task = std::forward<Task>(task)]() mutable {
+		Scope scope(cat, name);
+		task();
+	};
+}
+
+inline void write_chrome_json(std::ostream& os){
+	Tracer::get().write_chrome_json(os);
+}
+
+inline bool write_chrome_json(char const* path){
+	std::ofstream f(path);
+	if(!f)
+		return false;
+	write_chrome_json(f);
+	return bool(f);
+}
+
+} // namespace trace
+
+#define VENOMOUS_TRACE_CONCAT_IMPL(a, b) a##b
+#define VENOMOUS_TRACE_CONCAT(a, b) VENOMOUS_TRACE_CONCAT_IMPL(a, b)
+#define VENOMOUS_TRACE_SCOPE(...) trace::Scope VENOMOUS_TRACE_CONCAT(trace_scope_, __LINE__)(__VA_ARGS__)
+#define VENOMOUS_TRACE_INSTANT(...) trace::instant(__VA_ARGS__)
+#define VENOMOUS_TRACE_COUNTER(name, value) trace::counter(name, value)
+
+#else // VENOMOUS_TRACE
+
+namespace trace {
+
+// the same API, doing nothing, so callers don't need their own #ifdefs
+
+inline void enable(bool =true){}
+
+inline bool enabled(){
+	return false;
+}
+
+template<typename Task>
+Task&& wrap(char const*, char const*, Task&& task){
+	return std::forward<Task>(task);
+}
+
+inline void write_chrome_json(std::ostream&){}
+
+inline bool write_chrome_json(char const*){
+	return false;
+}
+
+} // namespace trace
+
+#define VENOMOUS_TRACE_SCOPE(...) ((void)0)
+#define VENOMOUS_TRACE_INSTANT(...) ((void)0)
+#define VENOMOUS_TRACE_COUNTER(name, value) ((void)0)
+
+#endif // VENOMOUS_TRACE
+
+#endif // _TRACE_H_
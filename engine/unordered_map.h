@@ -16,11 +16,24 @@
 	Only the main thread can insert and delete, and only the main thread has any access
 	to the extra_storage_info.
 
+	Both arrays are allocated with the page_alloc::Policy given to the constructor,
+	e.g. on huge pages, as random probes into a big table are otherwise mostly
+	TLB misses, see page_alloc.h.
+
 	See key_value_pair class for the required interface of KVP.
 
 	Worker threads (i.e. not main thread) are allowed to find(..), but may get a 
 	spurious nullptr if there is no thread-specific lock on the given KVP.
 
+	Deleting doesn't destroy the value straight away if any thread might be
+	reading it, i.e. if any epoch is pinned (see epoch.h).  Instead the KVP is
+	retired: it can't be found any more, but it keeps its slot (so nothing is
+	inserted over it, and probe chains through it stay as they were), and it
+	goes on the retired queue with the epoch it was retired in.  reclaim()
+	then finishes the delete for everything whose epoch is safe, it's called
+	on each insert and delete, and the engine calls it too.  Retired entries
+	aren't counted as valid, and are skipped by for_each_valid.
+
 	Only the main thread may obtain locks, and only worker threads can relase (their
 	respective) locks.
 
@@ -35,6 +48,37 @@
 	at each of the probe points its chain passed through, and sets them to null if they
 	were tombstones that no longer had any probe chains passing through.
 
+	key_len is the length of every key in the table, if it is known at compile
+	time, i.e. the table only holds one Q (see TypedStore), in which case
+	hashing and comparing keys use it rather than end-begin, so the compiler can
+	unroll them.  The default, 0, means keys can be any length.
+
+	In front of the table, each thread has a small direct-mapped "L0" cache of
+	the KVP*s its finds returned, so a thread that keeps asking for the same
+	few upstream values (e.g. the same header for every sibling of a node)
+	gets them without hashing or probing, just a cheap mix of the key to pick
+	an entry and a comparison with the KVP's own key.  Entries are checked
+	against a per-prefix generation, which delete_ and attempt_clear_tombstones
+	bump whenever a KVP of that prefix stops being findable where it was, so a
+	stale entry is never used.  The bump comes after the change, so a find
+	racing with it caches the old generation; and a hit still checks the
+	KVP's prefix, key and that it isn't retired, for the moment in between.  Inserts don't invalidate anything, as only
+	hits are cached.  The cache is per thread and per table type, entries say
+	which table they belong to by its instance id, rather than its address,
+	which could be reused by a later table.  Only the KVP* version of find
+	uses it, and L0 hits are counted as hits that read 0 slots.
+
+	stats() gives a snapshot of how the table is doing: per-prefix (i.e. per-Q)
+	find hits/misses, inserts and deletes, a histogram of how many probes finds
+	took, a histogram of the probe counts of the entries currently in the table,
+	and the load factor and tombstone ratio.  The counters are bumped by
+	whichever thread does the find, so each thread gets its own cache-line
+	aligned set (see thread_slot), and stats() sums them.  Beyond
+	max_stat_threads threads, slots are shared, which is still correct as the
+	counters are atomic, just slower.  A slot's set is only allocated when it
+	first counts something, as most tables are only used by a few threads,
+	and with VENOMOUS_TYPED_STORE there's a table per Q.
+
 */
 
 #ifndef _UNORDERED_MAP_H_
@@ -43,9 +87,14 @@
 #include <memory>
 #include <array>
 #include <cstdint>
+#include <atomic>
+#include <ostream>
+#include <deque>
 
 #include "utils/murmur3.h"
 #include "tmp_utils.h"
+#include "page_alloc.h"
+#include "epoch.h"
 
 #define HASH_NAMESPACE murmur3
 
@@ -83,28 +132,180 @@ public:
 	}
 };
 
-template<typename KVP, size_t capacity>
+template<size_t n_prefixes, size_t max_probing>
+struct StoreStats{
+	/* see unordered_map::stats, and SlotClassStore::stats which adds up the
+	   stats of several tables with +=. */
+	struct PrefixCounts{
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+		uint64_t inserts = 0;
+		uint64_t deletes = 0;
+	};
+
+	std::array<PrefixCounts, n_prefixes> per_prefix{};
+	std::array<uint64_t, max_probing + 1> find_probes{}; // [n] = finds that read n slots, 0 is L0 hits
+	std::array<size_t, max_probing> entry_probes{}; // [n] = valid entries that are n probes from their hash
+	size_t n_valid = 0;
+	size_t n_tombstones = 0;
+	size_t n_retired = 0; // deleted but not yet reclaimed, see unordered_map::delete_
+	size_t capacity = 0;
+	size_t counter_bytes = 0; // of the per-thread counters, which are allocated as threads use the table
+
+	double load_factor() const{
+		return double(n_valid) / capacity;
+	}
+
+	double tombstone_ratio() const{
+		return double(n_tombstones) / capacity;
+	}
+
+	StoreStats& operator+=(StoreStats const& other){
+		for(size_t p=0; p<n_prefixes; p++){
+			per_prefix[p].hits += other.per_prefix[p].hits;
+			per_prefix[p].misses += other.per_prefix[p].misses;
+			per_prefix[p].inserts += other.per_prefix[p].inserts;
+			per_prefix[p].deletes += other.per_prefix[p].deletes;
+		}
+		for(size_t n=0; n<=max_probing; n++)
+			find_probes[n] += other.find_probes[n];
+		for(size_t n=0; n<max_probing; n++)
+			entry_probes[n] += other.entry_probes[n];
+		n_valid += other.n_valid;
+		n_tombstones += other.n_tombstones;
+		n_retired += other.n_retired;
+		capacity += other.capacity;
+		counter_bytes += other.counter_bytes;
+		return *this;
+	}
+
+	friend std::ostream& operator<<(std::ostream& os, StoreStats const& s){
+		PrefixCounts total;
+		for(auto const& c : s.per_prefix){
+			total.hits += c.hits;
+			total.misses += c.misses;
+			total.inserts += c.inserts;
+			total.deletes += c.deletes;
+		}
+		os << "load: " << s.load_factor() << ", tombstones: " << s.tombstone_ratio()
+		   << ", retired: " << s.n_retired
+		   << ", hits: " << total.hits << ", misses: " << total.misses
+		   << ", inserts: " << total.inserts << ", deletes: " << total.deletes << "\n\tfind probes: ";
+		for(auto n : s.find_probes)
+			os << n << " ";
+		os << "\n\tentry probes: ";
+		for(auto n : s.entry_probes)
+			os << n << " ";
+		return os;
+	}
+};
+
+template<typename KVP, size_t capacity, size_t key_len=0>
 class unordered_map{
 	static_assert(utils::is_pow_2(capacity), "capacity should be pow 2.");
 
 public:
-	using self_t = unordered_map<KVP, capacity>;  //convenience
+	using self_t = unordered_map<KVP, capacity, key_len>;  //convenience
 	using key_element_t = typename KVP::key_element_t_;
 	using key_prefix_t = typename KVP::key_prefix_t;
 
 	static const auto capacity_ = capacity;
 	static const size_t invalid_index = -1;
+	static const size_t max_probing = 30; // total number of attempts to read from store before giving up
+										  // i.e. if 1, then just read at hashed location with no quadartic probing.
+	static const size_t n_prefixes = KVP::n_types;
+	static const size_t max_stat_threads = 64;
+
+	using Stats = StoreStats<n_prefixes, max_probing>;
 
 private:
-	// these large arrays might be better off on the heap, with unique ptrs
-	std::array<KVP, capacity> store;
-	std::array<ExtraStorageInfo, capacity> extra_storage_info;
-	const size_t max_probing = 30; // total number of attempts to read from store before giving up
-								   // i.e. if 1, then just read at hashed location with no quadartic probing.
+	// these are the big arrays, so they come from page_alloc, see the constructor
+	page_alloc::unique_array<KVP> store;
+	page_alloc::unique_array<ExtraStorageInfo> extra_storage_info;
 	size_t tombstone_count = 0;
 	size_t valid_count = 0;
 	static const size_t main_thread_id = 0;
 
+	struct Retired{
+		size_t idx;
+		uint64_t epoch;
+	};
+	std::deque<Retired> retired; // in order of epoch, see delete_
+
+	struct alignas(64) ThreadCounters{
+		std::array<std::atomic<uint64_t>, n_prefixes> hits{};
+		std::array<std::atomic<uint64_t>, n_prefixes> misses{};
+		std::array<std::atomic<uint64_t>, n_prefixes> inserts{};
+		std::array<std::atomic<uint64_t>, n_prefixes> deletes{};
+		std::array<std::atomic<uint64_t>, max_probing + 1> find_probes{};
+	};
+	std::array<std::atomic<ThreadCounters*>, max_stat_threads> thread_counters{}; // see counters
+	std::array<page_alloc::unique_array<ThreadCounters>, max_stat_threads> owned_counters;
+
+	static const size_t l0_len = 64; // entries per thread, pow 2
+
+	struct L0Entry{
+		uint64_t map_id = 0; // 0 is never an instance_id
+		uint64_t generation = 0;
+		KVP* kvp = nullptr;
+		key_prefix_t prefix = 0;
+	};
+
+	struct alignas(64) Generations{
+		std::array<std::atomic<uint64_t>, n_prefixes> of_prefix{};
+	};
+	const uint64_t instance_id = next_instance_id();
+	Generations generations;
+
+	static uint64_t next_instance_id(){
+		static std::atomic<uint64_t> next{1};
+		return next++;
+	}
+
+	static L0Entry& l0_entry_for(key_prefix_t key_prefix, key_element_t const* begin,
+								 key_element_t const* end){
+		thread_local std::array<L0Entry, l0_len> entries;
+		uint64_t h = key_prefix;
+		for(auto it=begin; it!=begin+key_len_of(begin, end); ++it)
+			h = (h ^ uint64_t(*it)) * 0x9E3779B97F4A7C15ull;
+		return entries[(h >> 32) & (l0_len - 1)];
+	}
+
+	void invalidate_l0(key_prefix_t key_prefix){
+		generations.of_prefix[key_prefix].fetch_add(1, std::memory_order_release);
+	}
+
+	static size_t thread_slot(){
+		static std::atomic<size_t> next_slot{0};
+		thread_local const size_t slot = next_slot++ % max_stat_threads;
+		return slot;
+	}
+
+	ThreadCounters& counters(){
+		/* this thread's set, allocated by whichever thread first uses the slot */
+		const size_t slot = thread_slot();
+		ThreadCounters* p = thread_counters[slot].load(std::memory_order_acquire);
+		if(p != nullptr)
+			return *p;
+		auto fresh = page_alloc::make_array<ThreadCounters>(1, page_alloc::Policy());
+		if(!thread_counters[slot].compare_exchange_strong(p, fresh.get(), std::memory_order_acq_rel))
+			return *p; // another thread sharing the slot got there first
+		owned_counters[slot] = std::move(fresh);
+		return *owned_counters[slot].get();
+	}
+
+	static void bump(std::atomic<uint64_t>& x){
+		x.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	static bool is_found(KVP const* p){
+		return p != nullptr;
+	}
+
+	static bool is_found(size_t idx){
+		return idx != invalid_index;
+	}
+
 	static auto modulo_capacity(size_t x) {
 		return (capacity-1) & x;
 	}
@@ -116,20 +317,34 @@ private:
 		// inverse of probe_i_from
 		return modulo_capacity(probe_idx - i*i);
 	}
+	static size_t key_len_of(key_element_t const* begin, key_element_t const* end){
+		// a compile time constant if key_len is given
+		assert(key_len == 0 || size_t(end - begin) == key_len);
+		return key_len == 0 ? size_t(end - begin) : key_len;
+	}
+
 	static auto get_hashed_idx(key_prefix_t key_prefix,
 						     key_element_t const* begin, key_element_t const* end) {
 		// returns the index into store.
 		// key_element_t must be contiguous
 		return modulo_capacity(HASH_NAMESPACE::hash<key_element_t>(
-								begin, end-begin, key_prefix));
+								begin, key_len_of(begin, end), key_prefix));
 	}
 
 public:
 
+	explicit unordered_map(page_alloc::Policy const& policy=page_alloc::Policy())
+		: store(page_alloc::make_array<KVP>(capacity, policy)),
+		  extra_storage_info(page_alloc::make_array<ExtraStorageInfo>(capacity, policy)) {}
+
+	unordered_map(self_t const&) = delete;
+	self_t& operator=(self_t const&) = delete;
+
 	KVP* insert(key_prefix_t key_prefix,
 		          key_element_t const* begin, key_element_t const* end){
 		// TODO: assert(is_on_main_thread);
-		assert(find(key_prefix, begin, end) == nullptr);
+		assert(find_impl<KVP*>(key_prefix, begin, end, main_thread_id) == nullptr);
+		reclaim();
 
 		auto base_idx = get_hashed_idx(key_prefix, begin, end);
 
@@ -144,6 +359,7 @@ public:
 
 				extra_storage_info[idx].set_to_probes_used(i);
 				valid_count++;
+				bump(counters().inserts[key_prefix]);
 				KVP& kvp = store[idx];
 				kvp.placement_new_key(key_prefix, begin, end);
 				return &kvp;
@@ -167,11 +383,93 @@ public:
 		  Note that only main thread should have any business asking for size_t version, but
 		  it's actually safe to use this in principle on other threads. 		 */
 
+		size_t n_probes;
+		return_type ret = find_cached(std::is_same<return_type, KVP*>(), key_prefix, begin, end, thread_id, &n_probes);
+		ThreadCounters& tc = counters();
+		assert(size_t(key_prefix) < n_prefixes);
+		bump(is_found(ret) ? tc.hits[key_prefix] : tc.misses[key_prefix]);
+		bump(tc.find_probes[n_probes]);
+		return ret;
+	}
+
+	template<typename Foo>
+	void for_each_valid(Foo foo) const{
+		/* calls foo(idx, kvp) for each valid entry. Main thread only, and don't
+		   insert or delete from within foo. */
+		for(size_t idx=0; idx<capacity; idx++)
+			if(extra_storage_info[idx].is_valid_probes_used() && !store[idx].is_retired())
+				foo(idx, store[idx]);
+	}
+
+	Stats stats() const{
+		/* A snapshot, see the comment at the top. The counters may be a little behind
+		   other threads, but the table state parts are main thread only. */
+		Stats ret;
+		for(auto const& slot : thread_counters){
+			ThreadCounters const* tc_p = slot.load(std::memory_order_acquire);
+			if(tc_p == nullptr)
+				continue;
+			ThreadCounters const& tc = *tc_p;
+			ret.counter_bytes += sizeof(ThreadCounters);
+			for(size_t p=0; p<n_prefixes; p++){
+				ret.per_prefix[p].hits += tc.hits[p].load(std::memory_order_relaxed);
+				ret.per_prefix[p].misses += tc.misses[p].load(std::memory_order_relaxed);
+				ret.per_prefix[p].inserts += tc.inserts[p].load(std::memory_order_relaxed);
+				ret.per_prefix[p].deletes += tc.deletes[p].load(std::memory_order_relaxed);
+			}
+			for(size_t n=0; n<=max_probing; n++)
+				ret.find_probes[n] += tc.find_probes[n].load(std::memory_order_relaxed);
+		}
+		for(size_t idx=0; idx<capacity; idx++)
+			if(extra_storage_info[idx].is_valid_probes_used() && !store[idx].is_retired())
+				ret.entry_probes[extra_storage_info[idx].probes_used()]++;
+		ret.n_valid = valid_count;
+		ret.n_tombstones = tombstone_count;
+		ret.n_retired = retired.size();
+		ret.capacity = capacity;
+		return ret;
+	}
+
+private:
+	KVP* find_cached(std::true_type /* KVP* */, key_prefix_t key_prefix, key_element_t const* begin,
+					 key_element_t const* end, size_t thread_id, size_t* n_probes){
+		/* find_impl, via this thread's L0 cache, see the comment at the top */
+		L0Entry& entry = l0_entry_for(key_prefix, begin, end);
+		const uint64_t generation = generations.of_prefix[key_prefix].load(std::memory_order_acquire);
+		if(entry.map_id == instance_id && entry.prefix == key_prefix && entry.generation == generation
+		   && entry.kvp->key_prefix() == key_prefix && !entry.kvp->is_retired()
+		   && std::equal(begin, begin + key_len_of(begin, end), entry.kvp->cbegin_key())){
+			*n_probes = 0;
+			return entry.kvp;
+		}
+		KVP* ret = find_impl<KVP*>(key_prefix, begin, end, thread_id, n_probes);
+		if(ret != nullptr){
+			entry.map_id = instance_id;
+			entry.generation = generation;
+			entry.kvp = ret;
+			entry.prefix = key_prefix;
+		}
+		return ret;
+	}
+
+	size_t find_cached(std::false_type /* size_t */, key_prefix_t key_prefix, key_element_t const* begin,
+					   key_element_t const* end, size_t thread_id, size_t* n_probes){
+		return find_impl<size_t>(key_prefix, begin, end, thread_id, n_probes);
+	}
+
+	template<typename return_type>
+	return_type find_impl(key_prefix_t key_prefix, key_element_t const* begin,
+					 key_element_t const* end, size_t thread_id, size_t* n_probes=nullptr){
+		/* find, without touching the stats. n_probes is set to the number of slots read. */
 		const bool return_as_size_t = std::is_same<size_t, return_type>::value;
 
 		const auto base_idx = get_hashed_idx(key_prefix, begin, end);
+		size_t dummy_n_probes;
+		if(n_probes == nullptr)
+			n_probes = &dummy_n_probes;
 
 		for(size_t i=0; i<max_probing; i++){
+			*n_probes = i + 1;
 			size_t idx = probe_i_from(base_idx, i);
 			KVP& kvp = store[idx];
 			if(kvp.is_null())
@@ -180,10 +478,13 @@ public:
 			if(!kvp.safe_to_read(thread_id))
 				continue; // this may be a match, but it's not safe to check
 
+			if(kvp.is_retired())
+				continue; // deleted, see delete_
+
 			if(kvp.key_prefix() != key_prefix)
 				continue; // this is clearly not a match
 
-			if(std::equal(begin, end, kvp.cbegin_key()))
+			if(std::equal(begin, begin + key_len_of(begin, end), kvp.cbegin_key()))
 				return utils::conditional_value<return_as_size_t>()(idx, &store[idx]);
 		} // for i
 
@@ -194,26 +495,60 @@ public:
 
 	}
 
+public:
+
 	void delete_(key_prefix_t key_prefix, key_element_t const* begin,
 				 key_element_t const* end){
 		//TODO: assert(is_on_main_thread);
 
-		size_t tombstone_idx = find<size_t>(key_prefix, begin, end, main_thread_id);
+		size_t tombstone_idx = find_impl<size_t>(key_prefix, begin, end, main_thread_id);
 		if(tombstone_idx == invalid_index)
 			return;
+		bump(counters().deletes[key_prefix]);
+		valid_count--;
+
+		if(Epochs::get().n_pinned() == 0){
+			// nobody can be reading it, so no need to wait
+			destroy(tombstone_idx);
+		}else{
+			store[tombstone_idx].retire();
+			retired.push_back(Retired{tombstone_idx, Epochs::get().current()});
+		}
+		invalidate_l0(key_prefix); // after, see the comment at the top
+		reclaim();
+	}
 
+	size_t reclaim(){
+		/* Finishes deleting retired KVPs whose epoch is safe, advancing the
+		   epoch if it can, see epoch.h. Returns how many were reclaimed. */
+		//TODO: assert(is_on_main_thread);
+		Epochs& epochs = Epochs::get();
+		size_t n = 0;
+		while(!retired.empty()){
+			if(!epochs.is_safe(retired.front().epoch) && !epochs.try_advance())
+				break;
+			if(!epochs.is_safe(retired.front().epoch))
+				continue; // it advanced, but may need to advance again
+			destroy(retired.front().idx);
+			retired.pop_front();
+			n++;
+		}
+		return n;
+	}
+
+private:
+	void destroy(size_t tombstone_idx){
+		/* the second half of delete_, for a KVP that's been found (and maybe retired) */
 		decrement_upstream_probes_of(tombstone_idx);
 		store[tombstone_idx].destruct_to_tombstone();
 		extra_storage_info[tombstone_idx].set_to_tombstone();
-		valid_count--;
 		tombstone_count++;
 
 		if(extra_storage_info[tombstone_idx].probes_passing_through == 0)
 			tombstone_to_null(tombstone_idx);
-			
 	}
 
-private:
+
 	void decrement_upstream_probes_of(size_t end_idx, size_t start_probe_i=0){
 		/* finds the base_idx for end_idx, using extra_storage.probes_used.
 		   It then decrements all probe steps from start_probe_i to end_idx, excluding 
@@ -268,7 +603,7 @@ public:
 					tombstone_to_null(idx);
 				}
 			}else if(extra_storage_info[idx].probes_used() != 0 
-				  && store[idx].main_thread_only_ref()){
+				  && store[idx].main_thread_only_ref() /* i.e. not retired, nor being read */){
 				// we've found an actual kvp (not null or tombstone), which is not
 				// at probe 0, and it is moveable. Lets try moving it.
 				size_t base_idx = base_from_probe_i(idx, extra_storage_info[idx].probes_used());
@@ -290,6 +625,7 @@ public:
 							tombstone_count++;
 						
 						// move idx into the new_idx
+						const key_prefix_t moved_prefix = store[idx].key_prefix();
 						extra_storage_info[new_idx].set_to_probes_used(i);	
 						store[new_idx] = std::move(store[idx]);
 
@@ -298,6 +634,7 @@ public:
 						extra_storage_info[idx].set_to_tombstone();
 						if(extra_storage_info[idx].probes_passing_through == 0)
 							tombstone_to_null(idx);
+						invalidate_l0(moved_prefix); // after, see the comment at the top
 						break; // break out of for-i, continue next idx
 					}
 				} // for i
@@ -313,9 +650,10 @@ public:
 	// http://en.cppreference.com/w/cpp/language/friend
 	friend std::ostream& operator<<(std::ostream& os, self_t const& map){
 		os << "unordered_map with capacity " << map.capacity_ << ":\n"
-		   << "\tnull: " << map.capacity_-map.tombstone_count-map.valid_count << "\n"
+		   << "\tnull: " << map.capacity_-map.tombstone_count-map.valid_count-map.retired.size() << "\n"
 		   << "\ttombstone: " << map.tombstone_count << "\n"
 		   << "\tvalid: " << map.valid_count << "\n"
+		   << "\tretired: " << map.retired.size() << "\n"
 		   << "\tstore head: ";
 
 		size_t head_size = 64;
@@ -324,6 +662,8 @@ public:
 				os << "-";
 			else if(map.store[i].is_tombstone())
 				os << "t";
+			else if(map.store[i].is_retired())
+				os << "r";
 			else if(get_hashed_idx(map.store[i].key_prefix(),
 					map.store[i].cbegin_key(), map.store[i].cend_key()) == i)
 				os << "#";
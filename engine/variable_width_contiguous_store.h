@@ -251,6 +251,7 @@ class VariableWidthContiguousStore{
 public:
 	static const bool has_extra = !std::is_void<Extra>::value;
 	static const size_t max_len = (2 << max_len_log_2);
+	static const size_t n_buckets = max_len_log_2;
 	using store_t = typename std::conditional<has_extra,
 									ContiguousStoreWithExtra<key_element_t, padding_el, Extra>,
 									ContiguousStore<key_element_t, padding_el> >::type;
@@ -366,6 +367,15 @@ public:
 		return b.update_extra_with_ref(ref.ref_within_bucket, ex);
 	}
 
+	std::array<size_t, n_buckets> bucket_sizes() const{
+		/* the number of entries in each bucket, i.e. bucket k has the
+		   entries with length in (2^k, 2^(k+1)], except bucket 0 which is 1 and 2. */
+		std::array<size_t, n_buckets> ret;
+		for(size_t k=0; k<n_buckets; k++)
+			ret[k] = bucket_pyramid[k].size();
+		return ret;
+	}
+
 	friend std::ostream& operator<<(std::ostream& o, const VariableWidthContiguousStore& vwcs){
 		o << "VariableWidthContiguousStore:\n";
 		for(auto& b: vwcs.bucket_pyramid)
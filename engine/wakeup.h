@@ -0,0 +1,117 @@
+/*
+	Wakeup class
+
+	What the engine's main thread sleeps on, instead of being polled: any thread
+	can notify() it (e.g. a worker that just finished a node, or a user thread
+	that dropped the last ref to a value), and whoever drives the engine waits
+	for it and then calls Engine::poll, see Engine::start.
+
+	On Linux it's an eventfd, so fd() can also be added to a host application's
+	own poll/epoll/select loop, which calls Engine::poll whenever it's readable,
+	and the kernel can signal it directly, e.g. io_uring completions, see
+	IoExecutor::notify_on_completion.  Notifications coalesce: any number of
+	notify()s before the next consume() is one wakeup.
+
+	Elsewhere it's a flag and a condition variable, and fd() is -1.
+
+	notify and fd can be called from any thread, wait and consume only from the
+	thread driving the engine.
+*/
+
+#ifndef _WAKEUP_H_
+#define _WAKEUP_H_
+
+#include <cstdint>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+
+class Wakeup{
+#ifdef __linux__
+	int event_fd;
+#else
+	std::mutex mutex;
+	std::condition_variable cv;
+	bool pending = false;
+#endif
+
+public:
+#ifdef __linux__
+	Wakeup() : event_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {
+		if(event_fd < 0)
+			abort();
+	}
+	~Wakeup(){
+		close(event_fd);
+	}
+#else
+	Wakeup() = default;
+#endif
+	Wakeup(Wakeup const&) = delete;
+	Wakeup& operator=(Wakeup const&) = delete;
+
+	int fd() const{
+#ifdef __linux__
+		return event_fd;
+#else
+		return -1;
+#endif
+	}
+
+	void notify(){
+#ifdef __linux__
+		const uint64_t one = 1;
+		ssize_t ret = write(event_fd, &one, sizeof(one)); // only fails if the counter is saturated, which is still a wakeup
+		(void)ret;
+#else
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			pending = true;
+		}
+		cv.notify_one();
+#endif
+	}
+
+	bool consume(){
+		/* clears the wakeup, returns whether there was one */
+#ifdef __linux__
+		uint64_t n;
+		return read(event_fd, &n, sizeof(n)) == sizeof(n);
+#else
+		std::lock_guard<std::mutex> lock(mutex);
+		const bool ret = pending;
+		pending = false;
+		return ret;
+#endif
+	}
+
+	bool wait_for(std::chrono::milliseconds timeout){
+		/* blocks until notified (without consuming it) or timeout, returns
+		   whether notified.  A negative timeout waits forever. */
+#ifdef __linux__
+		pollfd p{event_fd, POLLIN, 0};
+		return ::poll(&p, 1, timeout.count() < 0 ? -1 : int(timeout.count())) > 0;
+#else
+		std::unique_lock<std::mutex> lock(mutex);
+		if(timeout.count() < 0){
+			cv.wait(lock, [this]{ return pending; });
+			return true;
+		}
+		return cv.wait_for(lock, timeout, [this]{ return pending; });
+#endif
+	}
+
+	void wait(){
+		wait_for(std::chrono::milliseconds(-1));
+	}
+};
+
+
+#endif // _WAKEUP_H_
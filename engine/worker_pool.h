@@ -0,0 +1,327 @@
+/*
+	WorkerPool class
+
+	The pool of CPU worker threads.  Compute nodes that aren't disk bound are run
+	here (see Engine::schedule), and nodes that are allowed more than one CPU (the
+	CPU=N hint) can split their element-wise loops into chunk tasks which also run
+	here (see parallel_for, and parallel_map in chunked_array.h).
+
+	parallel_for(n, foo) calls foo(i) for i in [0, n), spread over at most
+	max_tasks threads, and blocks until they're all done.  The calling thread takes
+	part in the work, and indices are claimed with an atomic counter, so it makes
+	progress even if all the workers are busy (e.g. when it is itself called from
+	a worker), i.e. nested parallelism can't deadlock, it just degrades to serial.
+
+	Threads are started lazily on first use, as with the IoExecutor, so that a
+	global engine doesn't spawn threads during static initialization.
+
+	Each worker has its own deque of tasks, each with its own lock, and runs
+	the tasks in its own deque first.  When that's empty it steals from the
+	worker whose next task has the highest priority, so nobody sits idle while
+	there's work queued anywhere.  Each deque is kept in priority order (FIFO
+	among equal priorities), Engine::schedule uses the node's expected critical
+	path time, see CostModel.  parallel_for's helper tasks go ahead of
+	everything, as they are finishing work that has already started.
+
+	run(task, priority, worker) puts the task on the given worker's deque, so
+	that e.g. the consumers of a big value run on the core that produced it,
+	while it's still in that core's L2/L3, see Engine::preferred_worker.  If
+	that worker is busy, an idle one is woken, and will steal it, i.e. locality
+	is preferred but never at the cost of an idle core.  Without a preference,
+	the task goes to an idle worker if there is one, or else the calling
+	worker's own deque (for tasks spawned by tasks), or else round robin.
+	current_worker() says which worker of this pool the calling thread is.
+
+	set_pinning(true), before the threads start, pins worker i to the i'th CPU
+	the process is allowed to run on (wrapping around), so "the worker that
+	produced it" stays the same core.  Linux only, elsewhere it does nothing.
+*/
+
+#ifndef _WORKER_POOL_H_
+#define _WORKER_POOL_H_
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <limits>
+#include <utility>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "trace.h"
+#include "page_alloc.h"
+
+
+class WorkerPool{
+public:
+	using task_t = std::function<void()>;
+	static const size_t any_worker = -1;
+
+private:
+	struct alignas(64) Worker{
+		std::mutex tasks_mutex;
+		std::deque<std::pair<double, task_t>> tasks; // (priority, task), highest priority first
+		std::atomic<double> front_priority{-std::numeric_limits<double>::infinity()}; // for stealers, -inf if empty
+		std::condition_variable wake_cv; // with sleep_mutex
+		std::atomic<bool> idle{false}; // written with sleep_mutex held, see wake
+	};
+
+	struct ThisThread{
+		WorkerPool const* pool = nullptr;
+		size_t worker = any_worker;
+	};
+
+	size_t n_threads;
+	page_alloc::unique_array<Worker> workers; // as new[] doesn't respect alignas before C++17
+	std::vector<std::thread> threads;
+	std::atomic<size_t> n_queued{0};
+	std::atomic<size_t> n_idle{0};
+	std::atomic<size_t> next_round_robin{0};
+	std::mutex sleep_mutex;
+	bool stopping = false;
+	bool pinning = false;
+	std::once_flag started;
+
+	static ThisThread& this_thread(){
+		thread_local ThisThread t;
+		return t;
+	}
+
+	void start_threads(){
+		std::call_once(started, [this]{
+			std::vector<int> cpus = allowed_cpus();
+			for(size_t i=0; i<n_threads; i++)
+				threads.emplace_back([this, i, cpus]{
+					if(pinning && !cpus.empty())
+						pin_to_cpu(cpus[i % cpus.size()]);
+					thread_loop(i);
+				});
+		});
+	}
+
+	static std::vector<int> allowed_cpus(){
+		std::vector<int> ret;
+#ifdef __linux__
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		if(sched_getaffinity(0, sizeof(set), &set) == 0)
+			for(int c=0; c<CPU_SETSIZE; c++)
+				if(CPU_ISSET(c, &set))
+					ret.push_back(c);
+#endif
+		return ret;
+	}
+
+	static void pin_to_cpu(int cpu){
+#ifdef __linux__
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set); // only a hint, ignore failure
+#else
+		(void)cpu;
+#endif
+	}
+
+	bool pop_front(size_t w, task_t& task){
+		Worker& worker = workers[w];
+		std::lock_guard<std::mutex> lock(worker.tasks_mutex);
+		if(worker.tasks.empty())
+			return false;
+		task = std::move(worker.tasks.front().second);
+		worker.tasks.pop_front();
+		worker.front_priority = worker.tasks.empty() ? -std::numeric_limits<double>::infinity()
+													 : worker.tasks.front().first;
+		n_queued--;
+		return true;
+	}
+
+	bool take(size_t w, task_t& task){
+		/* from w's own deque, or else steal the highest priority task elsewhere */
+		if(pop_front(w, task))
+			return true;
+		for(size_t attempt=0; attempt<n_threads; attempt++){
+			size_t victim = any_worker;
+			double best = -std::numeric_limits<double>::infinity();
+			for(size_t v=0; v<n_threads; v++){
+				const double p = workers[v].front_priority;
+				if(v != w && p > best){
+					best = p;
+					victim = v;
+				}
+			}
+			if(victim == any_worker)
+				return false;
+			if(pop_front(victim, task))
+				return true;
+			// it went in the meantime, look again
+		}
+		return false;
+	}
+
+	void thread_loop(size_t w){
+		this_thread() = ThisThread{this, w};
+		while(true){
+			task_t task;
+			if(take(w, task)){
+				task();
+				continue;
+			}
+			// n_idle then n_queued here, and n_queued then n_idle in run, so
+			// either we see its task or it sees us idle and wakes someone
+			std::unique_lock<std::mutex> lock(sleep_mutex);
+			workers[w].idle = true;
+			n_idle++;
+			while(!stopping && n_queued == 0){
+				workers[w].wake_cv.wait(lock);
+				if(!workers[w].idle){
+					// woken for a task that's gone already, so idle again
+					workers[w].idle = true;
+					n_idle++;
+				}
+			}
+			if(workers[w].idle){
+				workers[w].idle = false;
+				n_idle--;
+			}
+			if(stopping && n_queued == 0)
+				return;
+			continue; // there's a task to take, or one left to drain before stopping
+		}
+	}
+
+	size_t pick_worker(size_t preferred){
+		/* see the comment at the top, the idle flags are only a hint here */
+		if(preferred < n_threads)
+			return preferred;
+		const size_t start = next_round_robin++;
+		for(size_t i=0; i<n_threads; i++)
+			if(workers[(start + i) % n_threads].idle)
+				return (start + i) % n_threads;
+		if(this_thread().pool == this)
+			return this_thread().worker;
+		return start % n_threads;
+	}
+
+	struct ParallelForState{
+		std::atomic<size_t> next{0};
+		std::atomic<size_t> n_done{0};
+		size_t n;
+		std::function<void(size_t)> foo;
+		std::mutex done_mutex;
+		std::condition_variable done_cv;
+
+		void work(){
+			size_t i;
+			while((i = next++) < n){
+				foo(i);
+				if(++n_done == n){
+					std::lock_guard<std::mutex> lock(done_mutex);
+					done_cv.notify_all();
+				}
+			}
+		}
+	};
+
+	void wake(size_t w){
+		/* wakes w, or if it's busy, an idle worker who can steal from it */
+		size_t to_wake = any_worker;
+		{
+			std::lock_guard<std::mutex> lock(sleep_mutex);
+			to_wake = workers[w].idle ? w : any_worker;
+			for(size_t i=0; i<n_threads && to_wake == any_worker; i++)
+				if(workers[i].idle)
+					to_wake = i;
+			if(to_wake != any_worker){
+				// so the next run wakes someone else
+				workers[to_wake].idle = false;
+				n_idle--;
+			}
+		}
+		if(to_wake != any_worker)
+			workers[to_wake].wake_cv.notify_one();
+	}
+
+public:
+	WorkerPool(size_t n_threads_in=0)
+			: n_threads(n_threads_in > 0 ? n_threads_in
+									 : std::max<size_t>(1, std::thread::hardware_concurrency())),
+			  workers(page_alloc::make_array<Worker>(n_threads, page_alloc::Policy())) {}
+
+	~WorkerPool(){
+		{
+			std::lock_guard<std::mutex> lock(sleep_mutex);
+			stopping = true;
+		}
+		for(size_t w=0; w<n_threads; w++)
+			workers[w].wake_cv.notify_all();
+		for(auto& t : threads)
+			t.join();
+	}
+
+	size_t size() const{
+		return n_threads;
+	}
+
+	void set_pinning(bool pin){
+		/* only has an effect before the first run */
+		pinning = pin;
+	}
+
+	size_t current_worker() const{
+		/* the calling thread's index in this pool, or any_worker if it isn't one */
+		return this_thread().pool == this ? this_thread().worker : any_worker;
+	}
+
+	void run(task_t task, double priority=0, size_t preferred_worker=any_worker){
+		start_threads();
+		const size_t w = pick_worker(preferred_worker);
+		{
+			Worker& worker = workers[w];
+			std::lock_guard<std::mutex> lock(worker.tasks_mutex);
+			// search from the back, as usually everything has the same priority
+			auto it = worker.tasks.end();
+			while(it != worker.tasks.begin() && std::prev(it)->first < priority)
+				--it;
+			worker.tasks.emplace(it, priority, std::move(task));
+			worker.front_priority = worker.tasks.front().first;
+			n_queued++;
+		}
+		VENOMOUS_TRACE_COUNTER("worker_queue", n_queued.load());
+		if(n_idle > 0)
+			wake(w);
+	}
+
+	template<typename Foo>
+	void parallel_for(size_t n, size_t max_tasks, Foo foo){
+		/* max_tasks includes the calling thread, so 1 means run serially here. */
+		max_tasks = std::min(max_tasks, n);
+		if(max_tasks <= 1){
+			for(size_t i=0; i<n; i++)
+				foo(i);
+			return;
+		}
+
+		// the state is shared, as helpers may only start after we've returned
+		auto state = std::make_shared<ParallelForState>();
+		state->n = n;
+		state->foo = foo;
+		for(size_t t=1; t<max_tasks; t++)
+			run([state]{ state->work(); }, std::numeric_limits<double>::infinity());
+		state->work();
+
+		std::unique_lock<std::mutex> lock(state->done_mutex);
+		state->done_cv.wait(lock, [&]{ return state->n_done == n; });
+	}
+};
+
+
+#endif // _WORKER_POOL_H_
@@ -25,11 +25,16 @@ alias_re = re.compile(r"(\w+)\s*=\s*(\w+)")
 return_re = re.compile(r"return\[\s*(\w+)\s*\]\s*=\s*([^;]+)")
 ltgt_re = re.compile(r"\^\s*(\w+)\s*\^")
 return_read_re = re.compile(r"return\[\s*(\w+)\s*\]")
+provisional_re = re.compile(r"provisional\[\s*(\w+)\s*\]\s*=\s*([^;]+)")
 return_computed_re = re.compile(r"computed\(\s*return\[\s*(\w+)\s*\]\s*\)")
+parallel_map_re = re.compile(r"\bparallel_map\s*\(")
+array_re = re.compile(r"^\s*([\w<>:, ]+?)\s*\[\s*\]\s*$")
 d_input = OrderedDict()
 d_compute = OrderedDict()
 d_alias = OrderedDict()
 d_type = OrderedDict()
+d_alias_args = OrderedDict() # alias name => args, for aliases of computes
+d_loop = OrderedDict() # loop name => the input whose ids are its iterations, see Compute.hint_members
 node_list = []
 
 raw_strs = []
@@ -48,16 +53,149 @@ def get_x(name):
     except KeyError:
         raise Exception("could not find input/compute '" + name + "'")
     
+def q_type(name):
+    """ the C++ type that is the engine's Q for the named input/compute/alias """
+    if name in d_compute:
+        return name + "_func"
+    if name in d_input or name in d_alias:
+        return name + "_t"
+    return None
+    
+def upstream_names(name):
+    """ args of a compute, or of an alias of a compute, that are known Qs """
+    if name in d_compute:
+        args = d_compute[name].args
+    elif name in d_alias_args:
+        args = d_alias_args[name]
+    else:
+        return []
+    return [a for a in args if q_type(a)]
+    
+def full_befores(name):
+    """
+    The distinct inputs upstream of the named node, in order of first appearance,
+    matching utils::input_closure in engine/tmp_utils.h.
+    """
+    args = upstream_names(name)
+    if not args:
+        return [name]
+    ret = []
+    for a in args:
+        ret += [x for x in full_befores(a) if x not in ret]
+    return ret
+    
+def graph_members(name, args):
+    """
+    The members that tell the engine about the graph at compile time, see 
+    StaticGraph in engine/static_graph.h, and the arg accessors, which read
+    straight from the upstream_values filled in by Engine::bind_upstream, so they
+    inline into the node's code.
+    """
+    known = [a for a in args if q_type(a)]
+    for a in args:
+        if not q_type(a) and a not in d_loop:
+            warnings.warn("[" + name + "] arg '" + a + "' is not an input/compute/alias")
+    befores = []
+    for a in known:
+        befores += [x for x in full_befores(a) if x not in befores]
+    public = ["static const auto accompanying_key_n = %d; // 1 + full-befores: %s" % (
+                    1 + len(befores), ", ".join(befores)),
+              "using upstream = utils::type_list<%s>;" % ", ".join(q_type(a) for a in known),
+              "std::array<void const*, %d> upstream_values; // see Engine::bind_upstream" % len(known),
+              q_name_str % name]
+    accessors = ["{t} const& {a}() const {{ return *static_cast<{t} const*>(upstream_values[{k}]); }}".format(
+                    t=q_type(a), a=a, k=k) for k, a in enumerate(known)]
+    return public, accessors
+    
+def topological_order():
+    """ all the Qs, each after everything upstream of it """
+    order = []
+    def visit(name):
+        if name in order:
+            return
+        for a in upstream_names(name):
+            visit(a)
+        order.append(name)
+    for name in list(d_input) + list(d_alias) + list(d_compute):
+        visit(name)
+    return order
+
+q_name_str = 'static char const* q_name(){ return "%s"; } // see utils::q_name'
+
+intern_str = """
+static const bool interned = true;
+string intern_key() const {{ return to_intern_key({member}); }}"""
+
 class Input(object):
-    def __init__(self, name, type_):
+    """
+    If intern is True, the engine deduplicates instances with the same value,
+    see Engine::make_input.
+    """
+    def __init__(self, name, type_, intern=False):
         self.name = name
         type_ = re.sub(ltgt_re, r"<\1>",  type_)
         self.type_ = type_
-        d_type[self.name] = "struct {name}_t{{\n{type_} 0_;\n}}".format(name=name,type_=type_)
+        self.intern = intern
+        d_type[self.name] = "struct {name}_t{{\nstatic const auto accompanying_key_n = 1;\n{q_name}\n{type_} _0;{intern}\n}}".format(name=name,type_=type_,
+                                q_name=q_name_str % name,
+                                intern=intern_str.format(member="_0") if intern else "")
         node_list.append(dict(id=len(node_list), name=name,directBefore=[],class_="input"))
     def translated_type(self):
         return self.type_
      
+def split_call(s, call_re):
+    """
+    Finds the first call matching call_re in s, and returns (before, args, after),
+    where args is the list of top-level comma separated arguments and after
+    excludes the trailing semicolon.  args is None if the brackets don't match.
+    """
+    m = call_re.search(s)
+    depth, start, args = 0, m.end(), []
+    for ii in range(m.end(), len(s)):
+        c = s[ii]
+        if c in "([{":
+            depth += 1
+        elif c in ")]}" and depth > 0:
+            depth -= 1
+        elif c == ")" or (c == "," and depth == 0):
+            args.append(s[start:ii].strip())
+            start = ii + 1
+            if c == ")":
+                return s[:m.start()], args, re.sub(r"^\s*;", "", s[ii+1:])
+    return s, None, ""
+    
+def return_type(ret):
+    """
+    The C++ type of a <return>, which is a public member of the node's class, so
+    it's kept with the node's value in the engine's store.  Arrays, "T[]", are
+    PersistentVector<T> with storage="persistent" (for the states of loops, so
+    that each iteration shares the chunks its delta didn't touch with the one
+    before), ChunkedArray<T, N> with chunking="N" (ChunkedArray<T, N, SoA> with
+    layout="soa" too, see chunked_array.h), otherwise std::vector<T>.
+    """
+    type_ = re.sub(ltgt_re, r"<\1>", ret.get('type', ''))
+    m = array_re.match(type_)
+    if not m:
+        if ret.get('storage'):
+            warnings.warn("[return:" + ret.get('name', '') + "] storage is only for arrays")
+        return type_
+    elem = m.group(1)
+    chunking = ret.get('chunking', '').split()
+    if ret.get('storage', '').lower() == 'persistent':
+        return "PersistentVector<%s>" % elem
+    if ret.get('storage'):
+        warnings.warn("[return:" + ret.get('name', '') + "] unknown storage '" + ret['storage'] + "'")
+    layout = ret.get('layout', '').lower()
+    if layout not in ('', 'aos', 'soa'):
+        warnings.warn("[return:" + ret.get('name', '') + "] unknown layout '" + ret['layout'] + "'")
+    if chunking and chunking[0].isdigit():
+        if layout == 'soa':
+            return "ChunkedArray<%s, %s, SoA>" % (elem, chunking[0])
+        return "ChunkedArray<%s, %s>" % (elem, chunking[0])
+    if layout == 'soa':
+        warnings.warn("[return:" + ret.get('name', '') + "] layout=\"soa\" is only for chunked arrays")
+    return "std::vector<%s>" % elem
+    
 def lookup_node_id(name):
     try:
        return next(ii for ii, el in enumerate(node_list) if el['name'] == name)
@@ -73,8 +211,14 @@ class Compute(object):
             
     hints are stored as a dict with the obvious name,values, note that values
     are strings though.
+    
+    delta is an optional dict(over=[input names], code=str), from a <delta over="...">
+    node, see delta_members.
+    
+    loop is the name of the <loop> the node is in, if any, see hint_members.
     """
-    def __init__(self, name="", code="", returns=[], args=[], description="", hints=""):
+    def __init__(self, name="", code="", returns=[], args=[], description="", hints="",
+                 delta=None, loop=None):
         self.name = name        
         self.description = strip_common_indent(description) if description else ""
         self.code = strip_common_indent(code) if code else ""
@@ -82,6 +226,9 @@ class Compute(object):
         self.arg_extra = {x['name']: x for x in args}        
         self.returns = {x.get('name',name): x for x in returns}        
         self.hints = {k: v for k, v in re.findall(hint_re,hints)} if hints else {}
+        self.fused_into = None
+        self.delta = delta
+        self.loop = loop
         self.node_list_id = len(node_list) 
         node_list.append(dict(id=self.node_list_id,name=name,class_="compute",
                               directBefore=[lookup_node_id(x['name']) for x in args],
@@ -95,19 +242,134 @@ class Compute(object):
         return s
         
     def translated_code(self):
-        s = self.stripped_code()
-        for a in self.args:
-            s = s.replace(a, a+"()")
+        return self.translate(self.stripped_code())
+        
+    def translate(self, s, extra_args=()):
+        for a in tuple(self.args) + tuple(extra_args):
+            # whole words only, so xy doesn't hit both_xy or both_xy.xy1
+            s = re.sub(r"(?<![.\w])%s\b" % a, a + "()", s)
+        s = re.sub(provisional_re, r'sink(x_return_provisional(\1, \2))', s)
         s = re.sub(return_re, r'sink(x_return(\1, \2))', s)
         s = re.sub(return_computed_re,  r'x_is_computed_self(\1)', s)
         s = re.sub(return_read_re, r'X_READ_SELF(\1)', s)
         return s
         
+    def hint_members(self):
+        """
+        The hints that the engine acts on become static members of the class,
+        see the utils::is_... traits in engine/tmp_utils.h.
+        """
+        members = []
+        if self.hints.get('disk', '').lower() == 'true':
+            members.append("static const bool disk = true; // run on the engine's io_executor")
+        cpu = self.hints.get('CPU', '1')
+        if cpu.lower() == 'auto':
+            members.append("static const int cpu = 0; // CPU=auto, parallel_map may use all workers")
+        elif cpu != '1':
+            members.append("static const int cpu = %d; // parallel_map may use this many threads" % int(cpu))
+        if self.hints.get('CACHE', '0') == '1':
+            members.append("static const bool cache = true; // CACHE=1, only a default, see CostModel")
+        if self.fused_into:
+            members.append("using fused_into = %s; // see FusedMap in generate_cpp.py" % self.fused_into)
+        if self.hints.get('progressive'):
+            members.append("static const int progressive = %d; // see Engine::progressive_for_chunks" %
+                           int(self.hints['progressive']))
+        # the loop's state is the node that reads the loop, i.e. its own previous
+        # iteration, and each iteration is one of the loop's first input
+        over = d_loop.get(self.loop)
+        if self.loop in self.args:
+            if over and over in full_befores(self.name):
+                members.append("using chain_over = %s; // an iteration of %s, see Engine::append_chain" %
+                               (q_type(over), self.loop))
+            else:
+                warnings.warn("[Compute:" + self.name + "] reads loop '" + self.loop + "' but isn't over its input")
+        return members
+        
+    def delta_members(self):
+        """
+        Nodes with a <delta over="input_a input_b"> get a second body, delta(sink),
+        for when only those inputs have changed since the node was last computed,
+        which patches the previous value rather than starting from scratch, see
+        Engine::bind_delta.  In its code prev(x) is the old value of x, where x is an
+        arg, one of the delta inputs or the node itself, and the delta inputs can be
+        used by name even if they aren't args.  It returns false if it can't handle
+        the change, in which case the full body is run.
+        Returns (public members, private accessors, the delta method), all empty if
+        there's no delta.
+        """
+        if not self.delta:
+            return [], [], ""
+        befores = full_befores(self.name)
+        over = [x for x in self.delta['over'] if x in befores]
+        for x in self.delta['over']:
+            if x not in befores:
+                warnings.warn("[Compute:" + self.name + "] delta over '" + x + "' which isn't upstream of it")
+        known = [a for a in self.args if q_type(a)]
+        public = ["using delta_over = utils::type_list<%s>; // see Engine::bind_delta" % ", ".join(q_type(x) for x in over),
+                  "void const* prev_value = nullptr;",
+                  "std::array<void const*, %d> prev_upstream_values;" % len(known),
+                  "std::array<void const*, %d> delta_values; // old then new, for each of delta_over" % (2*len(over))]
+        access = "{t} const& {a}() const {{ return *static_cast<{t} const*>({src}); }}"
+        private = [access.format(t=q_type(self.name), a="prev_" + self.name, src="prev_value")]
+        private += [access.format(t=q_type(a), a="prev_" + a, src="prev_upstream_values[%d]" % k)
+                    for k, a in enumerate(known)]
+        for k, x in enumerate(over):
+            private.append(access.format(t=q_type(x), a="prev_" + x, src="delta_values[%d]" % (2*k)))
+            if x not in known:
+                private.append(access.format(t=q_type(x), a=x, src="delta_values[%d]" % (2*k + 1)))
+        code = strip_common_indent(self.delta['code']).strip()
+        translated = re.sub(r"\bprev\(\s*(\w+)\s*\)", r"prev_\1()", code)
+        translated = self.translate(translated, extra_args=[x for x in over if x not in known])
+        method = strip_common_indent("""
+    bool delta(sink_t& sink){{
+        /* delta over {over}, see Engine::bind_delta
+    {comment}
+        */
+    {code}
+    }}""").format(over=", ".join(over), comment=add_indent(code), code=add_indent(translated))
+        return public, private, method
+        
+    def return_members(self):
+        """ see return_type """
+        return ["%s %s;" % (return_type(ret), name) for name, ret in self.returns.items()]
+        
+    def map_parts(self):
+        """
+        Nodes with a map=X hint promise that their code is of the form:
+        
+            prologue;
+            parallel_map(X, ret, [&](element, size_t i){ ... });
+            epilogue;
+            
+        where the lambda is cheap and only depends on its arguments, the prologue
+        and the node's args.  Returns a MapParts, or None if the code isn't of
+        that form (with a warning), in which case the node is never fused.
+        """
+        src = self.hints.get('map')
+        if not src:
+            return None
+        code = self.stripped_code()
+        if len(re.findall(parallel_map_re, code)) != 1:
+            warnings.warn("[Compute:" + self.name + "] map=" + src + " but not exactly one parallel_map")
+            return None
+        prologue, call_args, epilogue = split_call(code, parallel_map_re)
+        if call_args is None or len(call_args) != 3 or call_args[0] != src \
+                or call_args[1] not in self.returns:
+            warnings.warn("[Compute:" + self.name + "] map=" + src + " but can't parse its parallel_map")
+            return None
+        kernel = call_args[2]
+        # the kernel outlives the prologue's locals, so it has to capture by value
+        kernel = re.sub(r"^\[\s*&\s*\]", "[=]", kernel)
+        return MapParts(self, src, call_args[1], prologue.strip(), kernel, epilogue.strip())
+        
     def __repr__(self):
         return strip_common_indent("""
     class {name}_func {{
+    public:
+    {graph}
     private:
     {takes}
+    {delta_takes}
     
         template <typename T>
         yield_signal x_return(int n, T val){{
@@ -115,26 +377,179 @@ class Compute(object):
             return yield_signal(WRITTEN, n);
         }}
         
+        template <typename T>
+        yield_signal x_return_provisional(int n, T val){{
+            // an approximation, to be followed by x_return, see Engine::publish
+            return yield_signal(PROVISIONAL, n);
+        }}
+        
         bool x_is_computed_self(int n){{
             return true;// TODO: this        
         }}
         
-    public:
+    public:{hints}
         void operator()(sink_t& sink){{
     {comment}
     {code}
         }}
+    {delta}
     }}""").format(name=self.name,
                  comment=add_indent("/*\n" + self.description.strip() +
                                      "\n\n*************************************\n" +
                                     self.stripped_code() +
                                     "\n*************************************\n*/", n=2),
                  code= add_indent(self.translated_code(),n=2),
-                 takes= '\n'.join(indent + "{name}_t {name}(){{\n{indent}{indent}return something;//TODO: this\n{indent}}}".format(name=t,indent=indent) 
-                                  for t in self.args))
+                 hints= ''.join('\n' + indent + h for h in self.hint_members()),
+                 graph= '\n'.join(indent + g for g in graph_members(self.name, self.args)[0] +
+                                   self.delta_members()[0] + self.return_members()),
+                 takes= '\n'.join(indent + g for g in graph_members(self.name, self.args)[1]),
+                 delta_takes= '\n'.join(indent + g for g in self.delta_members()[1]),
+                 delta= add_indent(self.delta_members()[2]))
         
     
         
+class MapParts(object):
+    """ see Compute.map_parts. src is the iteration space and ret the output. """
+    def __init__(self, compute, src, ret, prologue, kernel, epilogue):
+        self.compute = compute
+        self.src = src
+        self.ret = ret
+        self.prologue = prologue
+        self.kernel = kernel
+        self.epilogue = epilogue
+        self.chunking = compute.returns[ret].get('chunking')
+        
+        
+class FusedMap(object):
+    """
+    A group of element-wise nodes (see Compute.map_parts) that all iterate over
+    the same src, either directly (siblings, e.g. speed and pos_bin_ind over xy)
+    or via the output of another member (chains, e.g. something with map=speed).
+    
+    Rather than each node allocating and writing its own array, re-reading src
+    (and the arrays in the chain) from memory, the fused func reads each element
+    of src once, runs all the kernels on it while it's in registers and writes
+    every requested output.  The outputs are still separate returns, so they are
+    cached (and evicted) separately, and each node can still run on its own.
+    Each member's prologue runs first, and its epilogue after the loop.
+    
+    A chained member is only fused if its kernel doesn't index into the upstream
+    output (e.g. speed[i-1]), as that chunk may not be written yet.  All the
+    outputs must have the same chunking, so that they line up chunk by chunk.
+    """
+    def __init__(self, src, members):
+        self.src = src
+        self.members = members
+        self.name = src + "_map_fused"
+        for m in members:
+            m.compute.fused_into = self.name + "_func"
+            
+    def hint_members(self):
+        cpus = [m.compute.hints.get('CPU', '1').lower() for m in self.members]
+        if 'auto' in cpus:
+            return ["static const int cpu = 0; // CPU=auto on at least one member"]
+        cpu = max(int(c) for c in cpus)
+        return ["static const int cpu = %d; // the most of any member" % cpu] if cpu != 1 else []
+        
+    def __repr__(self):
+        rets = set(m.ret for m in self.members)
+        args = OrderedDict((a, 1) for m in self.members for a in m.compute.args if a not in rets)
+        setup, loop, finish = [], [], []
+        for m in self.members:
+            c, name = m.compute, m.compute.name
+            setup.append("// " + name + "\nconst bool want_{name} = x_is_requested(\"{name}\");\n"
+                         "auto {name}_kernel = [&]{{\n{body}\n}}();".format(name=name,
+                            body=add_indent(c.translate(m.prologue + "\nreturn " + m.kernel + ";").strip())))
+            src_v = m.src + "_v" if m.src in rets else "src_v"
+            loop.append("auto const {ret}_v = need_{name} ? {name}_kernel({src_v}, i)\n"
+                        "{indent}{indent}{indent}: decltype({name}_kernel({src_v}, i)){{}};\n"
+                        "if(want_{name}) {ret}_c[j] = {ret}_v;".format(
+                            ret=m.ret, name=name, src_v=src_v, indent=indent))
+            if m.epilogue:
+                finish.append("if(want_{name}){{\n{epilogue}\n}}".format(
+                                name=name, epilogue=add_indent(c.translate(m.epilogue))))
+        # a member's kernel runs if it, or anything chained off it, is wanted
+        need = []
+        for m in reversed(self.members):
+            downstream = [d.compute.name for d in self.members if d.src == m.ret]
+            need.append("const bool need_{name} = {cond};".format(name=m.compute.name,
+                        cond=" || ".join(["want_" + m.compute.name] + ["need_" + d for d in downstream])))
+        need.reverse()
+        return strip_common_indent("""
+    class {name}_func {{
+        /* fused loop for {member_names}, see FusedMap in generate_cpp.py */
+    public:
+    {graph}
+    private:
+    {takes}
+    
+        bool x_is_requested(char const* node){{
+            return true;// TODO: this
+        }}
+        
+    public:{hints}
+        void operator()(sink_t& sink){{
+    {setup}
+    {need}
+            auto const& src = {src}();
+    {allocate}
+            parallel_for_chunks(src, [&](size_t c){{
+                auto const src_c = src.cchunk(c); // a pointer, or a chunk ref for layout="soa"
+    {chunk_ptrs}
+                for(size_t j=0, n=src.chunk_size(c), i=c*src.chunk_len; j<n; j++, i++){{
+                    auto const& src_v = src_c[j];
+    {loop}
+                }}
+    {finish_chunks}
+            }});
+    {finish}
+        }}
+    }}""").format(name=self.name, src=self.src,
+                 member_names=", ".join(m.compute.name for m in self.members),
+                 hints=''.join('\n' + indent + h for h in self.hint_members()),
+                 graph='\n'.join(indent + g for g in graph_members(self.name, list(args))[0]),
+                 takes='\n'.join(indent + g for g in graph_members(self.name, list(args))[1]),
+                 setup=add_indent('\n'.join(setup), n=2),
+                 need=add_indent('\n'.join(need), n=2),
+                 allocate=add_indent('\n'.join("if(want_{name}) {ret}.allocate(src.length());".format(
+                                    name=m.compute.name, ret=m.ret) for m in self.members), n=2),
+                 chunk_ptrs=add_indent('\n'.join("auto const {ret}_c = want_{name} ? {ret}.chunk_data(c) : decltype({ret}.chunk_data(c)){{}};".format(
+                                    name=m.compute.name, ret=m.ret) for m in self.members), n=3),
+                 loop=add_indent('\n'.join(loop), n=4),
+                 finish_chunks=add_indent('\n'.join("if(want_{name}) {ret}.finish_chunk(c);".format(
+                                    name=m.compute.name, ret=m.ret) for m in self.members), n=3),
+                 finish=add_indent('\n'.join(finish), n=2))
+    
+    
+def find_fused_maps():
+    """
+    Groups the nodes with a map=X hint by their root iteration space, following
+    chains through other members' outputs, see FusedMap.
+    """
+    parts = [p for p in (c.map_parts() for c in d_compute.values()) if p]
+    by_ret = {p.ret: p for p in parts}
+    def root_of(p):
+        up = by_ret.get(p.src)
+        if up is None or re.search(r"\b%s\s*\[" % p.src, p.kernel):
+            return p.src
+        return root_of(up)
+    groups = OrderedDict()
+    for p in parts:
+        groups.setdefault((root_of(p), p.chunking), []).append(p)
+    fused = []
+    for (src, chunking), members in groups.items():
+        if len(members) < 2:
+            continue
+        # chained members must come after what they read from
+        ordered = []
+        while members:
+            p = next(p for p in members if p.src not in [m.ret for m in members])
+            members.remove(p)
+            ordered.append(p)
+        fused.append(FusedMap(src, ordered))
+    return fused
+        
+    
 def do_alias(node):
     """
     This doesn't actully recurse - I thought it might be neccessary but then
@@ -152,21 +567,32 @@ def do_alias(node):
     else:
         args = [node_src]        
     node_type = node_alias + suffix + "t"
-    d_type[node_alias] = "struct %s{\n%s\n}" % (node_type, '\n'.join(
-                            '%s _%d;' %(v + "_t",i) for i,v in enumerate(args)))
+    if isinstance(node_parsed, Compute):
+        d_alias_args[node_alias] = args
+        extra = "\n" + "\n".join(graph_members(node_alias, args)[0][:2])
+    else:
+        extra = "\nstatic const auto accompanying_key_n = 1;"
+    extra += "\n" + q_name_str % node_alias
+    if isinstance(node_parsed, Input) and node_parsed.intern:
+        # share the id space of the src, so the same value gets the same id
+        extra += "\nusing intern_domain = %s_t;" % (node_src,) + intern_str.format(member="_0._0")
+    d_type[node_alias] = "struct %s{\n%s%s\n}" % (node_type, '\n'.join(
+                            '%s _%d;' %(v + "_t",i) for i,v in enumerate(args)), extra)
     return node_alias
     
     
 ##########################################    
 ##########################################
     
-parent = tree.getroot()
-for child in parent:
+def parse_node(child, loop=None):
     tag, name = child.tag.lower(), child.attrib.get('name',None)
     if tag == "input":
-        d_input[name] = Input(name,child.attrib['type'])
+        d_input[name] = Input(name,child.attrib['type'],
+                              child.attrib.get('intern', 'false').lower() == 'true')
+        if loop and d_loop[loop] is None:
+            d_loop[loop] = name
     elif tag == "compute":
-        hints = description = code = None
+        hints = description = code = delta = None
         args = []
         returns = []
         for sub_node in child:
@@ -181,11 +607,13 @@ for child in parent:
                 args.append(dict(sub_node.attrib))
             elif sub_tag in ("return","returns"):
                 returns.append(dict(sub_node.attrib))
+            elif sub_tag == "delta":
+                delta = dict(over=sub_node.attrib.get('over', '').split(), code=sub_node.text or "")
             else:
                 warnings.warn("[Compute:" + name + "] ignoring node: " + sub_tag)
         if child.text.strip():
             warnings.warn("[Compute:" + name + "] ignoring text: " + child.text.strip() )
-        d_compute[name] = Compute(name, code, returns, args, description, hints)
+        d_compute[name] = Compute(name, code, returns, args, description, hints, delta, loop)
         
     elif tag == "alias":
         d_alias[name] = get_x(child.attrib['src'])
@@ -193,25 +621,46 @@ for child in parent:
         #d_type[name] = "struct %s {\n%s value;\n}" %(name, child.attrib['src']);
     elif tag == "raw":
         raw_strs.append(strip_common_indent(child.text))
-    elif tag == "loop":
-        pass
+    elif tag == "loop" and loop is None:
+        d_loop[name] = None
+        for sub_node in child:
+            parse_node(sub_node, name)
     else:
         raise Exception("what is this '{}' node?".format(tag))
 
+parent = tree.getroot()
+for child in parent:
+    parse_node(child)
+
 ##########################################
 ##########################################
 
+# the engine's template args, from the root node, e.g. <engine store_capacity="64" id_type="uint32">,
+# store_capacity is the slots per table (see slot_class_store.h) so must be a power of 2, and
+# id_type must have room for as many ids as any input will get
+store_capacity = int(parent.attrib.get('store_capacity', '64'))
+if store_capacity & (store_capacity - 1):
+    raise Exception("store_capacity must be a power of 2, not %d" % store_capacity)
+id_type = parent.attrib.get('id_type', 'uint32')
+
+fused_maps = find_fused_maps()
 raw_str = '\n'.join(raw_strs)
 type_str = '\n\n'.join(d_type.values())
-func_str = '\n\n'.join(str(x) for x in d_compute.values())
+func_str = '\n\n'.join(["class %s_func;" % x.name for x in fused_maps] +
+                         [str(x) for x in d_compute.values()] +
+                         [str(x) for x in fused_maps])
 
 with open(fn_out,'w') as f:
     f.write(""" //generated in python from xml source
 #include <string.h>
 using string = std::string;
 using byte = char;
+using int8 = int8_t; using uint8 = uint8_t; using int16 = int16_t; using uint16 = uint16_t;
+using int32 = int32_t; using uint32 = uint32_t; using int64 = int64_t; using uint64 = uint64_t;
+using mapped_buffer = MappedBuffer; // see engine/mapped_file.h
 enum yield_enum{
 written,
+provisional,
 required
 }
 struct yield_signal{
@@ -220,11 +669,24 @@ int param; // TODO: use a union and explicit typing
 }
 using sink_t = boost::coroutines::asymmetric_coroutine<yield_signal>::push_type;
 
+// for interned inputs, see Engine::make_input
+template<typename T>
+string to_intern_key(T const& v){ return string(reinterpret_cast<char const*>(&v), sizeof(T)); }
+string to_intern_key(string const& v){ return v; }
+
 """)
     f.write(raw_str)
     f.write(type_str)
     f.write("\n\n")
     f.write(func_str)
+    f.write("""
+
+// All the Qs, each after everything upstream of it, see StaticGraph in engine/static_graph.h
+using engine_t = Engine<%d, %s,
+%s>;
+engine_t engine;
+using dispatcher_t = Dispatcher<engine_t, &engine>;
+""" % (store_capacity, id_type, ",\n".join(indent + q_type(x) for x in topological_order())))
     
     
 with open(r"explorer\sample.html","w") as f:
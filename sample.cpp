@@ -1,10 +1,13 @@
  //generated in python from xml source
-
 #include <string.h>
 using string = std::string;
 using byte = char;
+using int8 = int8_t; using uint8 = uint8_t; using int16 = int16_t; using uint16 = uint16_t;
+using int32 = int32_t; using uint32 = uint32_t; using int64 = int64_t; using uint64 = uint64_t;
+using mapped_buffer = MappedBuffer; // see engine/mapped_file.h
 enum yield_enum{
 written,
+provisional,
 required
 }
 struct yield_signal{
@@ -13,6 +16,11 @@ int param; // TODO: use a union and explicit typing
 }
 using sink_t = boost::coroutines::asymmetric_coroutine<yield_signal>::push_type;
 
+// for interned inputs, see Engine::make_input
+template<typename T>
+string to_intern_key(T const& v){ return string(reinterpret_cast<char const*>(&v), sizeof(T)); }
+string to_intern_key(string const& v){ return v; }
+
 
 struct point{
 int16 x;
@@ -20,6 +28,7 @@ int16 y;
 }
 
 
+// per-element, for use in map kernels. For whole arrays see kernels::atan2_diff.
 float angle_ab(point a, point b){
 	auto dx = b.x - a.x;
 	auto dy = b.y - a.y;
@@ -60,6 +69,7 @@ union shape{
 }
 }
 
+// per-element, for use in map kernels. For whole arrays see kernels::boundary_dist_rect.
 float boundary_dist_rect(point p, point topleft, int W, int H){
 	auto v1 = p.x - topleft.x);
 	auto v2 = topleft.x + W - p.x;
@@ -70,132 +80,221 @@ float boundary_dist_rect(point p, point topleft, int W, int H){
 
 
 
-enum logical_summary{
-// recrods the stat of a bool vector: either all true, none true, or a mixture of true and false.
-all; 
-none;
-mixture;
+// recrods the stat of a mask: either all true, none true, or a mixture of true and false.
+// Masks are bitmasks (see engine/bitmask.h), which keep a count per chunk as they are
+// written, so mask.summary() is O(chunks) rather than a scan over the samples.
+using logical_summary = LogicalSummary;
+
+
+
+// These are thin wrappers over the engine's vectorised kernels, see engine/kernels.h.
+// The number of bins is fixed by the bin size and the largest value we expect.
+const size_t N_SPEED_BINS = 100;
+
+vector<uint32> hist(vals, bin_size){
+	return kernels::hist(vals, bin_size, N_SPEED_BINS);
 }
 
-logical_summary make_logical_summary(bool[] X){
-  		if(all(X))
-  			return all;
-  		else if(none(X))
-  			return none;
-  		else
-  			return mixture;
+vector<uint32> hist_masked(vals, mask, bin_size){
+	return kernels::hist_masked(vals, mask, bin_size, N_SPEED_BINS);
 }
 
+// The samples that are in one of the two slices but not the other, as (up to) two
+// ranges: where the start moved and where the end moved.  null if either is null.
+vector<slice<int32>> changed_ranges(slice<int32> a, slice<int32> b){
+	if(isnull(a) || isnull(b))
+		return null;
+	return {{min(a.start, b.start), max(a.start, b.start)},
+			{min(a.end, b.end), max(a.end, b.end)}};
+}
 
 
-vector<int32> hist(vals, bin_size){
-	vector<int32> h; // TODO: behind the scenes we need to decide how to deal with dynamically 
-					 //resizing vector, which will reach a final state by the time the function returns.
-	for(int i=0;i <vals.length;i++)
-		h[vals[i]/bin_size]++;
-	return h;
+struct cut_delta_enum{
+	split_v_t;
+	merge;
+	swap;
+	paint;
 }
-
-vector<int32> hist_masked(vals, mask, bin_size){
-	vector<int32> h;
-	for(int i=0;i <vals.length;i++) if(mask[i])
-		h[vals[i]/bin_size]++
-	return h;
+struct cut_delta_spec{
+	cut_delta_enum kind;
+	union{
+	//stuff;
+	}
 }
 struct axona_file_name_t{
-string 0_;
+static const auto accompanying_key_n = 1;
+static char const* q_name(){ return "axona_file_name"; } // see utils::q_name
+string _0;
+static const bool interned = true;
+string intern_key() const { return to_intern_key(_0); }
 }
 
 struct pos_file_name_t{
 axona_file_name_t _0;
+static const auto accompanying_key_n = 1;
+static char const* q_name(){ return "pos_file_name"; } // see utils::q_name
+using intern_domain = axona_file_name_t;
+static const bool interned = true;
+string intern_key() const { return to_intern_key(_0._0); }
 }
 
 struct pos_file_t{
 pos_file_name_t _0;
+static const auto accompanying_key_n = 2; // 1 + full-befores: pos_file_name
+using upstream = utils::type_list<pos_file_name_t>;
+static char const* q_name(){ return "pos_file"; } // see utils::q_name
 }
 
 struct set_file_name_t{
 axona_file_name_t _0;
+static const auto accompanying_key_n = 1;
+static char const* q_name(){ return "set_file_name"; } // see utils::q_name
+using intern_domain = axona_file_name_t;
+static const bool interned = true;
+string intern_key() const { return to_intern_key(_0._0); }
 }
 
 struct set_file_t{
 set_file_name_t _0;
+static const auto accompanying_key_n = 2; // 1 + full-befores: set_file_name
+using upstream = utils::type_list<set_file_name_t>;
+static char const* q_name(){ return "set_file"; } // see utils::q_name
 }
 
 struct tet_file_name_t{
 axona_file_name_t _0;
+static const auto accompanying_key_n = 1;
+static char const* q_name(){ return "tet_file_name"; } // see utils::q_name
+using intern_domain = axona_file_name_t;
+static const bool interned = true;
+string intern_key() const { return to_intern_key(_0._0); }
 }
 
 struct tet_file_t{
 tet_file_name_t _0;
+static const auto accompanying_key_n = 2; // 1 + full-befores: tet_file_name
+using upstream = utils::type_list<tet_file_name_t>;
+static char const* q_name(){ return "tet_file"; } // see utils::q_name
 }
 
 struct eeg_file_name_t{
 axona_file_name_t _0;
+static const auto accompanying_key_n = 1;
+static char const* q_name(){ return "eeg_file_name"; } // see utils::q_name
+using intern_domain = axona_file_name_t;
+static const bool interned = true;
+string intern_key() const { return to_intern_key(_0._0); }
 }
 
 struct eeg_file_t{
 eeg_file_name_t _0;
+static const auto accompanying_key_n = 2; // 1 + full-befores: eeg_file_name
+using upstream = utils::type_list<eeg_file_name_t>;
+static char const* q_name(){ return "eeg_file"; } // see utils::q_name
 }
 
 struct group_num_t{
-uint8 0_;
+static const auto accompanying_key_n = 1;
+static char const* q_name(){ return "group_num"; } // see utils::q_name
+uint8 _0;
 }
 
 struct trial_time_slice_t{
-slice<int32> 0_;
+static const auto accompanying_key_n = 1;
+static char const* q_name(){ return "trial_time_slice"; } // see utils::q_name
+slice<int32> _0;
 }
 
 struct directional_slice_t{
-slice<float> 0_;
+static const auto accompanying_key_n = 1;
+static char const* q_name(){ return "directional_slice"; } // see utils::q_name
+slice<float> _0;
 }
 
 struct spatial_mask_t{
-spatial<bool> 0_;
+static const auto accompanying_key_n = 1;
+static char const* q_name(){ return "spatial_mask"; } // see utils::q_name
+spatial<bool> _0;
 }
 
 struct boundary_dist_slice_t{
-slice<float> 0_;
+static const auto accompanying_key_n = 1;
+static char const* q_name(){ return "boundary_dist_slice"; } // see utils::q_name
+slice<float> _0;
 }
 
 struct boundary_shape_t{
-shape 0_;
+static const auto accompanying_key_n = 1;
+static char const* q_name(){ return "boundary_shape"; } // see utils::q_name
+shape _0;
 }
 
 struct speed_bin_size_t{
-float 0_;
+static const auto accompanying_key_n = 1;
+static char const* q_name(){ return "speed_bin_size"; } // see utils::q_name
+float _0;
 }
 
 struct spa_bin_size_t{
-float 0_;
+static const auto accompanying_key_n = 1;
+static char const* q_name(){ return "spa_bin_size"; } // see utils::q_name
+float _0;
 }
 
 struct cut_file_name_t{
 axona_file_name_t _0;
+static const auto accompanying_key_n = 1;
+static char const* q_name(){ return "cut_file_name"; } // see utils::q_name
+using intern_domain = axona_file_name_t;
+static const bool interned = true;
+string intern_key() const { return to_intern_key(_0._0); }
 }
 
 struct tac_window_secs_t{
-float 0_;
+static const auto accompanying_key_n = 1;
+static char const* q_name(){ return "tac_window_secs"; } // see utils::q_name
+float _0;
 }
 
+struct cut_delta_t{
+static const auto accompanying_key_n = 1;
+static char const* q_name(){ return "cut_delta"; } // see utils::q_name
+cut_delta_spec _0;
+}
+
+class xy_map_fused_func;
+
 
 class axona_file_func {
+public:
+    static const auto accompanying_key_n = 2; // 1 + full-befores: axona_file_name
+    using upstream = utils::type_list<axona_file_name_t>;
+    std::array<void const*, 1> upstream_values; // see Engine::bind_upstream
+    static char const* q_name(){ return "axona_file"; } // see utils::q_name
+    map header;
+    mapped_buffer buffer;
 private:
-    axona_file_name_t axona_file_name(){
-        return something;//TODO: this
-    }
-    
+    axona_file_name_t const& axona_file_name() const { return *static_cast<axona_file_name_t const*>(upstream_values[0]); }
+
+
     template <typename T>
     yield_signal x_return(int n, T val){
         // TODO: store val
         return yield_signal(WRITTEN, n);
     }
     
+    template <typename T>
+    yield_signal x_return_provisional(int n, T val){
+        // an approximation, to be followed by x_return, see Engine::publish
+        return yield_signal(PROVISIONAL, n);
+    }
+    
     bool x_is_computed_self(int n){
         return true;// TODO: this        
     }
-
+    
 public:
+    static const bool disk = true; // run on the engine's io_executor
     void operator()(sink_t& sink){
         /*
         Reads an axomna file which consists of a header block of multiple lines of: 
@@ -204,60 +303,77 @@ public:
         Following that is a (large) block of binary data.
         In some cases (set files) there may not be a data_start and binary_data section.
         This compute is aliased as pos_file, set_file, tet_file, and eeg_file.
+        The buffer is a MappedBuffer, i.e. just a view over the memory-mapped file, so nothing
+        is copied into the store and the OS page cache is our cache for the actual data.
         
         *************************************
-        const int BLOCK_SIZE = 2*1024*104; //2MB
-        FileStreamer f(axona_file_name); //this is C++ RAII in action, we are using axona_file_name from its definition as an "input".
-        int n_blocks = ceil(f.length()/BLOCK_SIZE); 
+        const int BLOCK_SIZE = 2*1024*1024; //2MB
+        MappedBuffer f = MappedBuffer::open(axona_file_name, BLOCK_SIZE); //this is C++ RAII in action, we are using axona_file_name from its definition as an "input".
         if ( !computed(header) ){
         	// we may already have this cached.
         	map header_tmp;
-        	// parse f into header, storing the n_block, and data_start pointer as well
+        	// parse f.block(0) into header, storing the data_start offset as well
         	header = header_tmp; 
         }
         
+        buffer = f.subview(header.data_start); // no bytes are copied, it's just a view
         for (block_ii in requested_blocks){
-        	buffer[block_ii] = f.read(block_ii*BLOCK_SIZE, BLOCK_SIZE);
+        	buffer.will_need(block_ii); // madvise, the OS does the actual reading
         }
         *************************************
         */
-        const int BLOCK_SIZE = 2*1024*104; //2MB
-        FileStreamer f(axona_file_name()); //this is C++ RAII in action, we are using axona_file_name() from its definition as an "input".
-        int n_blocks = ceil(f.length()/BLOCK_SIZE); 
+        const int BLOCK_SIZE = 2*1024*1024; //2MB
+        MappedBuffer f = MappedBuffer::open(axona_file_name(), BLOCK_SIZE); //this is C++ RAII in action, we are using axona_file_name() from its definition as an "input".
         if ( !computed(header) ){
         	// we may already have this cached.
         	map header_tmp;
-        	// parse f into header, storing the n_block, and data_start pointer as well
+        	// parse f.block(0) into header, storing the data_start offset as well
         	header = header_tmp; 
         }
         
+        buffer = f.subview(header.data_start); // no bytes are copied, it's just a view
         for (block_ii in requested_blocks){
-        	buffer[block_ii] = f.read(block_ii*BLOCK_SIZE, BLOCK_SIZE);
+        	buffer.will_need(block_ii); // madvise, the OS does the actual reading
         }
     }
+
 }
 
 
 class both_xy_func {
+public:
+    static const auto accompanying_key_n = 3; // 1 + full-befores: pos_file_name, set_file_name
+    using upstream = utils::type_list<pos_file_t, set_file_t>;
+    std::array<void const*, 2> upstream_values; // see Engine::bind_upstream
+    static char const* q_name(){ return "both_xy"; } // see utils::q_name
+    bool used_both;
+    ChunkedArray<point, 10000, SoA> xy1;
+    ChunkedArray<point, 10000, SoA> xy2;
+    float w1;
+    float w2;
 private:
-    pos_file_t pos_file(){
-        return something;//TODO: this
-    }
-    set_file_t set_file(){
-        return something;//TODO: this
-    }
-    
+    pos_file_t const& pos_file() const { return *static_cast<pos_file_t const*>(upstream_values[0]); }
+    set_file_t const& set_file() const { return *static_cast<set_file_t const*>(upstream_values[1]); }
+
+
     template <typename T>
     yield_signal x_return(int n, T val){
         // TODO: store val
         return yield_signal(WRITTEN, n);
     }
     
+    template <typename T>
+    yield_signal x_return_provisional(int n, T val){
+        // an approximation, to be followed by x_return, see Engine::publish
+        return yield_signal(PROVISIONAL, n);
+    }
+    
     bool x_is_computed_self(int n){
         return true;// TODO: this        
     }
-
+    
 public:
+    static const bool cache = true; // CACHE=1, only a default, see CostModel
     void operator()(sink_t& sink){
         /*
         This takes the pos header and buffer and does the pos-post-processing, to produce either 1 or two
@@ -267,18 +383,14 @@ public:
         used_both = set_file.header['colactive_2']; 
         
         int num_samps = parseInt(pos_file.header['num_samps']);
-        if (use_both){
-        	xy1.allocate(num_samps);
+        xy1.allocate(num_samps);
+        if (used_both)
         	xy2.allocate(num_samps);
-        	for(auto c pos_file.buffer.iter_blocks(16)){
-        		xy1.write(block[3]); // TODO: actual post processing..this is complicated for a number of reasons.
-        		xy2.write(block[4]);
-        	}	
-        }else{
-        	xy_1.allocate(num_samps);
-        	for(auto c pos_file.buffer.iter_blocks(16))
-        		xy1.write(block[3]);
-        }
+        pos_file.buffer.for_each_record(16, [&](auto c){ // straight out of the mapping, like spike_times
+        	xy1.write(c[3]); // TODO: actual post processing..this is complicated for a number of reasons.
+        	if (used_both)
+        		xy2.write(c[4]);
+        });
         w1 = sum(!nan(xy1));
         w2 = sum(!nan(xy2));
         *************************************
@@ -286,45 +398,56 @@ public:
         used_both = set_file().header['colactive_2']; 
         
         int num_samps = parseInt(pos_file().header['num_samps']);
-        if (use_both){
-        	xy1.allocate(num_samps);
+        xy1.allocate(num_samps);
+        if (used_both)
         	xy2.allocate(num_samps);
-        	for(auto c pos_file().buffer.iter_blocks(16)){
-        		xy1.write(block[3]); // TODO: actual post processing..this is complicated for a number of reasons.
-        		xy2.write(block[4]);
-        	}	
-        }else{
-        	xy_1.allocate(num_samps);
-        	for(auto c pos_file().buffer.iter_blocks(16))
-        		xy1.write(block[3]);
-        }
+        pos_file().buffer.for_each_record(16, [&](auto c){ // straight out of the mapping, like spike_times
+        	xy1.write(c[3]); // TODO: actual post processing..this is complicated for a number of reasons.
+        	if (used_both)
+        		xy2.write(c[4]);
+        });
         w1 = sum(!nan(xy1));
         w2 = sum(!nan(xy2));
     }
+
 }
 
 
 class xy_func {
+public:
+    static const auto accompanying_key_n = 3; // 1 + full-befores: pos_file_name, set_file_name
+    using upstream = utils::type_list<both_xy_func>;
+    std::array<void const*, 1> upstream_values; // see Engine::bind_upstream
+    static char const* q_name(){ return "xy"; } // see utils::q_name
+    ChunkedArray<point, 10000, SoA> xy;
 private:
-    both_xy_t both_xy(){
-        return something;//TODO: this
-    }
-    
+    both_xy_func const& both_xy() const { return *static_cast<both_xy_func const*>(upstream_values[0]); }
+
+
     template <typename T>
     yield_signal x_return(int n, T val){
         // TODO: store val
         return yield_signal(WRITTEN, n);
     }
     
+    template <typename T>
+    yield_signal x_return_provisional(int n, T val){
+        // an approximation, to be followed by x_return, see Engine::publish
+        return yield_signal(PROVISIONAL, n);
+    }
+    
     bool x_is_computed_self(int n){
         return true;// TODO: this        
     }
-
+    
 public:
+    static const bool cache = true; // CACHE=1, only a default, see CostModel
     void operator()(sink_t& sink){
         /*
         If there are two LEDs, this takes both sets of XY data and combines them to get a single value of xy for
         each moment in time.  with 1 LED, this simply uses that 1 array of XY data.
+        The points are stored struct-of-arrays (layout="soa"), so kernels over xy get the x's
+        and y's as separate contiguous arrays, see kernels::lanes.
         
         *************************************
         if(!both_xy.used_both){
@@ -344,32 +467,44 @@ public:
         		xy.write(p1*both_xy().w1 + p2*both_xy().w2);
         }
     }
+
 }
 
 
 class dir_func {
+public:
+    static const auto accompanying_key_n = 3; // 1 + full-befores: pos_file_name, set_file_name
+    using upstream = utils::type_list<both_xy_func, xy_func, set_file_t>;
+    std::array<void const*, 3> upstream_values; // see Engine::bind_upstream
+    static char const* q_name(){ return "dir"; } // see utils::q_name
+    bool used_both;
+    ChunkedArray<float, 10000> dir_disp;
+    ChunkedArray<float, 10000> dir;
 private:
-    both_xy_t both_xy(){
-        return something;//TODO: this
-    }
-    xy_t xy(){
-        return something;//TODO: this
-    }
-    set_file_t set_file(){
-        return something;//TODO: this
-    }
-    
+    both_xy_func const& both_xy() const { return *static_cast<both_xy_func const*>(upstream_values[0]); }
+    xy_func const& xy() const { return *static_cast<xy_func const*>(upstream_values[1]); }
+    set_file_t const& set_file() const { return *static_cast<set_file_t const*>(upstream_values[2]); }
+
+
     template <typename T>
     yield_signal x_return(int n, T val){
         // TODO: store val
         return yield_signal(WRITTEN, n);
     }
     
+    template <typename T>
+    yield_signal x_return_provisional(int n, T val){
+        // an approximation, to be followed by x_return, see Engine::publish
+        return yield_signal(PROVISIONAL, n);
+    }
+    
     bool x_is_computed_self(int n){
         return true;// TODO: this        
     }
-
+    
 public:
+    static const bool cache = true; // CACHE=1, only a default, see CostModel
+    using fused_into = xy_map_fused_func; // see FusedMap in generate_cpp.py
     void operator()(sink_t& sink){
         /*
         The used_both is copied across from both_xy for convenience.
@@ -377,116 +512,137 @@ public:
         
         *************************************
         used_both = both_xy.used_both;
-        dir_disp.allocate(xy.length);
+        // like speed, dir is plotted over the whole trial, so has a pyramid
+        dir_disp.enable_pyramid();
+        // the per-sample part is element-wise over xy, so it's fused with speed etc., see map hint.
+        parallel_map(xy, dir_disp, [&](point pw, size_t i){
+        	return angle_ab(pw, i > 0 ? xy[i-1] : point(nan,nan));
+        });
         if(used_both){ 
-        	// TODO: could check which of the two dirs is requested and do different loop based on that. requested(dir_disp)
+        	// TODO: could check which of the two dirs is requested and skip this. requested(dir)
+        	dir.enable_pyramid();
         	dir.allocate(xy.length);
-        	point pw_old(nan,nan); 
-        	for(auto p1, p2, pw : both_xy.xy1, both_xy.xy2, xy){
+        	for(auto p1, p2 : both_xy.xy1, both_xy.xy2)
         		dir.write(angle_ab(p1,p2));
-        		dir_disp.write(angle_ab(pw,pw_old));
-        		pw_old = pw;	
-        	}
         }else{
-        	dir_disp.allocate(xy.length);
         	dir.equals(dir_disp);
-        	point pw_old(nan,nan); 
-        	for(auto pw : xy){
-        		dir_disp.write(angle_ab(pw,pw_old));
-        		pw_old = pw;	
-        	}
         }
         *************************************
         */
-        used_both = both_xy()().used_both;
-        dir_disp.allocate(xy().length);
+        used_both = both_xy().used_both;
+        // like speed, dir is plotted over the whole trial, so has a pyramid
+        dir_disp.enable_pyramid();
+        // the per-sample part is element-wise over xy(), so it's fused with speed etc., see map hint.
+        parallel_map(xy(), dir_disp, [&](point pw, size_t i){
+        	return angle_ab(pw, i > 0 ? xy()[i-1] : point(nan,nan));
+        });
         if(used_both){ 
-        	// TODO: could check which of the two dirs is requested and do different loop based on that. requested(dir_disp)
+        	// TODO: could check which of the two dirs is requested and skip this. requested(dir)
+        	dir.enable_pyramid();
         	dir.allocate(xy().length);
-        	point pw_old(nan,nan); 
-        	for(auto p1, p2, pw : both_xy()().xy()1, both_xy()().xy()2, xy()){
+        	for(auto p1, p2 : both_xy().xy1, both_xy().xy2)
         		dir.write(angle_ab(p1,p2));
-        		dir_disp.write(angle_ab(pw,pw_old));
-        		pw_old = pw;	
-        	}
         }else{
-        	dir_disp.allocate(xy().length);
         	dir.equals(dir_disp);
-        	point pw_old(nan,nan); 
-        	for(auto pw : xy()){
-        		dir_disp.write(angle_ab(pw,pw_old));
-        		pw_old = pw;	
-        	}
         }
     }
+
 }
 
 
 class speed_func {
+public:
+    static const auto accompanying_key_n = 3; // 1 + full-befores: pos_file_name, set_file_name
+    using upstream = utils::type_list<xy_func, pos_file_t>;
+    std::array<void const*, 2> upstream_values; // see Engine::bind_upstream
+    static char const* q_name(){ return "speed"; } // see utils::q_name
+    ChunkedArray<int16, 10000> speed;
 private:
-    xy_t xy(){
-        return something;//TODO: this
-    }
-    pos_file_t pos_file(){
-        return something;//TODO: this
-    }
-    
+    xy_func const& xy() const { return *static_cast<xy_func const*>(upstream_values[0]); }
+    pos_file_t const& pos_file() const { return *static_cast<pos_file_t const*>(upstream_values[1]); }
+
+
     template <typename T>
     yield_signal x_return(int n, T val){
         // TODO: store val
         return yield_signal(WRITTEN, n);
     }
     
+    template <typename T>
+    yield_signal x_return_provisional(int n, T val){
+        // an approximation, to be followed by x_return, see Engine::publish
+        return yield_signal(PROVISIONAL, n);
+    }
+    
     bool x_is_computed_self(int n){
         return true;// TODO: this        
     }
-
+    
 public:
+    static const int cpu = 0; // CPU=auto, parallel_map may use all workers
+    static const bool cache = true; // CACHE=1, only a default, see CostModel
+    using fused_into = xy_map_fused_func; // see FusedMap in generate_cpp.py
     void operator()(sink_t& sink){
         /*
         
         
         *************************************
         int f = parseInt(pos_file.header['timebase']);
-        speed.allocate(xy.length);
-        point p_old (nan,nan);
-        for(auto p : xy){
-        	speed.write(hypot(p_old.x - p.x, p_old.y - p.y) * f);
-        	p_old = p;
-        }
+        // speed is plotted over the whole trial, so keep a min/max/mean pyramid, see speed.summarise
+        speed.enable_pyramid();
+        // element-wise, so this can be split into chunk tasks, see CPU hint, and
+        // fused with the other maps over xy, see map hint.
+        parallel_map(xy, speed, [&](point p, size_t i){
+        	point p_old = i > 0 ? xy[i-1] : point(nan,nan);
+        	return hypot(p_old.x - p.x, p_old.y - p.y) * f;
+        });
         *************************************
         */
         int f = parseInt(pos_file().header['timebase']);
-        speed.allocate(xy().length);
-        point p_old (nan,nan);
-        for(auto p : xy()){
-        	speed.write(hypot(p_old.x - p.x, p_old.y - p.y) * f);
-        	p_old = p;
-        }
+        // speed is plotted over the whole trial, so keep a min/max/mean pyramid, see speed.summarise
+        speed.enable_pyramid();
+        // element-wise, so this can be split into chunk tasks, see CPU hint, and
+        // fused with the other maps over xy(), see map hint.
+        parallel_map(xy(), speed, [&](point p, size_t i){
+        	point p_old = i > 0 ? xy()[i-1] : point(nan,nan);
+        	return hypot(p_old.x - p.x, p_old.y - p.y) * f;
+        });
     }
+
 }
 
 
 class dist_to_boundary_func {
+public:
+    static const auto accompanying_key_n = 4; // 1 + full-befores: pos_file_name, set_file_name, boundary_shape
+    using upstream = utils::type_list<xy_func, boundary_shape_t>;
+    std::array<void const*, 2> upstream_values; // see Engine::bind_upstream
+    static char const* q_name(){ return "dist_to_boundary"; } // see utils::q_name
+    ChunkedArray<float, 10000> dist_to_boundary;
 private:
-    xy_t xy(){
-        return something;//TODO: this
-    }
-    boundary_shape_t boundary_shape(){
-        return something;//TODO: this
-    }
-    
+    xy_func const& xy() const { return *static_cast<xy_func const*>(upstream_values[0]); }
+    boundary_shape_t const& boundary_shape() const { return *static_cast<boundary_shape_t const*>(upstream_values[1]); }
+
+
     template <typename T>
     yield_signal x_return(int n, T val){
         // TODO: store val
         return yield_signal(WRITTEN, n);
     }
     
+    template <typename T>
+    yield_signal x_return_provisional(int n, T val){
+        // an approximation, to be followed by x_return, see Engine::publish
+        return yield_signal(PROVISIONAL, n);
+    }
+    
     bool x_is_computed_self(int n){
         return true;// TODO: this        
     }
-
+    
 public:
+    static const int cpu = 0; // CPU=auto, parallel_map may use all workers
+    using fused_into = xy_map_fused_func; // see FusedMap in generate_cpp.py
     void operator()(sink_t& sink){
         /*
         
@@ -494,61 +650,66 @@ public:
         *************************************
         // might want to implement it as dist_to_boundary squared..although that only makes sense for circle not square 
         // so the details are a bit more complicated.
-        dist_to_boundary.allocate(xy.length);
-        if(boundary_shape.kind == circle){
-        	for(auto p : xy)
-        		dist_to_boundary.write( hypot(p.x-boundary_shape.shape.centre.x, p.y-boundary_shape.shape.centre.y));
-        }else{ // boundary_shape.kind == rect
-        	for(auto p : xy)
-        		dist_to_boundary.write( boundary_dist_rect(p, boundary_shape.shape.topleft, boundary_shape.shape.W, boundary_shape.shape.H));
-        }
+        // The shape is loop invariant, so is_circle is read once, before the (possibly fused) loop,
+        // and the branch on it goes the same way for every element, i.e. it's always predicted.
+        const bool is_circle = boundary_shape.kind == circle;
+        parallel_map(xy, dist_to_boundary, [&](point p, size_t){
+        	if(is_circle)
+        		return hypot(p.x-boundary_shape.shape.centre.x, p.y-boundary_shape.shape.centre.y);
+        	else // boundary_shape.kind == rect
+        		return boundary_dist_rect(p, boundary_shape.shape.topleft, boundary_shape.shape.W, boundary_shape.shape.H);
+        });
         *************************************
         */
         // might want to implement it as dist_to_boundary squared..although that only makes sense for circle not square 
         // so the details are a bit more complicated.
-        dist_to_boundary.allocate(xy().length);
-        if(boundary_shape().kind == circle){
-        	for(auto p : xy())
-        		dist_to_boundary.write( hypot(p.x-boundary_shape().shape.centre.x, p.y-boundary_shape().shape.centre.y));
-        }else{ // boundary_shape().kind == rect
-        	for(auto p : xy())
-        		dist_to_boundary.write( boundary_dist_rect(p, boundary_shape().shape.topleft, boundary_shape().shape.W, boundary_shape().shape.H));
-        }
+        // The shape is loop invariant, so is_circle is read once, before the (possibly fused) loop,
+        // and the branch on it goes the same way for every element, i.e. it's always predicted.
+        const bool is_circle = boundary_shape().kind == circle;
+        parallel_map(xy(), dist_to_boundary, [&](point p, size_t){
+        	if(is_circle)
+        		return hypot(p.x-boundary_shape().shape.centre.x, p.y-boundary_shape().shape.centre.y);
+        	else // boundary_shape().kind == rect
+        		return boundary_dist_rect(p, boundary_shape().shape.topleft, boundary_shape().shape.W, boundary_shape().shape.H);
+        });
     }
+
 }
 
 
 class pos_mask_func {
+public:
+    static const auto accompanying_key_n = 8; // 1 + full-befores: pos_file_name, trial_time_slice, directional_slice, spatial_mask, boundary_dist_slice, set_file_name, boundary_shape
+    using upstream = utils::type_list<pos_file_t, trial_time_slice_t, directional_slice_t, spatial_mask_t, boundary_dist_slice_t, dist_to_boundary_func>;
+    std::array<void const*, 6> upstream_values; // see Engine::bind_upstream
+    static char const* q_name(){ return "pos_mask"; } // see utils::q_name
+    logical_summary summary;
+    bitmask mask;
 private:
-    pos_file_t pos_file(){
-        return something;//TODO: this
-    }
-    trial_time_slice_t trial_time_slice(){
-        return something;//TODO: this
-    }
-    directional_slice_t directional_slice(){
-        return something;//TODO: this
-    }
-    spatial_mask_t spatial_mask(){
-        return something;//TODO: this
-    }
-    boundary_dist_slice_t boundary_dist_slice(){
-        return something;//TODO: this
-    }
-    dist_to_boundary_t dist_to_boundary(){
-        return something;//TODO: this
-    }
-    
+    pos_file_t const& pos_file() const { return *static_cast<pos_file_t const*>(upstream_values[0]); }
+    trial_time_slice_t const& trial_time_slice() const { return *static_cast<trial_time_slice_t const*>(upstream_values[1]); }
+    directional_slice_t const& directional_slice() const { return *static_cast<directional_slice_t const*>(upstream_values[2]); }
+    spatial_mask_t const& spatial_mask() const { return *static_cast<spatial_mask_t const*>(upstream_values[3]); }
+    boundary_dist_slice_t const& boundary_dist_slice() const { return *static_cast<boundary_dist_slice_t const*>(upstream_values[4]); }
+    dist_to_boundary_func const& dist_to_boundary() const { return *static_cast<dist_to_boundary_func const*>(upstream_values[5]); }
+
+
     template <typename T>
     yield_signal x_return(int n, T val){
         // TODO: store val
         return yield_signal(WRITTEN, n);
     }
     
+    template <typename T>
+    yield_signal x_return_provisional(int n, T val){
+        // an approximation, to be followed by x_return, see Engine::publish
+        return yield_signal(PROVISIONAL, n);
+    }
+    
     bool x_is_computed_self(int n){
         return true;// TODO: this        
     }
-
+    
 public:
     void operator()(sink_t& sink){
         /*
@@ -568,19 +729,24 @@ public:
            	   if(!computed(mask)){
         		   // we may already have computed mask, (in which case we are supposed to compute summary)
         		   	   	   
-        		   vector<bool> tmp = array(pos_file.header["num_samps"]);
+        		   const size_t n = pos_file.header["num_samps"];
+        		   BitMask tmp(n, true);
         		   
         		   if(!isnull(trial_time_slice)){
-        		   		tmp[:trial_time_slice.start = False;
-        		   		tmp[trial_time_slice.end:] = False;
+        		   		tmp.set_range(0, trial_time_slice.start, false);
+        		   		tmp.set_range(trial_time_slice.end, n, false);
         		   }
         
+        		   // each slice is built as a bitmask and combined a word at a time
+        		   BitMask slice;
         		   if(!isnull(directional_slice)){
-        				tmp[!(directional_slice.start < dir[1] < directional_slice.end)] = False;
+        				kernels::in_range(dir[1], directional_slice.start, directional_slice.end, slice);
+        				tmp.and_with(slice);
         		   }
         
         		   if(!isnull(boundary_dist_slice)){
-        				tmp[!(boundary_dist_slice.start < dist_to_boundary < boundary_dist_slice.end)] = False;
+        				kernels::in_range(dist_to_boundary, boundary_dist_slice.start, boundary_dist_slice.end, slice);
+        				tmp.and_with(slice);
         		   }
         
         		   //TODO: implement spatial mask
@@ -589,7 +755,7 @@ public:
         
         	   }
         	   if(requested(summary))
-        	   		summary = make_logical_summary(mask);
+        	   		summary = mask.summary();
         
            }else{
         	   summary = all; //mask is all-true, so don't actually need to make it
@@ -605,19 +771,24 @@ public:
            	   if(!computed(mask)){
         		   // we may already have computed mask, (in which case we are supposed to compute summary)
         		   	   	   
-        		   vector<bool> tmp = array(pos_file().header["num_samps"]);
+        		   const size_t n = pos_file().header["num_samps"];
+        		   BitMask tmp(n, true);
         		   
         		   if(!isnull(trial_time_slice())){
-        		   		tmp[:trial_time_slice().start = False;
-        		   		tmp[trial_time_slice().end:] = False;
+        		   		tmp.set_range(0, trial_time_slice().start, false);
+        		   		tmp.set_range(trial_time_slice().end, n, false);
         		   }
         
+        		   // each slice is built as a bitmask and combined a word at a time
+        		   BitMask slice;
         		   if(!isnull(directional_slice())){
-        				tmp[!(directional_slice().start < dir[1] < directional_slice().end)] = False;
+        				kernels::in_range(dir[1], directional_slice().start, directional_slice().end, slice);
+        				tmp.and_with(slice);
         		   }
         
         		   if(!isnull(boundary_dist_slice())){
-        				tmp[!(boundary_dist_slice().start < dist_to_boundary() < boundary_dist_slice().end)] = False;
+        				kernels::in_range(dist_to_boundary(), boundary_dist_slice().start, boundary_dist_slice().end, slice);
+        				tmp.and_with(slice);
         		   }
         
         		   //TODO: implement spatial mask
@@ -626,34 +797,44 @@ public:
         
         	   }
         	   if(requested(summary))
-        	   		summary = make_logical_summary(mask);
+        	   		summary = mask.summary();
         
            }else{
         	   summary = all; //mask is all-true, so don't actually need to make it
            }
     }
+
 }
 
 
 class spike_pos_inds_func {
+public:
+    static const auto accompanying_key_n = 3; // 1 + full-befores: pos_file_name, tet_file_name
+    using upstream = utils::type_list<pos_file_t, spike_times_func>;
+    std::array<void const*, 2> upstream_values; // see Engine::bind_upstream
+    static char const* q_name(){ return "spike_pos_inds"; } // see utils::q_name
+    ChunkedArray<uint32, 10000> spike_pos_inds;
 private:
-    pos_file_t pos_file(){
-        return something;//TODO: this
-    }
-    spike_times_t spike_times(){
-        return something;//TODO: this
-    }
-    
+    pos_file_t const& pos_file() const { return *static_cast<pos_file_t const*>(upstream_values[0]); }
+    spike_times_func const& spike_times() const { return *static_cast<spike_times_func const*>(upstream_values[1]); }
+
+
     template <typename T>
     yield_signal x_return(int n, T val){
         // TODO: store val
         return yield_signal(WRITTEN, n);
     }
     
+    template <typename T>
+    yield_signal x_return_provisional(int n, T val){
+        // an approximation, to be followed by x_return, see Engine::publish
+        return yield_signal(PROVISIONAL, n);
+    }
+    
     bool x_is_computed_self(int n){
         return true;// TODO: this        
     }
-
+    
 public:
     void operator()(sink_t& sink){
         /*
@@ -665,64 +846,96 @@ public:
         */
         // read timebases to get factor and apply to spike times
     }
+
 }
 
 
 class spike_mask_func {
+public:
+    static const auto accompanying_key_n = 9; // 1 + full-befores: pos_file_name, trial_time_slice, directional_slice, spatial_mask, boundary_dist_slice, set_file_name, boundary_shape, tet_file_name
+    using upstream = utils::type_list<pos_mask_func, spike_pos_inds_func>;
+    std::array<void const*, 2> upstream_values; // see Engine::bind_upstream
+    static char const* q_name(){ return "spike_mask"; } // see utils::q_name
+    logical_summary summary;
+    bitmask mask;
 private:
-    pos_mask_t pos_mask(){
-        return something;//TODO: this
-    }
-    spike_pos_inds_t spike_pos_inds(){
-        return something;//TODO: this
-    }
-    
+    pos_mask_func const& pos_mask() const { return *static_cast<pos_mask_func const*>(upstream_values[0]); }
+    spike_pos_inds_func const& spike_pos_inds() const { return *static_cast<spike_pos_inds_func const*>(upstream_values[1]); }
+
+
     template <typename T>
     yield_signal x_return(int n, T val){
         // TODO: store val
         return yield_signal(WRITTEN, n);
     }
     
+    template <typename T>
+    yield_signal x_return_provisional(int n, T val){
+        // an approximation, to be followed by x_return, see Engine::publish
+        return yield_signal(PROVISIONAL, n);
+    }
+    
     bool x_is_computed_self(int n){
         return true;// TODO: this        
     }
-
+    
 public:
     void operator()(sink_t& sink){
         /*
         
         
         *************************************
-        //lookup spike pos inds in pos mask..use sorted_access_iterator
+        //lookup spike pos inds in pos mask, spike_pos_inds is sorted so this is kernels::gather_sorted
+        kernels::gather_sorted(pos_mask.mask, spike_pos_inds, mask);
+        summary = mask.summary();
         *************************************
         */
-        //lookup spike pos inds in pos mask..use sorted_access_iterator
+        //lookup spike pos inds in pos mask, spike_pos_inds() is sorted so this is kernels::gather_sorted
+        kernels::gather_sorted(pos_mask().mask, spike_pos_inds(), mask);
+        summary = mask.summary();
     }
+
 }
 
 
 class speed_dwell_func {
+public:
+    static const auto accompanying_key_n = 9; // 1 + full-befores: pos_file_name, set_file_name, trial_time_slice, directional_slice, spatial_mask, boundary_dist_slice, boundary_shape, speed_bin_size
+    using upstream = utils::type_list<speed_func, pos_mask_func, speed_bin_size_t>;
+    std::array<void const*, 3> upstream_values; // see Engine::bind_upstream
+    static char const* q_name(){ return "speed_dwell"; } // see utils::q_name
+    using delta_over = utils::type_list<trial_time_slice_t>; // see Engine::bind_delta
+    void const* prev_value = nullptr;
+    std::array<void const*, 3> prev_upstream_values;
+    std::array<void const*, 2> delta_values; // old then new, for each of delta_over
+    std::vector<uint32> speed_dwell;
 private:
-    speed_t speed(){
-        return something;//TODO: this
-    }
-    pos_mask_t pos_mask(){
-        return something;//TODO: this
-    }
-    speed_bin_size_t speed_bin_size(){
-        return something;//TODO: this
-    }
-    
+    speed_func const& speed() const { return *static_cast<speed_func const*>(upstream_values[0]); }
+    pos_mask_func const& pos_mask() const { return *static_cast<pos_mask_func const*>(upstream_values[1]); }
+    speed_bin_size_t const& speed_bin_size() const { return *static_cast<speed_bin_size_t const*>(upstream_values[2]); }
+    speed_dwell_func const& prev_speed_dwell() const { return *static_cast<speed_dwell_func const*>(prev_value); }
+    speed_func const& prev_speed() const { return *static_cast<speed_func const*>(prev_upstream_values[0]); }
+    pos_mask_func const& prev_pos_mask() const { return *static_cast<pos_mask_func const*>(prev_upstream_values[1]); }
+    speed_bin_size_t const& prev_speed_bin_size() const { return *static_cast<speed_bin_size_t const*>(prev_upstream_values[2]); }
+    trial_time_slice_t const& prev_trial_time_slice() const { return *static_cast<trial_time_slice_t const*>(delta_values[0]); }
+    trial_time_slice_t const& trial_time_slice() const { return *static_cast<trial_time_slice_t const*>(delta_values[1]); }
+
     template <typename T>
     yield_signal x_return(int n, T val){
         // TODO: store val
         return yield_signal(WRITTEN, n);
     }
     
+    template <typename T>
+    yield_signal x_return_provisional(int n, T val){
+        // an approximation, to be followed by x_return, see Engine::publish
+        return yield_signal(PROVISIONAL, n);
+    }
+    
     bool x_is_computed_self(int n){
         return true;// TODO: this        
     }
-
+    
 public:
     void operator()(sink_t& sink){
         /*
@@ -732,70 +945,119 @@ public:
         if(pos_mask.summary == all)
         	speed_dwell = hist(speed, speed_bin_size);
         else
-        	speed_dwell = hist_masked(speed, pos_mask, speed_bin_size);
+        	speed_dwell = hist_masked(speed, pos_mask.mask, speed_bin_size); // skips "none" chunks
         *************************************
         */
         if(pos_mask().summary == all)
-        	speed()_dwell = hist(speed(), speed()_bin_size);
+        	speed_dwell = hist(speed(), speed_bin_size());
         else
-        	speed()_dwell = hist_masked(speed(), pos_mask(), speed()_bin_size);
+        	speed_dwell = hist_masked(speed(), pos_mask().mask, speed_bin_size()); // skips "none" chunks
+    }
+    
+    bool delta(sink_t& sink){
+        /* delta over trial_time_slice, see Engine::bind_delta
+        // Dragging a trial_time_slice handle only changes pos_mask where the handle
+        // moved, so patch the old histogram with just those samples, added or removed.
+        auto changed = changed_ranges(prev(trial_time_slice), trial_time_slice);
+        if(isnull(changed) || prev(pos_mask).summary == all || pos_mask.summary == all)
+        	return false; // the slice was switched on/off, just do it from scratch
+        speed_dwell = copy(prev(speed_dwell));
+        for(auto r : changed)
+        	kernels::hist_masked_delta(speed, prev(pos_mask).mask, pos_mask.mask,
+        							   r.start, r.end, speed_bin_size, speed_dwell);
+        return true;
+        */
+        // Dragging a trial_time_slice() handle only changes pos_mask() where the handle
+        // moved, so patch the old histogram with just those samples, added or removed.
+        auto changed = changed_ranges(prev_trial_time_slice(), trial_time_slice());
+        if(isnull(changed) || prev_pos_mask().summary == all || pos_mask().summary == all)
+        	return false; // the slice was switched on/off, just do it from scratch
+        speed_dwell = copy(prev_speed_dwell());
+        for(auto r : changed)
+        	kernels::hist_masked_delta(speed(), prev_pos_mask().mask, pos_mask().mask,
+        							   r.start, r.end, speed_bin_size(), speed_dwell);
+        return true;
     }
 }
 
 
 class pos_bin_ind_func {
+public:
+    static const auto accompanying_key_n = 4; // 1 + full-befores: spa_bin_size, pos_file_name, set_file_name
+    using upstream = utils::type_list<spa_bin_size_t, xy_func>;
+    std::array<void const*, 2> upstream_values; // see Engine::bind_upstream
+    static char const* q_name(){ return "pos_bin_ind"; } // see utils::q_name
+    ChunkedArray<point, 10000, SoA> pos_bin_ind;
 private:
-    spa_bin_size_t spa_bin_size(){
-        return something;//TODO: this
-    }
-    xy_t xy(){
-        return something;//TODO: this
-    }
-    
+    spa_bin_size_t const& spa_bin_size() const { return *static_cast<spa_bin_size_t const*>(upstream_values[0]); }
+    xy_func const& xy() const { return *static_cast<xy_func const*>(upstream_values[1]); }
+
+
     template <typename T>
     yield_signal x_return(int n, T val){
         // TODO: store val
         return yield_signal(WRITTEN, n);
     }
     
+    template <typename T>
+    yield_signal x_return_provisional(int n, T val){
+        // an approximation, to be followed by x_return, see Engine::publish
+        return yield_signal(PROVISIONAL, n);
+    }
+    
     bool x_is_computed_self(int n){
         return true;// TODO: this        
     }
-
+    
 public:
+    static const int cpu = 0; // CPU=auto, parallel_map may use all workers
+    using fused_into = xy_map_fused_func; // see FusedMap in generate_cpp.py
     void operator()(sink_t& sink){
         /*
         
         
         *************************************
-        pos_bin_ind.allocate(xy.length);
-        for(auto p : xy)
-        	pos_bin_ind.write({p.x/spa_bin_size, p.y/spa_bin_size});
+        parallel_map(xy, pos_bin_ind, [&](point p, size_t){
+        	return point{p.x/spa_bin_size, p.y/spa_bin_size};
+        });
         *************************************
         */
-        pos_bin_ind.allocate(xy().length);
-        for(auto p : xy())
-        	pos_bin_ind.write({p.x/spa_bin_size(), p.y/spa_bin_size()});
+        parallel_map(xy(), pos_bin_ind, [&](point p, size_t){
+        	return point{p.x/spa_bin_size(), p.y/spa_bin_size()};
+        });
     }
+
 }
 
 
 class spike_times_func {
+public:
+    static const auto accompanying_key_n = 2; // 1 + full-befores: tet_file_name
+    using upstream = utils::type_list<tet_file_t>;
+    std::array<void const*, 1> upstream_values; // see Engine::bind_upstream
+    static char const* q_name(){ return "spike_times"; } // see utils::q_name
+    int timebase;
+    ChunkedArray<int32, 10000> times;
 private:
-    tet_file_t tet_file(){
-        return something;//TODO: this
-    }
-    
+    tet_file_t const& tet_file() const { return *static_cast<tet_file_t const*>(upstream_values[0]); }
+
+
     template <typename T>
     yield_signal x_return(int n, T val){
         // TODO: store val
         return yield_signal(WRITTEN, n);
     }
     
+    template <typename T>
+    yield_signal x_return_provisional(int n, T val){
+        // an approximation, to be followed by x_return, see Engine::publish
+        return yield_signal(PROVISIONAL, n);
+    }
+    
     bool x_is_computed_self(int n){
         return true;// TODO: this        
     }
-
+    
 public:
     void operator()(sink_t& sink){
         /*
@@ -805,35 +1067,49 @@ public:
         timebase = parseInt(tet_file.header["timeabase"]);
         int n_spikes = parseInt(tet_file.header["nump_spikes"]);
         times.allocate(n_spikes);
-        for(auto c : tet_file.buffer.iter_blocks(216));
+        tet_file.buffer.for_each_record(216, [&](auto c){ // straight out of the mapping
         	times.write(c[0:4]);
+        });
         *************************************
         */
         timebase = parseInt(tet_file().header["timeabase"]);
         int n_spikes = parseInt(tet_file().header["nump_spikes"]);
         times.allocate(n_spikes);
-        for(auto c : tet_file().buffer.iter_blocks(216));
+        tet_file().buffer.for_each_record(216, [&](auto c){ // straight out of the mapping
         	times.write(c[0:4]);
+        });
     }
+
 }
 
 
 class cut_file_func {
+public:
+    static const auto accompanying_key_n = 2; // 1 + full-befores: cut_file_name
+    using upstream = utils::type_list<cut_file_name_t>;
+    std::array<void const*, 1> upstream_values; // see Engine::bind_upstream
+    static char const* q_name(){ return "cut_file"; } // see utils::q_name
+    ChunkedArray<uint8, 10000> cut_file;
 private:
-    cut_file_name_t cut_file_name(){
-        return something;//TODO: this
-    }
-    
+    cut_file_name_t const& cut_file_name() const { return *static_cast<cut_file_name_t const*>(upstream_values[0]); }
+
+
     template <typename T>
     yield_signal x_return(int n, T val){
         // TODO: store val
         return yield_signal(WRITTEN, n);
     }
     
+    template <typename T>
+    yield_signal x_return_provisional(int n, T val){
+        // an approximation, to be followed by x_return, see Engine::publish
+        return yield_signal(PROVISIONAL, n);
+    }
+    
     bool x_is_computed_self(int n){
         return true;// TODO: this        
     }
-
+    
 public:
     void operator()(sink_t& sink){
         /*
@@ -861,4 +1137,680 @@ public:
         		cut_file.write(parseInt(val));
         }
     }
-}
\ No newline at end of file
+
+}
+
+
+class cut_state_func {
+public:
+    static const auto accompanying_key_n = 3; // 1 + full-befores: cut_delta, cut_file_name
+    using upstream = utils::type_list<cut_delta_t, cut_file_func>;
+    std::array<void const*, 2> upstream_values; // see Engine::bind_upstream
+    static char const* q_name(){ return "cut_state"; } // see utils::q_name
+    PersistentVector<uint8> group_nums;
+    PersistentVector<uint8> inds_by_group;
+private:
+    cut_delta_t const& cut_delta() const { return *static_cast<cut_delta_t const*>(upstream_values[0]); }
+    cut_file_func const& cut_file() const { return *static_cast<cut_file_func const*>(upstream_values[1]); }
+
+
+    template <typename T>
+    yield_signal x_return(int n, T val){
+        // TODO: store val
+        return yield_signal(WRITTEN, n);
+    }
+    
+    template <typename T>
+    yield_signal x_return_provisional(int n, T val){
+        // an approximation, to be followed by x_return, see Engine::publish
+        return yield_signal(PROVISIONAL, n);
+    }
+    
+    bool x_is_computed_self(int n){
+        return true;// TODO: this        
+    }
+    
+public:
+    using chain_over = cut_delta_t; // an iteration of cut_changes_loop, see Engine::append_chain
+    void operator()(sink_t& sink){
+        /*
+        On the first iteration of cut_changes_loop it reads from cut_file, on subsequent iterations
+        it reads the pervious version of itself, i.e. cut_changes_loop.old_state.
+        Each iteration of the loop is defined by its cut_delta.  This compute applies the delta
+        to the the previous state to produce the current state.
+        The returns use storage="persistent", i.e. PersistentVector, so copying the old state is
+        cheap and the delta only allocates the chunks it actually touches.
+        
+        *************************************
+        uint8[] inds;
+        // need to do check whether the whole thing is required or only group nums
+        // actually I think we are only going to want group nums
+        if(cut_changes_loop.is_first_iteration)
+        	old_state = cut_file;
+        else
+        	old_state = cut_changes_loop.cut_state.group_nums; // self on previous iteration, this copy shares all chunks
+        
+        switch(cut_delta.kind){
+        	case split_v_t:
+        		// do stuff with waves
+        		break;
+        	case paint:
+        		// do stuff with amps
+        		break;
+        	case swap:
+        		// do stuff simly with cut_inds 
+        		break;
+        	case swap:
+        		// do stuff simply with cut_inds
+        		break;
+        }  
+        cut_inds = inds;
+        *************************************
+        */
+        uint8[] inds;
+        // need to do check whether the whole thing is required or only group nums
+        // actually I think we are only going to want group nums
+        if(cut_changes_loop().is_first_iteration)
+        	old_state = cut_file();
+        else
+        	old_state = cut_changes_loop().cut_state.group_nums; // self on previous iteration, this copy shares all chunks
+        
+        switch(cut_delta().kind){
+        	case split_v_t:
+        		// do stuff with waves()
+        		break;
+        	case paint:
+        		// do stuff with amps()
+        		break;
+        	case swap:
+        		// do stuff simly with cut_inds 
+        		break;
+        	case swap:
+        		// do stuff simply with cut_inds
+        		break;
+        }  
+        cut_inds = inds;
+    }
+
+}
+
+
+class group_mask_func {
+public:
+    static const auto accompanying_key_n = 11; // 1 + full-befores: cut_delta, cut_file_name, pos_file_name, trial_time_slice, directional_slice, spatial_mask, boundary_dist_slice, set_file_name, boundary_shape, tet_file_name
+    using upstream = utils::type_list<cut_state_func, spike_mask_func>;
+    std::array<void const*, 2> upstream_values; // see Engine::bind_upstream
+    static char const* q_name(){ return "group_mask"; } // see utils::q_name
+    logical_summary summary;
+    bitmask mask;
+private:
+    cut_state_func const& cut_state() const { return *static_cast<cut_state_func const*>(upstream_values[0]); }
+    spike_mask_func const& spike_mask() const { return *static_cast<spike_mask_func const*>(upstream_values[1]); }
+
+
+    template <typename T>
+    yield_signal x_return(int n, T val){
+        // TODO: store val
+        return yield_signal(WRITTEN, n);
+    }
+    
+    template <typename T>
+    yield_signal x_return_provisional(int n, T val){
+        // an approximation, to be followed by x_return, see Engine::publish
+        return yield_signal(PROVISIONAL, n);
+    }
+    
+    bool x_is_computed_self(int n){
+        return true;// TODO: this        
+    }
+    
+public:
+    void operator()(sink_t& sink){
+        /*
+        
+        
+        *************************************
+        if(!computed(group_mask))
+        	kernels::gather_sorted(spike_mask.mask, cut_state.inds_by_group[group_num], group_mask);
+        if(required(summary))
+        	summary = group_mask.summary();
+        *************************************
+        */
+        if(!computed(group_mask))
+        	kernels::gather_sorted(spike_mask().mask, cut_state().inds_by_group[group_num], group_mask);
+        if(required(summary))
+        	summary = group_mask.summary();
+    }
+
+}
+
+
+class group_times_unmaksed_func {
+public:
+    static const auto accompanying_key_n = 5; // 1 + full-befores: group_num, cut_delta, cut_file_name, tet_file_name
+    using upstream = utils::type_list<group_num_t, cut_state_func, spike_times_func>;
+    std::array<void const*, 3> upstream_values; // see Engine::bind_upstream
+    static char const* q_name(){ return "group_times_unmaksed"; } // see utils::q_name
+private:
+    group_num_t const& group_num() const { return *static_cast<group_num_t const*>(upstream_values[0]); }
+    cut_state_func const& cut_state() const { return *static_cast<cut_state_func const*>(upstream_values[1]); }
+    spike_times_func const& spike_times() const { return *static_cast<spike_times_func const*>(upstream_values[2]); }
+
+
+    template <typename T>
+    yield_signal x_return(int n, T val){
+        // TODO: store val
+        return yield_signal(WRITTEN, n);
+    }
+    
+    template <typename T>
+    yield_signal x_return_provisional(int n, T val){
+        // an approximation, to be followed by x_return, see Engine::publish
+        return yield_signal(PROVISIONAL, n);
+    }
+    
+    bool x_is_computed_self(int n){
+        return true;// TODO: this        
+    }
+    
+public:
+    void operator()(sink_t& sink){
+        /*
+        
+        
+        *************************************
+        group_times_unmaksed = copy(spike_times.iter_sorted_inds(cut_state.inds_by_group[group_num]));
+        *************************************
+        */
+        group_times_unmaksed = copy(spike_times().iter_sorted_inds(cut_state().inds_by_group[group_num()]));
+    }
+
+}
+
+
+class group_times_func {
+public:
+    static const auto accompanying_key_n = 12; // 1 + full-befores: cut_delta, cut_file_name, pos_file_name, trial_time_slice, directional_slice, spatial_mask, boundary_dist_slice, set_file_name, boundary_shape, tet_file_name, group_num
+    using upstream = utils::type_list<group_mask_func, group_times_unmaksed_func>;
+    std::array<void const*, 2> upstream_values; // see Engine::bind_upstream
+    static char const* q_name(){ return "group_times"; } // see utils::q_name
+    std::vector<uint32> group_times;
+private:
+    group_mask_func const& group_mask() const { return *static_cast<group_mask_func const*>(upstream_values[0]); }
+    group_times_unmaksed_func const& group_times_unmaksed() const { return *static_cast<group_times_unmaksed_func const*>(upstream_values[1]); }
+
+
+    template <typename T>
+    yield_signal x_return(int n, T val){
+        // TODO: store val
+        return yield_signal(WRITTEN, n);
+    }
+    
+    template <typename T>
+    yield_signal x_return_provisional(int n, T val){
+        // an approximation, to be followed by x_return, see Engine::publish
+        return yield_signal(PROVISIONAL, n);
+    }
+    
+    bool x_is_computed_self(int n){
+        return true;// TODO: this        
+    }
+    
+public:
+    void operator()(sink_t& sink){
+        /*
+        
+        
+        *************************************
+        if(group_mask.all)
+        	group_times.equals(group_times_unmaksed);
+        if(group_mask.none)
+        	group_times = [];
+        
+        group_times = group_times_unmaksed[group_mask]; // TODO: implement logical take
+        *************************************
+        */
+        if(group_mask().all)
+        	group_times.equals(group_times_unmaksed());
+        if(group_mask().none)
+        	group_times = [];
+        
+        group_times = group_times_unmaksed()[group_mask()]; // TODO: implement logical take
+    }
+
+}
+
+
+class group_pos_inds_unmasked_func {
+public:
+    static const auto accompanying_key_n = 6; // 1 + full-befores: group_num, cut_delta, cut_file_name, pos_file_name, tet_file_name
+    using upstream = utils::type_list<group_num_t, cut_state_func, spike_pos_inds_func>;
+    std::array<void const*, 3> upstream_values; // see Engine::bind_upstream
+    static char const* q_name(){ return "group_pos_inds_unmasked"; } // see utils::q_name
+    std::vector<uint32> group_pos_inds_unmasked;
+private:
+    group_num_t const& group_num() const { return *static_cast<group_num_t const*>(upstream_values[0]); }
+    cut_state_func const& cut_state() const { return *static_cast<cut_state_func const*>(upstream_values[1]); }
+    spike_pos_inds_func const& spike_pos_inds() const { return *static_cast<spike_pos_inds_func const*>(upstream_values[2]); }
+
+
+    template <typename T>
+    yield_signal x_return(int n, T val){
+        // TODO: store val
+        return yield_signal(WRITTEN, n);
+    }
+    
+    template <typename T>
+    yield_signal x_return_provisional(int n, T val){
+        // an approximation, to be followed by x_return, see Engine::publish
+        return yield_signal(PROVISIONAL, n);
+    }
+    
+    bool x_is_computed_self(int n){
+        return true;// TODO: this        
+    }
+    
+public:
+    void operator()(sink_t& sink){
+        /*
+        
+        
+        *************************************
+        group_pos_inds_unmasked = copy(spike_pos_inds.iter_sorted_inds(cut_state.inds_by_group[group_num]));
+        *************************************
+        */
+        group_pos_inds_unmasked = copy(spike_pos_inds().iter_sorted_inds(cut_state().inds_by_group[group_num()]));
+    }
+
+}
+
+
+class group_pos_inds_func {
+public:
+    static const auto accompanying_key_n = 12; // 1 + full-befores: group_num, cut_delta, cut_file_name, pos_file_name, tet_file_name, trial_time_slice, directional_slice, spatial_mask, boundary_dist_slice, set_file_name, boundary_shape
+    using upstream = utils::type_list<group_pos_inds_unmasked_func, group_mask_func>;
+    std::array<void const*, 2> upstream_values; // see Engine::bind_upstream
+    static char const* q_name(){ return "group_pos_inds"; } // see utils::q_name
+    std::vector<uint32> group_pos_inds;
+private:
+    group_pos_inds_unmasked_func const& group_pos_inds_unmasked() const { return *static_cast<group_pos_inds_unmasked_func const*>(upstream_values[0]); }
+    group_mask_func const& group_mask() const { return *static_cast<group_mask_func const*>(upstream_values[1]); }
+
+
+    template <typename T>
+    yield_signal x_return(int n, T val){
+        // TODO: store val
+        return yield_signal(WRITTEN, n);
+    }
+    
+    template <typename T>
+    yield_signal x_return_provisional(int n, T val){
+        // an approximation, to be followed by x_return, see Engine::publish
+        return yield_signal(PROVISIONAL, n);
+    }
+    
+    bool x_is_computed_self(int n){
+        return true;// TODO: this        
+    }
+    
+public:
+    void operator()(sink_t& sink){
+        /*
+        
+        
+        *************************************
+        if(group_mask.all)
+        	group_pos_inds.equals(group_pos_inds_unmasked);
+        if(group_mask.none)
+        	group_pos_inds = [];
+        
+        group_pos_inds = group_pos_inds_unmaksed[group_mask]; // TODO: implement logical take
+        *************************************
+        */
+        if(group_mask().all)
+        	group_pos_inds.equals(group_pos_inds_unmasked());
+        if(group_mask().none)
+        	group_pos_inds = [];
+        
+        group_pos_inds = group_pos_inds_unmaksed[group_mask()]; // TODO: implement logical take
+    }
+
+}
+
+
+class tac_func {
+public:
+    static const auto accompanying_key_n = 13; // 1 + full-befores: cut_delta, cut_file_name, pos_file_name, trial_time_slice, directional_slice, spatial_mask, boundary_dist_slice, set_file_name, boundary_shape, tet_file_name, group_num, tac_window_secs
+    using upstream = utils::type_list<group_times_func, tac_window_secs_t>;
+    std::array<void const*, 2> upstream_values; // see Engine::bind_upstream
+    static char const* q_name(){ return "tac"; } // see utils::q_name
+    std::vector<float> tac;
+    uint32 max;
+private:
+    group_times_func const& group_times() const { return *static_cast<group_times_func const*>(upstream_values[0]); }
+    tac_window_secs_t const& tac_window_secs() const { return *static_cast<tac_window_secs_t const*>(upstream_values[1]); }
+
+
+    template <typename T>
+    yield_signal x_return(int n, T val){
+        // TODO: store val
+        return yield_signal(WRITTEN, n);
+    }
+    
+    template <typename T>
+    yield_signal x_return_provisional(int n, T val){
+        // an approximation, to be followed by x_return, see Engine::publish
+        return yield_signal(PROVISIONAL, n);
+    }
+    
+    bool x_is_computed_self(int n){
+        return true;// TODO: this        
+    }
+    
+public:
+    static const int progressive = 8; // see Engine::progressive_for_chunks
+    void operator()(sink_t& sink){
+        /*
+        With lots of spikes this is slow, so it first gives a provisional tac from every 8th chunk
+        of earlier times (see progressive hint), which already has the right shape once normalised.
+        
+        *************************************
+        N_BINS = 100;
+        auto const& times = group_times.times;
+        // a histogram per chunk, as the chunks run in parallel, summed in the publish lambda
+        std::vector<std::vector<uint32>> chunk_hists(times.n_chunks(), std::vector<uint32>(N_BINS));
+        float f = tac_window_secs * group_times.timebase /N_BINS;
+        auto max_diff = tac_window_secs * group_times.timebase;
+        // the earlier times are split up by chunk, the window can run on into later chunks
+        progressive_for_chunks(times, [&](size_t c){
+        	auto& hist = chunk_hists[c];
+        	auto later_time = times.begin() + c*times.chunk_len; //iterator
+        	for(auto earlier_time : times.chunk(c)){
+        		// move the later time until it is one element beyond the end of the window
+        		for(;later_time < earlier_time + max_diff && later_time != times.end(); ++later_time) ;
+        		// accumulate a "1" in the histogram for each time in the window, relative to the earlier time.
+        		for( auto mid_time = earlier_time; mid_time != later_time; ++mid_time)
+        			hist[(mid_time-earlier_time)*f]++;
+        	}
+        }, [&](float fraction_done, bool is_provisional){
+        	// chunks not done yet are all zeros
+        	uint32[] hist(N_BINS);
+        	for(auto const& hist_c : chunk_hists)
+        		for(int i=0;i<N_BINS;i++)
+        			hist[i] += hist_c[i];
+        	max = maximum(hist) / fraction_done; // scaled up, as max is a count
+        	float[] hist_normed(N_BINS);
+        	for(int i=0;i<N_BINS;i++)
+        		hist_normed[i] = hist[i] / maximum(hist);
+        	if(is_provisional)
+        		provisional[tac] = hist_normed;
+        	else
+        		tac = hist_normed;
+        });
+        *************************************
+        */
+        N_BINS = 100;
+        auto const& times = group_times().times;
+        // a histogram per chunk, as the chunks run in parallel, summed in the publish lambda
+        std::vector<std::vector<uint32>> chunk_hists(times.n_chunks(), std::vector<uint32>(N_BINS));
+        float f = tac_window_secs() * group_times().timebase /N_BINS;
+        auto max_diff = tac_window_secs() * group_times().timebase;
+        // the earlier times are split up by chunk, the window can run on into later chunks
+        progressive_for_chunks(times, [&](size_t c){
+        	auto& hist = chunk_hists[c];
+        	auto later_time = times.begin() + c*times.chunk_len; //iterator
+        	for(auto earlier_time : times.chunk(c)){
+        		// move the later time until it is one element beyond the end of the window
+        		for(;later_time < earlier_time + max_diff && later_time != times.end(); ++later_time) ;
+        		// accumulate a "1" in the histogram for each time in the window, relative to the earlier time.
+        		for( auto mid_time = earlier_time; mid_time != later_time; ++mid_time)
+        			hist[(mid_time-earlier_time)*f]++;
+        	}
+        }, [&](float fraction_done, bool is_provisional){
+        	// chunks not done yet are all zeros
+        	uint32[] hist(N_BINS);
+        	for(auto const& hist_c : chunk_hists)
+        		for(int i=0;i<N_BINS;i++)
+        			hist[i] += hist_c[i];
+        	max = maximum(hist) / fraction_done; // scaled up, as max is a count
+        	float[] hist_normed(N_BINS);
+        	for(int i=0;i<N_BINS;i++)
+        		hist_normed[i] = hist[i] / maximum(hist);
+        	if(is_provisional)
+        		sink(x_return_provisional(tac, hist_normed));
+        	else
+        		tac = hist_normed;
+        });
+    }
+
+}
+
+
+class group_speed_hist_func {
+public:
+    static const auto accompanying_key_n = 13; // 1 + full-befores: group_num, cut_delta, cut_file_name, pos_file_name, tet_file_name, trial_time_slice, directional_slice, spatial_mask, boundary_dist_slice, set_file_name, boundary_shape, speed_bin_size
+    using upstream = utils::type_list<group_pos_inds_func, speed_bin_size_t, speed_dwell_func, speed_func>;
+    std::array<void const*, 4> upstream_values; // see Engine::bind_upstream
+    static char const* q_name(){ return "group_speed_hist"; } // see utils::q_name
+    std::vector<float> group_speed_hist;
+    float max;
+private:
+    group_pos_inds_func const& group_pos_inds() const { return *static_cast<group_pos_inds_func const*>(upstream_values[0]); }
+    speed_bin_size_t const& speed_bin_size() const { return *static_cast<speed_bin_size_t const*>(upstream_values[1]); }
+    speed_dwell_func const& speed_dwell() const { return *static_cast<speed_dwell_func const*>(upstream_values[2]); }
+    speed_func const& speed() const { return *static_cast<speed_func const*>(upstream_values[3]); }
+
+
+    template <typename T>
+    yield_signal x_return(int n, T val){
+        // TODO: store val
+        return yield_signal(WRITTEN, n);
+    }
+    
+    template <typename T>
+    yield_signal x_return_provisional(int n, T val){
+        // an approximation, to be followed by x_return, see Engine::publish
+        return yield_signal(PROVISIONAL, n);
+    }
+    
+    bool x_is_computed_self(int n){
+        return true;// TODO: this        
+    }
+    
+public:
+    void operator()(sink_t& sink){
+        /*
+        Computes rate in each speed bin, normalises to max of 1, but also provides max rate in Hz.
+        
+        *************************************
+        // group_pos_inds is sorted, so gather the speeds and then histogram them
+        int16[] group_speed(group_pos_inds.length);
+        kernels::gather_sorted(speed, group_pos_inds, group_speed);
+        uint32[] spike = hist(group_speed, speed_bin_size);
+        float[] rate = array(spike.length);
+        for(int i=0; i< spike.length; i++)
+        	rate[i] = spike[i] / speed_dwell[i];
+        max = maximum(rate);
+        for(int i=0;i<rate.length;i++)
+        	rate[i] /= max;
+        group_speed_hist = rate;
+        *************************************
+        */
+        // group_pos_inds() is sorted, so gather the speeds and then histogram them
+        int16[] group_speed(group_pos_inds().length);
+        kernels::gather_sorted(speed(), group_pos_inds(), group_speed);
+        uint32[] spike = hist(group_speed, speed_bin_size());
+        float[] rate = array(spike.length);
+        for(int i=0; i< spike.length; i++)
+        	rate[i] = spike[i] / speed_dwell()[i];
+        max = maximum(rate);
+        for(int i=0;i<rate.length;i++)
+        	rate[i] /= max;
+        group_speed_hist = rate;
+    }
+
+}
+
+
+class xy_map_fused_func {
+    /* fused loop for dir, speed, dist_to_boundary, pos_bin_ind, see FusedMap in generate_cpp.py */
+public:
+    static const auto accompanying_key_n = 5; // 1 + full-befores: pos_file_name, set_file_name, boundary_shape, spa_bin_size
+    using upstream = utils::type_list<both_xy_func, xy_func, set_file_t, pos_file_t, boundary_shape_t, spa_bin_size_t>;
+    std::array<void const*, 6> upstream_values; // see Engine::bind_upstream
+    static char const* q_name(){ return "xy_map_fused"; } // see utils::q_name
+private:
+    both_xy_func const& both_xy() const { return *static_cast<both_xy_func const*>(upstream_values[0]); }
+    xy_func const& xy() const { return *static_cast<xy_func const*>(upstream_values[1]); }
+    set_file_t const& set_file() const { return *static_cast<set_file_t const*>(upstream_values[2]); }
+    pos_file_t const& pos_file() const { return *static_cast<pos_file_t const*>(upstream_values[3]); }
+    boundary_shape_t const& boundary_shape() const { return *static_cast<boundary_shape_t const*>(upstream_values[4]); }
+    spa_bin_size_t const& spa_bin_size() const { return *static_cast<spa_bin_size_t const*>(upstream_values[5]); }
+
+    bool x_is_requested(char const* node){
+        return true;// TODO: this
+    }
+    
+public:
+    static const int cpu = 0; // CPU=auto on at least one member
+    void operator()(sink_t& sink){
+        // dir
+        const bool want_dir = x_is_requested("dir");
+        auto dir_kernel = [&]{
+            used_both = both_xy().used_both;
+            // like speed, dir is plotted over the whole trial, so has a pyramid
+            dir_disp.enable_pyramid();
+            // the per-sample part is element-wise over xy(), so it's fused with speed etc., see map hint.
+            return [=](point pw, size_t i){
+            	return angle_ab(pw, i > 0 ? xy()[i-1] : point(nan,nan));
+            };
+        }();
+        // speed
+        const bool want_speed = x_is_requested("speed");
+        auto speed_kernel = [&]{
+            int f = parseInt(pos_file().header['timebase']);
+            // speed is plotted over the whole trial, so keep a min/max/mean pyramid, see speed.summarise
+            speed.enable_pyramid();
+            // element-wise, so this can be split into chunk tasks, see CPU hint, and
+            // fused with the other maps over xy(), see map hint.
+            return [=](point p, size_t i){
+            	point p_old = i > 0 ? xy()[i-1] : point(nan,nan);
+            	return hypot(p_old.x - p.x, p_old.y - p.y) * f;
+            };
+        }();
+        // dist_to_boundary
+        const bool want_dist_to_boundary = x_is_requested("dist_to_boundary");
+        auto dist_to_boundary_kernel = [&]{
+            // might want to implement it as dist_to_boundary squared..although that only makes sense for circle not square 
+            // so the details are a bit more complicated.
+            // The shape is loop invariant, so is_circle is read once, before the (possibly fused) loop,
+            // and the branch on it goes the same way for every element, i.e. it's always predicted.
+            const bool is_circle = boundary_shape().kind == circle;
+            return [=](point p, size_t){
+            	if(is_circle)
+            		return hypot(p.x-boundary_shape().shape.centre.x, p.y-boundary_shape().shape.centre.y);
+            	else // boundary_shape().kind == rect
+            		return boundary_dist_rect(p, boundary_shape().shape.topleft, boundary_shape().shape.W, boundary_shape().shape.H);
+            };
+        }();
+        // pos_bin_ind
+        const bool want_pos_bin_ind = x_is_requested("pos_bin_ind");
+        auto pos_bin_ind_kernel = [&]{
+            return [=](point p, size_t){
+            	return point{p.x/spa_bin_size(), p.y/spa_bin_size()};
+            };
+        }();
+        const bool need_dir = want_dir;
+        const bool need_speed = want_speed;
+        const bool need_dist_to_boundary = want_dist_to_boundary;
+        const bool need_pos_bin_ind = want_pos_bin_ind;
+        auto const& src = xy();
+        if(want_dir) dir_disp.allocate(src.length());
+        if(want_speed) speed.allocate(src.length());
+        if(want_dist_to_boundary) dist_to_boundary.allocate(src.length());
+        if(want_pos_bin_ind) pos_bin_ind.allocate(src.length());
+        parallel_for_chunks(src, [&](size_t c){
+            auto const src_c = src.cchunk(c); // a pointer, or a chunk ref for layout="soa"
+            auto const dir_disp_c = want_dir ? dir_disp.chunk_data(c) : decltype(dir_disp.chunk_data(c)){};
+            auto const speed_c = want_speed ? speed.chunk_data(c) : decltype(speed.chunk_data(c)){};
+            auto const dist_to_boundary_c = want_dist_to_boundary ? dist_to_boundary.chunk_data(c) : decltype(dist_to_boundary.chunk_data(c)){};
+            auto const pos_bin_ind_c = want_pos_bin_ind ? pos_bin_ind.chunk_data(c) : decltype(pos_bin_ind.chunk_data(c)){};
+            for(size_t j=0, n=src.chunk_size(c), i=c*src.chunk_len; j<n; j++, i++){
+                auto const& src_v = src_c[j];
+                auto const dir_disp_v = need_dir ? dir_kernel(src_v, i)
+                            : decltype(dir_kernel(src_v, i)){};
+                if(want_dir) dir_disp_c[j] = dir_disp_v;
+                auto const speed_v = need_speed ? speed_kernel(src_v, i)
+                            : decltype(speed_kernel(src_v, i)){};
+                if(want_speed) speed_c[j] = speed_v;
+                auto const dist_to_boundary_v = need_dist_to_boundary ? dist_to_boundary_kernel(src_v, i)
+                            : decltype(dist_to_boundary_kernel(src_v, i)){};
+                if(want_dist_to_boundary) dist_to_boundary_c[j] = dist_to_boundary_v;
+                auto const pos_bin_ind_v = need_pos_bin_ind ? pos_bin_ind_kernel(src_v, i)
+                            : decltype(pos_bin_ind_kernel(src_v, i)){};
+                if(want_pos_bin_ind) pos_bin_ind_c[j] = pos_bin_ind_v;
+            }
+            if(want_dir) dir_disp.finish_chunk(c);
+            if(want_speed) speed.finish_chunk(c);
+            if(want_dist_to_boundary) dist_to_boundary.finish_chunk(c);
+            if(want_pos_bin_ind) pos_bin_ind.finish_chunk(c);
+        });
+        if(want_dir){
+            if(used_both){ 
+            	// TODO: could check which of the two dirs is requested and skip this. requested(dir)
+            	dir.enable_pyramid();
+            	dir.allocate(xy().length);
+            	for(auto p1, p2 : both_xy().xy1, both_xy().xy2)
+            		dir.write(angle_ab(p1,p2));
+            }else{
+            	dir.equals(dir_disp);
+            }
+        }
+    }
+}
+
+// All the Qs, each after everything upstream of it, see StaticGraph in engine/static_graph.h
+using engine_t = Engine<64, uint32,
+    axona_file_name_t,
+    group_num_t,
+    trial_time_slice_t,
+    directional_slice_t,
+    spatial_mask_t,
+    boundary_dist_slice_t,
+    boundary_shape_t,
+    speed_bin_size_t,
+    spa_bin_size_t,
+    tac_window_secs_t,
+    cut_delta_t,
+    pos_file_name_t,
+    pos_file_t,
+    set_file_name_t,
+    set_file_t,
+    tet_file_name_t,
+    tet_file_t,
+    eeg_file_name_t,
+    eeg_file_t,
+    cut_file_name_t,
+    axona_file_func,
+    both_xy_func,
+    xy_func,
+    dir_func,
+    speed_func,
+    dist_to_boundary_func,
+    pos_mask_func,
+    spike_times_func,
+    spike_pos_inds_func,
+    spike_mask_func,
+    speed_dwell_func,
+    pos_bin_ind_func,
+    cut_file_func,
+    cut_state_func,
+    group_mask_func,
+    group_times_unmaksed_func,
+    group_times_func,
+    group_pos_inds_unmasked_func,
+    group_pos_inds_func,
+    tac_func,
+    group_speed_hist_func>;
+engine_t engine;
+using dispatcher_t = Dispatcher<engine_t, &engine>;